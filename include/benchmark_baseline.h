@@ -0,0 +1,31 @@
+/**
+ * @file benchmark_baseline.h
+ * @brief ベンチマークの基準値と、遅くなったとみなす割合
+ * @details
+ * 利用者ごとに書き換える config.h（Gitの管理対象外）ではなく、このファイルをリポジトリに含めて管理します。
+ * 本体もホスト環境のテストも必ずこのファイルを読み込むので、基準値が黙って空になることはありません。
+ * 処理を変えて速さが変わったときは、測った結果の最後に出力される行をそのまま貼り付けて更新します。
+ */
+#ifndef BENCHMARK_BASELINE_H
+#define BENCHMARK_BASELINE_H
+
+#include <stdint.h>
+
+// ========== 本体（シリアルモニタの `bench`）の基準値（1回あたりのナノ秒） ==========
+// 順番は sanitize, parse, ingest, format, format_string, compose, clock です。
+// まだM5StickCPlus2で測った値がないので、すべて0（未測定）です。0 の項目は比べられないので、
+// `bench` の集計行は "uncalibrated" になり、本体での回帰の判定は働きません。本体で `bench` を実行し、最後の行を貼り付けてください。
+const uint32_t BENCHMARK_BASELINE_NANOSECONDS[] = {0, 0, 0, 0, 0, 0, 0};
+const float BENCHMARK_TOLERANCE_PERCENT = 15.0f; // 基準値よりこの割合以上遅ければ「regressed」、速ければ「improved」とする
+const uint8_t BENCHMARK_ROUNDS = 5;              // 各処理を測る回数（割り込みなどの影響を除くため、最も速かった回を使う）
+
+// ========== ホスト環境（`pio test -e native` の test_benchmark）の基準値 ==========
+// 順番は sanitize, prefilter, parse, ingest, format, format_printf, codec, clock です。
+// PCの速さに左右されないよう、ナノ秒ではなく、同じ実行の中で測った「較正用の処理」（整数のハッシュ計算）の
+// 1回分の時間を1000としたときの値（千分率）で持ちます。PCを変えても比はあまり変わりませんが、大きく変わったときは
+// テストの出力の最後の行を貼り付けて更新してください（値は x86_64 のLinuxで10回測った中央値です）。
+const uint32_t NATIVE_BENCHMARK_BASELINE_PERMILLE[] = {1140, 440, 5400, 7000, 152, 2700, 2450, 67};
+const float NATIVE_BENCHMARK_TOLERANCE_PERCENT = 30.0f; // 基準値よりこの割合以上遅ければ、テストを失敗にする
+const uint8_t NATIVE_BENCHMARK_ROUNDS = 41;             // 較正用の処理と交互に測る回数（各回の比の中央値を使う）
+
+#endif // BENCHMARK_BASELINE_H
@@ -0,0 +1,92 @@
+/**
+ * @file clock_format.h
+ * @brief 時刻の文字列（「HH:MM」「HH:MM:SS」）の組み立てと、秒単位のNTP時刻からのミリ秒の推定
+ * @details
+ * sprintf の書式の解釈を通らず、決まった桁を直接書き込みます。NTPClient にも millis() にも依存せず、
+ * 値は呼び出し側から受け取るので、ホスト環境のテスト（test/）からもそのまま読み込めます。
+ */
+#ifndef CLOCK_FORMAT_H
+#define CLOCK_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+const size_t CLOCK_HOUR_MINUTE_TEXT_SIZE = 6;        // 「HH:MM」+ 終端
+const size_t CLOCK_HOUR_MINUTE_SECOND_TEXT_SIZE = 9; // 「HH:MM:SS」+ 終端
+
+/**
+ * @brief 0〜99の値を2桁（1桁なら0を補う）で書き込む（printf の「%02d」と同じ）
+ */
+inline void writeTwoDigits(char *destination, int value)
+{
+  destination[0] = (char)('0' + (value / 10) % 10);
+  destination[1] = (char)('0' + value % 10);
+}
+
+/**
+ * @brief 時と分を「HH:MM」の文字列にする（Digi-Clock Unitに送る形）
+ * @param buffer 書き込み先（CLOCK_HOUR_MINUTE_TEXT_SIZE バイト以上）
+ * @param bufferSize 書き込み先の大きさ
+ * @param hour 時（0〜23）
+ * @param minute 分（0〜59）
+ * @return 書き込んだ文字数（入りきらなければ空文字列にして0）
+ */
+inline size_t formatClockHourMinute(char *buffer, size_t bufferSize, int hour, int minute)
+{
+  if (bufferSize < CLOCK_HOUR_MINUTE_TEXT_SIZE)
+  {
+    if (bufferSize > 0)
+      buffer[0] = '\0';
+    return 0;
+  }
+  writeTwoDigits(buffer, hour);
+  buffer[2] = ':';
+  writeTwoDigits(buffer + 3, minute);
+  buffer[5] = '\0';
+  return 5;
+}
+
+/**
+ * @brief 時・分・秒を「HH:MM:SS」の文字列にする（画面の時刻表示の形。NTPClient の getFormattedTime() と同じ）
+ * @param buffer 書き込み先（CLOCK_HOUR_MINUTE_SECOND_TEXT_SIZE バイト以上）
+ * @param bufferSize 書き込み先の大きさ
+ * @return 書き込んだ文字数（入りきらなければ空文字列にして0）
+ */
+inline size_t formatClockHourMinuteSecond(char *buffer, size_t bufferSize, int hour, int minute, int second)
+{
+  if (bufferSize < CLOCK_HOUR_MINUTE_SECOND_TEXT_SIZE)
+  {
+    if (bufferSize > 0)
+      buffer[0] = '\0';
+    return 0;
+  }
+  formatClockHourMinute(buffer, bufferSize, hour, minute);
+  buffer[5] = ':';
+  writeTwoDigits(buffer + 6, second);
+  buffer[8] = '\0';
+  return 8;
+}
+
+/**
+ * @brief 秒単位の時刻と、その秒に切り替わったときの millis() から、UNIX時刻（協定世界時）をミリ秒で推定する
+ * @param localEpochSecond NTPClient の時刻（タイムゾーンの分だけずれた秒）。0なら未同期
+ * @param utcOffsetSeconds localEpochSecond に足されているタイムゾーンの秒数
+ * @param secondStartMillis 秒が切り替わったのを見たときの millis()
+ * @param nowMillis 今の millis()
+ * @return 推定したミリ秒単位の時刻（未同期なら0）
+ * @details 秒の切り替わりはループ1回ごとにしか見ないので、秒の中の経過は999ミリ秒を上限にします
+ */
+inline uint64_t estimateEpochMillis(unsigned long localEpochSecond, long utcOffsetSeconds, unsigned long secondStartMillis,
+                                    unsigned long nowMillis)
+{
+  if (localEpochSecond == 0)
+  {
+    return 0;
+  }
+  unsigned long subsecondMillis = nowMillis - secondStartMillis;
+  if (subsecondMillis > 999)
+    subsecondMillis = 999;
+  return (uint64_t)(localEpochSecond - utcOffsetSeconds) * 1000ULL + subsecondMillis;
+}
+
+#endif // CLOCK_FORMAT_H
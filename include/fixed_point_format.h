@@ -0,0 +1,133 @@
+/**
+ * @file fixed_point_format.h
+ * @brief 画面に出す値（CO2は整数、THIは小数1桁）を、決まった大きさの領域に書き込む
+ * @details
+ * 桁数をテンプレートの引数にしているので、10倍する・小数点を入れる位置はコンパイル時に決まり、
+ * printf の書式の解釈や String のヒープ確保を通りません。
+ * 設定ファイルにもM5StickCPlus2のライブラリにも依存しないので、ホスト環境のテスト（test/）からもそのまま読み込めます。
+ */
+#ifndef FIXED_POINT_FORMAT_H
+#define FIXED_POINT_FORMAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+constexpr size_t NUMERIC_TEXT_BUFFER_SIZE = 13; // 32ビット整数の10桁 + 小数点 + 符号 + 終端
+
+/**
+ * @brief 10のFractionDigits乗を返す
+ */
+constexpr int32_t getDecimalScale(uint8_t fractionDigits)
+{
+  return fractionDigits == 0 ? 1 : 10 * getDecimalScale(fractionDigits - 1);
+}
+
+/**
+ * @brief 10^FractionDigits 倍した整数を、小数点付きの文字列にする
+ * @param buffer 書き込み先（NUMERIC_TEXT_BUFFER_SIZE バイトあれば足りる）
+ * @param bufferSize 書き込み先の大きさ
+ * @param scaledValue 値を10^FractionDigits倍した整数（例：小数1桁で 72.4 なら 724）
+ * @return 書き込んだ文字数（入りきらなければ空文字列にして0）
+ * @details FractionDigits が0なら整数のまま書きます。1より小さい値は「0.5」「-0.5」のように0を補います
+ */
+template <uint8_t FractionDigits>
+size_t formatScaledDecimal(char *buffer, size_t bufferSize, int32_t scaledValue)
+{
+  static_assert(FractionDigits <= 9, "int32_t has at most 9 fraction digits");
+
+  // 下の桁から順に書き、最後に並びを逆にして写す
+  char reversed[NUMERIC_TEXT_BUFFER_SIZE];
+  size_t length = 0;
+  uint32_t magnitude = scaledValue < 0 ? 0U - (uint32_t)scaledValue : (uint32_t)scaledValue;
+  for (uint8_t i = 0; i < FractionDigits; i++)
+  {
+    reversed[length++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  }
+  if (FractionDigits > 0)
+  {
+    reversed[length++] = '.';
+  }
+  do
+  {
+    reversed[length++] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (scaledValue < 0)
+  {
+    reversed[length++] = '-';
+  }
+
+  if (length >= bufferSize)
+  {
+    if (bufferSize > 0)
+      buffer[0] = '\0';
+    return 0;
+  }
+  for (size_t i = 0; i < length; i++)
+  {
+    buffer[i] = reversed[length - 1 - i];
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+/**
+ * @brief 小数を、小数点以下FractionDigits桁に丸めた文字列にする（printf の「%.Nf」と同じ結果）
+ * @param buffer 書き込み先（NUMERIC_TEXT_BUFFER_SIZE バイトあれば足りる）
+ * @param bufferSize 書き込み先の大きさ
+ * @param value 文字列にする値
+ * @return 書き込んだ文字数
+ * @details
+ * floatを「仮数 × 2の指数乗」に分け、仮数に10^FractionDigitsを掛けてから指数の分だけずらすので、
+ * floatのまま10倍したときの丸めの誤差が入りません（72.45f は実際には 72.4499… なので「72.4」になります）。
+ * ちょうど中間の値は printf と同じく偶数の側に丸めます。違いは、0に丸まる負の値を「-0.0」ではなく「0.0」と書くことだけです。
+ * NaN・無限大・整数に収まらない大きさの値は snprintf に任せます（書き込み先は呼び出し側の領域なので、ヒープは使いません）。
+ */
+template <uint8_t FractionDigits>
+size_t formatFixedPoint(char *buffer, size_t bufferSize, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const bool negative = (bits >> 31) != 0;
+  const uint32_t exponentField = (bits >> 23) & 0xFF;
+  uint64_t mantissa = bits & 0x7FFFFF;
+  int exponent = -149; // 非正規化数（0を含む）
+  if (exponentField != 0)
+  {
+    mantissa |= 0x800000;
+    exponent = (int)exponentField - 150;
+  }
+
+  // 仮数（24ビット）× 10^FractionDigits（30ビット以下）は64ビットに収まる
+  const uint64_t product = mantissa * (uint64_t)getDecimalScale(FractionDigits);
+  uint64_t rounded = 0;
+  bool representable = exponentField != 0xFF;
+  if (representable && exponent >= 0)
+  {
+    representable = exponent < 31 && product <= ((uint64_t)INT32_MAX >> exponent);
+    rounded = product << (exponent < 31 ? exponent : 0);
+  }
+  else if (representable && exponent > -64)
+  {
+    const int shift = -exponent;
+    const uint64_t remainder = product & ((1ULL << shift) - 1);
+    const uint64_t half = 1ULL << (shift - 1);
+    rounded = product >> shift;
+    if (remainder > half || (remainder == half && (rounded & 1)))
+      rounded++;
+    representable = rounded <= (uint64_t)INT32_MAX;
+  }
+
+  if (!representable)
+  {
+    int written = snprintf(buffer, bufferSize, "%.*f", (int)FractionDigits, value);
+    if (written < 0 || bufferSize == 0)
+      return 0;
+    return (size_t)written < bufferSize ? (size_t)written : bufferSize - 1;
+  }
+  return formatScaledDecimal<FractionDigits>(buffer, bufferSize, negative ? -(int32_t)rounded : (int32_t)rounded);
+}
+
+#endif // FIXED_POINT_FORMAT_H
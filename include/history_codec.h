@@ -0,0 +1,347 @@
+/**
+ * @file history_codec.h
+ * @brief 履歴の圧縮サンプル（8バイト）と、それをビット列に詰める時系列圧縮（Gorilla方式）
+ * @details
+ * 時刻の delta-of-delta と値の差分を、小さい数ほど短くなる「長さ可変の符号」で書き込みます。
+ * 符号の先頭の 0 / 10 / 110 / 1110 / 1111 で、その後に続くビット数を表します。
+ * 例えば値が前回と同じなら「0」の1ビットだけで済みます。
+ * 送信間隔の初期値に config.h の HISTORY_SAMPLE_PERIOD_SECONDS を使うので、config.h（ホスト環境のテストでは config.example.h）の後に読み込みます。
+ */
+#ifndef HISTORY_CODEC_H
+#define HISTORY_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 履歴用に1件のセンサーデータを8バイトに詰め込んだ「圧縮サンプル」
+ * @details
+ * SensorDataPacketはfloatやString（ヒープ領域を使う文字列）を含むため、24時間分を保存するには大きすぎます。
+ * そこで各値を固定小数点の整数に変換して保存します（例：THI 72.5 → 725）。
+ * 時刻はスロット番号（時刻 ÷ スロット幅）で表し、スロット先頭からの差分秒だけを1バイトで持ちます。
+ */
+struct CompactHistorySample
+{
+  uint16_t carbonDioxidePpm;   // CO2濃度（ppm）。HISTORY_EMPTY_SLOT_MARKERなら空きスロット
+  int16_t thermalComfortX10;   // THI × 10（0.1刻み）
+  int16_t temperatureX10;      // 温度 × 10（0.1℃刻み）
+  uint8_t humidityX2;          // 湿度 × 2（0.5%刻み）
+  uint8_t secondsIntoSlot;     // スロット先頭からの差分秒（デルタタイムスタンプ）
+};
+static_assert(sizeof(CompactHistorySample) == 8, "CompactHistorySample must stay 8 bytes");
+
+/**
+ * @brief 履歴で扱う計測項目の種類
+ * @details 集計やグラフ表示で「どの値を対象にするか」を指定するために使います
+ */
+enum HistoryMetric
+{
+  METRIC_CO2 = 0,      // CO2濃度（ppm）
+  METRIC_THI,          // 温熱快適性指数（×10）
+  METRIC_TEMPERATURE,  // 温度（×10）
+  METRIC_HUMIDITY,     // 湿度（×2）
+  HISTORY_METRIC_COUNT // 項目数（配列サイズ用）
+};
+
+/**
+ * @brief ビット単位でデータを書き込むための状態
+ * @details 圧縮では1つの値を3ビットや10ビットといった半端な長さで書くため、バイト境界をまたいで詰めていきます
+ */
+struct BitStreamWriter
+{
+  uint8_t *buffer;      // 書き込み先
+  size_t capacityBits;  // 書き込める最大ビット数
+  size_t bitPosition;   // 次に書き込むビットの位置
+};
+
+/**
+ * @brief ビット単位でデータを読み出すための状態
+ */
+struct BitStreamReader
+{
+  const uint8_t *buffer; // 読み出し元
+  size_t lengthBits;     // データの長さ（ビット）
+  size_t bitPosition;    // 次に読み出すビットの位置
+  bool overflow;         // データの終わりを超えて読もうとしたらtrue
+};
+
+/**
+ * @brief 時系列圧縮（Gorilla方式）の符号化・復号で引き継ぐ「直前の状態」
+ * @details
+ * 時刻は「前回の間隔との差（delta-of-delta）」、各値は「前回の値との差」だけを書きます。
+ * センサーは一定間隔で送信し、値もゆっくりしか変わらないため、ほとんどの差は0か小さな数になり、数ビットで表せます。
+ */
+struct GorillaCodecState
+{
+  unsigned long previousEpoch;                   // 直前のサンプルの時刻
+  long previousInterval;                         // 直前のサンプル間隔（秒）
+  int32_t previousValues[HISTORY_METRIC_COUNT];  // 直前のサンプルの各値
+  uint16_t sampleCount;                          // これまでに符号化・復号したサンプル数
+};
+
+const size_t GORILLA_MAX_BITS_PER_SAMPLE = (4 + 32) + HISTORY_METRIC_COUNT * (4 + 17); // 1サンプルの最大ビット数（最悪の場合）
+const uint8_t GORILLA_METRIC_BITS[HISTORY_METRIC_COUNT] = {16, 16, 16, 8};            // 先頭サンプルで各値をそのまま書くときのビット数
+const uint8_t GORILLA_TIMESTAMP_BUCKET_BITS[4] = {5, 9, 13, 32}; // 時刻の delta-of-delta 用（10/110/1110/1111 の後のビット数）
+const uint8_t GORILLA_VALUE_BUCKET_BITS[4] = {3, 6, 10, 17};     // 値の差分用
+
+/**
+ * @brief 圧縮サンプルから指定した項目の値を取り出す
+ * @param sample 圧縮サンプル
+ * @param metric 取り出す項目
+ * @return 固定小数点の単位のままの値
+ */
+inline int32_t getHistorySampleMetric(const CompactHistorySample &sample, HistoryMetric metric)
+{
+  switch (metric)
+  {
+  case METRIC_CO2:
+    return sample.carbonDioxidePpm;
+  case METRIC_THI:
+    return sample.thermalComfortX10;
+  case METRIC_TEMPERATURE:
+    return sample.temperatureX10;
+  case METRIC_HUMIDITY:
+    return sample.humidityX2;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief 圧縮サンプルに指定した項目の値を設定する
+ * @param sample 設定先の圧縮サンプル
+ * @param metric 設定する項目
+ * @param value 固定小数点の単位の値
+ */
+inline void setHistorySampleMetric(CompactHistorySample &sample, HistoryMetric metric, int32_t value)
+{
+  switch (metric)
+  {
+  case METRIC_CO2:
+    sample.carbonDioxidePpm = (uint16_t)value;
+    break;
+  case METRIC_THI:
+    sample.thermalComfortX10 = (int16_t)value;
+    break;
+  case METRIC_TEMPERATURE:
+    sample.temperatureX10 = (int16_t)value;
+    break;
+  case METRIC_HUMIDITY:
+    sample.humidityX2 = (uint8_t)value;
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief 指定したビット数の値をビット列に書き込む（上位ビットから順に）
+ * @param writer 書き込み先の状態
+ * @param value 書き込む値（下位 bitCount ビットを使う）
+ * @param bitCount ビット数（1〜32）
+ * @details 書き込み先の容量を超える分は捨てます（呼び出し側で事前に空きを確認します）
+ */
+inline void writeBitStream(BitStreamWriter &writer, uint32_t value, uint8_t bitCount)
+{
+  for (int bit = bitCount - 1; bit >= 0; bit--)
+  {
+    if (writer.bitPosition >= writer.capacityBits)
+      return;
+    if ((value >> bit) & 1UL)
+      writer.buffer[writer.bitPosition / 8] |= (uint8_t)(0x80 >> (writer.bitPosition % 8));
+    else
+      writer.buffer[writer.bitPosition / 8] &= (uint8_t)~(0x80 >> (writer.bitPosition % 8));
+    writer.bitPosition++;
+  }
+}
+
+/**
+ * @brief ビット列から指定したビット数の値を読み出す
+ * @param reader 読み出し元の状態
+ * @param bitCount ビット数（1〜32）
+ * @return 読み出した値（データの終わりを超えた場合はoverflowをtrueにして0を返す）
+ */
+inline uint32_t readBitStream(BitStreamReader &reader, uint8_t bitCount)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < bitCount; i++)
+  {
+    if (reader.bitPosition >= reader.lengthBits)
+    {
+      reader.overflow = true;
+      return 0;
+    }
+    uint8_t bit = (reader.buffer[reader.bitPosition / 8] >> (7 - reader.bitPosition % 8)) & 1;
+    value = (value << 1) | bit;
+    reader.bitPosition++;
+  }
+  return value;
+}
+
+/**
+ * @brief 差分を長さ可変の符号で書き込む
+ * @param writer 書き込み先
+ * @param delta 書き込む差分（符号付き）
+ * @param bucketBits 「10」「110」「1110」「1111」の後に続くビット数の表
+ * @details
+ * 負の数はジグザグ符号（0,-1,1,-2,2… → 0,1,2,3,4…）で正の数に変換してから書きます。
+ * 差分が0なら「0」の1ビット、小さければ短い符号、大きければ長い符号を選びます。
+ */
+inline void writeVariableLengthDelta(BitStreamWriter &writer, int32_t delta, const uint8_t *bucketBits)
+{
+  if (delta == 0)
+  {
+    writeBitStream(writer, 0, 1);
+    return;
+  }
+
+  uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+  for (uint8_t bucket = 0; bucket < 4; bucket++)
+  {
+    bool isLastBucket = (bucket == 3);
+    if (isLastBucket || zigzag < (1UL << bucketBits[bucket]))
+    {
+      // 先頭の符号：bucket個の「1」と、最後の区分以外は終わりの「0」
+      uint8_t prefixLength = isLastBucket ? 4 : bucket + 2;
+      uint32_t prefix = isLastBucket ? 0xF : ((1UL << (bucket + 2)) - 2);
+      writeBitStream(writer, prefix, prefixLength);
+      writeBitStream(writer, bucketBits[bucket] >= 32 ? zigzag : zigzag & ((1UL << bucketBits[bucket]) - 1), bucketBits[bucket]);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief 長さ可変の符号から差分を読み出す
+ * @param reader 読み出し元
+ * @param bucketBits 書き込み時と同じビット数の表
+ * @return 差分（符号付き）
+ */
+inline int32_t readVariableLengthDelta(BitStreamReader &reader, const uint8_t *bucketBits)
+{
+  // 先頭の「1」の数（最大4）で、続くビット数が決まる
+  uint8_t bucket = 0;
+  while (bucket < 4 && readBitStream(reader, 1) == 1)
+  {
+    bucket++;
+  }
+  if (bucket == 0)
+  {
+    return 0;
+  }
+
+  uint32_t zigzag = readBitStream(reader, bucketBits[bucket - 1]);
+  return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
+
+/**
+ * @brief 圧縮状態をページの先頭に合わせて初期化する
+ * @param state 初期化する状態
+ * @param firstEpoch ページの最初のサンプルの時刻（ページヘッダーに保存されている値）
+ * @details 間隔の初期値を設定済みの送信間隔にしておくと、2件目が予定どおり届いた場合も「0」の1ビットで済みます
+ */
+inline void beginGorillaCodec(GorillaCodecState &state, unsigned long firstEpoch)
+{
+  state.previousEpoch = firstEpoch;
+  state.previousInterval = (long)HISTORY_SAMPLE_PERIOD_SECONDS;
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    state.previousValues[m] = 0;
+  }
+  state.sampleCount = 0;
+}
+
+/**
+ * @brief 1サンプルを圧縮してビット列に書き込む
+ * @param writer 書き込み先
+ * @param state 直前の状態（書き込み後に更新されます）
+ * @param sample 書き込むサンプル
+ * @param epochSeconds サンプルの時刻
+ * @details
+ * ページの最初のサンプルは、時刻をヘッダーに持つため値だけをそのまま書きます。
+ * 2件目以降は、時刻の delta-of-delta と各値の前回との差を長さ可変の符号で書きます。
+ * スロット内の差分秒（secondsIntoSlot）は時刻から計算できるので書きません。
+ */
+inline void encodeGorillaSample(BitStreamWriter &writer, GorillaCodecState &state,
+                         const CompactHistorySample &sample, unsigned long epochSeconds)
+{
+  if (state.sampleCount == 0)
+  {
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      int32_t value = getHistorySampleMetric(sample, (HistoryMetric)m);
+      writeBitStream(writer, (uint32_t)value & ((1UL << GORILLA_METRIC_BITS[m]) - 1), GORILLA_METRIC_BITS[m]);
+      state.previousValues[m] = value;
+    }
+  }
+  else
+  {
+    // 時刻：今回の間隔と前回の間隔の差（一定間隔で届いていれば0）
+    long interval = (long)(epochSeconds - state.previousEpoch);
+    writeVariableLengthDelta(writer, (int32_t)(interval - state.previousInterval), GORILLA_TIMESTAMP_BUCKET_BITS);
+    state.previousInterval = interval;
+
+    // 各値：前回の値との差
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      int32_t value = getHistorySampleMetric(sample, (HistoryMetric)m);
+      writeVariableLengthDelta(writer, value - state.previousValues[m], GORILLA_VALUE_BUCKET_BITS);
+      state.previousValues[m] = value;
+    }
+  }
+
+  state.previousEpoch = epochSeconds;
+  state.sampleCount++;
+}
+
+/**
+ * @brief ビット列から1サンプルを読み出して復元する
+ * @param reader 読み出し元
+ * @param state 直前の状態（読み出し後に更新されます）
+ * @param sample 復元したサンプルの格納先
+ * @param epochSeconds 復元した時刻の格納先
+ * @return 読み出せればtrue、データが途中で終わっていればfalse
+ */
+inline bool decodeGorillaSample(BitStreamReader &reader, GorillaCodecState &state,
+                         CompactHistorySample &sample, unsigned long &epochSeconds)
+{
+  if (state.sampleCount == 0)
+  {
+    epochSeconds = state.previousEpoch;
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      uint32_t rawValue = readBitStream(reader, GORILLA_METRIC_BITS[m]);
+      // THIと温度は符号付きなので、16ビットの符号を復元する
+      if (m == METRIC_THI || m == METRIC_TEMPERATURE)
+        state.previousValues[m] = (int16_t)rawValue;
+      else
+        state.previousValues[m] = (int32_t)rawValue;
+    }
+  }
+  else
+  {
+    state.previousInterval += readVariableLengthDelta(reader, GORILLA_TIMESTAMP_BUCKET_BITS);
+    epochSeconds = state.previousEpoch + state.previousInterval;
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      state.previousValues[m] += readVariableLengthDelta(reader, GORILLA_VALUE_BUCKET_BITS);
+    }
+  }
+
+  if (reader.overflow)
+  {
+    return false;
+  }
+
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    setHistorySampleMetric(sample, (HistoryMetric)m, state.previousValues[m]);
+  }
+  sample.secondsIntoSlot = (uint8_t)(epochSeconds % HISTORY_SAMPLE_PERIOD_SECONDS);
+
+  state.previousEpoch = epochSeconds;
+  state.sampleCount++;
+  return true;
+}
+
+#endif // HISTORY_CODEC_H
@@ -0,0 +1,29 @@
+/**
+ * @file log_format_token.h
+ * @brief ログの書式文字列からコンパイル時にIDを求める（FNV-1a、32ビット）
+ * @details 快適レベルの言葉を探す表（sensor_ingest.h）も、同じ計算を初期値を変えて使います
+ */
+#ifndef LOG_FORMAT_TOKEN_H
+#define LOG_FORMAT_TOKEN_H
+
+#include <stdint.h>
+
+/**
+ * @brief ログの書式文字列からIDを計算する（FNV-1a、32ビット）
+ * @details コンパイル時に計算されるので、バイナリ形式のログでは書式の文字列そのものはプログラムに含まれません
+ */
+constexpr uint32_t hashLogFormat(const char *format, uint32_t hash = 2166136261UL)
+{
+  return *format == '\0' ? hash : hashLogFormat(format + 1, (hash ^ (uint8_t)*format) * 16777619UL);
+}
+
+/**
+ * @brief IDを必ずコンパイル時に計算させるための入れ物
+ */
+template <uint32_t Token>
+struct LogFormatToken
+{
+  static const uint32_t value = Token;
+};
+
+#endif // LOG_FORMAT_TOKEN_H
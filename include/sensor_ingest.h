@@ -0,0 +1,511 @@
+/**
+ * @file sensor_ingest.h
+ * @brief 受信したセンサーデータの形（SensorDataPacket・PackedSensorRecord）と、ペイロードを解析して詰めるまでの処理
+ * @details
+ * ここにある関数は、受け取った領域だけを読み書きし、ヒープ領域も画面・通信も使いません。
+ * 本体の受信処理（main.cpp）と、ホスト環境のテスト（test/）の両方で同じものを使います。
+ * 文字列の長さの上限（SENSOR_ID_MAX_LENGTH など）や並べ替え窓の大きさは config.h の値なので、config.h（テストでは config.example.h）の後に読み込みます。
+ */
+#ifndef SENSOR_INGEST_H
+#define SENSOR_INGEST_H
+
+#include <ArduinoJson.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include "log_format_token.h"
+#include "sequence_window.h"
+
+/**
+ * @brief 快適レベル（JSONの comfort_level）の種類
+ * @details 送信側が付ける説明文は決まった言葉なので、文字列ではなく1バイトの番号で持ちます（言葉との対応は COMFORT_LEVEL_VOCABULARY）
+ */
+enum ComfortLevel : uint8_t
+{
+  COMFORT_LEVEL_NONE = 0,     // 付いていない
+  COMFORT_LEVEL_COLD,         // 寒い
+  COMFORT_LEVEL_CHILLY,       // 肌寒い
+  COMFORT_LEVEL_NEUTRAL,      // 何も感じない
+  COMFORT_LEVEL_PLEASANT,     // 快い（快適）
+  COMFORT_LEVEL_NOT_HOT,      // 暑くない
+  COMFORT_LEVEL_SLIGHTLY_HOT, // やや暑い
+  COMFORT_LEVEL_HOT,          // 暑くて汗が出る
+  COMFORT_LEVEL_VERY_HOT,     // 暑くてたまらない
+  COMFORT_LEVEL_OTHER,        // 上記以外の言葉（文字列は SensorDataPacket::comfortLevelText に入れる）
+  COMFORT_LEVEL_COUNT         // 種類の数
+};
+
+/**
+ * @brief 快適レベルの言葉と種類の対応（語彙表の1行）
+ */
+struct ComfortLevelWord
+{
+  const char *text;   // 送信側が付ける言葉（UTF-8）
+  ComfortLevel level; // 対応する種類
+};
+
+/**
+ * @brief MQTTで受信するセンサーデータをまとめて管理するための「設計図」
+ * @details
+ * 構造体（struct）とは、関連するデータを一つのまとまりとして扱うための「箱」のようなものです。
+ * この構造体では、センサーから取得した様々な種類のデータを一つの変数にまとめて管理します。
+ * 文字列も固定長の配列で持つので、コピーはmemcpyと同じ単純な複写になり、ヒープ領域を使いません。
+ */
+struct SensorDataPacket
+{
+  int carbonDioxideLevel;         // CO2濃度（ppm単位）- 部屋の空気の質を示す重要な指標
+  float thermalComfortIndex;      // 温熱快適性指数（THI）- 温度と湿度から算出される快適さの指標
+  float ambientTemperature;       // 環境温度（℃）- センサーで測定した周囲の温度
+  float relativeHumidity;         // 相対湿度（%）- センサーで測定した空気中の湿度
+  ComfortLevel comfortLevel;      // 快適レベル（「快適」「やや暑い」などの説明文を番号にしたもの）
+  char comfortLevelText[COMFORT_LEVEL_TEXT_MAX_LENGTH + 1]; // 語彙表にない説明文（COMFORT_LEVEL_OTHER のときだけ。超えた分は切り捨て）
+  unsigned long dataTimestamp;    // データのタイムスタンプ - このデータがいつ測定されたか
+  bool hasValidData;              // 有効なデータかどうかのフラグ - trueなら有効、falseなら無効
+  char sensorId[SENSOR_ID_MAX_LENGTH + 1]; // 送信元センサーのID（sensor_id）- 付いていなければ空文字列
+};
+static_assert(std::is_trivially_copyable<SensorDataPacket>::value, "SensorDataPacket must stay copyable with memcpy (no String members)");
+
+/**
+ * @brief PackedSensorRecord の presenceBits（JSONにあった項目）
+ */
+enum SensorRecordPresence : uint8_t
+{
+  RECORD_HAS_CO2 = 0x01,           // co2
+  RECORD_HAS_THI = 0x02,           // thi
+  RECORD_HAS_TEMPERATURE = 0x04,   // temperature
+  RECORD_HAS_HUMIDITY = 0x08,      // humidity
+  RECORD_HAS_COMFORT_LEVEL = 0x10, // comfort_level
+  RECORD_HAS_TIMESTAMP = 0x20,     // timestamp
+  RECORD_HAS_SENSOR_ID = 0x40      // sensor_id
+};
+
+/**
+ * @brief 受信したセンサーデータを、幅を決めた整数だけで16バイトに詰めた形（受信キューと履歴の入口で使う）
+ * @details
+ * SensorDataPacket（64バイト、画面や統計で使う形）の4分の1の大きさで、キャッシュの1行（32バイト）に2件入ります。
+ * 小数は固定小数点の整数で持ち、JSONにあった項目だけ presenceBits のビットを立てます（なかった項目の値は0）。
+ * 先頭のバイトの上位4ビットは形式の版です。項目や単位を変えるときは PACKED_SENSOR_RECORD_VERSION を上げ、
+ * 古い版のレコードは unpackSensorRecord で受け付けないようにします。
+ * sensor_id と語彙表にない快適レベルの言葉は、めったに読まないので IngestRecordText に分けて持ちます。
+ */
+struct PackedSensorRecord
+{
+  uint8_t versionAndFlags;    // 上位4ビット：形式の版、下位4ビット：RECORD_FLAG_* の印
+  uint8_t presenceBits;       // JSONにあった項目（SensorRecordPresence の組み合わせ）
+  uint8_t comfortLevel;       // 快適レベル（ComfortLevel）
+  uint8_t reserved;           // 予約（0）
+  uint32_t timestamp;         // 送信側のタイムスタンプ（秒）
+  uint16_t carbonDioxidePpm;  // CO2濃度（ppm、0〜65535に収める）
+  int16_t thermalComfortX10;  // THI × 10（0.1刻み）
+  int16_t temperatureX10;     // 温度 × 10（0.1℃刻み）
+  uint16_t humidityX10;       // 湿度 × 10（0.1%刻み）
+};
+static_assert(sizeof(PackedSensorRecord) == 16, "PackedSensorRecord must stay 16 bytes");
+static_assert(std::is_trivially_copyable<PackedSensorRecord>::value, "PackedSensorRecord must stay copyable with memcpy");
+
+/**
+ * @brief PackedSensorRecord と対にして持つ文字列（表示・登録表の更新のときだけ読む）
+ */
+struct IngestRecordText
+{
+  char sensorId[SENSOR_ID_MAX_LENGTH + 1];                  // 送信元センサーのID（付いていなければ空文字列）
+  char comfortLevelText[COMFORT_LEVEL_TEXT_MAX_LENGTH + 1]; // 語彙表にない快適レベルの言葉（COMFORT_LEVEL_OTHER のときだけ）
+};
+
+const uint8_t PACKED_SENSOR_RECORD_VERSION = 1;       // PackedSensorRecord の形式の版
+const uint8_t RECORD_FLAG_REORDERED = 0x01;           // 順序が入れ替わって届いた（統計にだけ使う）
+
+// 送信側が使う言葉（不快指数の日本語の区分と、英語の表記）。並べ替えや追加をしたら、下の static_assert で衝突がないことを確かめます
+constexpr ComfortLevelWord COMFORT_LEVEL_VOCABULARY[] = {
+    {"寒い", COMFORT_LEVEL_COLD}, {"肌寒い", COMFORT_LEVEL_CHILLY}, {"何も感じない", COMFORT_LEVEL_NEUTRAL},
+    {"快い", COMFORT_LEVEL_PLEASANT}, {"快適", COMFORT_LEVEL_PLEASANT}, {"暑くない", COMFORT_LEVEL_NOT_HOT},
+    {"やや暑い", COMFORT_LEVEL_SLIGHTLY_HOT}, {"暑くて汗が出る", COMFORT_LEVEL_HOT}, {"暑くてたまらない", COMFORT_LEVEL_VERY_HOT},
+    {"Cold", COMFORT_LEVEL_COLD}, {"Chilly", COMFORT_LEVEL_CHILLY}, {"Neutral", COMFORT_LEVEL_NEUTRAL},
+    {"Comfortable", COMFORT_LEVEL_PLEASANT}, {"Warm", COMFORT_LEVEL_NOT_HOT}, {"Slightly Hot", COMFORT_LEVEL_SLIGHTLY_HOT},
+    {"Hot", COMFORT_LEVEL_HOT}, {"Very Hot", COMFORT_LEVEL_VERY_HOT}};
+constexpr size_t COMFORT_LEVEL_VOCABULARY_SIZE = sizeof(COMFORT_LEVEL_VOCABULARY) / sizeof(COMFORT_LEVEL_VOCABULARY[0]);
+// 言葉のハッシュ値（書式IDと同じFNV-1aを、初期値を変えて使う）を表の大きさで割った余りが、語彙表の中で重ならない初期値
+const uint32_t COMFORT_LEVEL_HASH_SEED = 10;
+const size_t COMFORT_LEVEL_HASH_SLOT_COUNT = 64;
+const char *const COMFORT_LEVEL_NAMES[COMFORT_LEVEL_COUNT] = {"", "cold", "chilly", "neutral", "pleasant",
+                                                              "not_hot", "slightly_hot", "hot", "very_hot", ""}; // ログに使う名前
+
+/**
+ * @brief 言葉が入る表の位置を求める
+ */
+constexpr size_t getComfortLevelHashSlot(const char *text)
+{
+  return hashLogFormat(text, COMFORT_LEVEL_HASH_SEED) % COMFORT_LEVEL_HASH_SLOT_COUNT;
+}
+
+/**
+ * @brief 語彙表のi番目以降の言葉どうしで、表の位置が重ならないかを確かめる（コンパイル時に計算）
+ */
+constexpr bool comfortLevelHashSlotsAreUnique(size_t i = 0, size_t j = 1)
+{
+  return i + 1 >= COMFORT_LEVEL_VOCABULARY_SIZE ? true
+         : j >= COMFORT_LEVEL_VOCABULARY_SIZE   ? comfortLevelHashSlotsAreUnique(i + 1, i + 2)
+                                                : getComfortLevelHashSlot(COMFORT_LEVEL_VOCABULARY[i].text) !=
+                                                        getComfortLevelHashSlot(COMFORT_LEVEL_VOCABULARY[j].text) &&
+                                                    comfortLevelHashSlotsAreUnique(i, j + 1);
+}
+static_assert(comfortLevelHashSlotsAreUnique(), "comfort level words collide in the hash table; change COMFORT_LEVEL_HASH_SEED");
+
+/**
+ * @brief 快適レベルの言葉を探す表を返す（位置ごとに、語彙表の番号＋1。空きは0）
+ * @details ヘッダーの中で1つの表を共有するため、関数の中の静的な配列として持ちます（起動時に確保済みで、ヒープは使いません）
+ */
+inline uint8_t *getComfortLevelHashSlots()
+{
+  static uint8_t hashSlots[COMFORT_LEVEL_HASH_SLOT_COUNT];
+  return hashSlots;
+}
+
+/**
+ * @brief 文字列を、大きさの決まった領域に切り詰めて写す（strlcpy と同じ動き）
+ * @param destination 書き込み先（必ずNUL終端する）
+ * @param source 写す文字列
+ * @param destinationSize 書き込み先の大きさ（1以上）
+ * @return source の長さ（destinationSize 以上なら切り詰めた）
+ * @details strlcpy のないホスト環境（古いglibc）でも同じ結果になるよう、自前で持ちます
+ */
+inline size_t copyBoundedString(char *destination, const char *source, size_t destinationSize)
+{
+  size_t sourceLength = strlen(source);
+  size_t copyLength = sourceLength < destinationSize - 1 ? sourceLength : destinationSize - 1;
+  memcpy(destination, source, copyLength);
+  destination[copyLength] = '\0';
+  return sourceLength;
+}
+
+/**
+ * @brief JSONデータの整合性を検証する
+ * @param jsonData 検証するJSON文字列
+ * @param length 文字列の長さ
+ * @return 有効なJSONならtrue、そうでなければfalse
+ * @details 基本的なJSON形式の正当性チェックを行います（前後の空白は読み飛ばします）
+ */
+inline bool validateJSONDataIntegrity(const char *jsonData, size_t length)
+{
+  // 文字列の前後の空白を読み飛ばす
+  size_t first = 0;
+  while (first < length && isspace((unsigned char)jsonData[first]))
+    first++;
+  size_t last = length;
+  while (last > first && isspace((unsigned char)jsonData[last - 1]))
+    last--;
+
+  // 空のJSONは無効
+  if (first == last)
+    return false;
+
+  // 正しいJSONは「{」で始まり、「}」で終わる必要がある
+  if (jsonData[first] != '{' || jsonData[last - 1] != '}')
+    return false;
+
+  // 基本的なチェックに合格
+  return true;
+}
+
+/**
+ * @brief 受信したバイト配列を、印字可能な文字だけの文字列にして書き込む
+ * @param rawPayload バイトデータ配列
+ * @param payloadLength データ長
+ * @param destination 書き込み先（NUL終端する）
+ * @param destinationSize 書き込み先の大きさ（入りきらない分は切り捨て）
+ * @return 書き込んだ文字数
+ * @details バイナリデータから印字可能なASCII文字のみを抽出します。書き込み先は呼び出し側が用意するので、ヒープ領域は使いません
+ */
+inline size_t copyPrintablePayload(const uint8_t *rawPayload, unsigned int payloadLength, char *destination, size_t destinationSize)
+{
+  size_t copiedLength = 0;
+
+  // バイト配列を1バイトずつ処理
+  for (unsigned int i = 0; i < payloadLength && copiedLength < destinationSize - 1; i++)
+  {
+    // 印字可能なASCII文字（32-126）のみを文字列に追加
+    // これにより、制御文字やバイナリデータが含まれていても適切に処理できる
+    if (rawPayload[i] >= 32 && rawPayload[i] <= 126)
+    {
+      destination[copiedLength++] = (char)rawPayload[i];
+    }
+  }
+  destination[copiedLength] = '\0';
+
+  return copiedLength;
+}
+
+/**
+ * @brief 生のJSONから「"key":」を探し、値の先頭の位置を返す
+ * @param payload 受信したペイロード（NUL終端なし）
+ * @param length ペイロードのバイト長
+ * @param key 探すキー名
+ * @return 値の先頭の位置。見つからなければNULL
+ * @details 入れ子や配列は考えず、フラットなセンサーデータのJSONだけを想定した簡易な探索です
+ */
+inline const uint8_t *findRawJSONValue(const uint8_t *payload, unsigned int length, const char *key)
+{
+  size_t keyLength = strlen(key);
+  for (unsigned int i = 0; i + keyLength + 2 < length; i++)
+  {
+    if (payload[i] != '"' || payload[i + keyLength + 1] != '"' || memcmp(payload + i + 1, key, keyLength) != 0)
+      continue;
+
+    // キーの後の空白とコロンを読み飛ばす
+    unsigned int position = i + keyLength + 2;
+    while (position < length && (payload[position] == ' ' || payload[position] == '\t'))
+      position++;
+    if (position >= length || payload[position] != ':')
+      continue; // 値の中に同じ文字列があっただけ
+    position++;
+    while (position < length && (payload[position] == ' ' || payload[position] == '\t'))
+      position++;
+    return position < length ? payload + position : NULL;
+  }
+  return NULL;
+}
+
+/**
+ * @brief 生のJSONから、0以上の整数の値を取り出す
+ * @return 値（見つからない・数値でない場合は0）。ミリ秒単位のUNIX時刻も入るよう64ビットで返します
+ */
+inline uint64_t extractRawJSONUnsigned(const uint8_t *payload, unsigned int length, const char *key)
+{
+  const uint8_t *value = findRawJSONValue(payload, length, key);
+  uint64_t result = 0;
+  if (value == NULL)
+  {
+    return 0;
+  }
+  while (value < payload + length && *value >= '0' && *value <= '9')
+  {
+    result = result * 10 + (*value++ - '0');
+  }
+  return result;
+}
+
+/**
+ * @brief 生のJSONから、文字列の値を取り出す（エスケープは考慮しない）
+ * @param destination 格納先（見つからなければ空文字列）
+ * @param destinationSize 格納先の大きさ（入りきらない分は切り捨て）
+ */
+inline void extractRawJSONString(const uint8_t *payload, unsigned int length, const char *key, char *destination, size_t destinationSize)
+{
+  const uint8_t *value = findRawJSONValue(payload, length, key);
+  size_t copied = 0;
+  if (value != NULL && *value == '"')
+  {
+    value++;
+    while (value < payload + length && *value != '"' && copied < destinationSize - 1)
+    {
+      destination[copied++] = (char)*value++;
+    }
+  }
+  destination[copied] = '\0';
+}
+
+/**
+ * @brief 小数を「×10の固定小数点」の整数に変換する
+ * @param value 変換する値（例：72.46）
+ * @return 四捨五入した整数（例：725）。int16_tの範囲に丸めます
+ */
+inline int16_t convertToFixedPointX10(float value)
+{
+  long scaled = lroundf(value * 10.0f);
+  if (scaled > INT16_MAX)
+    return INT16_MAX;
+  if (scaled < INT16_MIN)
+    return INT16_MIN;
+  return (int16_t)scaled;
+}
+
+/**
+ * @brief 快適レベルの言葉を探すための表（完全ハッシュ表）を作る
+ * @details 語彙表の言葉どうしで位置が重ならないことはコンパイル時に確かめてあるので、各位置には多くとも1語しか入りません
+ */
+inline void initializeComfortLevelTable()
+{
+  uint8_t *hashSlots = getComfortLevelHashSlots();
+  memset(hashSlots, 0, COMFORT_LEVEL_HASH_SLOT_COUNT);
+  for (size_t i = 0; i < COMFORT_LEVEL_VOCABULARY_SIZE; i++)
+  {
+    hashSlots[getComfortLevelHashSlot(COMFORT_LEVEL_VOCABULARY[i].text)] = (uint8_t)(i + 1);
+  }
+}
+
+/**
+ * @brief 快適レベルの言葉を番号に変換する
+ * @param text 受信した言葉（UTF-8）
+ * @param fallbackText 語彙表にない言葉だったときに、言葉をそのまま入れる場所（それ以外では空文字列にする）
+ * @param fallbackSize fallbackText の大きさ（入りきらない分は、UTF-8の文字の途中で切らないように切り捨てる）
+ * @return 対応する種類。空なら COMFORT_LEVEL_NONE、語彙表になければ COMFORT_LEVEL_OTHER
+ * @details ハッシュ値を1回計算し、表の1か所と文字列を1回比べるだけで決まります（ヒープ領域は使いません）
+ */
+inline ComfortLevel internComfortLevel(const char *text, char *fallbackText, size_t fallbackSize)
+{
+  fallbackText[0] = '\0';
+  if (text == NULL || text[0] == '\0')
+  {
+    return COMFORT_LEVEL_NONE;
+  }
+
+  uint8_t entry = getComfortLevelHashSlots()[getComfortLevelHashSlot(text)];
+  if (entry != 0 && strcmp(COMFORT_LEVEL_VOCABULARY[entry - 1].text, text) == 0)
+  {
+    return COMFORT_LEVEL_VOCABULARY[entry - 1].level;
+  }
+
+  size_t length = copyBoundedString(fallbackText, text, fallbackSize);
+  if (length >= fallbackSize)
+  {
+    // 切った位置がマルチバイト文字の途中なら、その文字の先頭まで戻って切る
+    size_t end = fallbackSize - 1;
+    while (end > 0 && ((uint8_t)text[end] & 0xC0) == 0x80)
+      end--;
+    fallbackText[end] = '\0';
+  }
+  return COMFORT_LEVEL_OTHER;
+}
+
+/**
+ * @brief JSON文字列をパースして、詰めた形（PackedSensorRecord）に変換
+ * @param jsonDocument 解析に使うドキュメント（静的領域に確保したものを毎回使い回す）
+ * @param jsonText パース対象のJSON文字列（解析中に書き換わります）
+ * @param record 値の格納先（JSONになかった項目は0にし、presenceBits のビットを立てない）
+ * @param text sensor_id と語彙表にない快適レベルの言葉の格納先
+ * @return ArduinoJsonの解析結果（失敗したときは record の値は使わないこと）
+ * @details 範囲外の値は表現できる最大・最小値に丸めます。ログの出力と時間の計測は、呼び出し側（parseJSONSensorRecord）で行います
+ */
+inline DeserializationError decodeSensorRecordJSON(JsonDocument &jsonDocument, char *jsonText, PackedSensorRecord &record,
+                                                   IngestRecordText &text)
+{
+  // すべてゼロ（どの項目もない）状態から始める
+  memset(&record, 0, sizeof(record));
+  record.versionAndFlags = PACKED_SENSOR_RECORD_VERSION << 4;
+  text.sensorId[0] = '\0';
+  text.comfortLevelText[0] = '\0';
+
+  // JSON文字列をパース（書き換え可能な文字列を渡すと、文字列を複写せずにその場で解析する）
+  DeserializationError parseError = deserializeJson(jsonDocument, jsonText);
+  if (parseError)
+  {
+    return parseError;
+  }
+
+  // 各フィールドが存在すれば、値を設定して presenceBits に印を付ける
+  // キーが存在するかチェックすることで、一部のデータが欠けていても対応可能
+  if (jsonDocument.containsKey("co2"))
+  {
+    long co2 = jsonDocument["co2"];
+    record.carbonDioxidePpm = (uint16_t)(co2 < 0 ? 0 : (co2 > UINT16_MAX ? UINT16_MAX : co2));
+    record.presenceBits |= RECORD_HAS_CO2;
+  }
+
+  if (jsonDocument.containsKey("thi"))
+  {
+    record.thermalComfortX10 = convertToFixedPointX10(jsonDocument["thi"]);
+    record.presenceBits |= RECORD_HAS_THI;
+  }
+
+  if (jsonDocument.containsKey("temperature"))
+  {
+    record.temperatureX10 = convertToFixedPointX10(jsonDocument["temperature"]);
+    record.presenceBits |= RECORD_HAS_TEMPERATURE;
+  }
+
+  if (jsonDocument.containsKey("humidity"))
+  {
+    int16_t humidityX10 = convertToFixedPointX10(jsonDocument["humidity"]);
+    record.humidityX10 = (uint16_t)(humidityX10 < 0 ? 0 : humidityX10);
+    record.presenceBits |= RECORD_HAS_HUMIDITY;
+  }
+
+  if (jsonDocument.containsKey("comfort_level"))
+  {
+    record.comfortLevel = internComfortLevel(jsonDocument["comfort_level"] | "", text.comfortLevelText, sizeof(text.comfortLevelText));
+    record.presenceBits |= RECORD_HAS_COMFORT_LEVEL;
+  }
+
+  if (jsonDocument.containsKey("timestamp"))
+  {
+    record.timestamp = jsonDocument["timestamp"];
+    record.presenceBits |= RECORD_HAS_TIMESTAMP;
+  }
+
+  if (jsonDocument.containsKey("sensor_id"))
+  {
+    copyBoundedString(text.sensorId, jsonDocument["sensor_id"] | "", sizeof(text.sensorId));
+    record.presenceBits |= RECORD_HAS_SENSOR_ID;
+  }
+
+  return parseError;
+}
+
+/**
+ * @brief 詰めた形のデータを、画面・統計で使う形（SensorDataPacket）に戻す
+ * @param record 詰めた形のデータ
+ * @param text 同じデータの文字列
+ * @param displayData 変換結果の格納先
+ * @return 変換できればtrue（形式の版が違うレコードはfalse）
+ * @details 整数を0.1倍するだけで、文字列を読むのは sensor_id と、語彙表にない快適レベルのときだけです
+ */
+inline bool unpackSensorRecord(const PackedSensorRecord &record, const IngestRecordText &text, SensorDataPacket &displayData)
+{
+  if ((record.versionAndFlags >> 4) != PACKED_SENSOR_RECORD_VERSION)
+  {
+    displayData.hasValidData = false;
+    return false;
+  }
+
+  displayData.carbonDioxideLevel = record.carbonDioxidePpm;
+  displayData.thermalComfortIndex = record.thermalComfortX10 * 0.1f;
+  displayData.ambientTemperature = record.temperatureX10 * 0.1f;
+  displayData.relativeHumidity = record.humidityX10 * 0.1f;
+  displayData.comfortLevel = (ComfortLevel)record.comfortLevel;
+  if (record.comfortLevel == COMFORT_LEVEL_OTHER)
+    copyBoundedString(displayData.comfortLevelText, text.comfortLevelText, sizeof(displayData.comfortLevelText));
+  else
+    displayData.comfortLevelText[0] = '\0';
+  displayData.dataTimestamp = record.timestamp;
+  displayData.hasValidData = true;
+  copyBoundedString(displayData.sensorId, text.sensorId, sizeof(displayData.sensorId));
+  return true;
+}
+
+/**
+ * @brief 受信処理のうち状態を変えない部分（重複判定・文字列化・検証・解析）を、1件分行う
+ * @param payload 受信したペイロード（NUL終端なし）
+ * @param length ペイロードのバイト長
+ * @param window 重複判定に使う並べ替え窓（登録表の窓ではなく、呼び出し側が用意したもの）
+ * @param jsonDocument 解析に使うドキュメント（本体では受信処理と同じ sensorJsonDocument）
+ * @param messageBuffer ペイロードを文字列にして置く場所（本体では受信処理と同じ ingestMessageBuffer）
+ * @param messageBufferSize messageBuffer の大きさ
+ * @param decodedData 解析結果の格納先
+ * @return 解析できればtrue（重複・古すぎる・不正なデータならfalse）
+ * @details
+ * handleIncomingMQTTMessage と同じ手順で同じ領域を使いますが、登録表・現在の値・画面は変えません。
+ * ヒープ確保の確認用の再生（`replay`）と、ホスト環境のテスト（test/test_zero_alloc_replay）で使います。
+ */
+inline bool decodeSensorPayload(const uint8_t *payload, unsigned int length, SequenceWindow &window, JsonDocument &jsonDocument,
+                                char *messageBuffer, size_t messageBufferSize, SensorDataPacket &decodedData)
+{
+  unsigned long timestamp = (unsigned long)extractRawJSONUnsigned(payload, length, "timestamp");
+  SequenceCheckResult sequenceResult = checkSequenceWindow(window, timestamp);
+  if (sequenceResult == SEQUENCE_DUPLICATE || sequenceResult == SEQUENCE_TOO_OLD)
+  {
+    return false;
+  }
+
+  size_t jsonLength = copyPrintablePayload(payload, length, messageBuffer, messageBufferSize);
+  if (!validateJSONDataIntegrity(messageBuffer, jsonLength))
+  {
+    return false;
+  }
+  PackedSensorRecord record;
+  IngestRecordText text;
+  return !decodeSensorRecordJSON(jsonDocument, messageBuffer, record, text) && unpackSensorRecord(record, text, decodedData);
+}
+
+#endif // SENSOR_INGEST_H
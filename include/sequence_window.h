@@ -0,0 +1,99 @@
+/**
+ * @file sequence_window.h
+ * @brief 送信元ごとの「並べ替え窓」で、重複・古すぎる・順序の入れ替わったデータを見分ける
+ * @details 窓の大きさは config.h の SENSOR_REORDER_WINDOW_SIZE です。config.h（ホスト環境のテストでは config.example.h）の後に読み込みます
+ */
+#ifndef SEQUENCE_WINDOW_H
+#define SEQUENCE_WINDOW_H
+
+#include <stdint.h>
+
+/**
+ * @brief 送信元ごとに、直近に受け付けたタイムスタンプを覚えておく「並べ替え窓」
+ * @details
+ * QoSの再送や複数のゲートウェイ経由で、同じデータが2回届いたり、古いデータが後から届いたりします。
+ * 直近SENSOR_REORDER_WINDOW_SIZE件のタイムスタンプと比べて、重複と古すぎるデータを見分けます。
+ */
+struct SequenceWindow
+{
+  unsigned long acceptedTimestamps[SENSOR_REORDER_WINDOW_SIZE]; // 受け付けたタイムスタンプ（順不同）
+  uint8_t acceptedCount;                                        // 覚えている件数
+  unsigned long newestTimestamp;                                // 受け付けた中で最も新しいタイムスタンプ
+  uint32_t duplicateCount;                                      // 重複として捨てた件数
+  uint32_t tooOldCount;                                         // 窓より古いとして捨てた件数
+  uint32_t reorderedCount;                                      // 窓の中で順序が入れ替わって届いた件数
+};
+
+/**
+ * @brief 並べ替え窓での判定結果
+ */
+enum SequenceCheckResult
+{
+  SEQUENCE_IN_ORDER = 0, // これまでで最も新しい（通常の処理）
+  SEQUENCE_REORDERED,    // 初めて見るが、最新より古い（統計にだけ使う）
+  SEQUENCE_DUPLICATE,    // 受け付け済みと同じタイムスタンプ（捨てる）
+  SEQUENCE_TOO_OLD,      // 窓に残っているどれよりも古い（捨てる）
+  SEQUENCE_UNTRACKED     // タイムスタンプ・sensor_idがない、または未登録のセンサーで判定できない（通常の処理）
+};
+
+/**
+ * @brief 並べ替え窓でタイムスタンプを判定し、受け付けるものは窓に記録する
+ * @param window 送信元の並べ替え窓
+ * @param timestamp 届いたデータのタイムスタンプ
+ * @return 判定結果
+ * @details
+ * 窓が満杯のときは、最も古いタイムスタンプを新しいもので置き換えます。
+ * 窓に残っている最も古いものより前のデータは、すでに処理済みか判断できないため「古すぎる」として捨てます。
+ */
+inline SequenceCheckResult checkSequenceWindow(SequenceWindow &window, unsigned long timestamp)
+{
+  // 重複の確認と、窓の中で最も古いタイムスタンプの位置を同時に探す
+  uint8_t oldestIndex = 0;
+  for (uint8_t i = 0; i < window.acceptedCount; i++)
+  {
+    if (window.acceptedTimestamps[i] == timestamp)
+    {
+      window.duplicateCount++;
+      return SEQUENCE_DUPLICATE;
+    }
+    if (window.acceptedTimestamps[i] < window.acceptedTimestamps[oldestIndex])
+      oldestIndex = i;
+  }
+
+  if (window.acceptedCount < SENSOR_REORDER_WINDOW_SIZE)
+  {
+    window.acceptedTimestamps[window.acceptedCount++] = timestamp;
+  }
+  else if (timestamp < window.acceptedTimestamps[oldestIndex])
+  {
+    window.tooOldCount++;
+    return SEQUENCE_TOO_OLD;
+  }
+  else
+  {
+    window.acceptedTimestamps[oldestIndex] = timestamp;
+  }
+
+  if (timestamp < window.newestTimestamp)
+  {
+    window.reorderedCount++;
+    return SEQUENCE_REORDERED;
+  }
+  window.newestTimestamp = timestamp;
+  return SEQUENCE_IN_ORDER;
+}
+
+/**
+ * @brief 並べ替え窓を空にする
+ * @param window 初期化する窓
+ */
+inline void resetSequenceWindow(SequenceWindow &window)
+{
+  window.acceptedCount = 0;
+  window.newestTimestamp = 0;
+  window.duplicateCount = 0;
+  window.tooOldCount = 0;
+  window.reorderedCount = 0;
+}
+
+#endif // SEQUENCE_WINDOW_H
@@ -23,6 +23,8 @@ const char* MQTT_BROKER_ADDRESS = "192.168.1.100";     // ***** MQTTブローカ
 const char* MQTT_TOPIC_NAME = "sensor_data";           // 購読するトピック名（必要に応じて変更）
 const int MQTT_BROKER_PORT = 1883;                     // MQTTブローカのポート番号（標準は1883）
 const char* MQTT_CLIENT_ID_PREFIX = "M5StickCPlus2-";  // MQTT接続時のクライアントID接頭辞
+const char* MQTT_HISTORY_REQUEST_TOPIC = "sensor_data/history/request";   // 履歴の問い合わせを受け付けるトピック
+const char* MQTT_HISTORY_RESPONSE_TOPIC = "sensor_data/history/response"; // 履歴の応答を送るトピック
 
 // ========== 時刻同期設定 ==========
 const char* TIME_SERVER_ADDRESS = "pool.ntp.org";               // NTPサーバのアドレス
@@ -50,12 +52,98 @@ const int NO_DATA_MESSAGE_Y = 55 + VERTICAL_OFFSET;
 // ========== 再試行・タイムアウト設定 ==========
 const int MAXIMUM_NTP_RETRY_ATTEMPTS = 10;
 const unsigned long MQTT_RECONNECTION_DELAY_MILLISECONDS = 5000;
-const unsigned long CONNECTION_SUCCESS_DISPLAY_TIME = 2000;
+const unsigned long CONNECTION_SUCCESS_DISPLAY_TIME = 2000; // 接続成功の通知を表示しておく時間（起動処理はこの間も先へ進む）
+
+// ========== 通知（トースト）設定 ==========
+// 接続の成功・失敗などは、起動処理やメインループを止めずに、画面の下に重ねて一定時間だけ表示します
+const unsigned long ERROR_TOAST_DISPLAY_TIME = 5000; // エラーの通知を表示しておく時間
+const uint8_t TOAST_CAPACITY = 3;                    // 同時に表示できる通知の数（超えたら古いものから消す）
+const size_t TOAST_TEXT_MAX_LENGTH = 36;             // 通知1件の最大文字数（文字サイズ1で画面の幅に収まる長さ）
+const int TOAST_ROW_HEIGHT = 12;                     // 通知1件の枠の高さ（ピクセル）
+const int TOAST_MARGIN_X = 6;                        // 通知の枠の左右の余白（ピクセル）
 
 // ========== JSON解析設定 ==========
 const size_t JSON_PARSING_MEMORY_SIZE = 2048;
+const size_t JSON_MESSAGE_MAX_LENGTH = 512;      // 受信メッセージを文字列として置いておく場所の大きさ（超えたメッセージは不正なJSONとして捨てる）
+const size_t COMFORT_LEVEL_TEXT_MAX_LENGTH = 22; // 決まった言葉以外の comfort_level を覚えておく最大バイト数（超えた分は切り捨て）
+const uint8_t INGEST_QUEUE_CAPACITY = 8;         // 解析済みで反映待ちのデータを置いておける件数（1回の受信処理で続けて読むメッセージの最大数でもある）
 
 // ========== 交互表示のための設定 ==========
 const unsigned long INTERACTIVE_DISPLAY_INTERVAL_MILLISECONDS = 3000;
+const bool DIAGNOSTICS_PAGE_ENABLED = true; // 受信から表示までの遅延を示す診断ページを、ページ切り替えに含めるかどうか
+
+// ========== センサー履歴（リングバッファ）設定 ==========
+const unsigned long HISTORY_SAMPLE_PERIOD_SECONDS = 30;           // 履歴1スロットの幅（秒）。センサーのパブリッシュ間隔に合わせる（最大255）
+const unsigned long HISTORY_RETENTION_SECONDS = 24UL * 60UL * 60UL; // RAM上に保持する履歴の長さ（24時間）
+const size_t MINUTE_TIER_BUCKET_COUNT = 360;                      // 1分集計の保持数（6時間分）
+const size_t HOUR_TIER_BUCKET_COUNT = 168;                        // 1時間集計の保持数（7日分）
+const size_t HISTORY_QUERY_MAX_POINTS = 240;                      // 1回の範囲問い合わせで返す最大件数
+const size_t HISTORY_RESPONSE_CHUNK_MAX_BYTES = 200;              // 履歴応答1チャンクの最大バイト数（MQTTのバッファに収まる範囲で使用）
+const unsigned long HISTORY_RESPONSE_CHUNK_INTERVAL_MILLISECONDS = 20; // 履歴応答のチャンクを送る最小間隔
+
+// ========== 履歴のフラッシュ保存設定（LittleFS） ==========
+const size_t HISTORY_FLASH_PAGE_SIZE = 256;                                  // 1回にまとめて書き込むページの大きさ（バイト）
+const size_t HISTORY_FLASH_PAGES_PER_SEGMENT = 64;                           // 1つのセグメントファイルに入れるページ数（16KB）
+const size_t HISTORY_FLASH_MAX_SEGMENTS = 32;                                // 保持するセグメント数の上限（超えたら古い順に削除）
+const unsigned long HISTORY_FLASH_FLUSH_INTERVAL_MILLISECONDS = 10UL * 60UL * 1000UL; // ページが埋まらなくても書き込む間隔（10分）
+
+// ========== CO2予測設定 ==========
+const int CO2_WARNING_THRESHOLD_PPM = 1000;              // 換気を勧めるCO2濃度（ppm）
+const int CO2_CRITICAL_THRESHOLD_PPM = 1500;             // 換気が必要なCO2濃度（ppm）
+const float CO2_FORECAST_LEVEL_SMOOTHING = 0.5f;         // 水準の平滑化係数（0〜1。大きいほど最新値を重視）
+const float CO2_FORECAST_TREND_SMOOTHING = 0.2f;         // 傾きの平滑化係数（0〜1。大きいほど最近の変化を重視）
+const float CO2_FORECAST_MAX_DISPLAY_MINUTES = 180.0f;   // これより先の到達予測は表示しない（分）
+
+// ========== 統計情報設定 ==========
+const unsigned long STATISTICS_RECENT_WINDOW_SECONDS = 3600; // 「直近」統計の窓の長さ（1時間）
+const size_t STATISTICS_RECENT_SUBWINDOW_COUNT = 12;         // 直近窓の分割数（5分×12。細かいほど窓の端が正確）
+const unsigned long STATISTICS_DAY_LENGTH_SECONDS = 86400;   // 「今日」統計の区切り（日本時刻の0時で切り替わる）
+
+// ========== データ鮮度設定 ==========
+const unsigned long SENSOR_EXPECTED_PUBLISH_PERIOD_SECONDS = 30; // センサーがデータを送信する想定の間隔（秒）
+const float SENSOR_LATE_PERIOD_MULTIPLIER = 1.5f;                // 前回からこの倍数（×想定間隔）を超えて届いたら「遅延」と数える
+const float SENSOR_STALE_PERIOD_MULTIPLIER = 3.0f;               // この倍数（×想定間隔）を超えて届かなければ「古いデータ」として表示
+
+// ========== 自己診断メトリクス送信設定 ==========
+const char* MQTT_METRICS_TOPIC_PREFIX = "sensor_monitor/metrics/";    // この後ろに本体のMACアドレスを付けたトピックに送信
+const unsigned long METRICS_PUBLISH_INTERVAL_MILLISECONDS = 60000;   // メトリクスを送信する間隔（1分）
+
+// ========== ログ出力設定 ==========
+const size_t LOG_BUFFER_SIZE = 2048;                      // シリアルへ送る前のログをためておくバッファの大きさ（バイト）
+const size_t LOG_LINE_MAX_LENGTH = 160;                   // ログ1行の最大バイト数（超えた分は切り捨てて「~」を付ける）
+const size_t LOG_PAYLOAD_DUMP_MAX_BYTES = 64;             // 受信メッセージの内容をログに出すときの最大バイト数
+const unsigned long LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES = 10; // 受信メッセージの内容をログに出す頻度（N件に1件。1なら毎回、0なら出さない）
+
+// ========== イベントトレース設定 ==========
+const size_t TRACE_BUFFER_EVENT_COUNT = 1024;             // 記録しておくイベント数（1件8バイト。ループ1回あたり6件ほどなので約17秒分）
+const unsigned long TRACE_FREEZE_LOOP_MILLISECONDS = 200; // ループ1回がこれより長くかかったら記録を止め、その直前までを残す（0なら止めない）
+
+// ========== ヒープ使用量の記録設定 ==========
+const unsigned long HEAP_SAMPLE_INTERVAL_MILLISECONDS = 1000; // 空きヒープ・最大連続ブロックを記録する間隔
+
+// ========== 定常状態のヒープ確保の監視設定 ==========
+// 受信が始まった後は、受信・描画の処理でヒープを使わない作りになっています。それでも確保があれば、呼び出し元のアドレスをログに残します。
+// アドレスは xtensa-esp32-elf-addr2line -e .pio/build/m5stick-c-plus2/firmware.elf 0x... で関数と行に直せます（platformio.ini の --wrap 指定が必要）。
+const unsigned long STEADY_STATE_WARMUP_MILLISECONDS = 10000; // 起動・MQTT再接続のあと、監視を始めるまでの時間（ライブラリが初回だけ行う確保を除くため）
+const bool STEADY_STATE_TRAP_ON_ALLOCATION = false;           // trueにすると、確保した時点で止めてバックトレースを出す（開発中の確認用）
+const uint16_t REPLAY_MESSAGE_COUNT = 2000;                   // `replay` で流す受信メッセージの数
+const uint16_t REPLAY_WARMUP_MESSAGE_COUNT = 20;              // そのうち、確保を数えない最初のメッセージの数
+const uint16_t REPLAY_RENDER_EVERY_N_MESSAGES = 50;           // `replay` で画面全体を描き直す頻度（N件に1回）
+
+// ========== タスクの健全性監視設定 ==========
+const unsigned long TASK_MONITOR_INTERVAL_MILLISECONDS = 5000; // 各タスクのスタックの余裕とCPU時間を記録する間隔
+const uint32_t STACK_HEADROOM_WARNING_BYTES = 1024;            // スタックの残りがこれを下回ったら警告する（バイト）
+const size_t TASK_MONITOR_MAX_TASKS = 24;                      // 記録できるタスク数の上限（超えた場合はloopタスクだけを記録）
+
+// ========== Digi-Clock UnitのI2C通信の記録設定 ==========
+const uint8_t DIGI_CLOCK_I2C_ADDRESS = 0x30;                // Digi-Clock UnitのI2Cアドレス（書き込みのあとの応答確認に使う）
+const uint32_t I2C_SLOW_TRANSACTION_MICROSECONDS = 5000;    // 1回の書き込みがこれより長くかかったら警告する（マイクロ秒）
+
+// ========== 複数センサー設定 ==========
+const size_t SENSOR_REGISTRY_CAPACITY = 64; // 記録できるセンサー数の上限（2のべき乗。探索を短く保つため、実際に登録するのは3/4まで）
+const size_t SENSOR_ID_MAX_LENGTH = 15;     // sensor_idとして扱う最大文字数（超えた分は切り捨て）
+const size_t WORST_SENSOR_RANK_COUNT = 5;   // ランキングページに表示する部屋の数（CO2・THIそれぞれ）
+const char* PRIMARY_SENSOR_ID = "";         // 大きく表示・履歴に記録するセンサーのID（空文字列なら、最初にデータが届いたセンサー）
+const size_t SENSOR_REORDER_WINDOW_SIZE = 8; // 重複・順序の入れ替わりを判定するために覚えておく、センサーごとの直近のタイムスタンプ数
 
 #endif  // CONFIG_H
\ No newline at end of file
@@ -26,25 +26,548 @@
 #include <WiFiUdp.h>           // NTP通信の基礎となるUDP通信を使うためのライブラリ。UDPはインターネット上でデータを送受信する方式の一つです
 #include "config.h"            // Wi-FiやMQTTの接続情報など、個人情報を記述した設定ファイルを読み込みます
 #include <M5UNIT_DIGI_CLOCK.h> // M5Stackの「Digi-Clock Unit」を制御するための専用ライブラリ。7セグメントLEDの表示を制御します
+#include <LittleFS.h>          // フラッシュメモリ上のファイルシステム。再起動しても消えないようにセンサー履歴を保存します
+#include <type_traits>         // 構造体がmemcpyでそのままコピーできる形かどうかを、コンパイル時に確かめるために使います
+
+// 画面や通信を使わない部品は include/ に分けてあり、ホスト環境のテスト（test/、`pio test -e native`）でも同じものを使います。
+// どれも config.h の定数を使うので、config.h の後に読み込みます。
+#include "log_format_token.h"   // ログの書式IDの計算（コンパイル時）
+#include "fixed_point_format.h" // 画面に出す値の文字列化
+#include "sequence_window.h"    // 重複・順序入れ替わりの判定（並べ替え窓）
+#include "sensor_ingest.h"      // 受信データの形と、ペイロードの解析・詰め替え
+#include "history_codec.h"      // 履歴の圧縮サンプルと時系列圧縮（Gorilla方式）
+#include "clock_format.h"       // 時刻の文字列化とミリ秒の推定
+#include "benchmark_baseline.h" // `bench` の基準値（config.h ではなくリポジトリで管理する）
+
+// --- ログ出力のレベルと形式 ---
+// LOG_LEVEL より詳しいレベルのログは、呼び出しごとコンパイル時に取り除かれます（書式の文字列もプログラムに残りません）。
+// LOG_TOKENIZED を定義すると、ログは「書式のID＋引数の値」だけのバイナリで送られ、tools/detokenize_log.py で文章に戻します。
+// どちらも platformio.ini の build_flags で指定します。
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#ifdef LOG_TOKENIZED
+#define LOG_RECORD(level, format, ...) writeTokenizedLogRecord(level, LogFormatToken<hashLogFormat(format)>::value, ##__VA_ARGS__)
+#else
+#define LOG_RECORD(level, format, ...) logPrintf(format, ##__VA_ARGS__)
+#endif
+// 取り除いたログ：sizeof の中は実行も出力もされないが、引数は「使った」ことになり、書式と引数の型も確かめられる
+#define LOG_DISCARD(format, ...) do { (void)sizeof((logPrintf(format, ##__VA_ARGS__), 0)); } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_RECORD(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_RECORD(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_RECORD(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_RECORD(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_DISCARD(format, ##__VA_ARGS__)
+#endif
 
 // =================================================================
 // 2. データ構造体の定義
 // =================================================================
+// 受信データ（SensorDataPacket・PackedSensorRecord）と履歴の圧縮サンプルは include/ のヘッダーで定義しています。
+// 大きさの上限は本体（32ビット）での値なので、ここで確かめます
+static_assert(sizeof(SensorDataPacket) <= 64, "SensorDataPacket should fit in 64 bytes");
+
+/**
+ * @brief 1つの計測項目の集計値（最小・最大・合計）
+ * @details 値は圧縮サンプルと同じ固定小数点の単位で保持します。平均は 合計 ÷ 件数 で求めます。
+ */
+struct MetricAggregate
+{
+  int32_t minimum; // 最小値
+  int32_t maximum; // 最大値
+  int32_t sum;     // 合計値（平均の計算用）
+};
+
+/**
+ * @brief ダウンサンプリング（間引き集計）の1区間分のデータ
+ * @details 1分や1時間といった区間ごとに、全項目の最小・最大・合計と件数をまとめて持ちます
+ */
+struct DownsampleBucket
+{
+  MetricAggregate metrics[HISTORY_METRIC_COUNT]; // 項目ごとの集計値
+  uint16_t sampleCount;                          // この区間に含まれるサンプル数（0なら空き）
+};
+
+/**
+ * @brief 一定幅の区間で集計した履歴の「階層（ティア）」
+ * @details 生データのリングバッファと同じく、区間番号（時刻 ÷ 区間幅）をリングの位置に対応させています
+ */
+struct DownsampleTier
+{
+  const char *tierName;             // 階層の名前（ログ表示用）
+  unsigned long bucketSeconds;      // 1区間の幅（秒）
+  size_t bucketCapacity;            // 保持できる区間の数
+  DownsampleBucket *buckets;        // 区間データの配列（固定サイズで確保済み）
+  unsigned long newestBucketNumber; // 最も新しい区間の番号
+  bool hasBuckets;                  // 1件でも集計されたかどうか
+};
+
+/**
+ * @brief フラッシュに保存する履歴ログの「セグメント」ファイルの先頭に置くヘッダー
+ * @details
+ * 履歴ログは複数のセグメントファイルに分けて、追記だけで書き込みます（上書きはしません）。
+ * 起動時はこのヘッダーだけを読めば、どのセグメントがいつからのデータかが分かります。
+ */
+struct HistoryLogSegmentHeader
+{
+  uint32_t magic;          // ファイルの種類を示す目印（HISTORY_LOG_SEGMENT_MAGIC）
+  uint16_t formatVersion;  // 形式のバージョン
+  uint16_t pageSize;       // ページの大きさ（バイト）
+  uint32_t sequenceNumber; // セグメントの通し番号（大きいほど新しい）
+  uint32_t firstEpoch;     // このセグメントの最初のサンプルの時刻（UNIX時刻）
+  uint32_t headerCrc;      // ここまでの内容のCRC32（壊れていないかの確認用）
+};
+static_assert(sizeof(HistoryLogSegmentHeader) == 20, "segment header layout is part of the flash format");
+
+/**
+ * @brief 履歴ログの1ページ（まとめて書き込む単位）のヘッダー
+ * @details ページの中身（ペイロード）はCRC32で保護し、書き込み途中で電源が切れたページを見分けられるようにします
+ */
+struct HistoryLogPageHeader
+{
+  uint16_t magic;         // ページの目印（HISTORY_LOG_PAGE_MAGIC）
+  uint8_t encoding;       // ペイロードの符号化方式（HISTORY_LOG_ENCODING_GORILLA）
+  uint8_t sampleCount;    // このページに入っているサンプル数
+  uint32_t firstEpoch;    // 最初のサンプルの時刻
+  uint16_t payloadLength; // ペイロードの長さ（バイト）
+  uint16_t reserved;      // 予約（0）
+  uint32_t pageCrc;       // ヘッダー前半とペイロードのCRC32
+};
+static_assert(sizeof(HistoryLogPageHeader) == 16, "page header layout is part of the flash format");
+
+/**
+ * @brief 1つの計測項目の逐次統計（Welford法）
+ * @details
+ * 新しい値が来るたびに平均と「偏差の二乗和(m2)」を少しずつ更新する方法です。
+ * 過去のデータを読み直さずに、平均・分散・最小・最大をいつでも求められます。
+ */
+struct RunningStatistics
+{
+  uint32_t count; // サンプル数
+  float mean;     // 平均値
+  float m2;       // 平均からの偏差の二乗和（分散 = m2 ÷ 件数）
+  float minimum;  // 最小値
+  float maximum;  // 最大値
+};
+
+/**
+ * @brief センサーデータの鮮度（届く間隔と、途切れていないか）を追跡する状態
+ * @details
+ * 届いた時刻（本体の経過ミリ秒）と、送信側が付けたタイムスタンプを記録します。
+ * 到着間隔は逐次統計で集計し、その標準偏差を「ジッター（間隔のばらつき）」として扱います。
+ */
+struct SensorFreshnessTracker
+{
+  unsigned long lastArrivalMillis;      // 最後にデータが届いた時刻（millis()）
+  unsigned long lastPublisherTimestamp; // 最後に届いたデータの送信側タイムスタンプ（秒、なければ0）
+  uint32_t arrivalCount;                // 届いたデータの件数
+  RunningStatistics interArrivalSeconds; // 到着間隔（秒）の平均・ばらつき・最小・最大
+  uint32_t latePublicationCount;        // 想定より遅れて届いた回数
+  uint32_t missedPublicationCount;      // 届かなかったと推定される回数
+  bool isStale;                         // 一定時間届いていない（表示中の値が古い）かどうか
+};
+
+/**
+ * @brief センサー登録表（オープンアドレス法のハッシュ表）の1件分
+ * @details
+ * センサーごとの最新の値と鮮度を持ちます。値はStringを使わずfloatの配列で持つので、
+ * 登録表全体を固定サイズの配列として確保でき、受信中にヒープ領域を使いません。
+ */
+struct SensorRegistryEntry
+{
+  bool inUse;                                 // この位置が使われているかどうか
+  uint32_t idHash;                            // sensorIdのハッシュ値（比較を速くするために保存）
+  char sensorId[SENSOR_ID_MAX_LENGTH + 1];    // センサーのID
+  float metricValues[HISTORY_METRIC_COUNT];   // 最新の値（HistoryMetricの順）
+  SensorFreshnessTracker freshness;           // このセンサーの到着間隔・遅延・欠落
+  int8_t heapPositions[HISTORY_METRIC_COUNT]; // 各項目のランキング（ヒープ）内での位置（入っていなければ-1）
+  SequenceWindow sequenceWindow;              // 重複・順序入れ替わりの判定用
+};
+
+/**
+ * @brief 指定した項目の値が高い上位N件のセンサーを保持する「最小ヒープ」
+ * @details
+ * 先頭（根）には上位N件のうち最も低い値のセンサーが来ます。新しい値がそれより高ければ入れ替えるだけなので、
+ * 1件の受信あたり O(log N) で更新できます。全センサーを並べ替える必要はありません。
+ */
+struct WorstSensorHeap
+{
+  HistoryMetric metric;                              // 並べる項目（CO2またはTHI）
+  uint16_t entryIndexes[WORST_SENSOR_RANK_COUNT];    // 登録表の位置（ヒープの順）
+  uint8_t size;                                      // ヒープに入っている件数
+};
+
+/**
+ * @brief CO2濃度の傾向を予測するための状態（Holtの線形指数平滑法）
+ * @details
+ * 「今の水準（level）」と「1分あたりの傾き（trend）」の2つだけを持ち、新しい値が届くたびに少しずつ更新します。
+ * 過去のデータを読み直さずに、数分先の値や、しきい値に達するまでの時間を見積もれます。
+ */
+struct TrendForecaster
+{
+  bool initialized;                // 1件目を受け取ったかどうか
+  float level;                     // 平滑化した現在の水準
+  float trendPerMinute;            // 平滑化した1分あたりの変化量
+  unsigned long lastSampleSeconds; // 最後に更新した時刻（秒）
+  uint32_t sampleCount;            // 更新回数
+  float absoluteErrorSum;          // 1つ先の予測と実測の差（絶対値）の合計
+  uint32_t errorCount;             // 誤差を集計した回数
+};
+
+/**
+ * @brief MQTTで受け付けた履歴問い合わせに応答している途中の状態
+ * @details
+ * 結果は最大でも画面幅程度の件数なので、問い合わせを受けた時点でまとめて集計しておきます。
+ * 送信は1回のループで1チャンクずつ行い、通常の受信処理や画面更新を止めないようにします。
+ */
+struct HistoryQuerySession
+{
+  bool active;                  // 応答を送信中かどうか
+  uint16_t requestId;           // 問い合わせ側が指定した番号（応答に付けて返す）
+  HistoryMetric metric;         // 対象の項目
+  unsigned long bucketSeconds;  // 結果1件あたりの区間幅（秒）
+  size_t pointCount;            // 結果の件数
+  size_t nextPointIndex;        // 次に送る結果の位置
+  uint16_t nextChunkIndex;      // 次に送るチャンクの番号
+  unsigned long startMillis;    // 問い合わせを受けた時刻
+  unsigned long lastChunkMillis; // 最後にチャンクを送った時刻
+  uint32_t bytesSent;           // 送信したバイト数
+  uint32_t loopCount;           // 応答中に実行したループの回数
+  uint32_t loopMicrosSum;       // 応答中のループ処理時間の合計（マイクロ秒）
+  uint32_t loopMicrosMax;       // 応答中のループ処理時間の最大値（マイクロ秒）
+};
+
+/**
+ * @brief 履歴の問い合わせを処理できなかった理由
+ */
+enum HistoryQueryErrorReason
+{
+  HISTORY_QUERY_ERROR_NONE = 0,       // 送るべきエラーはない
+  HISTORY_QUERY_ERROR_INVALID_JSON,   // 問い合わせのJSONが読めない
+  HISTORY_QUERY_ERROR_BUSY,           // 別の問い合わせに応答中
+  HISTORY_QUERY_ERROR_INVALID_RANGE,  // 項目名が不明、または from が to より後
+  HISTORY_QUERY_ERROR_REASON_COUNT    // 理由の数
+};
+
+/**
+ * @brief 送信待ちのエラー応答
+ * @details
+ * 問い合わせはMQTTの受信コールバックの中で処理するため、その場で publish するとクライアントの送受信バッファを
+ * 受信中のメッセージと取り合ってしまいます。エラーは番号と理由だけを残し、応答チャンクと同じくループの中で送ります。
+ */
+struct PendingHistoryQueryError
+{
+  HistoryQueryErrorReason reason; // 理由（HISTORY_QUERY_ERROR_NONE なら送信待ちなし）
+  uint16_t requestId;             // 問い合わせ側が指定した番号
+};
+
+/**
+ * @brief loop()の中で処理時間を測る区間（ステージ）
+ */
+enum LoopStage
+{
+  STAGE_MQTT_CONNECTION = 0, // MQTT接続の維持
+  STAGE_MQTT_MESSAGES,       // MQTTメッセージの受信処理
+  STAGE_DISPLAY,             // 画面の定期更新
+  STAGE_NETWORK_TIME,        // NTP時刻の更新
+  STAGE_DIGICLOCK,           // Digi-Clock Unitの更新
+  STAGE_SERIAL_CONSOLE,      // シリアルコマンドの処理
+  STAGE_HISTORY_FLUSH,       // 履歴のフラッシュ書き込み
+  STAGE_FRESHNESS,           // データ鮮度の確認
+  STAGE_HEAP_SAMPLE,         // ヒープ使用量の記録
+  STAGE_METRICS,             // 自己診断メトリクスの送信
+  STAGE_HISTORY_QUERY,       // 履歴問い合わせへの応答
+  STAGE_LOG_DRAIN,           // たまったログのシリアル送信
+  STAGE_LOOP_TOTAL,          // ループ全体（待機時間を除く）
+  LOOP_STAGE_COUNT           // ステージ数
+};
+
+/**
+ * @brief 処理時間などの値を2のべき乗ごとの区間に数える「対数ヒストグラム」
+ * @details
+ * 区間は 1, 2〜3, 4〜7, ... のように倍々に広がるので、数マイクロ秒から数十秒までを32個の区間で表せます。
+ * 1回の記録は、最上位ビットの位置を求めて配列の1つを増やすだけなので、常に有効にしておけます。
+ */
+struct Log2Histogram
+{
+  uint32_t sampleCount; // 記録した回数
+  uint64_t total;       // 値の合計
+  uint32_t maximum;     // 最大値
+  uint32_t buckets[32]; // i番目は 2^i 以上 2^(i+1) 未満だった回数（32ビット全体を表せる）
+};
+
+/**
+ * @brief I2C通信の結果（Wire.endTransmission() の戻り値と同じ番号）
+ */
+enum I2CTransmissionResult
+{
+  I2C_RESULT_OK = 0,        // 成功
+  I2C_RESULT_DATA_TOO_LONG, // 送信バッファに入りきらない
+  I2C_RESULT_ADDRESS_NACK,  // アドレスに応答がない（ユニットが外れている・ケーブルの接触不良など）
+  I2C_RESULT_DATA_NACK,     // データに応答がない
+  I2C_RESULT_OTHER_ERROR,   // その他のバスエラー
+  I2C_RESULT_TIMEOUT,       // タイムアウト（クロック線が引っ張られたままなど）
+  I2C_RESULT_COUNT          // 種類の数
+};
+
 /**
- * @brief MQTTで受信するセンサーデータをまとめて管理するための「設計図」
+ * @brief Digi-Clock UnitとのI2C通信の記録
  * @details
- * 構造体（struct）とは、関連するデータを一つのまとまりとして扱うための「箱」のようなものです。
- * この構造体では、センサーから取得した様々な種類のデータを一つの変数にまとめて管理します。
- */
-struct SensorDataPacket
-{
-  int carbonDioxideLevel;         // CO2濃度（ppm単位）- 部屋の空気の質を示す重要な指標
-  float thermalComfortIndex;      // 温熱快適性指数（THI）- 温度と湿度から算出される快適さの指標
-  float ambientTemperature;       // 環境温度（℃）- センサーで測定した周囲の温度
-  float relativeHumidity;         // 相対湿度（%）- センサーで測定した空気中の湿度
-  String comfortLevelDescription; // 快適レベルの説明文（「快適」「やや暑い」など）
-  unsigned long dataTimestamp;    // データのタイムスタンプ - このデータがいつ測定されたか
-  bool hasValidData;              // 有効なデータかどうかのフラグ - trueなら有効、falseなら無効
+ * ライブラリの書き込み関数は結果を返さず、実際にバスへ送ったバイト数もわからないため、
+ * 結果は書き込みの直後にアドレスだけを送る確認（probe）のもので、バイト数はライブラリに渡した内容の大きさです。
+ */
+struct I2CBusStatistics
+{
+  uint32_t transactionCount;                    // 書き込み（と直後の確認）の回数
+  uint32_t payloadByteCount;                    // ライブラリに渡した内容のバイト数の合計（バス上のバイト数ではない）
+  uint32_t slowTransactionCount;                // I2C_SLOW_TRANSACTION_MICROSECONDS 以上かかった回数
+  uint32_t probeResultCounts[I2C_RESULT_COUNT]; // 書き込み直後の確認の結果の種類ごとの回数
+  uint8_t lastProbeResult;                      // 最後の確認の結果（I2CTransmissionResult）
+  unsigned long lastErrorMillis;                // 最後に確認が失敗した時刻（millis()。失敗がなければ0）
+  Log2Histogram durationHistogram;              // 1回の書き込みと直後の確認を合わせた時間（マイクロ秒）
+};
+
+/**
+ * @brief ヒープ確保を数える区分（どの処理の中で確保されたか）
+ */
+enum HeapSubsystem
+{
+  HEAP_TAG_OTHER = 0, // 上記以外（起動処理や、Wi-Fiなどloop以外のタスク）
+  HEAP_TAG_INGEST,    // MQTTメッセージの受信・解析
+  HEAP_TAG_RENDER,    // 画面の描画
+  HEAP_TAG_NETWORK,   // MQTT接続の維持・NTP・履歴応答の送信
+  HEAP_TAG_STORAGE,   // フラッシュへの履歴の書き込み
+  HEAP_TAG_CONSOLE,   // シリアルコマンドの処理
+  HEAP_SUBSYSTEM_COUNT // 区分の数
+};
+
+/**
+ * @brief 1つの区分でのヒープ確保の回数とバイト数
+ */
+struct HeapSubsystemUsage
+{
+  uint32_t allocationCount; // malloc/calloc/reallocの回数
+  uint32_t allocationBytes; // 確保を要求したバイト数の合計
+  uint32_t freeCount;       // freeの回数
+};
+
+/**
+ * @brief 定常状態で起きたヒープ確保の記録（受信・描画の処理での確保1回分）
+ */
+struct SteadyStateViolation
+{
+  uint32_t callerAddress; // mallocなどを呼び出した命令のアドレス
+  uint32_t size;          // 要求されたバイト数
+  uint8_t subsystem;      // 処理の区分（HeapSubsystem）
+};
+
+/**
+ * @brief 空きヒープの記録（一定間隔で測った値の最小・最大）
+ * @details 「最大連続ブロック ÷ 空き容量」が小さいほど、空きが細切れになっている（断片化している）ことを示します
+ */
+struct HeapUsageSamples
+{
+  uint32_t sampleCount;           // 記録した回数
+  uint32_t lastFreeBytes;         // 最後に測った空き容量
+  uint32_t lastLargestBlockBytes; // 最後に測った最大連続ブロック
+  uint32_t minimumFreeBytes;      // 記録中で最も少なかった空き容量
+  uint32_t minimumLargestBlockBytes; // 記録中で最も小さかった最大連続ブロック
+  float maximumFragmentation;     // 記録中で最も大きかった断片化率（1 - 最大連続ブロック ÷ 空き容量）
+};
+
+/**
+ * @brief 1件のセンサーデータが画面に映るまでの各時点（タイムスタンプを打つ位置）
+ */
+enum LatencyStamp
+{
+  STAMP_SOCKET_ARRIVAL = 0, // ソケットにデータが届いているのを見つけた時点
+  STAMP_CALLBACK_ENTRY,     // MQTTのコールバックに入った時点
+  STAMP_PARSE_COMPLETE,     // JSONの解析が終わった時点
+  STAMP_STATE_PUBLISHED,    // 現在の値・統計・履歴を更新し終えた時点
+  STAMP_RENDER_START,       // 画面の描画を始めた時点
+  STAMP_DISPLAY_PUSHED,     // 画面への転送が終わった時点
+  LATENCY_STAMP_COUNT       // 時点の数
+};
+
+/**
+ * @brief 遅延を集計する区間（隣り合う時点の差と、全体）
+ */
+enum LatencySegment
+{
+  SEGMENT_SOCKET_TO_CALLBACK = 0, // ソケット → コールバック
+  SEGMENT_CALLBACK_TO_PARSE,      // コールバック → 解析完了
+  SEGMENT_PARSE_TO_STATE,         // 解析完了 → 状態更新
+  SEGMENT_STATE_TO_RENDER,        // 状態更新 → 描画開始
+  SEGMENT_RENDER_TO_PUSH,         // 描画開始 → 転送完了
+  SEGMENT_ARRIVAL_TO_GLASS,       // ソケット → 転送完了（本体内の合計）
+  SEGMENT_PUBLISH_TO_GLASS,       // 送信側の送信時刻 → 転送完了（ネットワークを含む合計）
+  LATENCY_SEGMENT_COUNT           // 区間の数
+};
+
+/**
+ * @brief 処理中の1件のセンサーデータについて、各時点の時刻を記録したもの
+ */
+struct LatencyTrace
+{
+  bool active;                                 // 記録中かどうか
+  uint32_t stampMicros[LATENCY_STAMP_COUNT];   // 各時点のmicros()
+  uint64_t publisherSentMillis;                // 送信側の送信時刻（UNIXミリ秒。sent_msがなければ0）
+};
+
+/**
+ * @brief 画面に表示するページの種類
+ * @details 一定時間ごとに順番に切り替えて表示します
+ */
+enum DisplayPage
+{
+  PAGE_CO2 = 0,      // CO2濃度の大きな表示
+  PAGE_THI,          // 温熱快適性指数の大きな表示
+  PAGE_STATISTICS,   // 今日・直近1時間の統計一覧
+  PAGE_RANKING,      // 複数センサーのうち、CO2・THIが高い部屋のランキング
+  PAGE_DIAGNOSTICS,  // 受信から画面表示までの遅延
+  DISPLAY_PAGE_COUNT // ページ数（切り替え用）
+};
+
+/**
+ * @brief 範囲問い合わせの結果1件分
+ * @details 値は固定小数点の単位のままです（表示側で必要に応じて変換します）
+ */
+struct HistoryQueryPoint
+{
+  unsigned long bucketStartEpoch; // 区間の開始時刻
+  int32_t minimum;                // 区間内の最小値
+  int32_t maximum;                // 区間内の最大値
+  int32_t mean;                   // 区間内の平均値
+  uint16_t sampleCount;           // 区間内のサンプル数
+};
+
+/**
+ * @brief 問い合わせの応答で、結果1件ごとに送る値（この順番でビット列に並べます）
+ */
+enum HistoryQueryField
+{
+  QUERY_FIELD_MEAN = 0,      // 平均値
+  QUERY_FIELD_MINIMUM,       // 最小値
+  QUERY_FIELD_MAXIMUM,       // 最大値
+  QUERY_FIELD_SAMPLE_COUNT,  // サンプル数
+  HISTORY_QUERY_FIELD_COUNT  // 値の数
+};
+
+/**
+ * @brief 問い合わせの応答を圧縮するときの、直前の結果の状態
+ * @details 履歴ログのサンプル（GorillaCodecState）とは値の数も意味も違うため、別に持ちます
+ */
+struct HistoryQueryCodecState
+{
+  unsigned long previousEpoch;                       // 直前の結果の区間の開始時刻
+  long previousInterval;                             // 直前の結果との間隔（秒）
+  int32_t previousFields[HISTORY_QUERY_FIELD_COUNT]; // 直前の結果の各値
+};
+
+/**
+ * @brief 1つのタスクの健全性の記録
+ * @details スタックの「最高水位」は、起動からこれまでにスタックが最も深く使われたときの残り容量です（ESP32ではバイト単位）
+ */
+struct TaskHealthEntry
+{
+  TaskHandle_t handle;          // タスクのハンドル（同じタスクかどうかの判定用）
+  char name[16];                // タスク名
+  uint32_t stackHeadroomBytes;  // スタックの最高水位（残りの最小値、バイト）
+  uint32_t previousRunTime;     // 前回の記録時点での累計CPU時間（実行時間統計のカウンタ値）
+  bool hasPreviousRunTime;      // previousRunTimeが記録済みかどうか
+  float cpuPercent;             // 前回の記録からのCPU使用率（%。分からなければ負の値）
+  uint8_t priority;             // 優先度
+  bool headroomWarned;          // スタックの余裕が少ないことを警告済みかどうか
+};
+
+/**
+ * @brief トレースに記録する処理の種類
+ * @details 名前は TRACE_EVENT_NAMES に同じ順番で並べます（ダンプに名前の一覧も含めるので、ホスト側で番号を覚える必要はありません）
+ */
+enum TraceEventId
+{
+  TRACE_LOOP = 0,      // loop()の1回分（待機時間を除く）
+  TRACE_MQTT_CONNECT,  // MQTTブローカーへの再接続
+  TRACE_MQTT_POLL,     // MQTTクライアントの受信処理（ソケットの読み出し）
+  TRACE_INGEST,        // 受信メッセージの処理（引数はバイト数）
+  TRACE_PARSE,         // JSONの解析
+  TRACE_RENDER,        // 画面全体の描画
+  TRACE_I2C_WRITE,     // Digi-Clock UnitへのI2C書き込み
+  TRACE_NTP_UPDATE,    // NTPの更新（実際に通信するのは一定間隔ごと）
+  TRACE_MQTT_PUBLISH,  // MQTTの送信（引数はバイト数）
+  TRACE_FLASH_WRITE,   // 履歴ページのフラッシュ書き込み
+  TRACE_SERIAL_WRITE,  // ログのシリアル送信（引数はバイト数）
+  TRACE_EVENT_ID_COUNT // 種類の数
+};
+
+/**
+ * @brief トレースの1イベント（開始または終了）
+ */
+struct TraceEvent
+{
+  uint32_t timestampMicros; // micros()の値
+  uint8_t eventId;          // 処理の種類（TraceEventId）
+  uint8_t phase;            // 'B'（開始）または 'E'（終了）
+  uint16_t argument;        // バイト数など、処理ごとの補足の値
+};
+
+/**
+ * @brief 作ったときに開始、スコープを抜けるときに終了を記録する
+ * @details 途中で return する関数でも、終了の記録を忘れずに済みます
+ */
+struct TraceSpan
+{
+  TraceEventId eventId;
+  TraceSpan(TraceEventId id, uint16_t argument = 0);
+  ~TraceSpan();
+};
+
+/**
+ * @brief 画面の下に重ねて表示する通知（トースト）1件分
+ */
+struct ToastNotification
+{
+  char text[TOAST_TEXT_MAX_LENGTH + 1]; // 表示する文字列
+  uint16_t color;                       // 文字と枠の色
+  unsigned long postedMillis;           // 通知を出した時刻（ミリ秒）
+  unsigned long durationMillis;         // 表示しておく時間（ミリ秒）
+};
+
+/**
+ * @brief `bench` コマンドで測る処理の種類
+ * @details 名前は BENCHMARK_NAMES、基準値は benchmark_baseline.h の BENCHMARK_BASELINE_NANOSECONDS に同じ順番で並べます
+ */
+enum BenchmarkCase
+{
+  BENCH_SANITIZE = 0,   // 受信したバイト列から印字可能な文字だけを取り出す
+  BENCH_PARSE,          // JSONの解析
+  BENCH_INGEST,         // 受信処理の前半（重複判定・文字列化・検証・解析）
+  BENCH_FORMAT,         // 表示する値の文字列化（formatScaledDecimal / formatFixedPoint）
+  BENCH_FORMAT_STRING,  // 同じ値の String による文字列化（以前の方法。比べるためだけに測る）
+  BENCH_COMPOSE,        // CO2ページの描画（画面の代わりのスプライトに描く）
+  BENCH_CLOCK,          // 現在時刻の推定と「HH:MM」の組み立て
+  BENCHMARK_CASE_COUNT  // 種類の数
 };
 
 // =================================================================
@@ -64,18 +587,242 @@ PubSubClient mqttCommunicationClient(networkWifiClient);
 // 引数: WiFiクライアントオブジェクト
 
 // --- センサーデータ関連 ---
-SensorDataPacket currentSensorReading = {0, 0.0, 0.0, 0.0, "", 0, false};
+SensorDataPacket currentSensorReading = {0, 0.0, 0.0, 0.0, COMFORT_LEVEL_NONE, "", 0, false, ""};
 // 現在のセンサー読み取り値を保存する変数。初期値はすべてゼロまたは空で、データ無効フラグ
+char ingestMessageBuffer[JSON_MESSAGE_MAX_LENGTH + 1];          // 受信メッセージを文字列にして置く場所（解析中は文字列の中身もここを指す）
+StaticJsonDocument<JSON_PARSING_MEMORY_SIZE> sensorJsonDocument; // センサーデータの解析結果（毎回同じ領域を使い、ヒープ領域を使わない）
+
+// --- 受信キュー関連 ---
+// MQTTのコールバックでは解析して詰めた形で並べるだけにし、登録表・現在の値・履歴・画面への反映は、
+// 受信処理の直後（processIncomingMQTTMessages の最後）にまとめて行います
+PackedSensorRecord ingestQueueRecords[INGEST_QUEUE_CAPACITY]; // 反映待ちのデータ（値だけを詰めて並べる）
+IngestRecordText ingestQueueTexts[INGEST_QUEUE_CAPACITY];     // 同じ位置のデータの文字列
+uint8_t ingestQueueHead = 0;                                  // 次に反映するデータの位置
+uint8_t ingestQueueCount = 0;                                 // 反映待ちの件数
+uint8_t ingestQueueHighWater = 0;                             // 反映待ちが最も多かったときの件数
 
 // --- 表示制御関連 ---
 unsigned long lastDisplayUpdateTime = 0;      // 最後に画面を更新した時刻（ミリ秒）- 定期的な画面更新の管理に使用
 unsigned long lastInteractiveDisplayTime = 0; // 最後にインタラクティブ表示を更新した時刻（ミリ秒）
-bool displayCO2 = true;                       // 表示モード切替用フラグ: trueならCO2濃度表示、falseならTHI（熱快適性指数）表示
+DisplayPage currentDisplayPage = PAGE_CO2;    // 現在表示しているページ（CO2 → THI → 統計 → ランキング の順に切り替え）
+ToastNotification toastNotifications[TOAST_CAPACITY]; // 表示中の通知（古い順に詰めて並べる）
+uint8_t toastCount = 0;                       // 表示中の通知の数
+bool toastRedrawPending = false;              // 通知が増えたので、ページの切り替えを待たずに描き直す
 
 // --- Digi-Clock Unit 関連 ---
 M5UNIT_DIGI_CLOCK digi_clock;   // Digi-Clock Unitを制御するためのオブジェクト
 int last_digiclock_minute = -1; // 最後にDigi-Clockに表示した「分」を記憶する変数（チラツキ防止用）
                                 // -1で初期化することで、最初の更新を確実に行わせます
+I2CBusStatistics digiClockBusStatistics = {}; // Digi-Clock UnitとのI2C通信の記録
+const char *const I2C_RESULT_NAMES[I2C_RESULT_COUNT] = {"ok", "too_long", "addr_nack", "data_nack", "other", "timeout"}; // 出力に使う名前
+
+// --- センサー履歴（リングバッファ）関連 ---
+// 時刻をスロット幅で割った「スロット番号」をリングの位置に対応させることで、
+// 追加も時刻指定の読み出しも配列の添字計算だけ（O(1)）で済むようにしています。
+const size_t HISTORY_SLOT_CAPACITY = HISTORY_RETENTION_SECONDS / HISTORY_SAMPLE_PERIOD_SECONDS; // 保持できるスロット数
+const uint16_t HISTORY_EMPTY_SLOT_MARKER = 0xFFFF;                                             // 空きスロットを示すCO2値
+const unsigned long MINIMUM_VALID_EPOCH_SECONDS = 1672531200;                                  // 2023年1月1日。これ以前の時刻は未同期とみなす
+static_assert(HISTORY_SAMPLE_PERIOD_SECONDS >= 1 && HISTORY_SAMPLE_PERIOD_SECONDS <= 255, "slot offset is stored in one byte");
+static_assert(HISTORY_SLOT_CAPACITY >= 1, "history must hold at least one slot");
+
+CompactHistorySample sensorHistorySlots[HISTORY_SLOT_CAPACITY]; // 履歴本体（起動時に確保済みの固定サイズ配列）
+unsigned long newestHistorySlotNumber = 0;                      // 最も新しいサンプルのスロット番号
+bool sensorHistoryHasSamples = false;                           // 1件でも記録されたかどうか
+
+// --- ダウンサンプリング階層関連 ---
+// 受信のたびに1分・1時間の集計を少しずつ更新しておくことで、長時間のグラフや統計を出すときに
+// 生データを読み直す必要がなくなります。
+DownsampleBucket minuteTierBuckets[MINUTE_TIER_BUCKET_COUNT]; // 1分ごとの集計
+DownsampleBucket hourTierBuckets[HOUR_TIER_BUCKET_COUNT];     // 1時間ごとの集計
+DownsampleTier downsampleTiers[] = {
+    {"1min", 60, MINUTE_TIER_BUCKET_COUNT, minuteTierBuckets, 0, false},
+    {"1hour", 3600, HOUR_TIER_BUCKET_COUNT, hourTierBuckets, 0, false},
+};
+const size_t DOWNSAMPLE_TIER_COUNT = sizeof(downsampleTiers) / sizeof(downsampleTiers[0]);
+
+// --- 履歴のフラッシュ保存関連 ---
+// 履歴は「セグメント」と呼ぶファイルに、固定長のページ単位で追記していきます。
+// RAMのページバッファにサンプルをためてから1ページずつ書き込むため、フラッシュへの書き込み回数を抑えられます。
+// セグメントは通し番号順に使い、上限を超えたら最も古いものを削除します（同じ場所を繰り返し書き換えない）。
+const char *HISTORY_LOG_DIRECTORY = "/history";                 // セグメントファイルを置くフォルダ
+const uint32_t HISTORY_LOG_SEGMENT_MAGIC = 0x47455348;          // "HSEG"
+const uint16_t HISTORY_LOG_PAGE_MAGIC = 0x5048;                 // "HP"
+const uint16_t HISTORY_LOG_FORMAT_VERSION = 2;                  // 保存形式のバージョン（2: 時刻をUNIX時刻で記録。1は日本時間の値だったため読まない）
+const uint8_t HISTORY_LOG_ENCODING_GORILLA = 1;                 // ペイロード：delta-of-delta／差分で圧縮したビット列（0は使わない）
+const size_t HISTORY_LOG_PAGE_PAYLOAD_SIZE = HISTORY_FLASH_PAGE_SIZE - sizeof(HistoryLogPageHeader);
+
+bool historyLogAvailable = false;                             // LittleFSが使えるかどうか
+bool historyLogHasSegments = false;                           // セグメントが1つ以上あるかどうか
+uint32_t historyLogOldestSegment = 0;                         // 最も古いセグメントの通し番号
+uint32_t historyLogNewestSegment = 0;                         // 最も新しい（追記中の）セグメントの通し番号
+size_t historyLogPagesInNewestSegment = 0;                    // 追記中のセグメントに書き込み済みのページ数
+bool historyLogNewestSegmentSealed = false;                   // 追記中のセグメントを閉じて次に進むべきか（末尾が壊れていた場合など）
+bool historyLogRestored = false;                              // 起動後に履歴をRAMへ読み戻したかどうか
+uint8_t historyLogPendingPayload[HISTORY_LOG_PAGE_PAYLOAD_SIZE]; // まだ書き込んでいないサンプル（圧縮済みのビット列）
+BitStreamWriter historyLogPageWriter = {historyLogPendingPayload, HISTORY_LOG_PAGE_PAYLOAD_SIZE * 8, 0}; // ページバッファへの書き込み位置
+GorillaCodecState historyLogEncoderState;                     // ページバッファの圧縮状態
+size_t historyLogPendingCount = 0;                            // ページバッファ内のサンプル数
+unsigned long historyLogPendingFirstEpoch = 0;                // ページバッファの最初のサンプルの時刻
+unsigned long lastHistoryLogFlushTime = 0;                    // 最後にページを書き込んだ時刻（ミリ秒）
+uint32_t historyLogSamplesWritten = 0;                        // フラッシュに書き込んだサンプル数（起動後）
+uint32_t historyLogPagesWritten = 0;                          // 書き込んだページ数（起動後）
+uint32_t historyLogPhysicalBytesWritten = 0;                  // 実際にフラッシュへ書いたバイト数（ヘッダーや余白を含む）
+
+// --- 逐次統計関連 ---
+// 「起動してから」「今日」「直近1時間」の3つの期間について、項目ごとの統計を受信のたびに更新します。
+// 直近1時間は小さな区間（5分など）に分けて持ち、表示するときに合算することで「窓」をずらしています。
+const unsigned long STATISTICS_SUBWINDOW_SECONDS = STATISTICS_RECENT_WINDOW_SECONDS / STATISTICS_RECENT_SUBWINDOW_COUNT;
+static_assert(STATISTICS_SUBWINDOW_SECONDS >= 1, "recent statistics sub-window must be at least one second");
+
+RunningStatistics sinceBootStatistics[HISTORY_METRIC_COUNT];                                  // 起動してからの統計
+RunningStatistics todayStatistics[HISTORY_METRIC_COUNT];                                      // 今日（0時から）の統計
+unsigned long todayStatisticsDayNumber = 0;                                                   // todayStatisticsが何日目のものか
+RunningStatistics recentStatisticsPartials[STATISTICS_RECENT_SUBWINDOW_COUNT][HISTORY_METRIC_COUNT]; // 直近窓の小区間ごとの統計
+unsigned long recentStatisticsPartialNumbers[STATISTICS_RECENT_SUBWINDOW_COUNT];              // 各小区間の番号（古い区間の判定用）
+const char *const HISTORY_METRIC_NAMES[HISTORY_METRIC_COUNT] = {"CO2", "THI", "Temp", "Hum"}; // 表示用の項目名
+
+// --- 履歴問い合わせ（MQTT）関連 ---
+// 応答チャンクの形式（リトルエンディアン）:
+//   [0] 'H'  [1] 形式バージョン  [2-3] 問い合わせ番号  [4-5] チャンク番号  [6] フラグ  [7] 項目
+//   [8] 件数  [9-12] 区間幅（秒）  [13-16] 先頭の区間の開始時刻  [17-] 圧縮したビット列
+// ビット列は1件ごとに「時刻の delta-of-delta、平均・最小・最大・件数の前回との差」を、
+// 履歴ログと同じ長さ可変の符号で並べたものです。チャンクの最初の1件は、時刻は「1区間前に区間幅の間隔で
+// 結果があった」とした場合との差、値は0との差です。解読は tools/decode_history_response.py を参照。
+const uint8_t HISTORY_RESPONSE_MAGIC = 'H';
+const uint8_t HISTORY_RESPONSE_VERSION = 2;
+const size_t HISTORY_RESPONSE_HEADER_SIZE = 17;
+const size_t HISTORY_QUERY_MAX_BITS_PER_POINT = (4 + 32) + HISTORY_QUERY_FIELD_COUNT * (4 + 17); // 結果1件の最大ビット数（最悪の場合）
+const uint8_t HISTORY_RESPONSE_FLAG_LAST = 0x01;  // 最後のチャンク
+const uint8_t HISTORY_RESPONSE_FLAG_ERROR = 0x02; // 問い合わせを処理できなかった（内容不正・応答中など）
+const char *const HISTORY_METRIC_KEYS[HISTORY_METRIC_COUNT] = {"co2", "thi", "temperature", "humidity"}; // 問い合わせで使う項目名
+
+HistoryQueryPoint historyQueryResults[HISTORY_QUERY_MAX_POINTS];                 // 問い合わせ結果（送信し終わるまで保持）
+HistoryQuerySession historyQuerySession = {false, 0, METRIC_CO2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}; // 応答中の状態
+PendingHistoryQueryError pendingHistoryQueryError = {HISTORY_QUERY_ERROR_NONE, 0};               // 送信待ちのエラー応答
+const char *const HISTORY_QUERY_ERROR_REASON_NAMES[HISTORY_QUERY_ERROR_REASON_COUNT] = {"none", "invalid_json", "busy",
+                                                                                        "invalid_range"}; // ログに出す理由の名前
+
+// --- CO2予測関連 ---
+TrendForecaster co2Forecaster = {false, 0.0f, 0.0f, 0, 0, 0.0f, 0};   // 受信データで更新するCO2の予測器
+const float FORECAST_REPLAY_HORIZON_MINUTES[] = {5.0f, 15.0f, 30.0f}; // 履歴で精度を検証する予測の先読み時間（分）
+
+// --- データ鮮度関連 ---
+SensorFreshnessTracker currentSensorFreshness; // 受信中のセンサーの鮮度（setupで初期化）
+
+// --- 複数センサー関連 ---
+SensorRegistryEntry sensorRegistry[SENSOR_REGISTRY_CAPACITY];             // センサー登録表（IDのハッシュ値で位置を決める）
+size_t sensorRegistryCount = 0;                                           // 登録済みのセンサー数
+uint32_t sensorRegistryRejectedCount = 0;                                 // 登録表が満杯で記録できなかったメッセージ数
+uint32_t sensorRegistryProbeTotal = 0;                                    // 探索した位置の数の合計（平均探索長の確認用）
+uint32_t sensorRegistryLookupCount = 0;                                   // 探索の回数
+WorstSensorHeap worstSensorHeaps[] = {{METRIC_CO2, {0}, 0}, {METRIC_THI, {0}, 0}}; // CO2とTHIのランキング
+char primarySensorId[SENSOR_ID_MAX_LENGTH + 1] = "";                      // 大きく表示・履歴に記録するセンサーのID
+bool primarySensorChosen = false;                                         // primarySensorIdが決まっているかどうか
+const size_t WORST_SENSOR_HEAP_COUNT = sizeof(worstSensorHeaps) / sizeof(worstSensorHeaps[0]);
+
+// --- ループ処理時間計測関連 ---
+Log2Histogram loopStageProfiles[LOOP_STAGE_COUNT]; // ステージごとの処理時間（CPUサイクル数）の集計（静的領域に確保）
+const char *const LOOP_STAGE_NAMES[LOOP_STAGE_COUNT] = {"mqtt_conn", "mqtt_msg", "display", "ntp", "digiclock",
+                                                        "serial", "hist_flush", "freshness", "heap", "metrics", "hist_query", "log_drain", "loop_total"}; // 表示用のステージ名
+
+// --- 表示遅延計測関連 ---
+LatencyTrace currentLatencyTrace = {false, {0}, 0};             // 処理中のセンサーデータの各時点
+uint32_t socketArrivalMicros = 0;                               // ソケットにデータを見つけた時刻（0なら未検出）
+Log2Histogram latencySegmentHistograms[LATENCY_SEGMENT_COUNT];  // 区間ごとの遅延（マイクロ秒）の集計
+const char *const LATENCY_SEGMENT_NAMES[LATENCY_SEGMENT_COUNT] = {"sock>cb", "cb>parse", "parse>state", "state>draw",
+                                                                  "draw>push", "arrive>lcd", "publish>lcd"}; // 表示用の区間名
+unsigned long lastObservedEpochSecond = 0;                      // 最後に見たNTP時刻（秒）
+unsigned long epochSecondStartMillis = 0;                       // その秒に切り替わったときのmillis()（ミリ秒単位の時刻の推定用）
+
+// --- ヒープ使用量追跡関連 ---
+volatile HeapSubsystem currentHeapSubsystem = HEAP_TAG_OTHER;   // loopタスクで今実行している処理の区分
+TaskHandle_t loopTaskHandle = NULL;                             // loopタスク（他のタスクの確保は「その他」に数える）
+HeapSubsystemUsage heapSubsystemUsage[HEAP_SUBSYSTEM_COUNT];    // 区分ごとの確保の回数とバイト数
+HeapUsageSamples heapUsageSamples = {0, 0, 0, UINT32_MAX, UINT32_MAX, 0.0f}; // 空きヒープの記録
+unsigned long lastHeapSampleTime = 0;                           // 最後に空きヒープを測った時刻
+uint32_t mqttMessagesReceivedCount = 0;                         // 受信したMQTTメッセージの数（1件あたりの確保回数の計算用）
+const char *const HEAP_SUBSYSTEM_NAMES[HEAP_SUBSYSTEM_COUNT] = {"other", "ingest", "render", "network", "storage", "console"}; // 表示用の区分名
+// 定常状態で確保してはいけない区分（受信・描画）。通信（lwIPやWiFiUDPがパケットごとに確保）、保存（LittleFSがファイルを開くたびに確保）、
+// コマンド（必要なときだけ実行する診断）は、ライブラリの中や定常的でない処理なので数えるだけにします
+const bool STEADY_STATE_STRICT_SUBSYSTEMS[HEAP_SUBSYSTEM_COUNT] = {false, true, true, false, false, false};
+const size_t STEADY_STATE_VIOLATION_RECORD_COUNT = 8;           // 呼び出し元を覚えておく件数（直近のもの）
+bool steadyStateGuardArmed = false;                             // 定常状態の監視中かどうか
+unsigned long steadyStateWarmupStartTime = 0;                   // 監視の準備を始めた時刻（起動完了・MQTT再接続のとき）
+uint32_t steadyStateWarmupMessageCount = 0;                     // 準備を始めた時点の受信数（その後1件以上受信してから監視を始める）
+uint32_t steadyStateViolationCount = 0;                         // 監視中に受信・描画の処理で確保した回数
+uint32_t steadyStateReportedViolationCount = 0;                 // そのうちログに出した回数
+SteadyStateViolation steadyStateViolations[STEADY_STATE_VIOLATION_RECORD_COUNT]; // 直近の確保の記録
+
+// --- 自己診断メトリクス関連 ---
+// フレームの形式（リトルエンディアン、形式バージョン1）は tools/decode_metrics_frame.py を参照
+const uint8_t METRICS_FRAME_MAGIC = 'M';
+const uint8_t METRICS_FRAME_VERSION = 1;
+const uint8_t METRICS_FLAG_TIME_SYNCED = 0x01;    // NTP時刻が同期済み
+const uint8_t METRICS_FLAG_HEAP_HOOKS = 0x02;     // ヒープ確保の区分ごとの計数が有効
+const size_t METRICS_FRAME_MAX_SIZE = 73 + 2 * LOOP_STAGE_COUNT; // フレームのバイト数（固定部73バイト + ステージ数 × 2バイト）
+char metricsTopic[64] = "";                       // 送信先のトピック（初回送信時にMACアドレスから作る）
+uint16_t metricsFrameSequence = 0;                // 送信したフレームの通し番号
+unsigned long lastMetricsPublishTime = 0;         // 最後にメトリクスを送信した時刻
+Log2Histogram metricsWindowLoopCycles;            // 前回の送信以降のループ処理時間（CPUサイクル数）
+uint64_t metricsWindowStageCycles[LOOP_STAGE_COUNT]; // 前回の送信時点での、各ステージのサイクル数の合計
+uint32_t metricsWindowStageCounts[LOOP_STAGE_COUNT]; // 前回の送信時点での、各ステージの記録回数
+uint32_t mqttReconnectCount = 0;                  // MQTTの再接続を試みた回数
+uint32_t sensorDataRejectedCount = 0;             // JSONが不正、または解析に失敗したメッセージの数
+long lastNtpCorrectionSeconds = 0;                // 最後のNTP同期で時刻が修正された量（秒）
+
+// --- ログ出力関連 ---
+// 書き込むのは loop タスク、シリアルへ送るのも loop の空き時間だけなので、読み書きの位置はそれぞれ片側だけが進める
+char logRingBuffer[LOG_BUFFER_SIZE];     // シリアルへ送る前のログ（静的領域に確保）
+size_t logWritePosition = 0;             // 次に書き込む位置（書き込む側だけが進める）
+size_t logReadPosition = 0;              // 次にシリアルへ送る位置（送る側だけが進める）
+size_t logBufferHighWater = 0;           // バッファに同時にたまった最大バイト数
+uint32_t logWrittenLineCount = 0;        // バッファに書き込んだ行の数
+uint32_t logDroppedLineCount = 0;        // バッファがいっぱいで捨てた行の数
+uint32_t logUnreportedDroppedLines = 0;  // 捨てたことをまだログに書けていない行の数
+unsigned long logPayloadDumpCounter = 0; // 内容をログに出すかどうかを決めるための、受信メッセージの通し番号
+// バイナリ形式のログ1件：目印(0xF5) + レベル(1) + 書式のID(4、リトルエンディアン) + 引数のバイト数(1) + 引数
+// 0xF5 はUTF-8の文章には決して現れないので、起動メッセージなど普通の文章と同じシリアルに混ぜて送れます
+const uint8_t LOG_RECORD_MARKER = 0xF5;
+const size_t LOG_RECORD_HEADER_SIZE = 7;
+
+// --- タスクの健全性監視関連 ---
+TaskHealthEntry taskHealthEntries[TASK_MONITOR_MAX_TASKS]; // タスクごとの記録（loopタスクが先頭）
+size_t taskHealthCount = 0;                                // 記録しているタスク数
+uint32_t taskHealthSampleCount = 0;                        // 記録した回数
+unsigned long lastTaskMonitorTime = 0;                     // 最後に記録した時刻
+uint32_t lastTaskMonitorTotalRunTime = 0;                  // 前回の記録時点での全体の実行時間（実行時間統計のカウンタ値）
+uint64_t lastTaskMonitorLoopCycles = 0;                    // 前回の記録時点での、loop処理の累計CPUサイクル数
+unsigned long lastTaskMonitorMicros = 0;                   // 前回の記録時点でのmicros()
+float loopTaskBusyPercent = -1.0f;                         // loop処理がCPUを使っていた割合（%。ループ処理時間の計測から求める）
+#if configUSE_TRACE_FACILITY
+TaskStatus_t taskStatusSnapshot[TASK_MONITOR_MAX_TASKS];   // uxTaskGetSystemStateの結果の受け取り用（静的領域に確保）
+#endif
+
+// --- イベントトレース関連 ---
+TraceEvent traceEvents[TRACE_BUFFER_EVENT_COUNT]; // 直近のイベント（古いものから上書き、静的領域に確保）
+size_t traceNextIndex = 0;                        // 次に書き込む位置
+size_t traceEventCount = 0;                       // 記録中のイベント数
+uint32_t traceOverwrittenCount = 0;               // 上書きして失ったイベント数（前回のダンプから）
+bool traceFrozen = false;                         // 長いループを見つけて記録を止めているかどうか
+bool traceIgnoreSlowLoop = false;                 // 今回のループはコマンドの実行で長くなったので、止める判定をしない
+const char *const TRACE_EVENT_NAMES[TRACE_EVENT_ID_COUNT] = {"loop", "mqtt_connect", "mqtt_poll", "ingest", "parse", "render",
+                                                             "i2c_write", "ntp_update", "mqtt_publish", "flash_write", "serial_write"}; // ダンプに含める名前
+// ダンプの形式（リトルエンディアン）は tools/trace_to_chrome.py を参照
+const char TRACE_DUMP_MAGIC[4] = {'T', 'R', 'C', '1'};
+
+// --- ベンチマーク関連 ---
+const char *const BENCHMARK_NAMES[BENCHMARK_CASE_COUNT] = {"sanitize", "parse", "ingest", "format", "format_string", "compose", "clock"}; // 出力に使う名前
+const uint16_t BENCHMARK_ITERATIONS[BENCHMARK_CASE_COUNT] = {500, 200, 200, 500, 500, 10, 1000}; // 1回の計測で繰り返す回数（1回が数ミリ秒～数十ミリ秒になるように）
+const char BENCHMARK_SAMPLE_PAYLOAD[] =
+    "{\"sensor_id\":\"living\",\"timestamp\":1720000000,\"co2\":812,\"thi\":72.4,"
+    "\"temperature\":25.3,\"humidity\":58.1,\"comfort_level\":\"Comfortable\"}"; // 実際に届くものと同じ形のメッセージ
+static_assert(sizeof(BENCHMARK_BASELINE_NANOSECONDS) / sizeof(BENCHMARK_BASELINE_NANOSECONDS[0]) == BENCHMARK_CASE_COUNT,
+              "BENCHMARK_BASELINE_NANOSECONDS must have one entry per benchmark case");
+volatile uint32_t benchmarkSink = 0; // 測る処理の結果をここに足し込み、最適化で処理ごと消されないようにする
+
+// --- シリアルコンソール関連 ---
+char serialCommandBuffer[32];      // シリアルから受け取り中のコマンド文字列
+size_t serialCommandLength = 0;    // 受け取り済みの文字数
 
 // =================================================================
 // 4. 関数の前方宣言
@@ -94,14 +841,30 @@ void refreshEntireDisplay();                                 // 画面全体を
 void updateDisplayIfIntervalElapsed();                       // 一定時間経過後に画面を更新
 void displayApplicationTitle();                              // アプリケーションのタイトルを表示
 void displayCurrentSystemTime();                             // 現在のシステム時刻を表示
+void formatCurrentClockTime(char *buffer, size_t bufferSize); // 現在の時刻を「HH:MM:SS」の文字列にする
 void displaySensorDataOrErrorMessage();                      // センサーデータまたはエラーメッセージを表示
 void displayCO2ConcentrationData();                          // CO2濃度データを表示
 void displayTHIComfortData();                                // 温熱快適性指数を表示
+void displayStatisticsPage();                                // 統計ページを表示
+void displayCurrentSensorPage();                             // 現在のページのセンサーデータを表示
 void displayNoDataAvailableMessage();                        // データがない時のメッセージを表示
 void displayNetworkConnectionStatus();                       // ネットワーク接続状態を表示
 void displayJSONParsingError(const char *errorDescription);  // JSONパースエラーを表示
 void showConnectionStatusMessage(const char *statusMessage); // 接続状態メッセージを表示
 void clearDisplayScreenWithColor(uint16_t backgroundColor);  // 画面を指定色でクリア
+void postToastNotification(const char *text, uint16_t color, unsigned long durationMillis); // 画面の下に重ねる通知を追加
+bool removeExpiredToastNotifications();                      // 表示時間が過ぎた通知を消す
+void updateToastNotifications();                             // 通知が増えた・消えたときに画面を描き直す
+void drawToastNotifications();                               // 表示中の通知を画面の下に重ねて描く
+
+// 数値の文字列化関連の関数
+template <uint8_t FractionDigits>
+size_t formatScaledDecimal(char *buffer, size_t bufferSize, int32_t scaledValue); // 10^FractionDigits 倍した整数を、小数点付きの文字列にする
+template <uint8_t FractionDigits>
+size_t formatFixedPoint(char *buffer, size_t bufferSize, float value); // 小数を、決まった桁数で四捨五入した文字列にする
+template <uint8_t FractionDigits>
+void printFixedPointColumn(float value, int width);                    // 小数を決まった桁数で、右寄せにして画面に書く
+bool verifyNumericFormattingRoundTrip(uint32_t &checkedCount);         // 文字列にして読み戻した値が元の値と一致するかを確かめる
 
 // WiFi関連の関数
 void establishWiFiConnection();   // WiFi接続を確立
@@ -119,10 +882,12 @@ String generateUniqueMQTTClientId();
 bool attemptMQTTBrokerConnection(const String &clientIdentifier);                                  // MQTTブローカー接続を試みる
 void subscribeToMQTTDataTopic();                                                                   // MQTTトピックをサブスクライブ
 void handleIncomingMQTTMessage(char *topicName, byte *messagePayload, unsigned int messageLength); // 受信したMQTTメッセージを処理
-bool validateJSONDataIntegrity(const String &jsonData);                                            // JSONデータの整合性を検証
-String convertRawPayloadToString(byte *rawPayload, unsigned int payloadLength);                    // 生のペイロードを文字列に変換
-SensorDataPacket parseJSONSensorData(const String &jsonString);                                    // JSONからセンサーデータを解析
-void updateCurrentSensorData(const SensorDataPacket &newSensorData);                               // 現在のセンサーデータを更新
+bool parseJSONSensorRecord(char *jsonText, PackedSensorRecord &record, IngestRecordText &text);   // JSONからセンサーデータを解析し、詰めた形にする
+void enqueueSensorRecord(const PackedSensorRecord &record, const IngestRecordText &text);          // 解析したデータを受信キューに入れる
+void drainIngestQueue();                                                                           // 受信キューのデータを順に反映する
+void applySensorRecord(const PackedSensorRecord &record, const IngestRecordText &text);            // 1件のデータを登録表・現在の値・履歴・画面に反映する
+const char *getComfortLevelText(const SensorDataPacket &sensorData);                               // 快適レベルをログなどに出す文字列にする
+void updateCurrentSensorData(const SensorDataPacket &newSensorData, const PackedSensorRecord &record); // 現在のセンサーデータを更新
 void maintainMQTTBrokerConnection();                                                               // MQTT接続を維持
 void processIncomingMQTTMessages();                                                                // 受信したMQTTメッセージを処理
 void printMQTTSubscriptionDebugInfo();                                                             // MQTTサブスクリプションのデバッグ情報を表示
@@ -130,6 +895,169 @@ void printMQTTSubscriptionDebugInfo();
 // Digi-Clock Unit関連の関数
 void initializeDigiClock();    // Digi-Clock Unitを初期化
 void updateDigiClockDisplay(); // Digi-Clock Unitの表示を更新
+void writeDigiClockString(const char *text);                           // 表示する文字列を書き込み、通信を記録する
+void writeDigiClockBrightness(uint8_t brightness);                     // 明るさを書き込み、通信を記録する
+void recordDigiClockTransaction(uint32_t startMicros, size_t payloadByteCount); // 応答を確認し、書き込みと確認の時間・確認の結果を記録する
+uint8_t probeDigiClockBus();                                           // アドレスだけを送り、ユニットが応答するか確かめる
+void printI2CBusReport();                                              // I2C通信の記録をシリアルに出力
+
+// センサー履歴（リングバッファ）関連の関数
+void initializeSensorHistory();                                                                  // 履歴バッファを空の状態に初期化
+void recordSensorHistorySample(const PackedSensorRecord &record, unsigned long epochSeconds);   // 1件のサンプルを履歴に追加
+bool findSensorHistorySample(unsigned long epochSeconds, CompactHistorySample &foundSample);     // 指定時刻のサンプルを取得
+CompactHistorySample compressPackedSensorRecord(const PackedSensorRecord &record, uint8_t offset); // 詰めた形のデータを圧縮サンプルに変換
+bool storeCompactHistorySample(const CompactHistorySample &sample, unsigned long epochSeconds);  // 圧縮サンプルをRAMの履歴と集計階層に格納
+
+// 履歴のフラッシュ保存関連の関数
+void initializeHistoryLog();                                                                     // LittleFSを準備し、既存セグメントの末尾を探す
+void restoreHistoryFromLog();                                                                    // 保持期間分の履歴をフラッシュからRAMへ読み戻す
+void appendHistoryLogSample(const CompactHistorySample &sample, unsigned long epochSeconds);    // サンプルをページバッファに追加
+void flushHistoryLogPage();                                                                      // ページバッファをフラッシュに書き込む
+void flushHistoryLogIfIntervalElapsed();                                                         // 一定時間ごとにページバッファを書き込む
+bool openNextHistoryLogSegment(File &segmentFile, unsigned long firstEpoch);                      // 新しいセグメントファイルを作成する
+bool readHistoryLogSegmentHeader(uint32_t sequenceNumber, HistoryLogSegmentHeader &header, size_t &fileSize); // セグメントのヘッダーを読む
+bool verifyHistoryLogPage(const uint8_t *pageData);                                              // ページのCRCを検証する
+size_t replayHistoryLogPage(const uint8_t *pageData, unsigned long minimumEpoch);                // ページ内のサンプルをRAMの履歴へ戻す
+void buildHistoryLogSegmentPath(uint32_t sequenceNumber, char *pathBuffer, size_t bufferSize);   // セグメントのファイル名を作る
+void printHistoryLogStatus();                                                                    // 保存状況と書き込み増幅率をシリアルに出力
+uint32_t calculateCRC32(const uint8_t *data, size_t length, uint32_t crc = 0);                   // CRC32を計算する
+
+// 時系列圧縮（Gorilla方式）関連の関数
+void runHistoryCodecBenchmark();                                                                                  // 記録済みの履歴で圧縮率と速度を測る
+
+// ダウンサンプリング階層関連の関数
+void initializeDownsampleTiers();                                                                               // 全階層を空の状態に初期化
+void updateDownsampleTiers(const CompactHistorySample &sample, unsigned long epochSeconds);                      // 全階層に1件のサンプルを反映
+void resetDownsampleBucket(DownsampleBucket &bucket);                                                           // 区間データを空にする
+size_t queryHistoryRange(HistoryMetric metric, unsigned long fromEpoch, unsigned long toEpoch,
+                         HistoryQueryPoint *resultPoints, size_t maxPoints,
+                         unsigned long *selectedBucketSeconds = NULL);                                          // 指定範囲の履歴を問い合わせる
+
+// 逐次統計関連の関数
+void resetRunningStatistics(RunningStatistics *statistics);                                         // 全項目の統計を空にする
+void addRunningStatisticsSample(RunningStatistics &statistics, float value);                        // 1つの値を統計に加える（Welford法）
+void mergeRunningStatistics(RunningStatistics &target, const RunningStatistics &source);            // 2つの統計を合算する
+void updateRunningStatistics(const SensorDataPacket &sensorData);                                   // 受信データを全期間の統計に反映
+void collectRecentStatistics(RunningStatistics *mergedStatistics);                                  // 直近窓の小区間を合算する
+float getSensorPacketMetric(const SensorDataPacket &sensorData, HistoryMetric metric);              // センサーデータから指定項目の値を取り出す
+float calculateStandardDeviation(const RunningStatistics &statistics);                              // 標準偏差を求める
+void printRunningStatistics();                                                                      // 統計をシリアルに出力
+
+// 履歴問い合わせ（MQTT）関連の関数
+void handleHistoryQueryRequest(char *requestJson);                                  // 履歴の問い合わせを受け付ける
+void continueHistoryQueryResponse();                                                // 応答チャンクを1つ送る
+bool publishHistoryResponseChunk(uint8_t flags);                                    // 応答チャンクを組み立てて送信する
+void latchHistoryQueryError(uint16_t requestId, HistoryQueryErrorReason reason);   // エラー応答を送信待ちにする
+bool publishHistoryQueryError(uint16_t requestId);                                  // 問い合わせを処理できなかったことを返す
+void encodeHistoryQueryPoint(BitStreamWriter &writer, HistoryQueryCodecState &state,
+                             const HistoryQueryPoint &point);                       // 結果1件を圧縮して書き込む
+void recordHistoryQueryLoopLatency(unsigned long loopMicros);                       // 応答中のループ処理時間を記録する
+
+// CO2予測関連の関数
+void updateTrendForecaster(TrendForecaster &forecaster, float value, unsigned long timestampSeconds); // 新しい値で予測器を更新
+float forecastTrendValue(const TrendForecaster &forecaster, float minutesAhead);                     // 指定した分数先の値を予測
+bool estimateMinutesToThreshold(const TrendForecaster &forecaster, float threshold, float &minutes);  // しきい値に達するまでの分数を見積もる
+void displayCO2ForecastSummary();                                                                    // CO2表示の横に予測を表示
+void printCO2ForecastReport();                                                                       // 予測の状態と履歴での精度をシリアルに出力
+
+// データ鮮度関連の関数
+void resetSensorFreshness(SensorFreshnessTracker &tracker);                                                  // 鮮度の追跡を初期化
+void recordSensorArrival(SensorFreshnessTracker &tracker, unsigned long publisherTimestamp,
+                         unsigned long arrivalMillis);                                                       // データの到着を記録
+bool updateSensorStaleness(SensorFreshnessTracker &tracker, unsigned long nowMillis);                       // 古くなったかを判定
+void checkSensorDataFreshness();                                                                             // 表示中のデータが古くなったら画面に反映
+void displaySensorFreshnessMarker();                                                                         // 古いデータであることを画面に表示
+void printSensorFreshnessReport();                                                                           // 鮮度の統計をシリアルに出力
+
+// 複数センサー関連の関数
+uint32_t calculateFNV1aHash(const char *text);                                             // 文字列のハッシュ値を求める（FNV-1a）
+int findSensorRegistryEntry(const char *sensorId);                                         // 登録済みのセンサーの位置を探す（登録はしない）
+int findOrInsertSensorRegistryEntry(const char *sensorId);                                 // センサーの登録位置を探す（なければ登録）
+void updateSensorRegistry(const SensorDataPacket &sensorData);                             // 受信データで登録表とランキングを更新
+void updateWorstSensorHeap(WorstSensorHeap &heap, uint16_t entryIndex);                    // 1センサー分の値の変化をランキングに反映
+void siftWorstSensorHeapUp(WorstSensorHeap &heap, uint8_t position);                       // ヒープ内で根の方向へ移動
+void siftWorstSensorHeapDown(WorstSensorHeap &heap, uint8_t position);                     // ヒープ内で葉の方向へ移動
+void swapWorstSensorHeapItems(WorstSensorHeap &heap, uint8_t first, uint8_t second);       // ヒープ内の2件を入れ替える
+size_t collectWorstSensorRanking(const WorstSensorHeap &heap, uint16_t *rankedIndexes);    // ランキングを値の高い順に取り出す
+bool isPrimarySensor(const SensorDataPacket &sensorData);                                  // 大きく表示するセンサーのデータかどうか
+void displaySensorRankingPage();                                                           // ランキングページを表示
+void printSensorRegistryReport();                                                          // 登録表とランキングをシリアルに出力
+
+// 重複・順序入れ替わり判定関連の関数
+SequenceCheckResult checkSensorPayloadSequence(const byte *payload, unsigned int length);   // 生のペイロードから重複・古いデータを判定
+
+// 表示遅延計測関連の関数
+void beginLatencyTrace(const byte *payload, unsigned int length); // コールバックに入った時点から記録を始める
+void stampLatencyTrace(LatencyStamp stamp);                       // 記録中なら、現在時刻を指定の時点として記録
+void cancelLatencyTrace();                                        // 画面に反映しないデータの記録をやめる
+void completeLatencyTrace();                                      // 転送完了を記録し、区間ごとに集計する
+void trackEpochSecondBoundary();                                  // NTP時刻の秒の切り替わりを記録
+uint64_t getCurrentEpochMillis();                                 // 現在のUNIX時刻をミリ秒で推定
+void displayDiagnosticsPage();                                    // 遅延の診断ページを表示
+void printLatencyReport();                                        // 遅延の集計をシリアルに出力
+
+// 自己診断メトリクス関連の関数
+void publishMetricsIfIntervalElapsed();                                             // 一定時間ごとにメトリクスを送信
+size_t buildMetricsFrame(uint8_t *frame, unsigned long intervalMillis);             // メトリクスのフレームを組み立てる
+void writeLittleEndian(uint8_t *buffer, size_t &offset, uint32_t value, size_t byteCount); // 値をリトルエンディアンで書き込む
+
+// ヒープ使用量追跡関連の関数
+HeapSubsystem setHeapSubsystem(HeapSubsystem subsystem);           // これから実行する処理の区分を設定し、前の区分を返す
+void recordHeapAllocation(size_t size, void *returnAddress);       // ヒープ確保を現在の区分に数える（定常状態なら呼び出し元も記録）
+void recordHeapRelease();                                          // ヒープ解放を現在の区分に数える
+void sampleHeapUsageIfIntervalElapsed();                           // 一定時間ごとに空きヒープを記録
+void printHeapUsageReport();                                       // ヒープの記録をシリアルに出力
+void resetHeapUsageTracking();                                     // ヒープの記録を空にする
+void recordSteadyStateViolation(HeapSubsystem subsystem, size_t size, void *returnAddress); // 定常状態での確保を記録する
+void beginSteadyStateWarmup();                                     // 定常状態の監視をいったん止め、準備期間を始める
+void armSteadyStateGuardIfWarmedUp();                              // 準備期間が終わっていれば監視を始める
+void reportSteadyStateViolations();                                // 定常状態での確保を、呼び出し元のアドレス付きでログに出す
+void runSteadyStateReplay();                                       // 受信メッセージを流し、準備期間の後のヒープ確保が0回かを確かめる
+
+// ループ処理時間計測関連の関数
+void addLog2HistogramSample(Log2Histogram &histogram, uint32_t value);          // 対数ヒストグラムに1件加える
+uint32_t estimateLog2HistogramPercentile(const Log2Histogram &histogram, float fraction); // 指定した割合の値を区間の上限で見積もる
+uint32_t recordLoopStageCycles(LoopStage stage, uint32_t stageStartCycles); // ステージの処理時間を記録し、現在のサイクル数を返す
+void resetLoopStageProfiles();                                             // 処理時間の集計を空にする
+void printLoopStageProfiles();                                             // 処理時間のヒストグラムをシリアルに出力
+
+// ログ出力関連の関数
+void logPrintf(const char *format, ...) __attribute__((format(printf, 1, 2))); // ログを1行バッファに書き込む（シリアルへは後で送る）
+void logPayloadSample(const byte *payload, unsigned int length); // 受信メッセージの内容を、間引いて先頭だけログに出す
+template <typename... Arguments>
+void writeTokenizedLogRecord(uint8_t level, uint32_t token, Arguments... arguments); // バイナリ形式のログを1件バッファに書き込む
+bool enqueueLogLine(const char *line, size_t length);            // 1件分のログを書き込み、書き込めなければ捨てた数を数える
+bool enqueueLogBytes(const char *text, size_t length);           // バッファに空きがあれば書き込む
+size_t getLogBufferedBytes();                                     // まだ送っていないログのバイト数
+void drainLogBuffer();                                            // シリアルが待たずに受け取れる分だけ送る
+void flushLogBuffer();                                            // たまっているログをすべて送り終えるまで待つ
+void printLogStatus();                                            // ログバッファの状態をシリアルに出力
+
+// タスクの健全性監視関連の関数
+void sampleTaskHealthIfIntervalElapsed();                                           // 一定時間ごとに各タスクのスタックの余裕とCPU時間を記録
+TaskHealthEntry &updateTaskHealthEntry(size_t index, TaskHandle_t handle, const char *name, uint32_t headroomBytes,
+                                       uint8_t priority, const TaskHealthEntry *previousEntries, size_t previousCount); // 1タスク分の記録を更新
+void updateTaskCpuTime(TaskHealthEntry &entry, uint32_t runTimeCounter, uint32_t totalRunTimeDelta); // 前回からのCPU使用率を求める
+const TaskHealthEntry *findLowestStackHeadroomTask();                               // スタックの余裕が最も少ないタスクを探す
+void printTaskHealthReport();                                                       // タスクごとの記録をシリアルに出力
+
+// イベントトレース関連の関数
+void recordTraceEvent(TraceEventId eventId, uint8_t phase, uint16_t argument); // イベントを1件記録する
+void traceBegin(TraceEventId eventId, uint16_t argument = 0);                   // 処理の開始を記録する
+void traceEnd(TraceEventId eventId, uint16_t argument = 0);                     // 処理の終了を記録する
+void freezeTraceOnSlowLoop(unsigned long loopMicros);                           // 長いループのあとで記録を止める
+void dumpTraceBuffer();                                                         // 記録をバイナリでシリアルに出力し、記録を再開する
+
+// ベンチマーク関連の関数
+void runBenchmarkSuite();                                                        // 主な処理の速さを測り、基準値と比べてJSONで出力する
+uint32_t runBenchmarkCase(BenchmarkCase benchmarkCase, uint32_t iterations, M5Canvas &canvas); // 1種類の処理を繰り返し、かかったCPUサイクル数を返す
+void composeCO2PageOnCanvas(M5Canvas &canvas, int carbonDioxideLevel, const char *timeText); // CO2ページと同じ内容をスプライトに描く
+
+// シリアルコンソール関連の関数
+void processSerialConsoleCommands();                   // シリアルから届いたコマンドを受け付ける
+void executeSerialConsoleCommand(const char *command); // 1行分のコマンドを実行する
+bool isSystemTimeSynchronized();                                                                 // NTP時刻が有効かどうかを判定
+unsigned long getCurrentUnixEpochSeconds();                                                      // 現在のUNIX時刻（協定世界時）を秒で取得
 
 // =================================================================
 // 5. メインの初期化関数 (setup)
@@ -146,6 +1074,31 @@ void setup()
   Serial.begin(115200);
   Serial.println("\n========== M5StickCPlus2 & Digi-Clock Monitor 起動 ==========");
 
+  // ヒープ確保の区分けは、このタスク（loopを実行するタスク）についてだけ行う
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+
+  // 履歴バッファと集計階層を空の状態にしておく（メモリは固定サイズで確保済み）
+  initializeSensorHistory();
+  resetSensorFreshness(currentSensorFreshness);
+  Serial.printf("🏠 Sensor registry ready: %u slots, top %u ranking\n", (unsigned int)SENSOR_REGISTRY_CAPACITY,
+                (unsigned int)WORST_SENSOR_RANK_COUNT);
+  initializeDownsampleTiers();
+
+  // 快適レベルの言葉を番号に変換するための表を作る
+  initializeComfortLevelTable();
+
+  // フラッシュに保存された履歴ログを確認する（読み戻しは時刻同期の後で行う）
+  initializeHistoryLog();
+
+  // 逐次統計を空の状態にしておく
+  resetRunningStatistics(sinceBootStatistics);
+  resetRunningStatistics(todayStatistics);
+  for (size_t i = 0; i < STATISTICS_RECENT_SUBWINDOW_COUNT; i++)
+  {
+    resetRunningStatistics(recentStatisticsPartials[i]);
+    recentStatisticsPartialNumbers[i] = 0;
+  }
+
   // Step 1: M5StickCPlus2本体のディスプレイを初期化
   // ディスプレイに何かを表示するには、まず初期化が必要です
   initializeDisplaySystem();
@@ -168,10 +1121,19 @@ void setup()
   configureMQTTConnection();
   establishMQTTBrokerConnection();
 
+  // 時刻が分かったので、フラッシュに保存されていた直近の履歴をRAMへ読み戻す
+  restoreHistoryFromLog();
+
   // Step 6: 全ての準備が整ったので、メインの表示画面を描画
-  // 初期画面を表示します
+  // 初期画面を表示します（起動中の通知で、まだ表示時間が残っているものは重ねて表示されます）
   refreshEntireDisplay();
+  LOG_INFO("🖼️ First frame %lu ms after boot.\n", millis());
 
+  // ここまでの確保は起動処理のもの。受信が始まって落ち着いたら、受信・描画でのヒープ確保を監視する
+  beginSteadyStateWarmup();
+
+  // 初期化中にたまったログを送り切ってから、稼働開始を知らせる
+  flushLogBuffer();
   Serial.println("========== 初期化処理完了：システム稼働開始 ==========");
 }
 
@@ -185,27 +1147,88 @@ void setup()
  */
 void loop()
 {
+  // ループ処理にかかった時間を測るため、開始時刻を記録しておく
+  unsigned long loopStartMicros = micros();
+  uint32_t loopStartCycles = ESP.getCycleCount();   // ループ全体の開始時点のCPUサイクル数
+  uint32_t stageStartCycles = loopStartCycles;      // 各ステージの開始時点のCPUサイクル数
+  traceBegin(TRACE_LOOP);
+
   // 1. MQTTサーバーとの接続が切れていないか確認し、切れていたら再接続する
   // 通信が不安定な場合に、自動的に再接続するための処理です
+  setHeapSubsystem(HEAP_TAG_NETWORK);
   maintainMQTTBrokerConnection();
+  stageStartCycles = recordLoopStageCycles(STAGE_MQTT_CONNECTION, stageStartCycles);
 
   // 2. MQTTサーバーから新しいメッセージが届いていないか確認し、届いていれば処理する
   // センサーから送られてくるデータを受信するための処理です
+  setHeapSubsystem(HEAP_TAG_INGEST);
   processIncomingMQTTMessages();
+  stageStartCycles = recordLoopStageCycles(STAGE_MQTT_MESSAGES, stageStartCycles);
 
   // 3. M5StickCPlus2本体の画面を、一定時間ごとに更新する（CO2とTHIの交互表示）
   // 画面に表示する内容を定期的に切り替えるための処理です
+  setHeapSubsystem(HEAP_TAG_RENDER);
   updateDisplayIfIntervalElapsed();
+  updateToastNotifications();
+  stageStartCycles = recordLoopStageCycles(STAGE_DISPLAY, stageStartCycles);
 
   // 4. NTP時刻を、内部で定期的に更新する
   // 時計の精度を保つために、定期的に正確な時刻を取得します
+  setHeapSubsystem(HEAP_TAG_NETWORK);
   updateSystemNetworkTime();
+  stageStartCycles = recordLoopStageCycles(STAGE_NETWORK_TIME, stageStartCycles);
 
   // 5. Digi-Clock Unitの時刻表示を、必要に応じて更新する
   // 外部の7セグメントLEDの表示を更新します
+  setHeapSubsystem(HEAP_TAG_RENDER);
   updateDigiClockDisplay();
-
-  // 6. 次のループまで少し待機する（CPUを少し休ませて、消費電力を抑える）
+  stageStartCycles = recordLoopStageCycles(STAGE_DIGICLOCK, stageStartCycles);
+
+  // 6. シリアルモニタから入力されたコマンド（statsなど）を処理する
+  setHeapSubsystem(HEAP_TAG_CONSOLE);
+  processSerialConsoleCommands();
+  stageStartCycles = recordLoopStageCycles(STAGE_SERIAL_CONSOLE, stageStartCycles);
+
+  // 7. たまっている履歴を一定時間ごとにフラッシュへ書き込む
+  setHeapSubsystem(HEAP_TAG_STORAGE);
+  flushHistoryLogIfIntervalElapsed();
+  stageStartCycles = recordLoopStageCycles(STAGE_HISTORY_FLUSH, stageStartCycles);
+
+  // 8. 一定時間データが届いていなければ、表示中の値を「古い」と表示する
+  setHeapSubsystem(HEAP_TAG_RENDER);
+  checkSensorDataFreshness();
+  stageStartCycles = recordLoopStageCycles(STAGE_FRESHNESS, stageStartCycles);
+
+  // 9. 空きヒープと最大連続ブロック、各タスクのスタックの余裕を一定時間ごとに記録する
+  setHeapSubsystem(HEAP_TAG_OTHER);
+  sampleHeapUsageIfIntervalElapsed();
+  armSteadyStateGuardIfWarmedUp();
+  reportSteadyStateViolations();
+  sampleTaskHealthIfIntervalElapsed();
+  stageStartCycles = recordLoopStageCycles(STAGE_HEAP_SAMPLE, stageStartCycles);
+
+  // 10. 本体の状態（処理時間・ヒープ・受信数など）を一定時間ごとにMQTTで送る
+  setHeapSubsystem(HEAP_TAG_NETWORK);
+  publishMetricsIfIntervalElapsed();
+  stageStartCycles = recordLoopStageCycles(STAGE_METRICS, stageStartCycles);
+
+  // 11. 履歴の問い合わせに応答中なら、次のチャンクを1つだけ送る
+  continueHistoryQueryResponse();
+  stageStartCycles = recordLoopStageCycles(STAGE_HISTORY_QUERY, stageStartCycles);
+
+  // 12. たまったログを、シリアルが待たずに受け取れる分だけ送る
+  // 受信処理の途中でシリアル出力を待たないよう、ログはここ（待機の直前）でまとめて送ります
+  setHeapSubsystem(HEAP_TAG_CONSOLE);
+  drainLogBuffer();
+  recordLoopStageCycles(STAGE_LOG_DRAIN, stageStartCycles);
+  uint32_t loopEndCycles = recordLoopStageCycles(STAGE_LOOP_TOTAL, loopStartCycles);
+  addLog2HistogramSample(metricsWindowLoopCycles, loopEndCycles - loopStartCycles);
+  recordHistoryQueryLoopLatency(micros() - loopStartMicros);
+  traceEnd(TRACE_LOOP);
+  freezeTraceOnSlowLoop(micros() - loopStartMicros);
+  setHeapSubsystem(HEAP_TAG_OTHER);
+
+  // 13. 次のループまで少し待機する（CPUを少し休ませて、消費電力を抑える）
   // 連続して処理を行うとCPUが過熱したり、電力を無駄に消費するため、
   // 短い時間休ませることで効率的な動作を実現します
   delay(MAIN_LOOP_DELAY_MILLISECONDS); // (この値はconfig.hで定義)
@@ -237,18 +1260,15 @@ void initializeDigiClock()
   {
     // 初期化失敗時の処理
     Serial.println("❌ Digi-Clock Unit not found!");
-    // 本体画面にもエラーを表示
-    M5.Display.setCursor(10, 50);        // テキストの開始位置を設定（x=10, y=50）
-    M5.Display.setTextColor(RED);        // テキスト色を赤に設定
-    M5.Display.println("DigiClock ERR"); // エラーメッセージを表示
-    delay(2000);                         // 2秒間エラーを表示（ユーザーが確認できる時間を確保）
+    // 本体画面にも、起動を止めずにエラーを通知する（Wi-Fi接続中などの画面に重ねて表示される）
+    postToastNotification("DigiClock ERR: unit not found", RED, ERROR_TOAST_DISPLAY_TIME);
   }
   else
   {
     // 初期化成功時の処理
     Serial.println("✅ Digi-Clock Unit found and initialized.");
-    digi_clock.setBrightness(80); // 明るさを設定 (0-100の範囲で指定)
-    digi_clock.setString("----"); // 起動時はハイフンを表示しておく（時刻が取得できるまでの一時表示）
+    writeDigiClockBrightness(80); // 明るさを設定 (0-100の範囲で指定)
+    writeDigiClockString("----"); // 起動時はハイフンを表示しておく（時刻が取得できるまでの一時表示）
   }
 }
 
@@ -261,7 +1281,7 @@ void updateDigiClockDisplay()
 {
   // NTPで時刻が正しく同期されている場合のみ、処理を実行
   // 2023年1月1日のUNIXタイムスタンプは1672531200なので、それより大きければ正しい時刻とみなす
-  if (timeClient.getEpochTime() > 1672531200)
+  if (isSystemTimeSynchronized())
   { // 2023年以降の時刻ならOK
 
     // 現在の「分」を取得
@@ -275,15 +1295,14 @@ void updateDigiClockDisplay()
       int hour = timeClient.getHours();
 
       // 時刻を格納するための文字列バッファ
-      char time_string[6]; // "HH:MM" + 終端文字('\0')で5+1=6文字必要
+      char time_string[CLOCK_HOUR_MINUTE_TEXT_SIZE]; // "HH:MM" + 終端文字('\0')で5+1=6文字必要
 
       // HH:MM形式でコロンを常時点灯させる
-      // sprintf関数で、数値を指定したフォーマットの文字列に変換
-      // %02d は「2桁の数値、1桁の場合は0で埋める」という指定
-      sprintf(time_string, "%02d:%02d", hour, minute);
+      // 1桁の場合は0で埋めて、常に2桁ずつにする（clock_format.h）
+      formatClockHourMinute(time_string, sizeof(time_string), hour, minute);
 
       // 7セグメントLEDに時刻文字列を設定
-      digi_clock.setString(time_string);
+      writeDigiClockString(time_string);
 
       // 更新した「分」の値を記憶しておく（次回の比較用）
       last_digiclock_minute = minute;
@@ -291,6 +1310,118 @@ void updateDigiClockDisplay()
   }
 }
 
+/**
+ * @brief Digi-Clock Unitに表示する文字列を書き込み、直後の応答確認と合わせた時間と結果を記録する
+ * @param text 表示する文字列（例：「12:34」）
+ */
+void writeDigiClockString(const char *text)
+{
+  size_t payloadByteCount = strlen(text);
+  traceBegin(TRACE_I2C_WRITE, payloadByteCount);
+  uint32_t startMicros = micros();
+  digi_clock.setString(text);
+  recordDigiClockTransaction(startMicros, payloadByteCount);
+  traceEnd(TRACE_I2C_WRITE, payloadByteCount);
+}
+
+/**
+ * @brief Digi-Clock Unitに明るさを書き込み、直後の応答確認と合わせた時間と結果を記録する
+ * @param brightness 明るさ（0-100）
+ */
+void writeDigiClockBrightness(uint8_t brightness)
+{
+  traceBegin(TRACE_I2C_WRITE, 1);
+  uint32_t startMicros = micros();
+  digi_clock.setBrightness(brightness);
+  recordDigiClockTransaction(startMicros, 1);
+  traceEnd(TRACE_I2C_WRITE, 1);
+}
+
+/**
+ * @brief 書き込みの直後にユニットの応答を確かめ、書き込みと確認を合わせた時間と確認の結果を記録する
+ * @param startMicros 書き込みを始めたときのmicros()
+ * @param payloadByteCount ライブラリに渡した内容のバイト数
+ * @details
+ * ライブラリの書き込み関数は結果を返さないので、書き込みそのものがNACKされたかはわかりません。
+ * 代わりに直後にアドレスだけを送る確認を1回行い、その結果（Wire.endTransmission() の戻り値）を数えます。
+ * ループが止まっていた時間として見られるよう、時間は確認の分も含めて測ります。
+ * 書き込みは1分に1回なので、確認を足してもバスの負荷はほとんど変わりません。
+ */
+void recordDigiClockTransaction(uint32_t startMicros, size_t payloadByteCount)
+{
+  uint8_t result = probeDigiClockBus();
+  uint32_t elapsedMicros = micros() - startMicros;
+  if (result >= I2C_RESULT_COUNT)
+    result = I2C_RESULT_OTHER_ERROR;
+
+  I2CBusStatistics &statistics = digiClockBusStatistics;
+  statistics.transactionCount++;
+  statistics.payloadByteCount += payloadByteCount;
+  statistics.probeResultCounts[result]++;
+  statistics.lastProbeResult = result;
+  addLog2HistogramSample(statistics.durationHistogram, elapsedMicros);
+
+  if (elapsedMicros >= I2C_SLOW_TRANSACTION_MICROSECONDS)
+  {
+    statistics.slowTransactionCount++;
+    LOG_WARN("🐢 Digi-Clock I2C write + probe took %lu us\n", (unsigned long)elapsedMicros);
+  }
+  if (result != I2C_RESULT_OK)
+  {
+    statistics.lastErrorMillis = millis();
+    LOG_WARN("⚠️ Digi-Clock I2C post-write probe failed: %s (code %u)\n", I2C_RESULT_NAMES[result], (unsigned int)result);
+  }
+}
+
+/**
+ * @brief Digi-Clock Unitのアドレスだけを送り、応答があるか確かめる
+ * @return Wire.endTransmission() の戻り値（0なら応答あり）
+ */
+uint8_t probeDigiClockBus()
+{
+  Wire.beginTransmission(DIGI_CLOCK_I2C_ADDRESS);
+  return Wire.endTransmission();
+}
+
+/**
+ * @brief Digi-Clock UnitとのI2C通信の記録（回数・時間のヒストグラム・直後の確認の結果の種類ごとの回数）をシリアルに出力する
+ */
+void printI2CBusReport()
+{
+  const I2CBusStatistics &statistics = digiClockBusStatistics;
+  const Log2Histogram &histogram = statistics.durationHistogram;
+
+  Serial.println("--- Digi-Clock I2C Bus ---");
+  Serial.printf("Writes: %lu, payload bytes: %lu, slow (>=%luus): %lu\n", (unsigned long)statistics.transactionCount,
+                (unsigned long)statistics.payloadByteCount, (unsigned long)I2C_SLOW_TRANSACTION_MICROSECONDS,
+                (unsigned long)statistics.slowTransactionCount);
+  if (histogram.sampleCount > 0)
+  {
+    Serial.printf("Write + probe us: mean %.0f, p90 %lu, max %lu\n", histogram.total / (float)histogram.sampleCount,
+                  (unsigned long)estimateLog2HistogramPercentile(histogram, 0.9f), (unsigned long)histogram.maximum);
+    Serial.print("Histogram (>=us:count):");
+    for (int b = 0; b < 32; b++)
+    {
+      if (histogram.buckets[b] > 0)
+        Serial.printf(" %lu:%lu", 1UL << b, (unsigned long)histogram.buckets[b]);
+    }
+    Serial.println();
+  }
+
+  Serial.print("Post-write probe:");
+  for (int r = 0; r < I2C_RESULT_COUNT; r++)
+  {
+    Serial.printf(" %s=%lu", I2C_RESULT_NAMES[r], (unsigned long)statistics.probeResultCounts[r]);
+  }
+  Serial.println();
+  if (statistics.lastErrorMillis != 0)
+  {
+    Serial.printf("Last probe failure: %lus ago (last probe: %s)\n", (millis() - statistics.lastErrorMillis) / 1000,
+                  I2C_RESULT_NAMES[statistics.lastProbeResult]);
+  }
+  Serial.println("--------------------------");
+}
+
 // -----------------------------------------------------------------
 // M5StickCPlus2 本体画面関連の関数
 // -----------------------------------------------------------------
@@ -344,6 +1475,14 @@ void showSystemStartupMessage()
  */
 void refreshEntireDisplay()
 {
+  TraceSpan renderSpan(TRACE_RENDER);
+
+  // 受信したデータの描画なら、描画開始の時刻を記録
+  stampLatencyTrace(STAMP_RENDER_START);
+
+  // 受信処理の中から呼ばれても、描画中の確保は「描画」に数える
+  HeapSubsystem previousHeapSubsystem = setHeapSubsystem(HEAP_TAG_RENDER);
+
   // まず画面を黒でクリア
   clearDisplayScreenWithColor(BLACK);
 
@@ -359,21 +1498,22 @@ void refreshEntireDisplay()
   // センサーデータが有効な場合
   if (currentSensorReading.hasValidData)
   {
-    // 表示モードに応じてCO2濃度かTHIを表示
-    if (displayCO2)
-    {
-      displayCO2ConcentrationData();
-    }
-    else
-    {
-      displayTHIComfortData();
-    }
+    // 現在のページ（CO2、THI、統計）を表示
+    displayCurrentSensorPage();
   }
   else
   {
     // 有効なデータがない場合はエラーメッセージ
     displayNoDataAvailableMessage();
   }
+
+  // 接続状態などの通知があれば、いちばん上に重ねる
+  drawToastNotifications();
+
+  setHeapSubsystem(previousHeapSubsystem);
+
+  // 画面への転送が終わった時刻を記録し、遅延を集計する
+  completeLatencyTrace();
 }
 
 /**
@@ -400,23 +1540,23 @@ void updateDisplayIfIntervalElapsed()
     // センサーデータが有効な場合
     if (currentSensorReading.hasValidData)
     {
-      // 表示モードに応じてCO2濃度かTHIを表示
-      if (displayCO2)
-      {
-        displayCO2ConcentrationData();
-      }
-      else
+      // 現在のページ（CO2、THI、統計）を表示
+      displayCurrentSensorPage();
+      // 次回は次のページに切り替え（最後まで行ったら最初に戻る）
+      currentDisplayPage = (DisplayPage)((currentDisplayPage + 1) % DISPLAY_PAGE_COUNT);
+      // センサーが1台だけならランキングは不要なので飛ばす（診断ページも設定で無効なら飛ばす）
+      while ((currentDisplayPage == PAGE_RANKING && sensorRegistryCount < 2) ||
+             (currentDisplayPage == PAGE_DIAGNOSTICS && !DIAGNOSTICS_PAGE_ENABLED))
       {
-        displayTHIComfortData();
+        currentDisplayPage = (DisplayPage)((currentDisplayPage + 1) % DISPLAY_PAGE_COUNT);
       }
-      // 次回表示モードを切り替え（交互表示）
-      displayCO2 = !displayCO2;
     }
     else
     {
       // 有効なデータがない場合はエラーメッセージ
       displayNoDataAvailableMessage();
     }
+    drawToastNotifications();
 
     // 最終更新時刻を記録
     lastInteractiveDisplayTime = currentSystemTime;
@@ -455,7 +1595,20 @@ void displayCurrentSystemTime()
   M5.Display.setCursor(TIME_DISPLAY_X, TIME_DISPLAY_Y);
 
   // NTPクライアントから取得した時刻を「HH:MM:SS」形式で表示
-  M5.Display.println(timeClient.getFormattedTime());
+  char timeText[9];
+  formatCurrentClockTime(timeText, sizeof(timeText));
+  M5.Display.println(timeText);
+}
+
+/**
+ * @brief 現在の時刻を「HH:MM:SS」の文字列にする
+ * @param buffer 書き込み先（9バイト以上）
+ * @param bufferSize 書き込み先の大きさ
+ * @details NTPClient の getFormattedTime() と同じ形式ですが、String を作らないのでヒープ領域を使いません
+ */
+void formatCurrentClockTime(char *buffer, size_t bufferSize)
+{
+  formatClockHourMinuteSecond(buffer, bufferSize, timeClient.getHours(), timeClient.getMinutes(), timeClient.getSeconds());
 }
 
 /**
@@ -491,43 +1644,92 @@ void displayCO2ConcentrationData()
   M5.Display.println("CO2:");                         // ラベル表示
 
   // CO2濃度値の表示設定
-  M5.Display.setTextSize(8);      // テキストサイズ：大
-  M5.Display.setTextColor(GREEN); // 色：緑
+  M5.Display.setTextSize(8);                                           // テキストサイズ：大
+  M5.Display.setTextColor(currentSensorFreshness.isStale ? DARKGREY : GREEN); // 色：緑（古いデータなら灰色）
 
   // テキスト揃えを右寄せに設定（値を右端に揃えるため）
   M5.Display.setTextDatum(TR_DATUM);
 
   // CO2濃度値を文字列に変換
-  String co2Value = String(currentSensorReading.carbonDioxideLevel);
+  char co2Value[NUMERIC_TEXT_BUFFER_SIZE];
+  formatScaledDecimal<0>(co2Value, sizeof(co2Value), currentSensorReading.carbonDioxideLevel);
 
   // CO2値を画面の右側に表示（右マージンを考慮）
   M5.Display.drawString(co2Value, M5.Display.width() - DISPLAY_RIGHT_MARGIN, LARGE_VALUE_Y);
 
   // テキスト揃えを元の左揃えに戻す
   M5.Display.setTextDatum(TL_DATUM);
+
+  // ラベルの横に、傾きとしきい値到達までの予測時間を表示
+  displayCO2ForecastSummary();
 }
 
 /**
- * @brief 温熱快適性指数（THI）を大きく画面に表示
- * @details 現在のTHI値と快適レベルを目立つように表示します
+ * @brief CO2表示の「CO2:」ラベルの横に、傾向としきい値到達の予測を小さく表示
+ * @details 例：「+4.2ppm/min」「1000ppm in ~12min」。上昇していない場合は到達予測を出しません。
  */
-void displayTHIComfortData()
+void displayCO2ForecastSummary()
 {
-  // 「THI:」ラベルの表示設定
-  M5.Display.setTextSize(2);                          // テキストサイズ：中
-  M5.Display.setTextColor(ORANGE);                    // 色：オレンジ
-  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y); // 位置設定
-  M5.Display.println("THI:");                         // ラベル表示
+  if (co2Forecaster.sampleCount < 2)
+  {
+    return; // 傾きを求めるには2件以上必要
+  }
+
+  const int summaryX = LARGE_LABEL_X + 60;
+  M5.Display.setTextSize(1);
+  M5.Display.setTextColor(YELLOW);
+  M5.Display.setCursor(summaryX, LARGE_LABEL_Y);
+  char trendText[NUMERIC_TEXT_BUFFER_SIZE];
+  formatFixedPoint<1>(trendText, sizeof(trendText), co2Forecaster.trendPerMinute);
+  if (trendText[0] != '-')
+  {
+    M5.Display.print('+'); // printf の「%+」と同じく、0以上にも符号を付ける
+  }
+  M5.Display.print(trendText);
+  M5.Display.print("ppm/min");
+
+  // まだ超えていない方のしきい値について、到達までの時間を表示
+  M5.Display.setCursor(summaryX, LARGE_LABEL_Y + 9);
+  float minutes;
+  if (co2Forecaster.level >= CO2_CRITICAL_THRESHOLD_PPM)
+  {
+    M5.Display.setTextColor(RED);
+    M5.Display.printf("over %dppm", CO2_CRITICAL_THRESHOLD_PPM);
+  }
+  else
+  {
+    int threshold = co2Forecaster.level < CO2_WARNING_THRESHOLD_PPM ? CO2_WARNING_THRESHOLD_PPM : CO2_CRITICAL_THRESHOLD_PPM;
+    if (estimateMinutesToThreshold(co2Forecaster, threshold, minutes) && minutes <= CO2_FORECAST_MAX_DISPLAY_MINUTES)
+    {
+      M5.Display.printf("%dppm in ~", threshold);
+      printFixedPointColumn<0>(minutes, 0);
+      M5.Display.print("min");
+    }
+  }
+}
+
+/**
+ * @brief 温熱快適性指数（THI）を大きく画面に表示
+ * @details 現在のTHI値と快適レベルを目立つように表示します
+ */
+void displayTHIComfortData()
+{
+  // 「THI:」ラベルの表示設定
+  M5.Display.setTextSize(2);                          // テキストサイズ：中
+  M5.Display.setTextColor(ORANGE);                    // 色：オレンジ
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y); // 位置設定
+  M5.Display.println("THI:");                         // ラベル表示
 
   // THI値の表示設定
-  M5.Display.setTextSize(8);       // テキストサイズ：大
-  M5.Display.setTextColor(ORANGE); // 色：オレンジ
+  M5.Display.setTextSize(8);                                            // テキストサイズ：大
+  M5.Display.setTextColor(currentSensorFreshness.isStale ? DARKGREY : ORANGE); // 色：オレンジ（古いデータなら灰色）
 
   // テキスト揃えを右寄せに設定
   M5.Display.setTextDatum(TR_DATUM);
 
   // THI値を小数点1桁まで表示する文字列に変換
-  String thiValue = String(currentSensorReading.thermalComfortIndex, 1);
+  char thiValue[NUMERIC_TEXT_BUFFER_SIZE];
+  formatFixedPoint<1>(thiValue, sizeof(thiValue), currentSensorReading.thermalComfortIndex);
 
   // THI値を画面の右側に表示
   M5.Display.drawString(thiValue, M5.Display.width() - DISPLAY_RIGHT_MARGIN, LARGE_VALUE_Y);
@@ -536,6 +1738,94 @@ void displayTHIComfortData()
   M5.Display.setTextDatum(TL_DATUM);
 }
 
+/**
+ * @brief 現在のページに応じたセンサーデータを表示
+ * @details currentDisplayPageの値によって、表示する関数を切り替えます
+ */
+void displayCurrentSensorPage()
+{
+  switch (currentDisplayPage)
+  {
+  case PAGE_CO2:
+    displayCO2ConcentrationData();
+    break;
+  case PAGE_THI:
+    displayTHIComfortData();
+    break;
+  case PAGE_STATISTICS:
+    displayStatisticsPage();
+    break;
+  case PAGE_RANKING:
+    displaySensorRankingPage();
+    break;
+  case PAGE_DIAGNOSTICS:
+    displayDiagnosticsPage();
+    break;
+  default:
+    break;
+  }
+
+  // どのページでも、データが途切れていればその旨を表示する
+  displaySensorFreshnessMarker();
+}
+
+/**
+ * @brief 統計ページを表示
+ * @details 今日の最小・最大・平均・標準偏差を項目ごとに表にし、直近1時間と起動後のCO2も表示します。
+ * 値は受信のたびに更新済みの逐次統計から読むだけなので、履歴を読み直すことはありません。
+ */
+void displayStatisticsPage()
+{
+  // 見出しの表示
+  M5.Display.setTextSize(1);
+  M5.Display.setTextColor(YELLOW);
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y - 8);
+  M5.Display.println("Today      min    max   mean    sd");
+
+  // 項目ごとに1行ずつ表示（CO2は整数、それ以外は小数点1桁）
+  M5.Display.setTextColor(WHITE);
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    const RunningStatistics &statistics = todayStatistics[m];
+    M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 4 + m * 12);
+    if (statistics.count == 0)
+    {
+      M5.Display.printf("%-6s       --", HISTORY_METRIC_NAMES[m]);
+    }
+    else
+    {
+      const float columnValues[] = {statistics.minimum, statistics.maximum, statistics.mean, calculateStandardDeviation(statistics)};
+      const int columnWidths[] = {6, 6, 6, 5};
+      M5.Display.printf("%-6s", HISTORY_METRIC_NAMES[m]);
+      for (int c = 0; c < 4; c++)
+      {
+        M5.Display.print(' ');
+        if (m == METRIC_CO2)
+          printFixedPointColumn<0>(columnValues[c], columnWidths[c]);
+        else
+          printFixedPointColumn<1>(columnValues[c], columnWidths[c]);
+      }
+    }
+  }
+
+  // 直近1時間と起動後のCO2を下段に表示
+  RunningStatistics recentStatistics[HISTORY_METRIC_COUNT];
+  collectRecentStatistics(recentStatistics);
+  M5.Display.setTextColor(CYAN);
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 4 + HISTORY_METRIC_COUNT * 12 + 4);
+  if (recentStatistics[METRIC_CO2].count > 0)
+  {
+    M5.Display.print("CO2 1h  max ");
+    printFixedPointColumn<0>(recentStatistics[METRIC_CO2].maximum, 0);
+    M5.Display.print("  mean ");
+    printFixedPointColumn<0>(recentStatistics[METRIC_CO2].mean, 0);
+  }
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 4 + HISTORY_METRIC_COUNT * 12 + 16);
+  M5.Display.print("CO2 boot max ");
+  printFixedPointColumn<0>(sinceBootStatistics[METRIC_CO2].maximum, 0);
+  M5.Display.printf("  n=%lu", (unsigned long)sinceBootStatistics[METRIC_CO2].count);
+}
+
 /**
  * @brief データが利用できない場合のメッセージを表示
  * @details センサーデータがまだ受信されていない場合などに表示します
@@ -572,9 +1862,11 @@ void displayJSONParsingError(const char *errorDescription)
   M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
   M5.Display.println("Sensor Monitor");
 
+  char timeText[9];
+  formatCurrentClockTime(timeText, sizeof(timeText));
   M5.Display.setTextColor(WHITE);
   M5.Display.setCursor(TIME_DISPLAY_X, TIME_DISPLAY_Y);
-  M5.Display.println(timeClient.getFormattedTime());
+  M5.Display.println(timeText);
 
   M5.Display.setTextSize(1);
   M5.Display.setTextColor(mqttCommunicationClient.connected() ? GREEN : RED);
@@ -593,6 +1885,84 @@ void displayJSONParsingError(const char *errorDescription)
   M5.Display.println(errorDescription);
 }
 
+// -----------------------------------------------------------------
+// 数値の文字列化関連の関数
+// -----------------------------------------------------------------
+// 文字列化そのもの（formatScaledDecimal / formatFixedPoint）は fixed_point_format.h にあります。
+
+/**
+ * @brief 小数を小数点以下FractionDigits桁の文字列にし、width文字に満たない分は左に空白を入れて画面に書く
+ * @param value 書く値
+ * @param width 右寄せにする幅（0なら詰めない）
+ * @details printf の「%width.Nf」と同じ見た目になります。書式の解釈を通らないので、描画中にヒープを使いません
+ */
+template <uint8_t FractionDigits>
+void printFixedPointColumn(float value, int width)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  size_t length = formatFixedPoint<FractionDigits>(text, sizeof(text), value);
+  for (int column = (int)length; column < width; column++)
+  {
+    M5.Display.print(' ');
+  }
+  M5.Display.print(text);
+}
+
+/**
+ * @brief 画面に出す形式（整数・小数1桁）で文字列にして読み戻し、元の値と一致するかを確かめる
+ * @param checkedCount 確かめた値の数の格納先
+ * @return すべて一致すればtrue（一致しなかった値はシリアルに出力します）
+ * @details
+ * 整数はCO2の範囲を中心に、端の値（0、負の値、int32_tの最小・最大）も含めて、読み戻した値が元と同じで、
+ * printf の「%ld」とも同じ文字列になることを確かめます。
+ * 小数1桁は -50.00〜150.00 を0.01刻みで、読み戻した値と元の値の差が0.05（と丸めの誤差）以内で、
+ * 読み戻した値をもう一度文字列にすると同じ文字列になり、printf の「%.1f」とも同じ文字列になる（「-0.0」を除く）ことを確かめます。
+ * strtol/strtof はヒープを使うことがあるので、ベンチマーク（`bench`）の中からだけ呼びます。
+ */
+bool verifyNumericFormattingRoundTrip(uint32_t &checkedCount)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  char expected[NUMERIC_TEXT_BUFFER_SIZE];
+  uint32_t failureCount = 0;
+  checkedCount = 0;
+
+  const int32_t edgeValues[] = {0, 1, -1, 9, 10, -10, 99, 100, 399, 400, 999, 1000, 5000, 9999, 10000, 65535,
+                                INT32_MAX, INT32_MIN, INT32_MIN + 1};
+  const size_t edgeCount = sizeof(edgeValues) / sizeof(edgeValues[0]);
+  for (int32_t i = -(int32_t)edgeCount; i <= 20000; i++)
+  {
+    int32_t value = i < 0 ? edgeValues[edgeCount + i] : i;
+    formatScaledDecimal<0>(text, sizeof(text), value);
+    snprintf(expected, sizeof(expected), "%ld", (long)value);
+    checkedCount++;
+    if (strtol(text, NULL, 10) != value || strcmp(text, expected) != 0)
+    {
+      if (failureCount++ < 5)
+        Serial.printf("Round trip failed: %ld -> \"%s\" (printf \"%s\")\n", (long)value, text, expected);
+    }
+  }
+
+  for (int32_t hundredths = -5000; hundredths <= 15000; hundredths++)
+  {
+    float value = hundredths / 100.0f;
+    formatFixedPoint<1>(text, sizeof(text), value);
+    float parsedValue = strtof(text, NULL);
+    char reformatted[NUMERIC_TEXT_BUFFER_SIZE];
+    formatFixedPoint<1>(reformatted, sizeof(reformatted), parsedValue);
+    snprintf(expected, sizeof(expected), "%.1f", value);
+    checkedCount++;
+    if (fabsf(parsedValue - value) > 0.05f + 1e-4f || strcmp(text, reformatted) != 0 ||
+        (strcmp(text, expected) != 0 && strcmp(expected, "-0.0") != 0))
+    {
+      if (failureCount++ < 5)
+        Serial.printf("Round trip failed: %.3f -> \"%s\" -> %.3f -> \"%s\" (printf \"%s\")\n", value, text, parsedValue,
+                      reformatted, expected);
+    }
+  }
+
+  return failureCount == 0;
+}
+
 // -----------------------------------------------------------------
 // ネットワーク関連の関数
 // -----------------------------------------------------------------
@@ -638,24 +2008,18 @@ bool checkWiFiConnectionStatus()
 }
 
 /**
- * @brief WiFi接続成功時のメッセージを表示
+ * @brief WiFi接続成功を、割り当てられたIPアドレスとともに通知する
+ * @details 表示を待たずに戻るので、すぐにNTP同期へ進みます（通知は次の画面に重ねて表示されます）
  */
 void displayWiFiConnectionSuccess()
 {
-  // 画面をクリア
-  clearDisplayScreenWithColor(BLACK);
+  IPAddress localAddress = WiFi.localIP();
+  char message[TOAST_TEXT_MAX_LENGTH + 1];
+  snprintf(message, sizeof(message), "WiFi Connected! %u.%u.%u.%u", localAddress[0], localAddress[1], localAddress[2],
+           localAddress[3]);
 
-  // 接続成功メッセージを表示
-  M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
-  M5.Display.println("WiFi Connected!");
-
-  // 割り当てられたIPアドレスを表示
-  M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y + 20);
-  M5.Display.println(WiFi.localIP());
-
-  // メッセージを一定時間表示（ユーザーが確認できる時間）
   // CONNECTION_SUCCESS_DISPLAY_TIMEはconfig.hで定義された表示時間（ミリ秒）
-  delay(CONNECTION_SUCCESS_DISPLAY_TIME);
+  postToastNotification(message, GREEN, CONNECTION_SUCCESS_DISPLAY_TIME);
 }
 
 /**
@@ -714,35 +2078,29 @@ bool attemptNTPTimeSynchronization()
 }
 
 /**
- * @brief NTP同期結果を画面に表示
+ * @brief NTP同期結果を通知する
  * @param wasSuccessful 同期が成功したかどうか（true/false）
+ * @details 表示を待たずに戻るので、すぐにMQTT接続へ進みます
  */
 void displayNTPSynchronizationResult(bool wasSuccessful)
 {
-  // 画面をクリア
-  clearDisplayScreenWithColor(BLACK);
-
-  // テキスト位置を設定
-  M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
-
   if (wasSuccessful)
   {
-    // 同期成功時の表示
-    M5.Display.println("NTP Synced!");
-    M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y + 20);
-    M5.Display.println(timeClient.getFormattedTime()); // 同期された時刻を表示
+    // 同期成功時は、同期された時刻を添えて通知
+    char timeText[9];
+    formatCurrentClockTime(timeText, sizeof(timeText));
+    char message[TOAST_TEXT_MAX_LENGTH + 1];
+    snprintf(message, sizeof(message), "NTP Synced! %s", timeText);
+    postToastNotification(message, GREEN, CONNECTION_SUCCESS_DISPLAY_TIME);
 
     Serial.print("   Synced Time: ");
-    Serial.println(timeClient.getFormattedTime());
+    Serial.println(timeText);
   }
   else
   {
-    // 同期失敗時の表示
-    M5.Display.println("NTP Failed!");
+    // 同期失敗時の通知（時刻はメインループの中で同期し直す）
+    postToastNotification("NTP Failed!", RED, ERROR_TOAST_DISPLAY_TIME);
   }
-
-  // メッセージを一定時間表示
-  delay(CONNECTION_SUCCESS_DISPLAY_TIME);
 }
 
 /**
@@ -768,7 +2126,7 @@ void configureMQTTConnection()
  */
 void establishMQTTBrokerConnection()
 {
-  Serial.println("📡 Attempting to connect to MQTT broker...");
+  LOG_INFO("📡 Attempting to connect to MQTT broker...\n");
 
   // MQTT接続中メッセージを表示
   showConnectionStatusMessage("MQTT connecting...");
@@ -793,6 +2151,9 @@ void establishMQTTBrokerConnection()
       displayMQTTConnectionFailure();
     }
   }
+
+  // 接続処理はもともと待ち時間を含むので、ここでログを送り切っておく
+  flushLogBuffer();
 }
 
 /**
@@ -822,15 +2183,13 @@ bool attemptMQTTBrokerConnection(const String &clientIdentifier)
   if (connectionEstablished)
   {
     // 接続成功のログ
-    Serial.println("✅ MQTT Connection Successful.");
-    Serial.print("   Client ID: ");
-    Serial.println(clientIdentifier);
+    LOG_INFO("✅ MQTT Connection Successful.\n");
+    LOG_DEBUG("   Client ID: %s\n", clientIdentifier.c_str());
   }
   else
   {
     // 接続失敗のログ（エラーコード付き）
-    Serial.print("❌ MQTT Connection Failed, rc=");
-    Serial.println(mqttCommunicationClient.state());
+    LOG_ERROR("❌ MQTT Connection Failed, rc=%d\n", mqttCommunicationClient.state());
     // エラーコードの意味:
     // -4: MQTT_CONNECTION_TIMEOUT - サーバー接続がタイムアウト
     // -3: MQTT_CONNECTION_LOST - ネットワーク接続が切断された
@@ -858,20 +2217,20 @@ void subscribeToMQTTDataTopic()
   mqttCommunicationClient.subscribe(MQTT_TOPIC_NAME);
 
   // サブスクライブ成功のログ
-  Serial.print("📬 Subscribed to MQTT topic: ");
-  Serial.println(MQTT_TOPIC_NAME);
+  LOG_INFO("📬 Subscribed to MQTT topic: %s\n", MQTT_TOPIC_NAME);
+
+  // 履歴の問い合わせ用トピックもサブスクライブ
+  mqttCommunicationClient.subscribe(MQTT_HISTORY_REQUEST_TOPIC);
+  LOG_INFO("📬 Subscribed to MQTT topic: %s\n", MQTT_HISTORY_REQUEST_TOPIC);
 }
 
 /**
- * @brief MQTT接続成功時のメッセージを表示
+ * @brief MQTT接続成功を通知する
+ * @details 再接続のときもメインループを止めずに、表示中のページに重ねて表示します
  */
 void displayMQTTConnectionSuccess()
 {
-  // 接続成功メッセージを画面に表示
-  M5.Display.println("MQTT Connected!");
-
-  // メッセージを1秒間表示
-  delay(1000);
+  postToastNotification("MQTT Connected!", GREEN, CONNECTION_SUCCESS_DISPLAY_TIME);
 }
 
 /**
@@ -902,158 +2261,219 @@ void displayMQTTConnectionFailure()
  */
 void handleIncomingMQTTMessage(char *topicName, byte *messagePayload, unsigned int messageLength)
 {
-  // 受信したバイト配列を文字列に変換
-  String jsonMessageString = convertRawPayloadToString(messagePayload, messageLength);
+  TraceSpan ingestSpan(TRACE_INGEST, messageLength);
+  mqttMessagesReceivedCount++;
+
+  // 受信ログ（シリアルへはループの空き時間に送るので、ここでは待たない）
+  LOG_DEBUG("📥 %s (%u bytes)\n", topicName, messageLength);
+
+  // 履歴の問い合わせはセンサーデータとは別に処理する
+  if (strcmp(topicName, MQTT_HISTORY_REQUEST_TOPIC) == 0)
+  {
+    copyPrintablePayload(messagePayload, messageLength, ingestMessageBuffer, sizeof(ingestMessageBuffer));
+    handleHistoryQueryRequest(ingestMessageBuffer);
+    return;
+  }
+
+  // 重複・古すぎるデータは、タイムスタンプとsensor_idだけを見て、JSON全体を解析する前に捨てる
+  uint32_t callbackEntryMicros = micros();
+  SequenceCheckResult sequenceResult = checkSensorPayloadSequence(messagePayload, messageLength);
+  if (sequenceResult == SEQUENCE_DUPLICATE || sequenceResult == SEQUENCE_TOO_OLD)
+  {
+    LOG_DEBUG("⏭️ Dropped %s reading.\n", sequenceResult == SEQUENCE_DUPLICATE ? "duplicate" : "out-of-window");
+    return;
+  }
 
-  // 受信ログをシリアルに出力
-  Serial.println("\n--- New MQTT Message Received ---");
-  Serial.printf("Topic: %s\n", topicName);                     // トピック名
-  Serial.printf("Payload: '%s'\n", jsonMessageString.c_str()); // メッセージ内容
+  // ここから画面に映るまでの時間を計測する（コールバックに入った時刻は重複判定の前のもの）
+  beginLatencyTrace(messagePayload, messageLength);
+  currentLatencyTrace.stampMicros[STAMP_CALLBACK_ENTRY] = callbackEntryMicros;
+
+  // 受信したバイト配列を、決まった場所に文字列として書き込む（ヒープ領域は使わない）
+  size_t jsonMessageLength = copyPrintablePayload(messagePayload, messageLength, ingestMessageBuffer, sizeof(ingestMessageBuffer));
+  logPayloadSample(messagePayload, messageLength); // メッセージ内容（間引いて先頭だけ）
 
   // JSONデータの整合性をチェック（有効なJSONかどうか）
-  if (!validateJSONDataIntegrity(jsonMessageString))
+  if (!validateJSONDataIntegrity(ingestMessageBuffer, jsonMessageLength))
   {
-    Serial.println("❌ Invalid JSON data detected.");
+    LOG_ERROR("❌ Invalid JSON data detected.\n");
     displayJSONParsingError("Invalid JSON");
+    sensorDataRejectedCount++;
+    cancelLatencyTrace();
     return; // 不正なJSONなら処理を中断
   }
 
-  // JSONデータをパースしてセンサーデータ構造体に変換
-  SensorDataPacket parsedSensorData = parseJSONSensorData(jsonMessageString);
-
-  if (parsedSensorData.hasValidData)
+  // 受信処理は空きがある間しか読まないので満杯にはならないが、念のため満杯なら捨てる（ここでは反映しない）
+  if (ingestQueueCount == INGEST_QUEUE_CAPACITY)
   {
-    // パースが成功した場合：センサーデータを更新して画面を更新
-    updateCurrentSensorData(parsedSensorData);
-    Serial.printf("✅ Sensor data updated: CO2=%d, THI=%.1f\n",
-                  parsedSensorData.carbonDioxideLevel, parsedSensorData.thermalComfortIndex);
-    refreshEntireDisplay();
+    LOG_WARN("⚠️ Ingest queue full. Dropped reading.\n");
+    sensorDataRejectedCount++;
+    cancelLatencyTrace();
+    return;
   }
-  else
+
+  // JSONデータをパースして、詰めた形（PackedSensorRecord）に変換する（文字列はキューの空き位置に直接書く）
+  PackedSensorRecord record;
+  IngestRecordText &recordText = ingestQueueTexts[(ingestQueueHead + ingestQueueCount) % INGEST_QUEUE_CAPACITY];
+  if (!parseJSONSensorRecord(ingestMessageBuffer, record, recordText))
   {
     // パースが失敗した場合：エラーメッセージを表示
-    Serial.println("❌ Sensor data parsing failed.");
+    LOG_ERROR("❌ Sensor data parsing failed.\n");
     displayJSONParsingError("Parse Failed");
+    sensorDataRejectedCount++;
+    cancelLatencyTrace();
+    return;
   }
+  stampLatencyTrace(STAMP_PARSE_COMPLETE);
 
-  Serial.println("---------------------------------");
+  // 遅れて届いた初見のデータは、反映するときに統計にだけ使う
+  if (sequenceResult == SEQUENCE_REORDERED)
+  {
+    record.versionAndFlags |= RECORD_FLAG_REORDERED;
+  }
+  enqueueSensorRecord(record, recordText);
 }
 
 /**
- * @brief JSONデータの整合性を検証する
- * @param jsonData 検証するJSON文字列
- * @return 有効なJSONならtrue、そうでなければfalse
- * @details 基本的なJSON形式の正当性チェックを行います
+ * @brief JSON文字列をパースして、詰めた形（PackedSensorRecord）に変換
+ * @param jsonText パース対象のJSON文字列（解析中に書き換わります）
+ * @param record 値の格納先（JSONになかった項目は0にし、presenceBits のビットを立てない）
+ * @param text sensor_id と語彙表にない快適レベルの言葉の格納先
+ * @return パースできればtrue
+ * @details 解析そのものは decodeSensorRecordJSON（sensor_ingest.h）で行い、ここでは時間の計測とエラーのログ出力をします
  */
-bool validateJSONDataIntegrity(const String &jsonData)
+bool parseJSONSensorRecord(char *jsonText, PackedSensorRecord &record, IngestRecordText &text)
 {
-  // 文字列の前後の空白を削除
-  String trimmedData = jsonData;
-  trimmedData.trim();
-
-  // 空のJSONは無効
-  if (trimmedData.length() == 0)
-    return false;
+  TraceSpan parseSpan(TRACE_PARSE);
 
-  // 正しいJSONは「{」で始まる必要がある
-  if (!trimmedData.startsWith("{"))
-    return false;
+  // JSONパース用のドキュメントは、静的領域に確保したものを毎回使い回す
+  // JSON_PARSING_MEMORY_SIZEはconfig.hで定義されたJSONパース用メモリサイズ
+  DeserializationError parseError = decodeSensorRecordJSON(sensorJsonDocument, jsonText, record, text);
 
-  // 正しいJSONは「}」で終わる必要がある
-  if (!trimmedData.endsWith("}"))
+  // パースエラーがあれば処理中断
+  if (parseError)
+  {
+    LOG_ERROR("❌ JSON parsing failed: %s\n", parseError.c_str());
     return false;
-
-  // 基本的なチェックに合格
+  }
   return true;
 }
 
 /**
- * @brief 受信したバイト配列を文字列に変換
- * @param rawPayload バイトデータ配列
- * @param payloadLength データ長
- * @return 変換された文字列
- * @details バイナリデータから印字可能なASCII文字のみを抽出
+ * @brief 解析したデータを受信キューの末尾に入れる
+ * @param record 詰めた形のデータ
+ * @param text 同じデータの文字列（parseJSONSensorRecord でキューの空き位置に直接書いたものなら、写さない）
+ * @details 呼び出す前に空きがあることが前提です（processIncomingMQTTMessages は空きがある間しか読まない）
  */
-String convertRawPayloadToString(byte *rawPayload, unsigned int payloadLength)
+void enqueueSensorRecord(const PackedSensorRecord &record, const IngestRecordText &text)
 {
-  String convertedMessage;
-
-  // 必要なメモリをあらかじめ確保（最適化）
-  convertedMessage.reserve(payloadLength + 1);
-
-  // バイト配列を1バイトずつ処理
-  for (unsigned int i = 0; i < payloadLength; i++)
+  uint8_t tail = (ingestQueueHead + ingestQueueCount) % INGEST_QUEUE_CAPACITY;
+  ingestQueueRecords[tail] = record;
+  if (&ingestQueueTexts[tail] != &text)
   {
-    // 印字可能なASCII文字（32-126）のみを文字列に追加
-    // これにより、制御文字やバイナリデータが含まれていても適切に処理できる
-    if (rawPayload[i] >= 32 && rawPayload[i] <= 126)
-    {
-      convertedMessage += (char)rawPayload[i];
-    }
+    ingestQueueTexts[tail] = text;
+  }
+  ingestQueueCount++;
+  if (ingestQueueCount > ingestQueueHighWater)
+  {
+    ingestQueueHighWater = ingestQueueCount;
   }
-
-  return convertedMessage;
 }
 
 /**
- * @brief JSON文字列をパースしてセンサーデータ構造体に変換
- * @param jsonString パース対象のJSON文字列
- * @return センサーデータ構造体（パースエラー時はhasValidData=false）
- * @details ArduinoJsonライブラリを使用してJSONをパースします
+ * @brief 受信キューのデータを、届いた順にすべて反映する
+ * @details MQTTの受信処理の直後に呼び出します。反映中に新しいデータが届くことはないので、呼び出し後は空になります
  */
-SensorDataPacket parseJSONSensorData(const String &jsonString)
+void drainIngestQueue()
 {
-  // 初期値がすべてゼロの構造体を作成
-  SensorDataPacket extractedData = {0, 0.0, 0.0, 0.0, "", 0, false};
-
-  // JSONパース用のドキュメントオブジェクトを作成
-  // JSON_PARSING_MEMORY_SIZEはconfig.hで定義されたJSONパース用メモリサイズ
-  DynamicJsonDocument jsonDocument(JSON_PARSING_MEMORY_SIZE);
-
-  // JSON文字列をパース
-  DeserializationError parseError = deserializeJson(jsonDocument, jsonString);
-
-  // パースエラーがあれば処理中断
-  if (parseError)
+  while (ingestQueueCount > 0)
   {
-    Serial.printf("❌ JSON parsing failed: %s\n", parseError.c_str());
-    return extractedData; // 無効なデータを返す
+    uint8_t position = ingestQueueHead;
+    ingestQueueHead = (ingestQueueHead + 1) % INGEST_QUEUE_CAPACITY;
+    ingestQueueCount--;
+    applySensorRecord(ingestQueueRecords[position], ingestQueueTexts[position]);
   }
+}
 
-  // 各フィールドが存在すれば、構造体にデータを設定
-  // キーが存在するかチェックすることで、一部のデータが欠けていても対応可能
-  if (jsonDocument.containsKey("co2"))
-    extractedData.carbonDioxideLevel = jsonDocument["co2"];
-
-  if (jsonDocument.containsKey("thi"))
-    extractedData.thermalComfortIndex = jsonDocument["thi"];
-
-  if (jsonDocument.containsKey("temperature"))
-    extractedData.ambientTemperature = jsonDocument["temperature"];
-
-  if (jsonDocument.containsKey("humidity"))
-    extractedData.relativeHumidity = jsonDocument["humidity"];
+/**
+ * @brief 1件のデータを、登録表・現在の値・統計・履歴・画面に反映する
+ * @param record 詰めた形のデータ
+ * @param text 同じデータの文字列
+ */
+void applySensorRecord(const PackedSensorRecord &record, const IngestRecordText &text)
+{
+  SensorDataPacket sensorData;
+  if (!unpackSensorRecord(record, text, sensorData))
+  {
+    cancelLatencyTrace();
+    return;
+  }
 
-  if (jsonDocument.containsKey("comfort_level"))
-    extractedData.comfortLevelDescription = jsonDocument["comfort_level"].as<String>();
+  if (record.versionAndFlags & RECORD_FLAG_REORDERED)
+  {
+    // 遅れて届いた初見のデータは、現在の値を古い値で上書きしないよう、順序に関係しない統計にだけ使う
+    if (isPrimarySensor(sensorData))
+    {
+      updateRunningStatistics(sensorData);
+    }
+    LOG_DEBUG("↩️ Reordered reading used for statistics only.\n");
+  }
+  else
+  {
+    // どのセンサーのデータも、登録表とランキングには反映する
+    updateSensorRegistry(sensorData);
 
-  if (jsonDocument.containsKey("timestamp"))
-    extractedData.dataTimestamp = jsonDocument["timestamp"];
+    // 大きく表示するセンサーのデータなら、現在の値を更新して画面を更新
+    if (isPrimarySensor(sensorData))
+    {
+      updateCurrentSensorData(sensorData, record);
+      stampLatencyTrace(STAMP_STATE_PUBLISHED);
+      LOG_INFO("✅ Sensor data updated: CO2=%d, THI=%.1f %s\n",
+               sensorData.carbonDioxideLevel, sensorData.thermalComfortIndex, getComfortLevelText(sensorData));
+      refreshEntireDisplay();
+    }
+  }
 
-  // データが有効であることをフラグで示す
-  extractedData.hasValidData = true;
+  // 画面に反映しなかったデータ（他のセンサーなど）の記録は捨てる
+  cancelLatencyTrace();
+}
 
-  return extractedData;
+/**
+ * @brief 快適レベルを、ログなどに出す文字列にする
+ * @return 語彙表にある言葉なら英語の名前（例：「slightly_hot」）、ない言葉なら受信した言葉、付いていなければ空文字列
+ */
+const char *getComfortLevelText(const SensorDataPacket &sensorData)
+{
+  if (sensorData.comfortLevel == COMFORT_LEVEL_OTHER)
+  {
+    return sensorData.comfortLevelText;
+  }
+  return sensorData.comfortLevel < COMFORT_LEVEL_COUNT ? COMFORT_LEVEL_NAMES[sensorData.comfortLevel] : "";
 }
 
 /**
  * @brief 現在のセンサーデータを新しいデータで更新
  * @param newSensorData 新しいセンサーデータ
+ * @param record 同じデータの詰めた形（履歴には、小数に戻す前のこちらを記録する）
  */
-void updateCurrentSensorData(const SensorDataPacket &newSensorData)
+void updateCurrentSensorData(const SensorDataPacket &newSensorData, const PackedSensorRecord &record)
 {
   // グローバル変数のセンサーデータを、新しく受信したデータで上書き
   currentSensorReading = newSensorData;
+
+  // 到着間隔と送信側のタイムスタンプを記録する（遅延・欠落の検出に使う）
+  recordSensorArrival(currentSensorFreshness, newSensorData.dataTimestamp, millis());
+
+  // 起動後・今日・直近1時間の統計を更新する（1件あたり一定の処理量）
+  updateRunningStatistics(newSensorData);
+
+  // CO2の傾向予測を更新する（時刻同期に関係なく使えるよう、起動からの経過秒で計算）
+  updateTrendForecaster(co2Forecaster, (float)newSensorData.carbonDioxideLevel, millis() / 1000);
+
+  // 時刻が同期済みなら、受信時刻で履歴バッファにも記録する
+  if (isSystemTimeSynchronized())
+  {
+    recordSensorHistorySample(record, getCurrentUnixEpochSeconds());
+  }
 }
 
 /**
@@ -1065,21 +2485,48 @@ void maintainMQTTBrokerConnection()
   if (!mqttCommunicationClient.connected())
   {
     // 切断されていれば再接続を試みる
-    Serial.println("⚠️ MQTT connection lost. Reconnecting...");
+    LOG_WARN("⚠️ MQTT connection lost. Reconnecting...\n");
+    mqttReconnectCount++;
+    traceBegin(TRACE_MQTT_CONNECT);
     establishMQTTBrokerConnection();
+    traceEnd(TRACE_MQTT_CONNECT);
+    beginSteadyStateWarmup(); // 新しい接続で初めて受信するときの確保は、定常状態のものではない
   }
 }
 
 /**
  * @brief 受信したMQTTメッセージを処理する
- * @details MQTTクライアントのloop()メソッドを呼び出し、メッセージ受信を処理します
+ * @details MQTTクライアントのloop()メソッドを、ソケットにデータが残っていて受信キューに空きがある間、
+ *          続けて呼び出します（loop()は1回に1メッセージしか読まないため）。読んだ分は最後にまとめて反映します
  */
 void processIncomingMQTTMessages()
 {
   // MQTTクライアントのループ処理を実行
   // このメソッドを定期的に呼び出すことで、新しいメッセージがないかチェックし、
   // あればhandleIncomingMQTTMessageコールバック関数を自動的に呼び出します
-  mqttCommunicationClient.loop();
+  // 1回目はデータがなくても呼ぶ（接続の維持のため）。2回目以降は、データが届いているときだけ呼ぶ
+  for (uint8_t pollCount = 0; pollCount < INGEST_QUEUE_CAPACITY && ingestQueueCount < INGEST_QUEUE_CAPACITY; pollCount++)
+  {
+    bool dataWaiting = networkWifiClient.available() > 0;
+    if (pollCount > 0 && !dataWaiting)
+    {
+      break;
+    }
+
+    // 遅延計測のため、ソケットにデータが届いていれば、その時刻を先に記録しておく
+    socketArrivalMicros = dataWaiting ? micros() : 0;
+    traceBegin(TRACE_MQTT_POLL);
+    bool stillConnected = mqttCommunicationClient.loop();
+    traceEnd(TRACE_MQTT_POLL);
+    socketArrivalMicros = 0;
+    if (!stillConnected)
+    {
+      break;
+    }
+  }
+
+  // コールバックで受信キューに入れたデータを、登録表・現在の値・履歴・画面に反映する
+  drainIngestQueue();
 }
 
 /**
@@ -1090,27 +2537,4014 @@ void updateSystemNetworkTime()
   // NTPクライアントの更新処理を実行
   // このメソッドは内部的に設定された間隔に基づいて更新処理を行います
   // （毎回サーバーにアクセスするわけではない）
-  timeClient.update();
+  // 実際に同期した場合は、同期の前後で時刻がどれだけ修正されたかを記録する
+  unsigned long epochBeforeUpdate = timeClient.getEpochTime();
+  traceBegin(TRACE_NTP_UPDATE);
+  bool timeUpdated = timeClient.update();
+  traceEnd(TRACE_NTP_UPDATE);
+  if (timeUpdated && epochBeforeUpdate > MINIMUM_VALID_EPOCH_SECONDS)
+  {
+    lastNtpCorrectionSeconds = (long)(timeClient.getEpochTime() - epochBeforeUpdate);
+  }
+
+  // 起動時にNTP同期できなかった場合は、時刻が分かった時点で履歴を読み戻す（実行は1回だけ）
+  restoreHistoryFromLog();
+
+  // 送信側の送信時刻と比べられるよう、秒が切り替わったときのmillis()を覚えておく
+  trackEpochSecondBoundary();
 }
 
 // -----------------------------------------------------------------
-// ユーティリティ関数
+// センサー履歴（リングバッファ）関連の関数
 // -----------------------------------------------------------------
 
 /**
- * @brief 接続状態メッセージを画面に表示
- * @param statusMessage 表示するメッセージ
+ * @brief 履歴バッファを空の状態に初期化する
+ * @details 全スロットに「空き」の印を付けます。メモリ確保は行いません。
  */
-void showConnectionStatusMessage(const char *statusMessage)
+void initializeSensorHistory()
 {
-  // 画面をクリア
-  clearDisplayScreenWithColor(BLACK);
+  for (size_t i = 0; i < HISTORY_SLOT_CAPACITY; i++)
+  {
+    sensorHistorySlots[i].carbonDioxidePpm = HISTORY_EMPTY_SLOT_MARKER;
+  }
+  newestHistorySlotNumber = 0;
+  sensorHistoryHasSamples = false;
 
-  // テキスト位置を設定
-  M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
+  Serial.printf("🗄️  History buffer ready: %u slots x %u bytes (%lu s per slot)\n",
+                (unsigned int)HISTORY_SLOT_CAPACITY, (unsigned int)sizeof(CompactHistorySample),
+                HISTORY_SAMPLE_PERIOD_SECONDS);
+}
 
-  // 指定されたメッセージを表示
-  M5.Display.println(statusMessage);
+/**
+ * @brief 1件のセンサーデータを履歴バッファに追加する
+ * @param record 記録するセンサーデータ（詰めた形）
+ * @param epochSeconds 記録する時刻（UNIX時刻の秒）
+ * @details 圧縮サンプルに変換してRAMの履歴に格納し、フラッシュ保存用のページバッファにも追加します
+ */
+void recordSensorHistorySample(const PackedSensorRecord &record, unsigned long epochSeconds)
+{
+  uint8_t offsetInSlot = (uint8_t)(epochSeconds % HISTORY_SAMPLE_PERIOD_SECONDS);
+
+  CompactHistorySample compressedSample = compressPackedSensorRecord(record, offsetInSlot);
+  if (!storeCompactHistorySample(compressedSample, epochSeconds))
+  {
+    return; // 保持期間より古いデータは記録しない
+  }
+
+  // 再起動しても失われないよう、フラッシュ保存用のページバッファにも追加する
+  appendHistoryLogSample(compressedSample, epochSeconds);
+}
+
+/**
+ * @brief 圧縮サンプルをRAMの履歴バッファと集計階層に格納する
+ * @param sample 格納する圧縮サンプル
+ * @param epochSeconds サンプルの時刻
+ * @return 格納できればtrue、保持期間より古ければfalse
+ * @details
+ * 時刻からスロット番号を計算し、その位置に上書きします。同じスロット内で複数受信した場合は最新の値が残ります。
+ * 新しいスロットへ進むときは、飛ばしたスロット（受信が途切れた時間帯）を空きに戻します。
+ * 空きに戻す数はバッファ容量が上限なので、1件あたりの処理量は平均して一定（O(1)）です。
+ * 受信時とフラッシュからの読み戻し時の両方で使います。
+ */
+bool storeCompactHistorySample(const CompactHistorySample &sample, unsigned long epochSeconds)
+{
+  unsigned long slotNumber = epochSeconds / HISTORY_SAMPLE_PERIOD_SECONDS;
+
+  if (!sensorHistoryHasSamples)
+  {
+    newestHistorySlotNumber = slotNumber;
+    sensorHistoryHasSamples = true;
+  }
+  else if (slotNumber > newestHistorySlotNumber)
+  {
+    // 前回から進んだ分のスロットを空きにする（最大でもバッファ1周分）
+    unsigned long skippedSlots = slotNumber - newestHistorySlotNumber;
+    if (skippedSlots > HISTORY_SLOT_CAPACITY)
+    {
+      skippedSlots = HISTORY_SLOT_CAPACITY;
+    }
+    for (unsigned long i = 1; i < skippedSlots; i++)
+    {
+      sensorHistorySlots[(slotNumber - i) % HISTORY_SLOT_CAPACITY].carbonDioxidePpm = HISTORY_EMPTY_SLOT_MARKER;
+    }
+    newestHistorySlotNumber = slotNumber;
+  }
+  else if (newestHistorySlotNumber - slotNumber >= HISTORY_SLOT_CAPACITY)
+  {
+    // 保持期間より古いデータは記録できない
+    return false;
+  }
+
+  sensorHistorySlots[slotNumber % HISTORY_SLOT_CAPACITY] = sample;
+
+  // 1分・1時間の集計階層にも同じサンプルを反映する
+  updateDownsampleTiers(sample, epochSeconds);
+  return true;
+}
+
+/**
+ * @brief 指定した時刻を含むスロットのサンプルを取得する
+ * @param epochSeconds 探したい時刻（UNIX時刻の秒）
+ * @param foundSample 見つかったサンプルの格納先
+ * @return サンプルが存在すればtrue、保持期間外または空きスロットならfalse
+ * @details 時刻から直接配列の位置を計算するため、履歴の件数に関係なく一定時間で取り出せます
+ */
+bool findSensorHistorySample(unsigned long epochSeconds, CompactHistorySample &foundSample)
+{
+  unsigned long slotNumber = epochSeconds / HISTORY_SAMPLE_PERIOD_SECONDS;
+
+  if (!sensorHistoryHasSamples || slotNumber > newestHistorySlotNumber ||
+      newestHistorySlotNumber - slotNumber >= HISTORY_SLOT_CAPACITY)
+  {
+    return false;
+  }
+
+  const CompactHistorySample &slot = sensorHistorySlots[slotNumber % HISTORY_SLOT_CAPACITY];
+  if (slot.carbonDioxidePpm == HISTORY_EMPTY_SLOT_MARKER)
+  {
+    return false;
+  }
+
+  foundSample = slot;
+  return true;
+}
+
+/**
+ * @brief 詰めた形のデータを8バイトの圧縮サンプルに変換する
+ * @param record 変換元のデータ
+ * @param offset スロット先頭からの差分秒
+ * @return 圧縮サンプル
+ * @details
+ * どちらも固定小数点の整数なので、小数の計算をせずに写すだけです。範囲外の値は表現できる最大・最小値に丸めます。
+ * JSONになかった項目は0として記録します（圧縮サンプルはフラッシュの形式でもあるので、有無のビットは持ちません）。
+ */
+CompactHistorySample compressPackedSensorRecord(const PackedSensorRecord &record, uint8_t offset)
+{
+  CompactHistorySample sample;
+
+  // CO2は0〜65534ppmに収める（65535は空きスロットの印として予約）
+  uint16_t co2 = record.carbonDioxidePpm;
+  sample.carbonDioxidePpm = co2 >= HISTORY_EMPTY_SLOT_MARKER ? HISTORY_EMPTY_SLOT_MARKER - 1 : co2;
+
+  sample.thermalComfortX10 = record.thermalComfortX10;
+  sample.temperatureX10 = record.temperatureX10;
+
+  // 湿度は0.1%刻みから0.5%刻みに四捨五入して1バイトに収める
+  uint32_t humidityX2 = ((uint32_t)record.humidityX10 * 2 + 5) / 10;
+  sample.humidityX2 = (uint8_t)(humidityX2 > UINT8_MAX ? UINT8_MAX : humidityX2);
+
+  sample.secondsIntoSlot = offset;
+  return sample;
+}
+
+// -----------------------------------------------------------------
+// ダウンサンプリング階層関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 全てのダウンサンプリング階層を空の状態に初期化する
+ */
+void initializeDownsampleTiers()
+{
+  for (size_t t = 0; t < DOWNSAMPLE_TIER_COUNT; t++)
+  {
+    DownsampleTier &tier = downsampleTiers[t];
+    for (size_t i = 0; i < tier.bucketCapacity; i++)
+    {
+      resetDownsampleBucket(tier.buckets[i]);
+    }
+    tier.newestBucketNumber = 0;
+    tier.hasBuckets = false;
+
+    Serial.printf("🗄️  Downsample tier %s: %u buckets x %lu s\n",
+                  tier.tierName, (unsigned int)tier.bucketCapacity, tier.bucketSeconds);
+  }
+}
+
+/**
+ * @brief 区間データを空（件数0）にする
+ * @param bucket 対象の区間データ
+ */
+void resetDownsampleBucket(DownsampleBucket &bucket)
+{
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    bucket.metrics[m].minimum = INT32_MAX;
+    bucket.metrics[m].maximum = INT32_MIN;
+    bucket.metrics[m].sum = 0;
+  }
+  bucket.sampleCount = 0;
+}
+
+/**
+ * @brief 1件のサンプルを全てのダウンサンプリング階層に反映する
+ * @param sample 反映する圧縮サンプル
+ * @param epochSeconds サンプルの時刻
+ * @details
+ * 各階層で該当する区間の最小・最大・合計・件数を更新するだけなので、1件あたりの処理量は一定です。
+ * 新しい区間へ進むときは、飛ばした区間を空に戻します（生データのリングバッファと同じ考え方）。
+ */
+void updateDownsampleTiers(const CompactHistorySample &sample, unsigned long epochSeconds)
+{
+  for (size_t t = 0; t < DOWNSAMPLE_TIER_COUNT; t++)
+  {
+    DownsampleTier &tier = downsampleTiers[t];
+    unsigned long bucketNumber = epochSeconds / tier.bucketSeconds;
+
+    if (!tier.hasBuckets)
+    {
+      tier.newestBucketNumber = bucketNumber;
+      tier.hasBuckets = true;
+      resetDownsampleBucket(tier.buckets[bucketNumber % tier.bucketCapacity]);
+    }
+    else if (bucketNumber > tier.newestBucketNumber)
+    {
+      // 新しい区間とその手前の飛ばした区間を空にする（最大でも1周分）
+      unsigned long advancedBuckets = bucketNumber - tier.newestBucketNumber;
+      if (advancedBuckets > tier.bucketCapacity)
+      {
+        advancedBuckets = tier.bucketCapacity;
+      }
+      for (unsigned long i = 0; i < advancedBuckets; i++)
+      {
+        resetDownsampleBucket(tier.buckets[(bucketNumber - i) % tier.bucketCapacity]);
+      }
+      tier.newestBucketNumber = bucketNumber;
+    }
+    else if (tier.newestBucketNumber - bucketNumber >= tier.bucketCapacity)
+    {
+      // この階層の保持期間より古いサンプルは反映しない
+      continue;
+    }
+
+    DownsampleBucket &bucket = tier.buckets[bucketNumber % tier.bucketCapacity];
+    if (bucket.sampleCount == UINT16_MAX)
+    {
+      continue; // 件数が上限に達した区間にはこれ以上加えない
+    }
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      int32_t value = getHistorySampleMetric(sample, (HistoryMetric)m);
+      MetricAggregate &aggregate = bucket.metrics[m];
+      if (value < aggregate.minimum)
+        aggregate.minimum = value;
+      if (value > aggregate.maximum)
+        aggregate.maximum = value;
+      aggregate.sum += value;
+    }
+    bucket.sampleCount++;
+  }
+}
+
+/**
+ * @brief 指定した時刻範囲の履歴を問い合わせる
+ * @param metric 対象の項目
+ * @param fromEpoch 範囲の開始時刻
+ * @param toEpoch 範囲の終了時刻（この時刻を含む）
+ * @param resultPoints 結果の格納先（maxPoints件分の領域が必要）
+ * @param maxPoints 返す最大件数（通常は画面の横幅）
+ * @param selectedBucketSeconds 選んだ階層の区間幅（秒）の格納先（不要ならNULL）
+ * @return 格納した件数（データのない区間は含みません）
+ * @details
+ * 範囲を maxPoints 個以下の区間で表せる、最も細かい階層（生データ → 1分 → 1時間）を自動で選びます。
+ * そのため、どのズーム倍率でも読み出す区間の数は maxPoints 以下に収まります。
+ */
+size_t queryHistoryRange(HistoryMetric metric, unsigned long fromEpoch, unsigned long toEpoch,
+                         HistoryQueryPoint *resultPoints, size_t maxPoints, unsigned long *selectedBucketSeconds)
+{
+  if (toEpoch < fromEpoch || maxPoints == 0)
+  {
+    return 0;
+  }
+  unsigned long rangeSeconds = toEpoch - fromEpoch;
+  size_t storedPoints = 0;
+
+  // まず生データで足りるかを調べる（保持期間内で、区間数がmaxPoints以下）
+  unsigned long rawSlotCount = rangeSeconds / HISTORY_SAMPLE_PERIOD_SECONDS + 1;
+  if (sensorHistoryHasSamples && rawSlotCount <= maxPoints &&
+      newestHistorySlotNumber - fromEpoch / HISTORY_SAMPLE_PERIOD_SECONDS < HISTORY_SLOT_CAPACITY)
+  {
+    if (selectedBucketSeconds != NULL)
+      *selectedBucketSeconds = HISTORY_SAMPLE_PERIOD_SECONDS;
+    for (unsigned long slot = fromEpoch / HISTORY_SAMPLE_PERIOD_SECONDS;
+         slot <= toEpoch / HISTORY_SAMPLE_PERIOD_SECONDS; slot++)
+    {
+      CompactHistorySample sample;
+      if (findSensorHistorySample(slot * HISTORY_SAMPLE_PERIOD_SECONDS, sample))
+      {
+        int32_t value = getHistorySampleMetric(sample, metric);
+        HistoryQueryPoint &point = resultPoints[storedPoints++];
+        point.bucketStartEpoch = slot * HISTORY_SAMPLE_PERIOD_SECONDS;
+        point.minimum = value;
+        point.maximum = value;
+        point.mean = value;
+        point.sampleCount = 1;
+      }
+    }
+    return storedPoints;
+  }
+
+  // 生データで足りなければ、区間数がmaxPoints以下になる最も細かい階層を使う
+  for (size_t t = 0; t < DOWNSAMPLE_TIER_COUNT; t++)
+  {
+    const DownsampleTier &tier = downsampleTiers[t];
+    unsigned long firstBucket = fromEpoch / tier.bucketSeconds;
+    unsigned long lastBucket = toEpoch / tier.bucketSeconds;
+    bool isLastTier = (t == DOWNSAMPLE_TIER_COUNT - 1);
+
+    if (lastBucket - firstBucket + 1 > maxPoints && !isLastTier)
+      continue; // 区間が多すぎるので、より粗い階層へ
+    if (tier.hasBuckets && tier.newestBucketNumber > firstBucket &&
+        tier.newestBucketNumber - firstBucket >= tier.bucketCapacity && !isLastTier)
+      continue; // 保持期間外なので、より長く保持している階層へ
+    if (!tier.hasBuckets)
+      return 0;
+    if (selectedBucketSeconds != NULL)
+      *selectedBucketSeconds = tier.bucketSeconds;
+
+    // 最も粗い階層でも収まらない場合は、新しい側のmaxPoints区間だけを返す
+    if (lastBucket - firstBucket + 1 > maxPoints)
+      firstBucket = lastBucket - maxPoints + 1;
+
+    for (unsigned long b = firstBucket; b <= lastBucket; b++)
+    {
+      if (b > tier.newestBucketNumber || tier.newestBucketNumber - b >= tier.bucketCapacity)
+        continue;
+      const DownsampleBucket &bucket = tier.buckets[b % tier.bucketCapacity];
+      if (bucket.sampleCount == 0)
+        continue;
+
+      const MetricAggregate &aggregate = bucket.metrics[metric];
+      HistoryQueryPoint &point = resultPoints[storedPoints++];
+      point.bucketStartEpoch = b * tier.bucketSeconds;
+      point.minimum = aggregate.minimum;
+      point.maximum = aggregate.maximum;
+      point.mean = aggregate.sum / (int32_t)bucket.sampleCount;
+      point.sampleCount = bucket.sampleCount;
+    }
+    return storedPoints;
+  }
+
+  return storedPoints;
+}
+
+// -----------------------------------------------------------------
+// 履歴のフラッシュ保存関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief LittleFSを準備し、保存済みの履歴ログの状態を確認する
+ * @details
+ * 起動時に読むのは各セグメントのヘッダー（20バイト）と、最新セグメントの最後の1ページだけです。
+ * 最後のページが書き込み途中で壊れていた場合は、そのセグメントを閉じて次回から新しいセグメントに書きます。
+ */
+void initializeHistoryLog()
+{
+  // LittleFSをマウント（初回などで失敗した場合はフォーマットしてから使う）
+  if (!LittleFS.begin(true))
+  {
+    Serial.println("❌ LittleFS mount failed. History will not be persisted.");
+    return;
+  }
+  historyLogAvailable = true;
+
+  if (!LittleFS.exists(HISTORY_LOG_DIRECTORY))
+  {
+    LittleFS.mkdir(HISTORY_LOG_DIRECTORY);
+  }
+
+  // フォルダ内のセグメントファイル名（16進数の通し番号）から、最古と最新の番号を調べる
+  File directory = LittleFS.open(HISTORY_LOG_DIRECTORY);
+  File entry = directory.openNextFile();
+  while (entry)
+  {
+    char *nameEnd;
+    uint32_t sequenceNumber = strtoul(entry.name(), &nameEnd, 16);
+    if (strcmp(nameEnd, ".seg") == 0)
+    {
+      if (!historyLogHasSegments || sequenceNumber < historyLogOldestSegment)
+        historyLogOldestSegment = sequenceNumber;
+      if (!historyLogHasSegments || sequenceNumber > historyLogNewestSegment)
+        historyLogNewestSegment = sequenceNumber;
+      historyLogHasSegments = true;
+    }
+    entry.close();
+    entry = directory.openNextFile();
+  }
+  directory.close();
+
+  if (!historyLogHasSegments)
+  {
+    Serial.println("🗄️  History log: empty");
+    return;
+  }
+
+  // 最新セグメントの末尾を確認する（ファイルサイズからページ数を求め、最後のページだけCRCを検証）
+  HistoryLogSegmentHeader header;
+  size_t fileSize = 0;
+  if (!readHistoryLogSegmentHeader(historyLogNewestSegment, header, fileSize))
+  {
+    historyLogNewestSegmentSealed = true;
+  }
+  else
+  {
+    size_t bodySize = fileSize - sizeof(HistoryLogSegmentHeader);
+    historyLogPagesInNewestSegment = bodySize / HISTORY_FLASH_PAGE_SIZE;
+    if (bodySize % HISTORY_FLASH_PAGE_SIZE != 0)
+    {
+      // ページの途中で書き込みが止まっている
+      historyLogNewestSegmentSealed = true;
+    }
+    else if (historyLogPagesInNewestSegment > 0)
+    {
+      char path[32];
+      buildHistoryLogSegmentPath(historyLogNewestSegment, path, sizeof(path));
+      File segmentFile = LittleFS.open(path, FILE_READ);
+      uint8_t pageData[HISTORY_FLASH_PAGE_SIZE];
+      segmentFile.seek(fileSize - HISTORY_FLASH_PAGE_SIZE);
+      size_t readBytes = segmentFile.read(pageData, sizeof(pageData));
+      segmentFile.close();
+      if (readBytes != sizeof(pageData) || !verifyHistoryLogPage(pageData))
+      {
+        historyLogNewestSegmentSealed = true;
+      }
+    }
+  }
+
+  Serial.printf("🗄️  History log: segments %08lx..%08lx, %u pages in newest%s\n",
+                (unsigned long)historyLogOldestSegment, (unsigned long)historyLogNewestSegment,
+                (unsigned int)historyLogPagesInNewestSegment,
+                historyLogNewestSegmentSealed ? " (tail damaged, sealed)" : "");
+}
+
+/**
+ * @brief 保持期間分の履歴をフラッシュからRAMの履歴バッファへ読み戻す
+ * @details
+ * まず新しいセグメントから順にヘッダーだけを読み、保持期間（24時間）の始まりを含むセグメントを探します。
+ * そこから最新までのページだけを読むので、ログ全体を読み直すことはありません。
+ * 時刻が分からないと保持期間を判断できないため、NTP同期の後に1回だけ実行します。
+ */
+void restoreHistoryFromLog()
+{
+  if (!historyLogAvailable || historyLogRestored || !isSystemTimeSynchronized())
+  {
+    return;
+  }
+  historyLogRestored = true;
+  if (!historyLogHasSegments)
+  {
+    return;
+  }
+
+  unsigned long startTime = millis();
+  unsigned long currentEpoch = getCurrentUnixEpochSeconds();
+  unsigned long minimumEpoch = currentEpoch > HISTORY_RETENTION_SECONDS ? currentEpoch - HISTORY_RETENTION_SECONDS : 0;
+
+  // 新しい順にヘッダーを読み、保持期間の始まりより前から始まるセグメントを見つける
+  uint32_t firstSegment = historyLogNewestSegment;
+  while (firstSegment > historyLogOldestSegment)
+  {
+    HistoryLogSegmentHeader header;
+    size_t fileSize;
+    if (readHistoryLogSegmentHeader(firstSegment, header, fileSize) && header.firstEpoch <= minimumEpoch)
+      break;
+    firstSegment--;
+  }
+
+  // 見つけたセグメントから最新まで、ページ単位で読み戻す
+  size_t restoredSamples = 0;
+  size_t skippedPages = 0;
+  for (uint32_t sequenceNumber = firstSegment; sequenceNumber <= historyLogNewestSegment; sequenceNumber++)
+  {
+    HistoryLogSegmentHeader header;
+    size_t fileSize;
+    if (!readHistoryLogSegmentHeader(sequenceNumber, header, fileSize))
+      continue;
+
+    char path[32];
+    buildHistoryLogSegmentPath(sequenceNumber, path, sizeof(path));
+    File segmentFile = LittleFS.open(path, FILE_READ);
+    segmentFile.seek(sizeof(HistoryLogSegmentHeader));
+
+    uint8_t pageData[HISTORY_FLASH_PAGE_SIZE];
+    while (segmentFile.read(pageData, sizeof(pageData)) == sizeof(pageData))
+    {
+      if (!verifyHistoryLogPage(pageData))
+      {
+        skippedPages++;
+        continue;
+      }
+      restoredSamples += replayHistoryLogPage(pageData, minimumEpoch);
+    }
+    segmentFile.close();
+  }
+
+  Serial.printf("🗄️  History restored: %u samples from segments %08lx..%08lx (%u bad pages) in %lu ms\n",
+                (unsigned int)restoredSamples, (unsigned long)firstSegment, (unsigned long)historyLogNewestSegment,
+                (unsigned int)skippedPages, millis() - startTime);
+}
+
+/**
+ * @brief 1件のサンプルをフラッシュ保存用のページバッファに追加する
+ * @param sample 追加する圧縮サンプル
+ * @param epochSeconds サンプルの時刻
+ * @details
+ * サンプルは時系列圧縮（Gorilla方式）でページバッファに直接書き込みます。
+ * ページが埋まったときだけフラッシュに書き込むので、1件ごとに書き込むより書き込み回数が大幅に減ります。
+ */
+void appendHistoryLogSample(const CompactHistorySample &sample, unsigned long epochSeconds)
+{
+  if (!historyLogAvailable)
+  {
+    return;
+  }
+
+  // 最悪の場合のビット数が入りきらない、件数が上限、または時刻が戻った場合は、先に今のページを書き込む
+  if (historyLogPendingCount > 0 &&
+      (historyLogPageWriter.bitPosition + GORILLA_MAX_BITS_PER_SAMPLE > historyLogPageWriter.capacityBits ||
+       historyLogPendingCount == UINT8_MAX ||
+       epochSeconds < historyLogEncoderState.previousEpoch))
+  {
+    flushHistoryLogPage();
+  }
+
+  if (historyLogPendingCount == 0)
+  {
+    historyLogPendingFirstEpoch = epochSeconds;
+    historyLogPageWriter.bitPosition = 0;
+    memset(historyLogPendingPayload, 0, sizeof(historyLogPendingPayload));
+    beginGorillaCodec(historyLogEncoderState, epochSeconds);
+  }
+
+  encodeGorillaSample(historyLogPageWriter, historyLogEncoderState, sample, epochSeconds);
+  historyLogPendingCount++;
+}
+
+/**
+ * @brief ページバッファの内容を1ページとしてフラッシュに追記する
+ * @details
+ * ページは常に固定長（余白は0埋め）で書き込み、ヘッダーにCRC32を付けます。
+ * 追記中のセグメントが満杯、または末尾が壊れていた場合は、新しいセグメントを作ってから書き込みます。
+ */
+void flushHistoryLogPage()
+{
+  if (!historyLogAvailable || historyLogPendingCount == 0)
+  {
+    return;
+  }
+  TraceSpan flashSpan(TRACE_FLASH_WRITE);
+
+  // ページを組み立てる（ヘッダー + 圧縮したビット列 + 0埋め）
+  uint8_t pageData[HISTORY_FLASH_PAGE_SIZE];
+  memset(pageData, 0, sizeof(pageData));
+
+  HistoryLogPageHeader header;
+  header.magic = HISTORY_LOG_PAGE_MAGIC;
+  header.encoding = HISTORY_LOG_ENCODING_GORILLA;
+  header.sampleCount = (uint8_t)historyLogPendingCount;
+  header.firstEpoch = historyLogPendingFirstEpoch;
+  header.payloadLength = (uint16_t)((historyLogPageWriter.bitPosition + 7) / 8);
+  header.reserved = 0;
+  memcpy(pageData + sizeof(HistoryLogPageHeader), historyLogPendingPayload, header.payloadLength);
+  header.pageCrc = calculateCRC32((const uint8_t *)&header, offsetof(HistoryLogPageHeader, pageCrc));
+  header.pageCrc = calculateCRC32(pageData + sizeof(HistoryLogPageHeader), header.payloadLength, header.pageCrc);
+  memcpy(pageData, &header, sizeof(header));
+
+  // 追記先のセグメントを開く（必要なら新しく作る）
+  File segmentFile;
+  if (!historyLogHasSegments || historyLogNewestSegmentSealed ||
+      historyLogPagesInNewestSegment >= HISTORY_FLASH_PAGES_PER_SEGMENT)
+  {
+    if (!openNextHistoryLogSegment(segmentFile, historyLogPendingFirstEpoch))
+    {
+      LOG_ERROR("❌ History log: failed to create segment.\n");
+      historyLogPendingCount = 0;
+      return;
+    }
+  }
+  else
+  {
+    char path[32];
+    buildHistoryLogSegmentPath(historyLogNewestSegment, path, sizeof(path));
+    segmentFile = LittleFS.open(path, FILE_APPEND);
+  }
+
+  size_t writtenBytes = segmentFile ? segmentFile.write(pageData, sizeof(pageData)) : 0;
+  segmentFile.close();
+
+  if (writtenBytes == sizeof(pageData))
+  {
+    historyLogPagesInNewestSegment++;
+    historyLogPagesWritten++;
+    historyLogSamplesWritten += historyLogPendingCount;
+    historyLogPhysicalBytesWritten += sizeof(pageData);
+  }
+  else
+  {
+    // 書き込みに失敗したセグメントには以後追記しない
+    LOG_ERROR("❌ History log: page write failed.\n");
+    historyLogNewestSegmentSealed = true;
+  }
+
+  historyLogPendingCount = 0;
+  lastHistoryLogFlushTime = millis();
+}
+
+/**
+ * @brief ページが埋まっていなくても、一定時間ごとにページバッファを書き込む
+ * @details 電源が切れたときに失われるデータを、最大でもHISTORY_FLASH_FLUSH_INTERVAL_MILLISECONDS分に抑えます
+ */
+void flushHistoryLogIfIntervalElapsed()
+{
+  if (historyLogPendingCount > 0 && millis() - lastHistoryLogFlushTime >= HISTORY_FLASH_FLUSH_INTERVAL_MILLISECONDS)
+  {
+    flushHistoryLogPage();
+  }
+}
+
+/**
+ * @brief 新しいセグメントファイルを作成し、ヘッダーを書き込む
+ * @param segmentFile 作成したファイル（追記できる状態で開いたまま返します）
+ * @param firstEpoch このセグメントの最初のサンプルの時刻
+ * @return 作成できればtrue
+ * @details セグメント数が上限を超えた場合は、最も古いセグメントから削除します
+ */
+bool openNextHistoryLogSegment(File &segmentFile, unsigned long firstEpoch)
+{
+  uint32_t sequenceNumber = historyLogHasSegments ? historyLogNewestSegment + 1 : 0;
+
+  char path[32];
+  buildHistoryLogSegmentPath(sequenceNumber, path, sizeof(path));
+  segmentFile = LittleFS.open(path, FILE_WRITE);
+  if (!segmentFile)
+  {
+    return false;
+  }
+
+  HistoryLogSegmentHeader header;
+  header.magic = HISTORY_LOG_SEGMENT_MAGIC;
+  header.formatVersion = HISTORY_LOG_FORMAT_VERSION;
+  header.pageSize = (uint16_t)HISTORY_FLASH_PAGE_SIZE;
+  header.sequenceNumber = sequenceNumber;
+  header.firstEpoch = firstEpoch;
+  header.headerCrc = calculateCRC32((const uint8_t *)&header, offsetof(HistoryLogSegmentHeader, headerCrc));
+  if (segmentFile.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+  {
+    segmentFile.close();
+    return false;
+  }
+  historyLogPhysicalBytesWritten += sizeof(header);
+
+  if (!historyLogHasSegments)
+  {
+    historyLogOldestSegment = sequenceNumber;
+  }
+  historyLogHasSegments = true;
+  historyLogNewestSegment = sequenceNumber;
+  historyLogPagesInNewestSegment = 0;
+  historyLogNewestSegmentSealed = false;
+
+  // 上限を超えた古いセグメントを削除する（同じ領域への書き込みが偏らないよう、順番に使い回す）
+  while (historyLogNewestSegment - historyLogOldestSegment + 1 > HISTORY_FLASH_MAX_SEGMENTS)
+  {
+    char oldPath[32];
+    buildHistoryLogSegmentPath(historyLogOldestSegment, oldPath, sizeof(oldPath));
+    LittleFS.remove(oldPath);
+    historyLogOldestSegment++;
+  }
+
+  return true;
+}
+
+/**
+ * @brief セグメントファイルのヘッダーを読み、正しいか確認する
+ * @param sequenceNumber セグメントの通し番号
+ * @param header 読み込んだヘッダーの格納先
+ * @param fileSize ファイルサイズの格納先
+ * @return ヘッダーが正しければtrue
+ */
+bool readHistoryLogSegmentHeader(uint32_t sequenceNumber, HistoryLogSegmentHeader &header, size_t &fileSize)
+{
+  char path[32];
+  buildHistoryLogSegmentPath(sequenceNumber, path, sizeof(path));
+  File segmentFile = LittleFS.open(path, FILE_READ);
+  if (!segmentFile)
+  {
+    return false;
+  }
+
+  fileSize = segmentFile.size();
+  size_t readBytes = segmentFile.read((uint8_t *)&header, sizeof(header));
+  segmentFile.close();
+
+  return readBytes == sizeof(header) &&
+         header.magic == HISTORY_LOG_SEGMENT_MAGIC &&
+         header.formatVersion == HISTORY_LOG_FORMAT_VERSION &&
+         header.pageSize == HISTORY_FLASH_PAGE_SIZE &&
+         header.sequenceNumber == sequenceNumber &&
+         header.headerCrc == calculateCRC32((const uint8_t *)&header, offsetof(HistoryLogSegmentHeader, headerCrc));
+}
+
+/**
+ * @brief ページのヘッダーとCRC32を検証する
+ * @param pageData 1ページ分のデータ
+ * @return 壊れていなければtrue
+ */
+bool verifyHistoryLogPage(const uint8_t *pageData)
+{
+  HistoryLogPageHeader header;
+  memcpy(&header, pageData, sizeof(header));
+
+  if (header.magic != HISTORY_LOG_PAGE_MAGIC || header.payloadLength > HISTORY_LOG_PAGE_PAYLOAD_SIZE)
+  {
+    return false;
+  }
+
+  uint32_t crc = calculateCRC32(pageData, offsetof(HistoryLogPageHeader, pageCrc));
+  crc = calculateCRC32(pageData + sizeof(HistoryLogPageHeader), header.payloadLength, crc);
+  return crc == header.pageCrc;
+}
+
+/**
+ * @brief 検証済みのページに入っているサンプルをRAMの履歴へ戻す
+ * @param pageData 1ページ分のデータ
+ * @param minimumEpoch これより古いサンプルは読み飛ばす
+ * @return 戻したサンプル数
+ */
+size_t replayHistoryLogPage(const uint8_t *pageData, unsigned long minimumEpoch)
+{
+  HistoryLogPageHeader header;
+  memcpy(&header, pageData, sizeof(header));
+  const uint8_t *payload = pageData + sizeof(HistoryLogPageHeader);
+  size_t restoredCount = 0;
+
+  if (header.encoding == HISTORY_LOG_ENCODING_GORILLA)
+  {
+    // 圧縮ページ：先頭から順に1サンプルずつ復元する
+    BitStreamReader reader = {payload, (size_t)header.payloadLength * 8, 0, false};
+    GorillaCodecState decoderState;
+    beginGorillaCodec(decoderState, header.firstEpoch);
+    for (uint8_t i = 0; i < header.sampleCount; i++)
+    {
+      CompactHistorySample sample;
+      unsigned long epochSeconds;
+      if (!decodeGorillaSample(reader, decoderState, sample, epochSeconds))
+        break;
+      if (epochSeconds >= minimumEpoch && storeCompactHistorySample(sample, epochSeconds))
+        restoredCount++;
+    }
+  }
+  // それ以外の知らない形式のページは読み飛ばす
+
+  return restoredCount;
+}
+
+/**
+ * @brief セグメントのファイル名を作る
+ * @param sequenceNumber セグメントの通し番号
+ * @param pathBuffer ファイル名の格納先
+ * @param bufferSize 格納先の大きさ
+ * @details 例：通し番号26 → "/history/0000001a.seg"
+ */
+void buildHistoryLogSegmentPath(uint32_t sequenceNumber, char *pathBuffer, size_t bufferSize)
+{
+  snprintf(pathBuffer, bufferSize, "%s/%08lx.seg", HISTORY_LOG_DIRECTORY, (unsigned long)sequenceNumber);
+}
+
+/**
+ * @brief 履歴ログの保存状況と書き込み増幅率をシリアルに出力する
+ * @details
+ * 書き込み増幅率 = 実際にフラッシュへ書いたバイト数 ÷ サンプル本体のバイト数。
+ * ページヘッダー、時刻の差分、セグメントヘッダー、途中で書き込んだページの余白がこの比率を押し上げます。
+ * シリアルモニタで「flash」と入力すると呼び出されます。
+ */
+void printHistoryLogStatus()
+{
+  Serial.println("--- History Log (LittleFS) ---");
+  if (!historyLogAvailable)
+  {
+    Serial.println("Not available");
+    return;
+  }
+
+  uint32_t logicalBytes = historyLogSamplesWritten * sizeof(CompactHistorySample);
+  Serial.printf("Segments: %08lx..%08lx (%lu files, %u pages in newest)\n",
+                (unsigned long)historyLogOldestSegment, (unsigned long)historyLogNewestSegment,
+                historyLogHasSegments ? (unsigned long)(historyLogNewestSegment - historyLogOldestSegment + 1) : 0UL,
+                (unsigned int)historyLogPagesInNewestSegment);
+  Serial.printf("Pending: %u samples, %u / %u bits\n", (unsigned int)historyLogPendingCount,
+                (unsigned int)historyLogPageWriter.bitPosition, (unsigned int)historyLogPageWriter.capacityBits);
+  Serial.printf("Written since boot: %lu samples, %lu pages, %lu bytes (%.1f bits/sample on flash)\n",
+                (unsigned long)historyLogSamplesWritten, (unsigned long)historyLogPagesWritten,
+                (unsigned long)historyLogPhysicalBytesWritten,
+                historyLogSamplesWritten > 0 ? historyLogPhysicalBytesWritten * 8.0f / historyLogSamplesWritten : 0.0f);
+  Serial.printf("Write amplification: %.2f (%u bytes per sample)\n",
+                logicalBytes > 0 ? (float)historyLogPhysicalBytesWritten / logicalBytes : 0.0f,
+                (unsigned int)sizeof(CompactHistorySample));
+  Serial.printf("LittleFS: %u / %u bytes used\n", (unsigned int)LittleFS.usedBytes(), (unsigned int)LittleFS.totalBytes());
+  Serial.println("------------------------------");
+}
+
+/**
+ * @brief CRC32（IEEE 802.3と同じ方式）を計算する
+ * @param data 対象のデータ
+ * @param length データの長さ
+ * @param crc 前回までの計算結果（続けて計算する場合に指定。最初は0）
+ * @return CRC32の値
+ */
+uint32_t calculateCRC32(const uint8_t *data, size_t length, uint32_t crc)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1UL)));
+    }
+  }
+  return ~crc;
+}
+
+// -----------------------------------------------------------------
+// 時系列圧縮（Gorilla方式）関連の関数
+// -----------------------------------------------------------------
+// 符号化・復号そのものは history_codec.h にあります。
+
+/**
+ * @brief RAMに記録済みの履歴を使って、圧縮率と圧縮・復元の速度を測る
+ * @details
+ * 実際に受信した履歴（最大24時間分）をページ単位で圧縮し、1サンプルあたりのビット数と処理速度を出力します。
+ * 復元した値が元と一致するかも確認します。シリアルモニタで「bench codec」と入力すると呼び出されます。
+ */
+void runHistoryCodecBenchmark()
+{
+  uint8_t payload[HISTORY_LOG_PAGE_PAYLOAD_SIZE];
+  BitStreamWriter writer = {payload, sizeof(payload) * 8, 0};
+  GorillaCodecState encoderState;
+  GorillaCodecState decoderState;
+
+  size_t totalSamples = 0;
+  size_t totalPages = 0;
+  size_t totalBits = 0;
+  size_t mismatches = 0;
+  unsigned long encodeMicros = 0;
+  unsigned long decodeMicros = 0;
+
+  // ページ1枚分ずつ圧縮し、すぐに復元して比較する
+  unsigned long oldestSlot = newestHistorySlotNumber >= HISTORY_SLOT_CAPACITY ? newestHistorySlotNumber - HISTORY_SLOT_CAPACITY + 1 : 0;
+  unsigned long slot = oldestSlot;
+  while (sensorHistoryHasSamples && slot <= newestHistorySlotNumber)
+  {
+    CompactHistorySample pageSamples[UINT8_MAX];
+    unsigned long pageEpochs[UINT8_MAX];
+    size_t pageCount = 0;
+
+    memset(payload, 0, sizeof(payload));
+    writer.bitPosition = 0;
+
+    unsigned long startMicros = micros();
+    for (; slot <= newestHistorySlotNumber && pageCount < UINT8_MAX; slot++)
+    {
+      const CompactHistorySample &sample = sensorHistorySlots[slot % HISTORY_SLOT_CAPACITY];
+      if (sample.carbonDioxidePpm == HISTORY_EMPTY_SLOT_MARKER)
+        continue;
+      if (writer.bitPosition + GORILLA_MAX_BITS_PER_SAMPLE > writer.capacityBits)
+        break;
+      unsigned long epochSeconds = slot * HISTORY_SAMPLE_PERIOD_SECONDS + sample.secondsIntoSlot;
+      if (pageCount == 0)
+        beginGorillaCodec(encoderState, epochSeconds);
+      encodeGorillaSample(writer, encoderState, sample, epochSeconds);
+      pageSamples[pageCount] = sample;
+      pageEpochs[pageCount] = epochSeconds;
+      pageCount++;
+    }
+    encodeMicros += micros() - startMicros;
+
+    if (pageCount == 0)
+      continue;
+
+    startMicros = micros();
+    BitStreamReader reader = {payload, writer.bitPosition, 0, false};
+    beginGorillaCodec(decoderState, pageEpochs[0]);
+    for (size_t i = 0; i < pageCount; i++)
+    {
+      CompactHistorySample decoded;
+      unsigned long decodedEpoch;
+      if (!decodeGorillaSample(reader, decoderState, decoded, decodedEpoch) ||
+          decodedEpoch != pageEpochs[i] || memcmp(&decoded, &pageSamples[i], sizeof(decoded)) != 0)
+      {
+        mismatches++;
+      }
+    }
+    decodeMicros += micros() - startMicros;
+
+    totalSamples += pageCount;
+    totalBits += writer.bitPosition;
+    totalPages++;
+  }
+
+  Serial.println("--- History Codec Benchmark ---");
+  if (totalSamples == 0)
+  {
+    Serial.println("No recorded samples yet.");
+    return;
+  }
+  Serial.printf("Samples: %u in %u pages (%.1f samples/page)\n", (unsigned int)totalSamples,
+                (unsigned int)totalPages, (float)totalSamples / totalPages);
+  Serial.printf("Size: %.2f bits/sample (raw %u bits, ratio %.1fx)\n", (float)totalBits / totalSamples,
+                (unsigned int)(sizeof(CompactHistorySample) * 8),
+                (float)(totalSamples * sizeof(CompactHistorySample) * 8) / totalBits);
+  Serial.printf("Encode: %.0f samples/s, Decode: %.0f samples/s\n",
+                encodeMicros > 0 ? totalSamples * 1e6f / encodeMicros : 0.0f,
+                decodeMicros > 0 ? totalSamples * 1e6f / decodeMicros : 0.0f);
+  Serial.printf("Round-trip mismatches: %u\n", (unsigned int)mismatches);
+  Serial.println("-------------------------------");
+}
+
+// -----------------------------------------------------------------
+// 逐次統計関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 全項目の統計を空（件数0）にする
+ * @param statistics 項目数分の統計の配列
+ */
+void resetRunningStatistics(RunningStatistics *statistics)
+{
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    statistics[m].count = 0;
+    statistics[m].mean = 0.0f;
+    statistics[m].m2 = 0.0f;
+    statistics[m].minimum = 0.0f;
+    statistics[m].maximum = 0.0f;
+  }
+}
+
+/**
+ * @brief 1つの値を統計に加える（Welford法）
+ * @param statistics 更新する統計
+ * @param value 新しい値
+ * @details 合計を持たずに平均を少しずつ動かすため、件数が多くなっても誤差がたまりにくい方法です
+ */
+void addRunningStatisticsSample(RunningStatistics &statistics, float value)
+{
+  statistics.count++;
+  if (statistics.count == 1)
+  {
+    statistics.minimum = value;
+    statistics.maximum = value;
+  }
+  else
+  {
+    if (value < statistics.minimum)
+      statistics.minimum = value;
+    if (value > statistics.maximum)
+      statistics.maximum = value;
+  }
+
+  float deltaBefore = value - statistics.mean;
+  statistics.mean += deltaBefore / statistics.count;
+  float deltaAfter = value - statistics.mean;
+  statistics.m2 += deltaBefore * deltaAfter;
+}
+
+/**
+ * @brief 2つの統計を1つに合算する（Chanの並列アルゴリズム）
+ * @param target 合算先の統計（結果で上書きされます）
+ * @param source 加える統計
+ * @details 元のデータを持っていなくても、件数・平均・m2だけから合算後の平均と分散を求められます
+ */
+void mergeRunningStatistics(RunningStatistics &target, const RunningStatistics &source)
+{
+  if (source.count == 0)
+    return;
+  if (target.count == 0)
+  {
+    target = source;
+    return;
+  }
+
+  uint32_t combinedCount = target.count + source.count;
+  float delta = source.mean - target.mean;
+  target.mean += delta * source.count / combinedCount;
+  target.m2 += source.m2 + delta * delta * ((float)target.count * source.count / combinedCount);
+  target.count = combinedCount;
+  if (source.minimum < target.minimum)
+    target.minimum = source.minimum;
+  if (source.maximum > target.maximum)
+    target.maximum = source.maximum;
+}
+
+/**
+ * @brief 受信したセンサーデータを、起動後・今日・直近1時間の統計に反映する
+ * @param sensorData 新しいセンサーデータ
+ * @details 時刻が未同期の間は、期間の区切りが分からないため「起動後」だけを更新します
+ */
+void updateRunningStatistics(const SensorDataPacket &sensorData)
+{
+  bool timeIsValid = isSystemTimeSynchronized();
+  unsigned long epochSeconds = getCurrentUnixEpochSeconds();
+
+  // 日付が変わったら「今日」の統計をやり直す（日付の区切りは日本時間の0時）
+  if (timeIsValid)
+  {
+    unsigned long dayNumber = (epochSeconds + JAPAN_TIME_OFFSET_SECONDS) / STATISTICS_DAY_LENGTH_SECONDS;
+    if (dayNumber != todayStatisticsDayNumber)
+    {
+      resetRunningStatistics(todayStatistics);
+      todayStatisticsDayNumber = dayNumber;
+    }
+  }
+
+  // 直近窓では、今の小区間が前回使っていたものと違えば空にしてから使う
+  unsigned long partialNumber = epochSeconds / STATISTICS_SUBWINDOW_SECONDS;
+  size_t partialIndex = partialNumber % STATISTICS_RECENT_SUBWINDOW_COUNT;
+  if (timeIsValid && recentStatisticsPartialNumbers[partialIndex] != partialNumber)
+  {
+    resetRunningStatistics(recentStatisticsPartials[partialIndex]);
+    recentStatisticsPartialNumbers[partialIndex] = partialNumber;
+  }
+
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    float value = getSensorPacketMetric(sensorData, (HistoryMetric)m);
+    addRunningStatisticsSample(sinceBootStatistics[m], value);
+    if (timeIsValid)
+    {
+      addRunningStatisticsSample(todayStatistics[m], value);
+      addRunningStatisticsSample(recentStatisticsPartials[partialIndex][m], value);
+    }
+  }
+}
+
+/**
+ * @brief 直近窓に含まれる小区間の統計を合算する
+ * @param mergedStatistics 合算結果の格納先（項目数分の配列）
+ * @details 合算するのは小区間の数（既定で12個）だけで、個々のサンプルは読み直しません
+ */
+void collectRecentStatistics(RunningStatistics *mergedStatistics)
+{
+  resetRunningStatistics(mergedStatistics);
+  if (!isSystemTimeSynchronized())
+    return;
+
+  unsigned long currentPartialNumber = getCurrentUnixEpochSeconds() / STATISTICS_SUBWINDOW_SECONDS;
+  for (size_t i = 0; i < STATISTICS_RECENT_SUBWINDOW_COUNT; i++)
+  {
+    // 窓の外に出た古い小区間は合算しない
+    if (currentPartialNumber - recentStatisticsPartialNumbers[i] >= STATISTICS_RECENT_SUBWINDOW_COUNT)
+      continue;
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      mergeRunningStatistics(mergedStatistics[m], recentStatisticsPartials[i][m]);
+    }
+  }
+}
+
+/**
+ * @brief センサーデータから指定した項目の値を取り出す
+ * @param sensorData センサーデータ
+ * @param metric 取り出す項目
+ * @return 項目の値（実際の単位）
+ */
+float getSensorPacketMetric(const SensorDataPacket &sensorData, HistoryMetric metric)
+{
+  switch (metric)
+  {
+  case METRIC_CO2:
+    return (float)sensorData.carbonDioxideLevel;
+  case METRIC_THI:
+    return sensorData.thermalComfortIndex;
+  case METRIC_TEMPERATURE:
+    return sensorData.ambientTemperature;
+  case METRIC_HUMIDITY:
+    return sensorData.relativeHumidity;
+  default:
+    return 0.0f;
+  }
+}
+
+/**
+ * @brief 統計から標準偏差を求める
+ * @param statistics 対象の統計
+ * @return 標準偏差（サンプルが2件未満なら0）
+ */
+float calculateStandardDeviation(const RunningStatistics &statistics)
+{
+  if (statistics.count < 2)
+    return 0.0f;
+  return sqrtf(statistics.m2 / statistics.count);
+}
+
+/**
+ * @brief 全期間・全項目の統計をシリアルに出力する
+ * @details シリアルモニタで「stats」と入力すると呼び出されます
+ */
+void printRunningStatistics()
+{
+  RunningStatistics recentStatistics[HISTORY_METRIC_COUNT];
+  collectRecentStatistics(recentStatistics);
+
+  const char *windowNames[] = {"Since boot", "Today", "Last hour"};
+  const RunningStatistics *windows[] = {sinceBootStatistics, todayStatistics, recentStatistics};
+
+  Serial.println("--- Sensor Statistics ---");
+  for (int w = 0; w < 3; w++)
+  {
+    Serial.printf("[%s]\n", windowNames[w]);
+    for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+    {
+      const RunningStatistics &statistics = windows[w][m];
+      Serial.printf("  %-5s n=%-6lu min=%8.1f max=%8.1f mean=%8.2f sd=%7.2f\n",
+                    HISTORY_METRIC_NAMES[m], (unsigned long)statistics.count, statistics.minimum,
+                    statistics.maximum, statistics.mean, calculateStandardDeviation(statistics));
+    }
+  }
+  Serial.println("-------------------------");
+}
+
+// -----------------------------------------------------------------
+// 履歴問い合わせ（MQTT）関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief MQTTで届いた履歴の問い合わせを受け付ける
+ * @param requestJson 問い合わせ内容のJSON（解析中に書き換わります）
+ * @details
+ * 例：{"id":7,"metric":"co2","from":1720000000,"to":1720086400,"resolution":300}
+ * from / to はUNIX時刻（協定世界時の秒）です。to を省略すると現在時刻、from を省略すると to の1時間前になります。
+ * resolution（秒）を省略すると、HISTORY_QUERY_MAX_POINTS件以内で最も細かい区間幅になります。
+ * 集計済みの階層から結果を作るだけなので、ここで重い処理は発生しません。送信はループの中で少しずつ行います。
+ */
+void handleHistoryQueryRequest(char *requestJson)
+{
+  StaticJsonDocument<256> requestDocument;
+  DeserializationError parseError = deserializeJson(requestDocument, requestJson);
+  uint16_t requestId = requestDocument["id"] | 0;
+
+  if (parseError || historyQuerySession.active)
+  {
+    // 内容が読めない、または別の問い合わせに応答中
+    latchHistoryQueryError(requestId, parseError ? HISTORY_QUERY_ERROR_INVALID_JSON : HISTORY_QUERY_ERROR_BUSY);
+    return;
+  }
+
+  // 項目名を調べる（見つからなければエラー）
+  const char *metricKey = requestDocument["metric"] | "co2";
+  int metric = -1;
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    if (strcmp(metricKey, HISTORY_METRIC_KEYS[m]) == 0)
+      metric = m;
+  }
+  unsigned long toEpoch = requestDocument["to"] | getCurrentUnixEpochSeconds();
+  unsigned long fromEpoch = requestDocument["from"] | (toEpoch > 3600 ? toEpoch - 3600 : 0);
+  unsigned long resolution = requestDocument["resolution"] | 0UL;
+  if (metric < 0 || fromEpoch > toEpoch)
+  {
+    latchHistoryQueryError(requestId, HISTORY_QUERY_ERROR_INVALID_RANGE);
+    return;
+  }
+
+  // 区間幅の指定があれば、その幅で範囲を割った件数を上限にする
+  size_t maxPoints = HISTORY_QUERY_MAX_POINTS;
+  if (resolution > 0 && (toEpoch - fromEpoch) / resolution + 1 < maxPoints)
+  {
+    maxPoints = (toEpoch - fromEpoch) / resolution + 1;
+  }
+
+  historyQuerySession.active = true;
+  historyQuerySession.requestId = requestId;
+  historyQuerySession.metric = (HistoryMetric)metric;
+  historyQuerySession.bucketSeconds = 0;
+  historyQuerySession.pointCount = queryHistoryRange((HistoryMetric)metric, fromEpoch, toEpoch, historyQueryResults,
+                                                     maxPoints, &historyQuerySession.bucketSeconds);
+  historyQuerySession.nextPointIndex = 0;
+  historyQuerySession.nextChunkIndex = 0;
+  historyQuerySession.startMillis = millis();
+  historyQuerySession.lastChunkMillis = 0;
+  historyQuerySession.bytesSent = 0;
+  historyQuerySession.loopCount = 0;
+  historyQuerySession.loopMicrosSum = 0;
+  historyQuerySession.loopMicrosMax = 0;
+
+  LOG_INFO("📤 History query #%u: %s %lu..%lu -> %u points @ %lu s\n", requestId, metricKey, fromEpoch, toEpoch,
+           (unsigned int)historyQuerySession.pointCount, historyQuerySession.bucketSeconds);
+}
+
+/**
+ * @brief 問い合わせを処理できなかったことを記録し、ループの中で送るエラー応答を待たせる
+ * @param requestId 問い合わせ番号
+ * @param reason 処理できなかった理由
+ * @details 送信待ちのエラーが残っている間に次のエラーが来た場合は、新しい方で上書きします（古い方はログに残します）
+ */
+void latchHistoryQueryError(uint16_t requestId, HistoryQueryErrorReason reason)
+{
+  if (pendingHistoryQueryError.reason != HISTORY_QUERY_ERROR_NONE)
+  {
+    LOG_WARN("⚠️ History query #%u error dropped (superseded by #%u).\n", pendingHistoryQueryError.requestId, requestId);
+  }
+  LOG_WARN("❌ History query #%u rejected (%s).\n", requestId, HISTORY_QUERY_ERROR_REASON_NAMES[reason]);
+  pendingHistoryQueryError.reason = reason;
+  pendingHistoryQueryError.requestId = requestId;
+}
+
+/**
+ * @brief 送信待ちのエラー応答か、応答中の問い合わせの次のチャンクを1つだけ送る
+ * @details
+ * 1回のループで送るのは1チャンクだけで、前回から一定時間（HISTORY_RESPONSE_CHUNK_INTERVAL_MILLISECONDS）空けます。
+ * エラー応答は受信コールバックの外で送るため、ここで先に送ります（送れなければ次のループで送り直します）。
+ * 全て送り終えたら、送信量とループ処理時間の統計をシリアルに出力します。
+ */
+void continueHistoryQueryResponse()
+{
+  if (!mqttCommunicationClient.connected())
+  {
+    return;
+  }
+  if (pendingHistoryQueryError.reason != HISTORY_QUERY_ERROR_NONE)
+  {
+    if (publishHistoryQueryError(pendingHistoryQueryError.requestId))
+    {
+      pendingHistoryQueryError.reason = HISTORY_QUERY_ERROR_NONE;
+    }
+    return;
+  }
+  if (!historyQuerySession.active)
+  {
+    return;
+  }
+  if (millis() - historyQuerySession.lastChunkMillis < HISTORY_RESPONSE_CHUNK_INTERVAL_MILLISECONDS)
+  {
+    return;
+  }
+
+  if (!publishHistoryResponseChunk(0))
+  {
+    return; // 送信バッファがいっぱいなどで失敗した場合は、次のループで同じチャンクを送り直す
+  }
+
+  if (historyQuerySession.nextPointIndex >= historyQuerySession.pointCount)
+  {
+    unsigned long elapsedMillis = millis() - historyQuerySession.startMillis;
+    LOG_INFO("📤 History query #%u done: %u chunks, %lu bytes in %lu ms (%.0f B/s), loop avg %lu us / max %lu us\n",
+             historyQuerySession.requestId, historyQuerySession.nextChunkIndex,
+             (unsigned long)historyQuerySession.bytesSent, elapsedMillis,
+             elapsedMillis > 0 ? historyQuerySession.bytesSent * 1000.0f / elapsedMillis : 0.0f,
+             historyQuerySession.loopCount > 0 ? (unsigned long)(historyQuerySession.loopMicrosSum / historyQuerySession.loopCount) : 0UL,
+             (unsigned long)historyQuerySession.loopMicrosMax);
+    historyQuerySession.active = false;
+  }
+}
+
+/**
+ * @brief 結果の続きから、1チャンクに入るだけ圧縮して送信する
+ * @param flags 追加で立てるフラグ
+ * @return 送信できればtrue
+ * @details チャンクの大きさは、MQTTクライアントの送信バッファ（トピック名などを除いた残り）を超えないように決めます
+ */
+bool publishHistoryResponseChunk(uint8_t flags)
+{
+  // 送信バッファの大きさから、ヘッダー（固定部5バイト + トピック長2バイト + トピック名）を除いた分が使える
+  size_t packetOverhead = 5 + 2 + strlen(MQTT_HISTORY_RESPONSE_TOPIC);
+  size_t chunkLimit = HISTORY_RESPONSE_CHUNK_MAX_BYTES;
+  if (mqttCommunicationClient.getBufferSize() < chunkLimit + packetOverhead)
+  {
+    chunkLimit = mqttCommunicationClient.getBufferSize() - packetOverhead;
+  }
+
+  uint8_t chunk[HISTORY_RESPONSE_CHUNK_MAX_BYTES];
+  memset(chunk, 0, sizeof(chunk));
+  BitStreamWriter writer = {chunk + HISTORY_RESPONSE_HEADER_SIZE, (chunkLimit - HISTORY_RESPONSE_HEADER_SIZE) * 8, 0};
+  size_t firstIndex = historyQuerySession.nextPointIndex;
+  size_t index = firstIndex;
+  unsigned long firstEpoch = index < historyQuerySession.pointCount ? historyQueryResults[index].bucketStartEpoch : 0;
+
+  // 「1区間前に、区間幅の間隔で結果があった」ことにして始めると、先頭の1件の時刻も「0」の1ビットで済む
+  HistoryQueryCodecState state;
+  state.previousInterval = (long)historyQuerySession.bucketSeconds;
+  state.previousEpoch = firstEpoch - historyQuerySession.bucketSeconds;
+  for (int f = 0; f < HISTORY_QUERY_FIELD_COUNT; f++)
+  {
+    state.previousFields[f] = 0;
+  }
+
+  // 最悪の場合のビット数が入る間は、結果を詰め込む（1チャンク最大255件）
+  while (index < historyQuerySession.pointCount && index - firstIndex < UINT8_MAX &&
+         writer.bitPosition + HISTORY_QUERY_MAX_BITS_PER_POINT <= writer.capacityBits)
+  {
+    encodeHistoryQueryPoint(writer, state, historyQueryResults[index]);
+    index++;
+  }
+  if (index >= historyQuerySession.pointCount)
+  {
+    flags |= HISTORY_RESPONSE_FLAG_LAST;
+  }
+
+  // ヘッダーを書き込む
+  chunk[0] = HISTORY_RESPONSE_MAGIC;
+  chunk[1] = HISTORY_RESPONSE_VERSION;
+  chunk[2] = (uint8_t)(historyQuerySession.requestId & 0xFF);
+  chunk[3] = (uint8_t)(historyQuerySession.requestId >> 8);
+  chunk[4] = (uint8_t)(historyQuerySession.nextChunkIndex & 0xFF);
+  chunk[5] = (uint8_t)(historyQuerySession.nextChunkIndex >> 8);
+  chunk[6] = flags;
+  chunk[7] = (uint8_t)historyQuerySession.metric;
+  chunk[8] = (uint8_t)(index - firstIndex);
+  for (int i = 0; i < 4; i++)
+  {
+    chunk[9 + i] = (uint8_t)(historyQuerySession.bucketSeconds >> (8 * i));
+    chunk[13 + i] = (uint8_t)(firstEpoch >> (8 * i));
+  }
+
+  size_t chunkLength = HISTORY_RESPONSE_HEADER_SIZE + (writer.bitPosition + 7) / 8;
+  traceBegin(TRACE_MQTT_PUBLISH, chunkLength);
+  bool published = mqttCommunicationClient.publish(MQTT_HISTORY_RESPONSE_TOPIC, chunk, chunkLength);
+  traceEnd(TRACE_MQTT_PUBLISH);
+  if (!published)
+  {
+    return false;
+  }
+
+  historyQuerySession.nextPointIndex = index;
+  historyQuerySession.nextChunkIndex++;
+  historyQuerySession.lastChunkMillis = millis();
+  historyQuerySession.bytesSent += chunkLength;
+  return true;
+}
+
+/**
+ * @brief 問い合わせを処理できなかったことを、エラーフラグ付きの空チャンクで返す
+ * @param requestId 問い合わせ番号
+ * @return 送信できればtrue
+ */
+bool publishHistoryQueryError(uint16_t requestId)
+{
+  uint8_t chunk[HISTORY_RESPONSE_HEADER_SIZE];
+  memset(chunk, 0, sizeof(chunk));
+  chunk[0] = HISTORY_RESPONSE_MAGIC;
+  chunk[1] = HISTORY_RESPONSE_VERSION;
+  chunk[2] = (uint8_t)(requestId & 0xFF);
+  chunk[3] = (uint8_t)(requestId >> 8);
+  chunk[6] = HISTORY_RESPONSE_FLAG_LAST | HISTORY_RESPONSE_FLAG_ERROR;
+  traceBegin(TRACE_MQTT_PUBLISH, sizeof(chunk));
+  bool published = mqttCommunicationClient.publish(MQTT_HISTORY_RESPONSE_TOPIC, chunk, sizeof(chunk));
+  traceEnd(TRACE_MQTT_PUBLISH);
+  return published;
+}
+
+/**
+ * @brief 問い合わせ結果1件を圧縮してビット列に書き込む
+ * @param writer 書き込み先
+ * @param state 直前の結果の状態（書き込み後に更新されます）
+ * @param point 書き込む結果
+ */
+void encodeHistoryQueryPoint(BitStreamWriter &writer, HistoryQueryCodecState &state, const HistoryQueryPoint &point)
+{
+  // 時刻：区間の間隔の変化（データの欠けがなければ0）
+  long interval = (long)(point.bucketStartEpoch - state.previousEpoch);
+  writeVariableLengthDelta(writer, (int32_t)(interval - state.previousInterval), GORILLA_TIMESTAMP_BUCKET_BITS);
+  state.previousInterval = interval;
+  state.previousEpoch = point.bucketStartEpoch;
+
+  // 値：前回の結果との差（HistoryQueryField の順）
+  int32_t fields[HISTORY_QUERY_FIELD_COUNT];
+  fields[QUERY_FIELD_MEAN] = point.mean;
+  fields[QUERY_FIELD_MINIMUM] = point.minimum;
+  fields[QUERY_FIELD_MAXIMUM] = point.maximum;
+  fields[QUERY_FIELD_SAMPLE_COUNT] = (int32_t)point.sampleCount;
+  for (int f = 0; f < HISTORY_QUERY_FIELD_COUNT; f++)
+  {
+    writeVariableLengthDelta(writer, fields[f] - state.previousFields[f], GORILLA_VALUE_BUCKET_BITS);
+    state.previousFields[f] = fields[f];
+  }
+}
+
+/**
+ * @brief 履歴の応答中に、ループ1回分の処理時間を記録する
+ * @param loopMicros ループ1回分の処理時間（待機時間を除く、マイクロ秒）
+ * @details 応答の送信が通常の処理をどれだけ遅らせたかを確認するために使います
+ */
+void recordHistoryQueryLoopLatency(unsigned long loopMicros)
+{
+  if (!historyQuerySession.active)
+  {
+    return;
+  }
+  historyQuerySession.loopCount++;
+  historyQuerySession.loopMicrosSum += loopMicros;
+  if (loopMicros > historyQuerySession.loopMicrosMax)
+  {
+    historyQuerySession.loopMicrosMax = loopMicros;
+  }
+}
+
+// -----------------------------------------------------------------
+// データ鮮度関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 鮮度の追跡を初期状態に戻す
+ * @param tracker 初期化する状態
+ */
+void resetSensorFreshness(SensorFreshnessTracker &tracker)
+{
+  tracker.lastArrivalMillis = 0;
+  tracker.lastPublisherTimestamp = 0;
+  tracker.arrivalCount = 0;
+  RunningStatistics emptyStatistics = {0, 0.0f, 0.0f, 0.0f, 0.0f};
+  tracker.interArrivalSeconds = emptyStatistics;
+  tracker.latePublicationCount = 0;
+  tracker.missedPublicationCount = 0;
+  tracker.isStale = false;
+}
+
+/**
+ * @brief データが届いたことを記録し、到着間隔・遅延・欠落を集計する
+ * @param tracker 更新する状態
+ * @param publisherTimestamp 送信側が付けたタイムスタンプ（UNIX秒。付いていなければ0）
+ * @param arrivalMillis 届いた時刻（millis()）
+ * @details
+ * 前回との間隔が想定間隔の何回分かを数え、2回分以上空いていれば、その間の送信は「欠落」とみなします。
+ * 送信側のタイムスタンプがあればそちらの間隔で数えるので、ネットワークで遅れて届いただけのデータは
+ * 欠落ではなく「遅延」として区別できます。
+ */
+void recordSensorArrival(SensorFreshnessTracker &tracker, unsigned long publisherTimestamp, unsigned long arrivalMillis)
+{
+  if (tracker.arrivalCount > 0)
+  {
+    float arrivalIntervalSeconds = (arrivalMillis - tracker.lastArrivalMillis) / 1000.0f;
+    addRunningStatisticsSample(tracker.interArrivalSeconds, arrivalIntervalSeconds);
+
+    // 欠落の判定には、送信側のタイムスタンプが前回より進んでいればその間隔を使う
+    float publishIntervalSeconds = arrivalIntervalSeconds;
+    if (publisherTimestamp != 0 && publisherTimestamp > tracker.lastPublisherTimestamp && tracker.lastPublisherTimestamp != 0)
+    {
+      publishIntervalSeconds = (float)(publisherTimestamp - tracker.lastPublisherTimestamp);
+    }
+
+    // 想定間隔の何回分空いたか（四捨五入）。2回分以上なら、その間の送信が届かなかった
+    uint32_t elapsedPeriods = (uint32_t)(publishIntervalSeconds / SENSOR_EXPECTED_PUBLISH_PERIOD_SECONDS + 0.5f);
+    if (elapsedPeriods > 1)
+    {
+      tracker.missedPublicationCount += elapsedPeriods - 1;
+    }
+    else if (arrivalIntervalSeconds > SENSOR_EXPECTED_PUBLISH_PERIOD_SECONDS * SENSOR_LATE_PERIOD_MULTIPLIER)
+    {
+      tracker.latePublicationCount++;
+    }
+  }
+
+  if (tracker.isStale)
+  {
+    LOG_INFO("✅ Sensor data is live again.\n");
+  }
+  tracker.lastArrivalMillis = arrivalMillis;
+  tracker.lastPublisherTimestamp = publisherTimestamp;
+  tracker.arrivalCount++;
+  tracker.isStale = false;
+}
+
+/**
+ * @brief 最後の到着から一定時間が過ぎていれば「古い」状態にする
+ * @param tracker 判定する状態
+ * @param nowMillis 現在時刻（millis()）
+ * @return 今回の判定で新しく「古い」状態になったらtrue
+ */
+bool updateSensorStaleness(SensorFreshnessTracker &tracker, unsigned long nowMillis)
+{
+  if (tracker.arrivalCount == 0 || tracker.isStale)
+  {
+    return false;
+  }
+  unsigned long staleAfterMillis = (unsigned long)(SENSOR_EXPECTED_PUBLISH_PERIOD_SECONDS * SENSOR_STALE_PERIOD_MULTIPLIER * 1000.0f);
+  if (nowMillis - tracker.lastArrivalMillis < staleAfterMillis)
+  {
+    return false;
+  }
+  tracker.isStale = true;
+  return true;
+}
+
+/**
+ * @brief 表示中のデータが古くなったかを調べ、古くなった時点ですぐ画面に反映する
+ * @details 次のページ切り替えを待たずに表示を更新するので、古い値が最新のように見える時間がありません
+ */
+void checkSensorDataFreshness()
+{
+  if (updateSensorStaleness(currentSensorFreshness, millis()))
+  {
+    LOG_WARN("⚠️ Sensor data is stale (no data for %lu s).\n",
+             (millis() - currentSensorFreshness.lastArrivalMillis) / 1000);
+    refreshEntireDisplay();
+  }
+}
+
+/**
+ * @brief データが途切れている場合、タイトルの横に最後の受信からの経過時間を赤で表示する
+ * @details 例：「STALE 4m」。値そのものは各ページで灰色になります。
+ */
+void displaySensorFreshnessMarker()
+{
+  if (!currentSensorFreshness.isStale)
+  {
+    return;
+  }
+  unsigned long silentSeconds = (millis() - currentSensorFreshness.lastArrivalMillis) / 1000;
+  M5.Display.setTextSize(1);
+  M5.Display.setTextColor(RED);
+  M5.Display.setCursor(TITLE_POSITION_X + 90, TITLE_POSITION_Y);
+  if (silentSeconds < 60)
+    M5.Display.printf("STALE %lus", silentSeconds);
+  else
+    M5.Display.printf("STALE %lum", silentSeconds / 60);
+}
+
+/**
+ * @brief 鮮度の統計（到着間隔の平均とジッター、遅延・欠落の回数）をシリアルに出力する
+ */
+void printSensorFreshnessReport()
+{
+  const SensorFreshnessTracker &tracker = currentSensorFreshness;
+  Serial.println("--- Sensor Freshness ---");
+  if (tracker.arrivalCount == 0)
+  {
+    Serial.println("No data received yet.");
+    Serial.println("------------------------");
+    return;
+  }
+  Serial.printf("Status: %s (last data %lu s ago)\n", tracker.isStale ? "STALE" : "live",
+                (millis() - tracker.lastArrivalMillis) / 1000);
+  Serial.printf("Arrivals: %lu, expected every %lu s\n", (unsigned long)tracker.arrivalCount,
+                SENSOR_EXPECTED_PUBLISH_PERIOD_SECONDS);
+  if (tracker.interArrivalSeconds.count > 0)
+  {
+    Serial.printf("Interval: mean %.1f s, jitter %.2f s, min %.1f s, max %.1f s\n",
+                  tracker.interArrivalSeconds.mean, calculateStandardDeviation(tracker.interArrivalSeconds),
+                  tracker.interArrivalSeconds.minimum, tracker.interArrivalSeconds.maximum);
+  }
+  Serial.printf("Late: %lu, Missed: %lu\n", (unsigned long)tracker.latePublicationCount,
+                (unsigned long)tracker.missedPublicationCount);
+  Serial.printf("Last publisher timestamp: %lu\n", tracker.lastPublisherTimestamp);
+  Serial.println("------------------------");
+}
+
+// -----------------------------------------------------------------
+// 複数センサー関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 文字列の32ビットハッシュ値を求める（FNV-1a）
+ * @param text ハッシュ値を求める文字列
+ * @return ハッシュ値
+ * @details 1文字ごとに「XORしてから素数を掛ける」だけの、短い文字列向けの速いハッシュ関数です
+ */
+uint32_t calculateFNV1aHash(const char *text)
+{
+  uint32_t hash = 2166136261UL; // FNVオフセット基底
+  while (*text != '\0')
+  {
+    hash ^= (uint8_t)*text++;
+    hash *= 16777619UL; // FNV素数
+  }
+  return hash;
+}
+
+/**
+ * @brief 登録済みのセンサーIDに対応する登録表の位置を探す
+ * @param sensorId センサーのID
+ * @return 登録表の位置。登録されていなければ-1
+ * @details 解析前のペイロードの判定で使います。不正なデータで登録表の枠を使ってしまわないよう、ここでは登録しません
+ */
+int findSensorRegistryEntry(const char *sensorId)
+{
+  uint32_t idHash = calculateFNV1aHash(sensorId);
+  size_t position = idHash & (SENSOR_REGISTRY_CAPACITY - 1);
+  sensorRegistryLookupCount++;
+
+  for (size_t probe = 0; probe < SENSOR_REGISTRY_CAPACITY; probe++)
+  {
+    sensorRegistryProbeTotal++;
+    const SensorRegistryEntry &entry = sensorRegistry[position];
+    if (!entry.inUse)
+    {
+      return -1; // 削除はしないので、空き位置に着いたら未登録
+    }
+    if (entry.idHash == idHash && strcmp(entry.sensorId, sensorId) == 0)
+    {
+      return (int)position;
+    }
+    position = (position + 1) & (SENSOR_REGISTRY_CAPACITY - 1);
+  }
+  return -1;
+}
+
+/**
+ * @brief センサーIDに対応する登録表の位置を探す（見つからなければ新しく登録する）
+ * @param sensorId センサーのID
+ * @return 登録表の位置。登録表が満杯で登録できなければ-1
+ * @details
+ * ハッシュ値から決めた位置から順に（線形探索で）調べ、同じIDか空き位置が見つかるまで進みます。
+ * センサーの削除はしないので、空き位置に着いた時点で「未登録」と判断できます。
+ */
+int findOrInsertSensorRegistryEntry(const char *sensorId)
+{
+  uint32_t idHash = calculateFNV1aHash(sensorId);
+  size_t position = idHash & (SENSOR_REGISTRY_CAPACITY - 1);
+  sensorRegistryLookupCount++;
+
+  for (size_t probe = 0; probe < SENSOR_REGISTRY_CAPACITY; probe++)
+  {
+    sensorRegistryProbeTotal++;
+    SensorRegistryEntry &entry = sensorRegistry[position];
+    if (!entry.inUse)
+    {
+      // 未登録。埋まりすぎると探索が長くなるので、3/4を上限にする
+      if (sensorRegistryCount >= SENSOR_REGISTRY_CAPACITY * 3 / 4)
+      {
+        return -1;
+      }
+      entry.inUse = true;
+      entry.idHash = idHash;
+      strlcpy(entry.sensorId, sensorId, sizeof(entry.sensorId));
+      for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+      {
+        entry.metricValues[m] = 0.0f;
+        entry.heapPositions[m] = -1;
+      }
+      resetSensorFreshness(entry.freshness);
+      resetSequenceWindow(entry.sequenceWindow);
+      sensorRegistryCount++;
+      LOG_INFO("🏠 New sensor registered: '%s' (%u total)\n", sensorId, (unsigned int)sensorRegistryCount);
+      return (int)position;
+    }
+    if (entry.idHash == idHash && strcmp(entry.sensorId, sensorId) == 0)
+    {
+      return (int)position;
+    }
+    position = (position + 1) & (SENSOR_REGISTRY_CAPACITY - 1);
+  }
+  return -1;
+}
+
+/**
+ * @brief 受信したデータで、そのセンサーの最新値・鮮度・ランキングを更新する
+ * @param sensorData 受信したセンサーデータ
+ */
+void updateSensorRegistry(const SensorDataPacket &sensorData)
+{
+  // sensor_idのないデータは、どのセンサーのものか区別できないので登録しない
+  if (sensorData.sensorId[0] == '\0')
+  {
+    return;
+  }
+
+  int entryIndex = findOrInsertSensorRegistryEntry(sensorData.sensorId);
+  if (entryIndex < 0)
+  {
+    sensorRegistryRejectedCount++;
+    LOG_WARN("⚠️ Sensor registry full. Ignoring '%s'.\n", sensorData.sensorId);
+    return;
+  }
+
+  SensorRegistryEntry &entry = sensorRegistry[entryIndex];
+
+  // 登録したばかりのセンサーは、解析前の判定の時点では窓がなかったので、最初のタイムスタンプをここで窓に入れる
+  if (entry.sequenceWindow.acceptedCount == 0 && sensorData.dataTimestamp != 0)
+  {
+    checkSequenceWindow(entry.sequenceWindow, sensorData.dataTimestamp);
+  }
+
+  for (int m = 0; m < HISTORY_METRIC_COUNT; m++)
+  {
+    entry.metricValues[m] = getSensorPacketMetric(sensorData, (HistoryMetric)m);
+  }
+  recordSensorArrival(entry.freshness, sensorData.dataTimestamp, millis());
+
+  for (size_t h = 0; h < WORST_SENSOR_HEAP_COUNT; h++)
+  {
+    updateWorstSensorHeap(worstSensorHeaps[h], (uint16_t)entryIndex);
+  }
+}
+
+/**
+ * @brief 1センサー分の値の変化をランキング（最小ヒープ）に反映する
+ * @param heap 更新するランキング
+ * @param entryIndex 値が変わったセンサーの登録表の位置
+ * @details
+ * - すでにランキング内にいる：値が変わった方向へ移動するだけ
+ * - まだ空きがある：末尾に追加して根の方向へ移動
+ * - 満杯で、根（上位N件の最下位）より高い：根と入れ替えて葉の方向へ移動
+ * ランキング外のセンサーの値は、そのセンサーの次の受信時に比べ直すので、
+ * 上位のセンサーの値が下がった場合も、遅くとも1送信周期後には正しい顔ぶれに戻ります。
+ */
+void updateWorstSensorHeap(WorstSensorHeap &heap, uint16_t entryIndex)
+{
+  SensorRegistryEntry &entry = sensorRegistry[entryIndex];
+  int8_t position = entry.heapPositions[heap.metric];
+
+  if (position >= 0)
+  {
+    siftWorstSensorHeapUp(heap, (uint8_t)position);
+    siftWorstSensorHeapDown(heap, (uint8_t)entry.heapPositions[heap.metric]);
+    return;
+  }
+
+  if (heap.size < WORST_SENSOR_RANK_COUNT)
+  {
+    heap.entryIndexes[heap.size] = entryIndex;
+    entry.heapPositions[heap.metric] = (int8_t)heap.size;
+    heap.size++;
+    siftWorstSensorHeapUp(heap, heap.size - 1);
+    return;
+  }
+
+  SensorRegistryEntry &lowest = sensorRegistry[heap.entryIndexes[0]];
+  if (entry.metricValues[heap.metric] > lowest.metricValues[heap.metric])
+  {
+    lowest.heapPositions[heap.metric] = -1;
+    heap.entryIndexes[0] = entryIndex;
+    entry.heapPositions[heap.metric] = 0;
+    siftWorstSensorHeapDown(heap, 0);
+  }
+}
+
+/**
+ * @brief 親より値が低い間、根の方向へ入れ替えていく
+ * @param heap 対象のランキング
+ * @param position 移動させる位置
+ */
+void siftWorstSensorHeapUp(WorstSensorHeap &heap, uint8_t position)
+{
+  while (position > 0)
+  {
+    uint8_t parent = (position - 1) / 2;
+    if (sensorRegistry[heap.entryIndexes[position]].metricValues[heap.metric] >=
+        sensorRegistry[heap.entryIndexes[parent]].metricValues[heap.metric])
+      break;
+    swapWorstSensorHeapItems(heap, position, parent);
+    position = parent;
+  }
+}
+
+/**
+ * @brief 子より値が高い間、葉の方向へ入れ替えていく
+ * @param heap 対象のランキング
+ * @param position 移動させる位置
+ */
+void siftWorstSensorHeapDown(WorstSensorHeap &heap, uint8_t position)
+{
+  while (true)
+  {
+    uint8_t lowestPosition = position;
+    for (uint8_t child = 2 * position + 1; child <= 2 * position + 2 && child < heap.size; child++)
+    {
+      if (sensorRegistry[heap.entryIndexes[child]].metricValues[heap.metric] <
+          sensorRegistry[heap.entryIndexes[lowestPosition]].metricValues[heap.metric])
+        lowestPosition = child;
+    }
+    if (lowestPosition == position)
+      break;
+    swapWorstSensorHeapItems(heap, position, lowestPosition);
+    position = lowestPosition;
+  }
+}
+
+/**
+ * @brief ヒープ内の2件を入れ替え、登録表側の位置情報も合わせて更新する
+ * @param heap 対象のランキング
+ * @param first 入れ替える位置1
+ * @param second 入れ替える位置2
+ */
+void swapWorstSensorHeapItems(WorstSensorHeap &heap, uint8_t first, uint8_t second)
+{
+  uint16_t firstEntry = heap.entryIndexes[first];
+  heap.entryIndexes[first] = heap.entryIndexes[second];
+  heap.entryIndexes[second] = firstEntry;
+  sensorRegistry[heap.entryIndexes[first]].heapPositions[heap.metric] = (int8_t)first;
+  sensorRegistry[heap.entryIndexes[second]].heapPositions[heap.metric] = (int8_t)second;
+}
+
+/**
+ * @brief ランキングを値の高い順に並べて取り出す
+ * @param heap 対象のランキング
+ * @param rankedIndexes 登録表の位置の格納先（WORST_SENSOR_RANK_COUNT件分）
+ * @return 取り出した件数
+ * @details 件数はN件だけなので、ヒープをコピーして挿入ソートで並べます
+ */
+size_t collectWorstSensorRanking(const WorstSensorHeap &heap, uint16_t *rankedIndexes)
+{
+  for (uint8_t i = 0; i < heap.size; i++)
+  {
+    uint16_t entryIndex = heap.entryIndexes[i];
+    float value = sensorRegistry[entryIndex].metricValues[heap.metric];
+    int j = i;
+    while (j > 0 && sensorRegistry[rankedIndexes[j - 1]].metricValues[heap.metric] < value)
+    {
+      rankedIndexes[j] = rankedIndexes[j - 1];
+      j--;
+    }
+    rankedIndexes[j] = entryIndex;
+  }
+  return heap.size;
+}
+
+/**
+ * @brief 大きく表示・履歴に記録するセンサーのデータかどうかを判定する
+ * @param sensorData 受信したセンサーデータ
+ * @return 対象のセンサー（PRIMARY_SENSOR_ID、または最初に届いたセンサー）のデータならtrue
+ * @details
+ * PRIMARY_SENSOR_IDが空のときは、最初にデータが届いたセンサーのIDを覚えて、以後はそのセンサーだけを対象にします
+ * （sensor_idのないデータが最初なら、IDのないデータだけが対象）。
+ * こうしないと、部屋ごとの値が1つの現在値・履歴・統計・予測・鮮度の記録に混ざってしまいます。
+ */
+bool isPrimarySensor(const SensorDataPacket &sensorData)
+{
+  if (!primarySensorChosen)
+  {
+    strlcpy(primarySensorId, PRIMARY_SENSOR_ID[0] != '\0' ? PRIMARY_SENSOR_ID : sensorData.sensorId,
+            sizeof(primarySensorId));
+    primarySensorChosen = true;
+    LOG_INFO("🏠 Primary sensor: '%s'\n", primarySensorId);
+  }
+  return strcmp(sensorData.sensorId, primarySensorId) == 0;
+}
+
+/**
+ * @brief CO2とTHIが高い部屋のランキングを2列で表示する
+ * @details 一定時間データが届いていないセンサーは灰色で表示します
+ */
+void displaySensorRankingPage()
+{
+  for (size_t h = 0; h < WORST_SENSOR_HEAP_COUNT; h++)
+  {
+    const WorstSensorHeap &heap = worstSensorHeaps[h];
+    const int columnX = LARGE_LABEL_X + (int)h * 110;
+
+    // 見出しの表示
+    M5.Display.setTextSize(1);
+    M5.Display.setTextColor(YELLOW);
+    M5.Display.setCursor(columnX, LARGE_LABEL_Y - 8);
+    M5.Display.printf("Worst %s", heap.metric == METRIC_CO2 ? "CO2" : "THI");
+
+    // 値の高い順に1行ずつ表示（CO2は整数、THIは小数点1桁）
+    uint16_t rankedIndexes[WORST_SENSOR_RANK_COUNT];
+    size_t rankedCount = collectWorstSensorRanking(heap, rankedIndexes);
+    for (size_t rank = 0; rank < rankedCount; rank++)
+    {
+      SensorRegistryEntry &entry = sensorRegistry[rankedIndexes[rank]];
+      updateSensorStaleness(entry.freshness, millis());
+      M5.Display.setTextColor(entry.freshness.isStale ? DARKGREY : WHITE);
+      M5.Display.setCursor(columnX, LARGE_LABEL_Y + 4 + (int)rank * 12);
+      M5.Display.printf("%u %-10.10s", (unsigned int)(rank + 1), entry.sensorId);
+      if (heap.metric == METRIC_CO2)
+        printFixedPointColumn<0>(entry.metricValues[heap.metric], 5);
+      else
+        printFixedPointColumn<1>(entry.metricValues[heap.metric], 5);
+    }
+  }
+}
+
+/**
+ * @brief 登録済みのセンサーとランキングをシリアルに出力する
+ */
+void printSensorRegistryReport()
+{
+  Serial.println("--- Sensor Registry ---");
+  Serial.printf("Sensors: %u / %u, rejected messages: %lu, avg probes: %.2f\n", (unsigned int)sensorRegistryCount,
+                (unsigned int)SENSOR_REGISTRY_CAPACITY, (unsigned long)sensorRegistryRejectedCount,
+                sensorRegistryLookupCount > 0 ? (float)sensorRegistryProbeTotal / sensorRegistryLookupCount : 0.0f);
+  if (primarySensorChosen)
+    Serial.printf("Primary sensor: '%s'\n", primarySensorId);
+  else
+    Serial.println("Primary sensor: (none yet)");
+  Serial.printf("Ingest queue: peak %u / %u (%u-byte records)\n", (unsigned int)ingestQueueHighWater,
+                (unsigned int)INGEST_QUEUE_CAPACITY, (unsigned int)sizeof(PackedSensorRecord));
+  for (size_t i = 0; i < SENSOR_REGISTRY_CAPACITY; i++)
+  {
+    SensorRegistryEntry &entry = sensorRegistry[i];
+    if (!entry.inUse)
+      continue;
+    updateSensorStaleness(entry.freshness, millis());
+    Serial.printf("  %-15s CO2=%4.0f THI=%4.1f  last %lus ago  late=%lu missed=%lu  dup=%lu old=%lu reordered=%lu%s\n",
+                  entry.sensorId, entry.metricValues[METRIC_CO2], entry.metricValues[METRIC_THI],
+                  (millis() - entry.freshness.lastArrivalMillis) / 1000, (unsigned long)entry.freshness.latePublicationCount,
+                  (unsigned long)entry.freshness.missedPublicationCount, (unsigned long)entry.sequenceWindow.duplicateCount,
+                  (unsigned long)entry.sequenceWindow.tooOldCount, (unsigned long)entry.sequenceWindow.reorderedCount,
+                  entry.freshness.isStale ? "  STALE" : "");
+  }
+  for (size_t h = 0; h < WORST_SENSOR_HEAP_COUNT; h++)
+  {
+    uint16_t rankedIndexes[WORST_SENSOR_RANK_COUNT];
+    size_t rankedCount = collectWorstSensorRanking(worstSensorHeaps[h], rankedIndexes);
+    Serial.printf("Worst %s:", HISTORY_METRIC_NAMES[worstSensorHeaps[h].metric]);
+    for (size_t rank = 0; rank < rankedCount; rank++)
+    {
+      Serial.printf(" %s", sensorRegistry[rankedIndexes[rank]].sensorId);
+    }
+    Serial.println();
+  }
+  Serial.println("-----------------------");
+}
+
+// -----------------------------------------------------------------
+// 重複・順序入れ替わり判定関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 生のペイロードからsensor_idとtimestampだけを取り出し、重複・古いデータかどうかを判定する
+ * @param payload 受信したペイロード（NUL終端なし）
+ * @param length ペイロードのバイト長
+ * @return 判定結果
+ * @details
+ * 捨てるデータのためにString化やJSON全体の解析をしなくて済むよう、2つのキーだけを直接探します。
+ * 判定は送信元（sensor_id）ごとに、登録表の各センサーが持つ並べ替え窓で行います。
+ * ここでは登録表を探すだけで、新しいセンサーの登録は解析に成功した後（updateSensorRegistry）で行います。
+ * sensor_idのないデータは送信元を区別できないので、判定しません。
+ */
+SequenceCheckResult checkSensorPayloadSequence(const byte *payload, unsigned int length)
+{
+  unsigned long timestamp = (unsigned long)extractRawJSONUnsigned(payload, length, "timestamp");
+  if (timestamp == 0)
+  {
+    return SEQUENCE_UNTRACKED;
+  }
+
+  char sensorId[SENSOR_ID_MAX_LENGTH + 1];
+  extractRawJSONString(payload, length, "sensor_id", sensorId, sizeof(sensorId));
+  if (sensorId[0] == '\0')
+  {
+    return SEQUENCE_UNTRACKED;
+  }
+  int entryIndex = findSensorRegistryEntry(sensorId);
+  if (entryIndex < 0)
+  {
+    return SEQUENCE_UNTRACKED;
+  }
+  return checkSequenceWindow(sensorRegistry[entryIndex].sequenceWindow, timestamp);
+}
+
+// -----------------------------------------------------------------
+// CO2予測関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 新しい値で予測器（水準と傾き）を更新する
+ * @param forecaster 更新する予測器
+ * @param value 新しい値
+ * @param timestampSeconds 値の時刻（秒）。受信間隔がばらついても、経過時間に応じて傾きを計算します
+ * @details
+ * 更新の前に「前回の予測が今回どれだけ外れたか」を記録しておき、精度の目安として使います。
+ * 処理は数回の掛け算だけで、履歴の件数には関係しません。
+ */
+void updateTrendForecaster(TrendForecaster &forecaster, float value, unsigned long timestampSeconds)
+{
+  if (!forecaster.initialized)
+  {
+    forecaster.initialized = true;
+    forecaster.level = value;
+    forecaster.trendPerMinute = 0.0f;
+    forecaster.lastSampleSeconds = timestampSeconds;
+    forecaster.sampleCount = 1;
+    return;
+  }
+
+  // 前回からの経過時間（分）。同じ秒に2件届いた場合も0で割らないようにする
+  unsigned long elapsedSeconds = timestampSeconds > forecaster.lastSampleSeconds ? timestampSeconds - forecaster.lastSampleSeconds : 1;
+  float elapsedMinutes = elapsedSeconds / 60.0f;
+
+  // 今回の時刻に対する予測値と、実際の値との差を記録
+  float predictedValue = forecaster.level + forecaster.trendPerMinute * elapsedMinutes;
+  forecaster.absoluteErrorSum += fabsf(value - predictedValue);
+  forecaster.errorCount++;
+
+  // 水準：予測値と実測値を混ぜる。傾き：水準の変化を1分あたりに直して混ぜる
+  float previousLevel = forecaster.level;
+  forecaster.level = CO2_FORECAST_LEVEL_SMOOTHING * value + (1.0f - CO2_FORECAST_LEVEL_SMOOTHING) * predictedValue;
+  forecaster.trendPerMinute = CO2_FORECAST_TREND_SMOOTHING * ((forecaster.level - previousLevel) / elapsedMinutes) +
+                              (1.0f - CO2_FORECAST_TREND_SMOOTHING) * forecaster.trendPerMinute;
+
+  forecaster.lastSampleSeconds = timestampSeconds;
+  forecaster.sampleCount++;
+}
+
+/**
+ * @brief 指定した分数先の値を予測する
+ * @param forecaster 予測器
+ * @param minutesAhead 何分先か
+ * @return 予測値（水準 + 傾き × 分数）
+ */
+float forecastTrendValue(const TrendForecaster &forecaster, float minutesAhead)
+{
+  return forecaster.level + forecaster.trendPerMinute * minutesAhead;
+}
+
+/**
+ * @brief 今の傾きが続いた場合に、しきい値に達するまでの分数を見積もる
+ * @param forecaster 予測器
+ * @param threshold しきい値
+ * @param minutes 見積もった分数の格納先
+ * @return 上昇中でまだしきい値未満ならtrue（それ以外は到達しないとみなしてfalse）
+ */
+bool estimateMinutesToThreshold(const TrendForecaster &forecaster, float threshold, float &minutes)
+{
+  if (!forecaster.initialized || forecaster.trendPerMinute <= 0.0f || forecaster.level >= threshold)
+  {
+    return false;
+  }
+  minutes = (threshold - forecaster.level) / forecaster.trendPerMinute;
+  return true;
+}
+
+/**
+ * @brief 予測の状態と、記録済みの履歴を再生したときの予測精度をシリアルに出力する
+ * @details
+ * RAMの履歴（最大24時間分）を古い順に新しい予測器へ流し込み、各時点で5/15/30分先を予測して、
+ * 実際にその時刻に記録されている値と比べます（平均絶対誤差）。実測値は時刻から直接取り出せるので、
+ * 検証にかかる時間はサンプル数に比例するだけです。シリアルモニタで「forecast」と入力すると呼び出されます。
+ */
+void printCO2ForecastReport()
+{
+  Serial.println("--- CO2 Forecast ---");
+  Serial.printf("Live: level=%.1f ppm, trend=%+.2f ppm/min, samples=%lu, 1-step MAE=%.1f ppm\n",
+                co2Forecaster.level, co2Forecaster.trendPerMinute, (unsigned long)co2Forecaster.sampleCount,
+                co2Forecaster.errorCount > 0 ? co2Forecaster.absoluteErrorSum / co2Forecaster.errorCount : 0.0f);
+
+  const int thresholds[] = {CO2_WARNING_THRESHOLD_PPM, CO2_CRITICAL_THRESHOLD_PPM};
+  for (int i = 0; i < 2; i++)
+  {
+    float minutes;
+    if (estimateMinutesToThreshold(co2Forecaster, thresholds[i], minutes))
+      Serial.printf("  %d ppm in ~%.1f min\n", thresholds[i], minutes);
+    else
+      Serial.printf("  %d ppm: not approaching\n", thresholds[i]);
+  }
+
+  // 記録済みの履歴を再生して、先読み時間ごとの誤差を集計する
+  const size_t horizonCount = sizeof(FORECAST_REPLAY_HORIZON_MINUTES) / sizeof(FORECAST_REPLAY_HORIZON_MINUTES[0]);
+  float errorSums[horizonCount] = {0};
+  uint32_t errorCounts[horizonCount] = {0};
+  TrendForecaster replayForecaster = {false, 0.0f, 0.0f, 0, 0, 0.0f, 0};
+
+  unsigned long oldestSlot = newestHistorySlotNumber >= HISTORY_SLOT_CAPACITY ? newestHistorySlotNumber - HISTORY_SLOT_CAPACITY + 1 : 0;
+  for (unsigned long slot = oldestSlot; sensorHistoryHasSamples && slot <= newestHistorySlotNumber; slot++)
+  {
+    const CompactHistorySample &sample = sensorHistorySlots[slot % HISTORY_SLOT_CAPACITY];
+    if (sample.carbonDioxidePpm == HISTORY_EMPTY_SLOT_MARKER)
+      continue;
+
+    unsigned long sampleEpoch = slot * HISTORY_SAMPLE_PERIOD_SECONDS + sample.secondsIntoSlot;
+    updateTrendForecaster(replayForecaster, sample.carbonDioxidePpm, sampleEpoch);
+    if (replayForecaster.sampleCount < 2)
+      continue;
+
+    for (size_t h = 0; h < horizonCount; h++)
+    {
+      unsigned long targetEpoch = sampleEpoch + (unsigned long)(FORECAST_REPLAY_HORIZON_MINUTES[h] * 60.0f);
+      CompactHistorySample actualSample;
+      if (findSensorHistorySample(targetEpoch, actualSample))
+      {
+        errorSums[h] += fabsf(forecastTrendValue(replayForecaster, FORECAST_REPLAY_HORIZON_MINUTES[h]) - actualSample.carbonDioxidePpm);
+        errorCounts[h]++;
+      }
+    }
+  }
+
+  Serial.printf("Replay over %lu history samples:\n", (unsigned long)replayForecaster.sampleCount);
+  for (size_t h = 0; h < horizonCount; h++)
+  {
+    if (errorCounts[h] > 0)
+      Serial.printf("  +%2.0f min: MAE=%.1f ppm (n=%lu)\n", FORECAST_REPLAY_HORIZON_MINUTES[h],
+                    errorSums[h] / errorCounts[h], (unsigned long)errorCounts[h]);
+    else
+      Serial.printf("  +%2.0f min: no data\n", FORECAST_REPLAY_HORIZON_MINUTES[h]);
+  }
+  Serial.println("--------------------");
+}
+
+// -----------------------------------------------------------------
+// 表示遅延計測関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief センサーデータ1件について、画面に映るまでの計測を始める
+ * @param payload 受信したペイロード（送信側の送信時刻 sent_ms を探す）
+ * @param length ペイロードのバイト長
+ * @details
+ * ソケットの時刻は、ループがソケットを確認した時点のものです。
+ * 届いてからループが確認するまでの待ち（最大でMAIN_LOOP_DELAY_MILLISECONDS程度）は、
+ * 送信時刻からの合計（publish>lcd）にだけ含まれます。
+ */
+void beginLatencyTrace(const byte *payload, unsigned int length)
+{
+  uint32_t nowMicros = micros();
+  currentLatencyTrace.active = true;
+  for (int s = 0; s < LATENCY_STAMP_COUNT; s++)
+  {
+    currentLatencyTrace.stampMicros[s] = nowMicros;
+  }
+  if (socketArrivalMicros != 0)
+  {
+    currentLatencyTrace.stampMicros[STAMP_SOCKET_ARRIVAL] = socketArrivalMicros;
+  }
+  currentLatencyTrace.publisherSentMillis = extractRawJSONUnsigned(payload, length, "sent_ms");
+}
+
+/**
+ * @brief 計測中なら、現在時刻を指定した時点として記録する
+ * @param stamp 記録する時点
+ */
+void stampLatencyTrace(LatencyStamp stamp)
+{
+  if (currentLatencyTrace.active)
+  {
+    currentLatencyTrace.stampMicros[stamp] = micros();
+  }
+}
+
+/**
+ * @brief 画面に反映しないことになったデータの計測をやめる
+ */
+void cancelLatencyTrace()
+{
+  currentLatencyTrace.active = false;
+}
+
+/**
+ * @brief 画面への転送が終わるのを待って時刻を記録し、区間ごとの遅延をヒストグラムに加える
+ * @details
+ * 描画命令は転送を待たずに戻ることがあるため、waitDisplay()で転送の完了を待ってから記録します。
+ * 待つのは計測中のデータを描画したときだけです。
+ */
+void completeLatencyTrace()
+{
+  if (!currentLatencyTrace.active)
+  {
+    return;
+  }
+  M5.Display.waitDisplay();
+  currentLatencyTrace.stampMicros[STAMP_DISPLAY_PUSHED] = micros();
+  currentLatencyTrace.active = false;
+
+  // 隣り合う時点の差（5区間）と、ソケットから画面までの合計
+  const uint32_t *stamps = currentLatencyTrace.stampMicros;
+  for (int s = 0; s < STAMP_DISPLAY_PUSHED; s++)
+  {
+    addLog2HistogramSample(latencySegmentHistograms[s], stamps[s + 1] - stamps[s]);
+  }
+  addLog2HistogramSample(latencySegmentHistograms[SEGMENT_ARRIVAL_TO_GLASS],
+                         stamps[STAMP_DISPLAY_PUSHED] - stamps[STAMP_SOCKET_ARRIVAL]);
+
+  // 送信時刻が付いていて、こちらの時刻も同期済みなら、ネットワークを含めた合計も記録
+  uint64_t nowEpochMillis = getCurrentEpochMillis();
+  if (currentLatencyTrace.publisherSentMillis != 0 && nowEpochMillis > currentLatencyTrace.publisherSentMillis)
+  {
+    uint64_t publishToGlassMillis = nowEpochMillis - currentLatencyTrace.publisherSentMillis;
+    if (publishToGlassMillis < 3600000ULL) // 時計が大きくずれている場合は記録しない
+    {
+      addLog2HistogramSample(latencySegmentHistograms[SEGMENT_PUBLISH_TO_GLASS], (uint32_t)publishToGlassMillis * 1000UL);
+    }
+  }
+}
+
+/**
+ * @brief NTP時刻の秒が切り替わったときのmillis()を記録する
+ * @details NTPClientは秒単位の時刻しか返さないため、秒の切り替わりを見てミリ秒単位の時刻を推定します（誤差はループ1回分程度）
+ */
+void trackEpochSecondBoundary()
+{
+  unsigned long epochSecond = timeClient.getEpochTime();
+  if (epochSecond != lastObservedEpochSecond)
+  {
+    lastObservedEpochSecond = epochSecond;
+    epochSecondStartMillis = millis();
+  }
+}
+
+/**
+ * @brief 現在のUNIX時刻（協定世界時）をミリ秒で推定する
+ * @return 推定したミリ秒単位の時刻。時刻が同期されていなければ0
+ */
+uint64_t getCurrentEpochMillis()
+{
+  if (!isSystemTimeSynchronized())
+  {
+    return 0;
+  }
+  return estimateEpochMillis(lastObservedEpochSecond, JAPAN_TIME_OFFSET_SECONDS, epochSecondStartMillis, millis());
+}
+
+/**
+ * @brief 区間ごとの遅延（回数・平均・90パーセンタイル・最大、ミリ秒）を表にして表示する
+ */
+void displayDiagnosticsPage()
+{
+  M5.Display.setTextSize(1);
+  M5.Display.setTextColor(YELLOW);
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y - 8);
+  M5.Display.println("Latency ms       n   mean    p90    max");
+
+  for (int s = 0; s < LATENCY_SEGMENT_COUNT; s++)
+  {
+    const Log2Histogram &histogram = latencySegmentHistograms[s];
+    // 合計の2行は強調して表示
+    M5.Display.setTextColor(s >= SEGMENT_ARRIVAL_TO_GLASS ? CYAN : WHITE);
+    M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 4 + s * 10);
+    if (histogram.sampleCount == 0)
+    {
+      M5.Display.printf("%-11s      -", LATENCY_SEGMENT_NAMES[s]);
+      continue;
+    }
+    const float columnValues[] = {histogram.total / (float)histogram.sampleCount / 1000.0f,
+                                  estimateLog2HistogramPercentile(histogram, 0.9f) / 1000.0f, histogram.maximum / 1000.0f};
+    M5.Display.printf("%-11s %5lu", LATENCY_SEGMENT_NAMES[s], (unsigned long)histogram.sampleCount);
+    for (int c = 0; c < 3; c++)
+    {
+      M5.Display.print(' ');
+      printFixedPointColumn<1>(columnValues[c], 6);
+    }
+  }
+
+  // スタックの余裕が最も少ないタスクと、loop処理のCPU使用率（余裕が少なければ赤）
+  const TaskHealthEntry *lowestTask = findLowestStackHeadroomTask();
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 6 + LATENCY_SEGMENT_COUNT * 10);
+  if (lowestTask == NULL)
+  {
+    M5.Display.setTextColor(DARKGREY);
+    M5.Display.print("Stack: -");
+  }
+  else
+  {
+    M5.Display.setTextColor(lowestTask->stackHeadroomBytes < STACK_HEADROOM_WARNING_BYTES ? RED : GREEN);
+    M5.Display.printf("Stack min %-.10s %luB", lowestTask->name, (unsigned long)lowestTask->stackHeadroomBytes);
+    if (loopTaskBusyPercent >= 0.0f)
+    {
+      M5.Display.setTextColor(WHITE);
+      M5.Display.print("  CPU ");
+      printFixedPointColumn<0>(loopTaskBusyPercent, 0);
+      M5.Display.print('%');
+    }
+  }
+
+  // 最下行：Digi-Clock UnitとのI2C通信（最後の確認が失敗していれば赤、過去に確認の失敗や遅い書き込みがあれば黄）
+  // 書き込みそのものの結果はわからないので、エラー数は書き込み直後の確認（probe）が失敗した回数
+  const I2CBusStatistics &busStatistics = digiClockBusStatistics;
+  uint32_t busErrorCount = busStatistics.transactionCount - busStatistics.probeResultCounts[I2C_RESULT_OK];
+  M5.Display.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y + 16 + LATENCY_SEGMENT_COUNT * 10);
+  if (busStatistics.transactionCount == 0)
+  {
+    M5.Display.setTextColor(DARKGREY);
+    M5.Display.print("I2C: -");
+    return;
+  }
+  uint16_t busColor = GREEN;
+  if (busStatistics.lastProbeResult != I2C_RESULT_OK)
+    busColor = RED;
+  else if (busErrorCount > 0 || busStatistics.slowTransactionCount > 0)
+    busColor = YELLOW;
+  M5.Display.setTextColor(busColor);
+  M5.Display.printf("I2C %lu wr  max ", (unsigned long)busStatistics.transactionCount);
+  printFixedPointColumn<1>(busStatistics.durationHistogram.maximum / 1000.0f, 0);
+  M5.Display.printf("ms  probe err %lu", (unsigned long)busErrorCount);
+}
+
+/**
+ * @brief 区間ごとの遅延の集計と、対数ヒストグラムをシリアルに出力する
+ */
+void printLatencyReport()
+{
+  Serial.println("--- Arrival-to-LCD Latency (ms) ---");
+  Serial.println("segment         n     mean      p90      max  histogram (>=ms:count)");
+  for (int s = 0; s < LATENCY_SEGMENT_COUNT; s++)
+  {
+    const Log2Histogram &histogram = latencySegmentHistograms[s];
+    if (histogram.sampleCount == 0)
+    {
+      Serial.printf("%-11s %5d        -        -        -\n", LATENCY_SEGMENT_NAMES[s], 0);
+      continue;
+    }
+    Serial.printf("%-11s %5lu %8.2f %8.2f %8.2f ", LATENCY_SEGMENT_NAMES[s], (unsigned long)histogram.sampleCount,
+                  histogram.total / (float)histogram.sampleCount / 1000.0f,
+                  estimateLog2HistogramPercentile(histogram, 0.9f) / 1000.0f, histogram.maximum / 1000.0f);
+    for (int b = 0; b < 32; b++)
+    {
+      if (histogram.buckets[b] > 0)
+        Serial.printf(" %.3g:%lu", (1UL << b) / 1000.0f, (unsigned long)histogram.buckets[b]);
+    }
+    Serial.println();
+  }
+  Serial.println("-----------------------------------");
+}
+
+// -----------------------------------------------------------------
+// 自己診断メトリクス関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 一定時間ごとに、本体の状態をまとめたバイナリのフレームをMQTTで送る
+ * @details
+ * 1フレームは100バイト足らずで、送信はMQTTクライアントの送信バッファへの書き込み1回です。
+ * 未接続のとき、履歴の問い合わせに応答中のときは送らずに次の機会を待ちます（ループを止めません）。
+ */
+void publishMetricsIfIntervalElapsed()
+{
+  unsigned long intervalMillis = millis() - lastMetricsPublishTime;
+  if (intervalMillis < METRICS_PUBLISH_INTERVAL_MILLISECONDS || !mqttCommunicationClient.connected() ||
+      historyQuerySession.active)
+  {
+    return;
+  }
+
+  // 送信先のトピックは、本体ごとに区別できるようMACアドレスを付けて1回だけ作る
+  if (metricsTopic[0] == '\0')
+  {
+    uint8_t macAddress[6];
+    WiFi.macAddress(macAddress);
+    snprintf(metricsTopic, sizeof(metricsTopic), "%s%02x%02x%02x%02x%02x%02x", MQTT_METRICS_TOPIC_PREFIX, macAddress[0],
+             macAddress[1], macAddress[2], macAddress[3], macAddress[4], macAddress[5]);
+  }
+
+  uint8_t frame[METRICS_FRAME_MAX_SIZE];
+  size_t frameLength = buildMetricsFrame(frame, intervalMillis);
+  traceBegin(TRACE_MQTT_PUBLISH, frameLength);
+  if (mqttCommunicationClient.publish(metricsTopic, frame, frameLength))
+  {
+    metricsFrameSequence++;
+  }
+  traceEnd(TRACE_MQTT_PUBLISH);
+
+  // 送信に失敗しても、次の送信は次の間隔まで待つ（再送で詰まらないように）
+  lastMetricsPublishTime = millis();
+  memset(&metricsWindowLoopCycles, 0, sizeof(metricsWindowLoopCycles));
+  for (int s = 0; s < LOOP_STAGE_COUNT; s++)
+  {
+    metricsWindowStageCycles[s] = loopStageProfiles[s].total;
+    metricsWindowStageCounts[s] = loopStageProfiles[s].sampleCount;
+  }
+}
+
+/**
+ * @brief メトリクスのフレームを組み立てる
+ * @param frame 書き込み先（METRICS_FRAME_MAX_SIZEバイト）
+ * @param intervalMillis 前回の送信からの経過時間
+ * @return フレームのバイト数
+ * @details
+ * 回数の項目は起動からの累計なので、受信側で前のフレームとの差を取れば、フレームが欠けても率を求められます。
+ * ループ処理時間は前回の送信以降の値です。
+ */
+size_t buildMetricsFrame(uint8_t *frame, unsigned long intervalMillis)
+{
+  float cyclesPerMicrosecond = (float)ESP.getCpuFreqMHz();
+  size_t offset = 0;
+
+  // 重複・順序入れ替わりで捨てた数は、センサーごとの数を合計する
+  uint32_t duplicateCount = 0, tooOldCount = 0, reorderedCount = 0;
+  for (size_t i = 0; i < SENSOR_REGISTRY_CAPACITY; i++)
+  {
+    if (!sensorRegistry[i].inUse)
+      continue;
+    duplicateCount += sensorRegistry[i].sequenceWindow.duplicateCount;
+    tooOldCount += sensorRegistry[i].sequenceWindow.tooOldCount;
+    reorderedCount += sensorRegistry[i].sequenceWindow.reorderedCount;
+  }
+
+  uint8_t flags = isSystemTimeSynchronized() ? METRICS_FLAG_TIME_SYNCED : 0;
+#ifdef HEAP_ALLOCATION_HOOKS
+  flags |= METRICS_FLAG_HEAP_HOOKS;
+#endif
+
+  // ヘッダー
+  writeLittleEndian(frame, offset, METRICS_FRAME_MAGIC, 1);
+  writeLittleEndian(frame, offset, METRICS_FRAME_VERSION, 1);
+  writeLittleEndian(frame, offset, metricsFrameSequence, 2);
+  writeLittleEndian(frame, offset, millis() / 1000, 4);
+  writeLittleEndian(frame, offset, intervalMillis / 1000 > 0xFFFF ? 0xFFFF : intervalMillis / 1000, 2);
+  writeLittleEndian(frame, offset, (uint8_t)(int8_t)WiFi.RSSI(), 1);
+  writeLittleEndian(frame, offset, flags, 1);
+
+  // ヒープ
+  writeLittleEndian(frame, offset, ESP.getFreeHeap(), 4);
+  writeLittleEndian(frame, offset, ESP.getMaxAllocHeap(), 4);
+  writeLittleEndian(frame, offset, ESP.getMinFreeHeap(), 4);
+
+  // ループ処理時間（前回の送信以降、マイクロ秒）
+  const Log2Histogram &loopCycles = metricsWindowLoopCycles;
+  writeLittleEndian(frame, offset, loopCycles.sampleCount, 4);
+  writeLittleEndian(frame, offset, loopCycles.sampleCount > 0 ? (uint32_t)(loopCycles.total / loopCycles.sampleCount / cyclesPerMicrosecond) : 0, 4);
+  writeLittleEndian(frame, offset, (uint32_t)(estimateLog2HistogramPercentile(loopCycles, 0.9f) / cyclesPerMicrosecond), 4);
+  writeLittleEndian(frame, offset, (uint32_t)(loopCycles.maximum / cyclesPerMicrosecond), 4);
+
+  // 通信と受信データの累計
+  writeLittleEndian(frame, offset, mqttMessagesReceivedCount, 4);
+  writeLittleEndian(frame, offset, mqttReconnectCount, 4);
+  writeLittleEndian(frame, offset, duplicateCount, 4);
+  writeLittleEndian(frame, offset, tooOldCount, 4);
+  writeLittleEndian(frame, offset, reorderedCount, 4);
+  writeLittleEndian(frame, offset, sensorDataRejectedCount, 4);
+  writeLittleEndian(frame, offset, sensorRegistryRejectedCount, 4);
+  writeLittleEndian(frame, offset, (uint32_t)(int32_t)lastNtpCorrectionSeconds, 4);
+
+  // ステージごとの平均処理時間（前回の送信以降、マイクロ秒。65535で頭打ち）
+  writeLittleEndian(frame, offset, LOOP_STAGE_COUNT, 1);
+  for (int s = 0; s < LOOP_STAGE_COUNT; s++)
+  {
+    uint32_t windowCount = loopStageProfiles[s].sampleCount - metricsWindowStageCounts[s];
+    uint64_t windowCycles = loopStageProfiles[s].total - metricsWindowStageCycles[s];
+    uint32_t meanMicros = windowCount > 0 ? (uint32_t)(windowCycles / windowCount / cyclesPerMicrosecond) : 0;
+    writeLittleEndian(frame, offset, meanMicros > 0xFFFF ? 0xFFFF : meanMicros, 2);
+  }
+  return offset;
+}
+
+/**
+ * @brief 値を下位バイトから順に書き込み、書き込み位置を進める
+ * @param buffer 書き込み先
+ * @param offset 書き込み位置（書き込んだ分だけ進む）
+ * @param value 書き込む値
+ * @param byteCount 書き込むバイト数（1〜4）
+ */
+void writeLittleEndian(uint8_t *buffer, size_t &offset, uint32_t value, size_t byteCount)
+{
+  for (size_t i = 0; i < byteCount; i++)
+  {
+    buffer[offset++] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+// -----------------------------------------------------------------
+// ヒープ使用量追跡関連の関数
+// -----------------------------------------------------------------
+
+#ifdef HEAP_ALLOCATION_HOOKS
+// リンカの --wrap=malloc 指定により、プログラム中（ライブラリを含む）の malloc 呼び出しは __wrap_malloc に、
+// 本来の malloc は __real_malloc という名前になります。ここで回数を数えてから本来の関数を呼びます。
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t count, size_t size);
+  void *__real_realloc(void *pointer, size_t size);
+  void __real_free(void *pointer);
+
+  void *__wrap_malloc(size_t size)
+  {
+    recordHeapAllocation(size, __builtin_return_address(0));
+    return __real_malloc(size);
+  }
+
+  void *__wrap_calloc(size_t count, size_t size)
+  {
+    recordHeapAllocation(count * size, __builtin_return_address(0));
+    return __real_calloc(count, size);
+  }
+
+  void *__wrap_realloc(void *pointer, size_t size)
+  {
+    recordHeapAllocation(size, __builtin_return_address(0));
+    return __real_realloc(pointer, size);
+  }
+
+  void __wrap_free(void *pointer)
+  {
+    if (pointer != NULL)
+    {
+      recordHeapRelease();
+    }
+    __real_free(pointer);
+  }
+}
+#endif
+
+/**
+ * @brief これから実行する処理の区分を設定する
+ * @param subsystem 新しい区分
+ * @return それまでの区分（入れ子にした処理の後で元に戻すために使う）
+ */
+HeapSubsystem setHeapSubsystem(HeapSubsystem subsystem)
+{
+  HeapSubsystem previousSubsystem = currentHeapSubsystem;
+  currentHeapSubsystem = subsystem;
+  return previousSubsystem;
+}
+
+/**
+ * @brief ヒープ確保を1回、現在の区分に数える
+ * @param size 要求されたバイト数
+ * @param returnAddress mallocなどの呼び出し元（__builtin_return_address(0)）
+ * @details
+ * malloc のたびに呼ばれるので、区分の配列の1つを増やすだけにしています。
+ * loopタスク以外（Wi-Fiなど）からの確保は「その他」に数えます（複数のタスクから同時に数えるため、値はおよそです）。
+ * 定常状態の監視中に、受信・描画の処理で確保があった場合は、呼び出し元も記録します。
+ */
+void recordHeapAllocation(size_t size, void *returnAddress)
+{
+  bool onLoopTask = xTaskGetCurrentTaskHandle() == loopTaskHandle;
+  HeapSubsystem subsystem = onLoopTask ? currentHeapSubsystem : HEAP_TAG_OTHER;
+  heapSubsystemUsage[subsystem].allocationCount++;
+  heapSubsystemUsage[subsystem].allocationBytes += size;
+
+  if (onLoopTask && steadyStateGuardArmed && STEADY_STATE_STRICT_SUBSYSTEMS[subsystem])
+  {
+    recordSteadyStateViolation(subsystem, size, returnAddress);
+  }
+}
+
+/**
+ * @brief 定常状態での確保を1回、呼び出し元のアドレスとともに記録する
+ * @details
+ * malloc の中から呼ばれるので、ここではログを書かずに記録だけします（ログは reportSteadyStateViolations で出します）。
+ * STEADY_STATE_TRAP_ON_ALLOCATION が true なら、その場で止めてバックトレースを出します。
+ */
+void recordSteadyStateViolation(HeapSubsystem subsystem, size_t size, void *returnAddress)
+{
+  // Xtensaの戻りアドレスは上位2ビットにレジスタウィンドウの情報が入っているので、
+  // コード領域のアドレスに直し、呼び出し命令（3バイト）の位置を指すようにする
+  uint32_t callerAddress = (uint32_t)(uintptr_t)returnAddress;
+  if (callerAddress & 0x80000000UL)
+    callerAddress = ((callerAddress & 0x3FFFFFFFUL) | 0x40000000UL) - 3;
+
+  SteadyStateViolation &violation = steadyStateViolations[steadyStateViolationCount % STEADY_STATE_VIOLATION_RECORD_COUNT];
+  violation.callerAddress = callerAddress;
+  violation.size = (uint32_t)size;
+  violation.subsystem = (uint8_t)subsystem;
+  steadyStateViolationCount++;
+
+  if (STEADY_STATE_TRAP_ON_ALLOCATION)
+  {
+    abort();
+  }
+}
+
+/**
+ * @brief 定常状態の監視をいったん止め、準備期間を始める
+ * @details 起動直後やMQTTの再接続後は、ライブラリが初回の受信で行う確保（受信バッファなど）があるので、監視の対象にしません
+ */
+void beginSteadyStateWarmup()
+{
+  steadyStateGuardArmed = false;
+  steadyStateWarmupStartTime = millis();
+  steadyStateWarmupMessageCount = mqttMessagesReceivedCount;
+}
+
+/**
+ * @brief 準備期間が過ぎ、その間に1件以上受信していれば、定常状態の監視を始める
+ */
+void armSteadyStateGuardIfWarmedUp()
+{
+  if (steadyStateGuardArmed || millis() - steadyStateWarmupStartTime < STEADY_STATE_WARMUP_MILLISECONDS ||
+      mqttMessagesReceivedCount == steadyStateWarmupMessageCount)
+  {
+    return;
+  }
+  steadyStateGuardArmed = true;
+#ifdef HEAP_ALLOCATION_HOOKS
+  LOG_INFO("🔒 Steady state reached: ingest and render must not allocate from now on.\n");
+#endif
+}
+
+/**
+ * @brief まだログに出していない定常状態での確保を、呼び出し元のアドレス付きでログに出す
+ * @details 覚えておける件数より多く起きていた場合は、古いものは件数だけを出します
+ */
+void reportSteadyStateViolations()
+{
+  uint32_t violationCount = steadyStateViolationCount;
+  if (violationCount == steadyStateReportedViolationCount)
+  {
+    return;
+  }
+  if (violationCount - steadyStateReportedViolationCount > STEADY_STATE_VIOLATION_RECORD_COUNT)
+  {
+    LOG_WARN("🚫 %lu steady-state allocations were not recorded.\n",
+             (unsigned long)(violationCount - steadyStateReportedViolationCount - STEADY_STATE_VIOLATION_RECORD_COUNT));
+    steadyStateReportedViolationCount = violationCount - STEADY_STATE_VIOLATION_RECORD_COUNT;
+  }
+  for (; steadyStateReportedViolationCount < violationCount; steadyStateReportedViolationCount++)
+  {
+    const SteadyStateViolation &violation =
+        steadyStateViolations[steadyStateReportedViolationCount % STEADY_STATE_VIOLATION_RECORD_COUNT];
+    LOG_WARN("🚫 Steady-state allocation: %lu bytes in %s from 0x%08lx\n", (unsigned long)violation.size,
+             HEAP_SUBSYSTEM_NAMES[violation.subsystem], (unsigned long)violation.callerAddress);
+  }
+}
+
+/**
+ * @brief 受信メッセージを流して受信・描画の処理を繰り返し、準備期間の後のヒープ確保が0回かを確かめる
+ * @details
+ * 少しずつ値を変えたセンサーデータを REPLAY_MESSAGE_COUNT 件作り、受信処理と同じ手順（sensor_ingest.h の decodeSensorPayload）で解析し、
+ * REPLAY_RENDER_EVERY_N_MESSAGES 件ごとに、ページを1つずつ切り替えながら画面全体を描き直します（すべてのページを順に描く）。
+ * 最初の REPLAY_WARMUP_MESSAGE_COUNT 件は数えず、その間に全ページを1回ずつ描いておきます。終わったら元のページに戻します。
+ * 解析結果は捨てるので、登録表・統計・履歴は変わりません。シリアルモニタで「replay」と入力すると呼び出されます。
+ */
+void runSteadyStateReplay()
+{
+  Serial.println("--- Steady-State Replay ---");
+#ifdef HEAP_ALLOCATION_HOOKS
+  char payload[JSON_MESSAGE_MAX_LENGTH];
+  SequenceWindow window;
+  resetSequenceWindow(window);
+  uint32_t warmupCounts[HEAP_SUBSYSTEM_COUNT] = {0};
+  uint32_t decodedCount = 0;
+  uint32_t renderCount = 0;
+  HeapSubsystem previousSubsystem = currentHeapSubsystem;
+  DisplayPage previousPage = currentDisplayPage;
+
+  for (uint16_t i = 0; i < REPLAY_MESSAGE_COUNT; i++)
+  {
+    if (i == REPLAY_WARMUP_MESSAGE_COUNT)
+    {
+      for (int s = 0; s < HEAP_SUBSYSTEM_COUNT; s++)
+        warmupCounts[s] = heapSubsystemUsage[s].allocationCount;
+    }
+
+    // メッセージを作るのは受信処理の外（コマンドの区分）で行う
+    setHeapSubsystem(HEAP_TAG_CONSOLE);
+    int payloadLength = snprintf(payload, sizeof(payload),
+                                 "{\"sensor_id\":\"replay\",\"timestamp\":%lu,\"co2\":%d,\"thi\":%.1f,"
+                                 "\"temperature\":%.1f,\"humidity\":%.1f,\"comfort_level\":\"%s\"}",
+                                 1720000000UL + i, 600 + (i % 900), 65.0f + (i % 200) * 0.1f, 20.0f + (i % 100) * 0.1f,
+                                 40.0f + (i % 300) * 0.1f, COMFORT_LEVEL_VOCABULARY[i % COMFORT_LEVEL_VOCABULARY_SIZE].text);
+
+    setHeapSubsystem(HEAP_TAG_INGEST);
+    SensorDataPacket decodedData;
+    if (decodeSensorPayload((const uint8_t *)payload, (unsigned int)payloadLength, window, sensorJsonDocument, ingestMessageBuffer,
+                            sizeof(ingestMessageBuffer), decodedData))
+      decodedCount++;
+
+    if (i % REPLAY_RENDER_EVERY_N_MESSAGES == 0)
+    {
+      // 描き直すたびに次のページへ進める（最初の1回は準備期間なので、全ページを1回ずつ描く）
+      setHeapSubsystem(HEAP_TAG_RENDER);
+      int pagesToDraw = (i == 0) ? DISPLAY_PAGE_COUNT : 1;
+      for (int p = 0; p < pagesToDraw; p++)
+      {
+        currentDisplayPage = (DisplayPage)(renderCount % DISPLAY_PAGE_COUNT);
+        refreshEntireDisplay();
+        renderCount++;
+      }
+    }
+  }
+  currentDisplayPage = previousPage;
+  refreshEntireDisplay();
+  setHeapSubsystem(previousSubsystem);
+
+  uint32_t ingestAllocations = heapSubsystemUsage[HEAP_TAG_INGEST].allocationCount - warmupCounts[HEAP_TAG_INGEST];
+  uint32_t renderAllocations = heapSubsystemUsage[HEAP_TAG_RENDER].allocationCount - warmupCounts[HEAP_TAG_RENDER];
+  Serial.printf("Messages: %u (first %u not counted), decoded: %lu, full redraws: %lu (all pages)\n", (unsigned int)REPLAY_MESSAGE_COUNT,
+                (unsigned int)REPLAY_WARMUP_MESSAGE_COUNT, (unsigned long)decodedCount, (unsigned long)renderCount);
+  Serial.printf("Allocations after warm-up: ingest %lu, render %lu\n", (unsigned long)ingestAllocations,
+                (unsigned long)renderAllocations);
+  Serial.println(ingestAllocations == 0 && renderAllocations == 0 && decodedCount > 0
+                     ? "Result: PASS (zero allocations in steady state)"
+                     : "Result: FAIL (see `heap` for caller addresses)");
+#else
+  Serial.println("Allocation hooks are disabled (build without HEAP_ALLOCATION_HOOKS).");
+#endif
+  Serial.println("---------------------------");
+}
+
+/**
+ * @brief ヒープ解放を1回、現在の区分に数える
+ */
+void recordHeapRelease()
+{
+  HeapSubsystem subsystem = (xTaskGetCurrentTaskHandle() == loopTaskHandle) ? currentHeapSubsystem : HEAP_TAG_OTHER;
+  heapSubsystemUsage[subsystem].freeCount++;
+}
+
+/**
+ * @brief 一定時間ごとに、空きヒープと最大連続ブロックを測って記録する
+ */
+void sampleHeapUsageIfIntervalElapsed()
+{
+  if (heapUsageSamples.sampleCount > 0 && millis() - lastHeapSampleTime < HEAP_SAMPLE_INTERVAL_MILLISECONDS)
+  {
+    return;
+  }
+  lastHeapSampleTime = millis();
+
+  uint32_t freeBytes = ESP.getFreeHeap();
+  uint32_t largestBlockBytes = ESP.getMaxAllocHeap();
+  heapUsageSamples.sampleCount++;
+  heapUsageSamples.lastFreeBytes = freeBytes;
+  heapUsageSamples.lastLargestBlockBytes = largestBlockBytes;
+  if (freeBytes < heapUsageSamples.minimumFreeBytes)
+    heapUsageSamples.minimumFreeBytes = freeBytes;
+  if (largestBlockBytes < heapUsageSamples.minimumLargestBlockBytes)
+    heapUsageSamples.minimumLargestBlockBytes = largestBlockBytes;
+  if (freeBytes > 0)
+  {
+    float fragmentation = 1.0f - (float)largestBlockBytes / freeBytes;
+    if (fragmentation > heapUsageSamples.maximumFragmentation)
+      heapUsageSamples.maximumFragmentation = fragmentation;
+  }
+}
+
+/**
+ * @brief 空きヒープの記録と、区分ごとの確保回数をシリアルに出力する
+ * @details
+ * 「/loop」はloop 1回あたり、「/msg」はMQTTメッセージ1件あたりの確保回数です。
+ * 受信も表示の更新もない状態でも「/loop」が0にならない区分は、定常的に確保を繰り返しています。
+ */
+void printHeapUsageReport()
+{
+  Serial.println("--- Heap Usage ---");
+  Serial.printf("Free: %lu bytes, largest block: %lu bytes (fragmentation %.0f%%)\n",
+                (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMaxAllocHeap(),
+                ESP.getFreeHeap() > 0 ? 100.0f * (1.0f - (float)ESP.getMaxAllocHeap() / ESP.getFreeHeap()) : 0.0f);
+  Serial.printf("Min ever free (since boot): %lu bytes\n", (unsigned long)ESP.getMinFreeHeap());
+  if (heapUsageSamples.sampleCount > 0)
+  {
+    Serial.printf("Sampled %lu times: min free %lu, min largest block %lu, max fragmentation %.0f%%\n",
+                  (unsigned long)heapUsageSamples.sampleCount, (unsigned long)heapUsageSamples.minimumFreeBytes,
+                  (unsigned long)heapUsageSamples.minimumLargestBlockBytes, heapUsageSamples.maximumFragmentation * 100.0f);
+  }
+
+#ifdef HEAP_ALLOCATION_HOOKS
+  Serial.printf("Steady state: %s, %lu allocations in ingest/render\n", steadyStateGuardArmed ? "armed" : "warming up",
+                (unsigned long)steadyStateViolationCount);
+  uint32_t firstRecorded = steadyStateViolationCount > STEADY_STATE_VIOLATION_RECORD_COUNT
+                               ? steadyStateViolationCount - STEADY_STATE_VIOLATION_RECORD_COUNT
+                               : 0;
+  for (uint32_t i = firstRecorded; i < steadyStateViolationCount; i++)
+  {
+    const SteadyStateViolation &violation = steadyStateViolations[i % STEADY_STATE_VIOLATION_RECORD_COUNT];
+    Serial.printf("  %-7s %5lu bytes from 0x%08lx\n", HEAP_SUBSYSTEM_NAMES[violation.subsystem],
+                  (unsigned long)violation.size, (unsigned long)violation.callerAddress);
+  }
+
+  uint32_t loopCount = loopStageProfiles[STAGE_LOOP_TOTAL].sampleCount;
+  Serial.println("subsystem    allocs      bytes      frees   /loop    /msg");
+  for (int s = 0; s < HEAP_SUBSYSTEM_COUNT; s++)
+  {
+    const HeapSubsystemUsage &usage = heapSubsystemUsage[s];
+    Serial.printf("%-9s %9lu %10lu %10lu %7.2f %7.2f\n", HEAP_SUBSYSTEM_NAMES[s], (unsigned long)usage.allocationCount,
+                  (unsigned long)usage.allocationBytes, (unsigned long)usage.freeCount,
+                  loopCount > 0 ? (float)usage.allocationCount / loopCount : 0.0f,
+                  mqttMessagesReceivedCount > 0 ? (float)usage.allocationCount / mqttMessagesReceivedCount : 0.0f);
+  }
+#else
+  Serial.println("Allocation hooks are disabled (build without HEAP_ALLOCATION_HOOKS).");
+#endif
+  Serial.println("------------------");
+}
+
+/**
+ * @brief 区分ごとの確保回数と、空きヒープの記録を空にする
+ * @details 回数の比較がしやすいよう、ループ処理時間の集計とMQTTメッセージ数もあわせて数え直します
+ */
+void resetHeapUsageTracking()
+{
+  memset(heapSubsystemUsage, 0, sizeof(heapSubsystemUsage));
+  HeapUsageSamples emptySamples = {0, 0, 0, UINT32_MAX, UINT32_MAX, 0.0f};
+  heapUsageSamples = emptySamples;
+  mqttMessagesReceivedCount = 0;
+  resetLoopStageProfiles();
+  steadyStateViolationCount = 0;
+  steadyStateReportedViolationCount = 0;
+  beginSteadyStateWarmup();
+}
+
+// -----------------------------------------------------------------
+// ループ処理時間計測関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief ステージの処理時間をCPUサイクル数で記録する
+ * @param stage 記録するステージ
+ * @param stageStartCycles ステージ開始時のサイクル数（ESP.getCycleCount()）
+ * @return 現在のサイクル数（そのまま次のステージの開始時刻として使える）
+ * @details
+ * サイクルカウンタは32ビットで、240MHzでは約18秒で一周しますが、引き算は一周をまたいでも正しく求まります。
+ * ヒストグラムの区間は「最上位ビットの位置」なので、__builtin_clz（先頭の0の数を数える命令）1回で決まります。
+ */
+uint32_t recordLoopStageCycles(LoopStage stage, uint32_t stageStartCycles)
+{
+  uint32_t nowCycles = ESP.getCycleCount();
+  addLog2HistogramSample(loopStageProfiles[stage], nowCycles - stageStartCycles);
+  return nowCycles;
+}
+
+/**
+ * @brief 対数ヒストグラムに1件の値を加える
+ * @param histogram 更新するヒストグラム
+ * @param value 加える値
+ */
+void addLog2HistogramSample(Log2Histogram &histogram, uint32_t value)
+{
+  histogram.sampleCount++;
+  histogram.total += value;
+  if (value > histogram.maximum)
+    histogram.maximum = value;
+  histogram.buckets[31 - __builtin_clz(value | 1)]++;
+}
+
+/**
+ * @brief 小さい方から数えて指定した割合に当たる値を、その区間の上限で見積もる
+ * @param histogram 対象のヒストグラム
+ * @param fraction 割合（例：0.9で90パーセンタイル）
+ * @return 見積もった値（実際の値以上。区間の幅が倍々なので、誤差は最大で2倍）
+ */
+uint32_t estimateLog2HistogramPercentile(const Log2Histogram &histogram, float fraction)
+{
+  uint32_t targetCount = (uint32_t)(histogram.sampleCount * fraction + 0.5f);
+  uint32_t accumulatedCount = 0;
+  for (int b = 0; b < 32; b++)
+  {
+    accumulatedCount += histogram.buckets[b];
+    if (accumulatedCount >= targetCount && accumulatedCount > 0)
+    {
+      uint32_t bucketUpperBound = (b == 31) ? UINT32_MAX : (2UL << b) - 1;
+      return bucketUpperBound < histogram.maximum ? bucketUpperBound : histogram.maximum;
+    }
+  }
+  return histogram.maximum;
+}
+
+/**
+ * @brief すべてのステージの集計を空にする
+ */
+void resetLoopStageProfiles()
+{
+  memset(loopStageProfiles, 0, sizeof(loopStageProfiles));
+}
+
+/**
+ * @brief ステージごとの回数・平均・最大と、対数ヒストグラムをシリアルに出力する
+ * @details
+ * ヒストグラムは記録のあった区間だけを「下限のマイクロ秒:回数」の形で出します。
+ * 計測自体のコストも、空の区間を何度か記録して見積もり、最後に表示します。
+ */
+void printLoopStageProfiles()
+{
+  float cyclesPerMicrosecond = (float)ESP.getCpuFreqMHz();
+  Serial.println("--- Loop Profile (cycles -> us) ---");
+  Serial.println("stage          calls    mean us     max us  histogram (>=us:count)");
+  for (int s = 0; s < LOOP_STAGE_COUNT; s++)
+  {
+    const Log2Histogram &profile = loopStageProfiles[s];
+    if (profile.sampleCount == 0)
+    {
+      Serial.printf("%-11s %8d          -          -\n", LOOP_STAGE_NAMES[s], 0);
+      continue;
+    }
+    Serial.printf("%-11s %8lu %10.1f %10.1f ", LOOP_STAGE_NAMES[s], (unsigned long)profile.sampleCount,
+                  profile.total / (float)profile.sampleCount / cyclesPerMicrosecond,
+                  profile.maximum / cyclesPerMicrosecond);
+    for (int b = 0; b < 32; b++)
+    {
+      if (profile.buckets[b] > 0)
+        Serial.printf(" %.2g:%lu", (1UL << b) / cyclesPerMicrosecond, (unsigned long)profile.buckets[b]);
+    }
+    Serial.println();
+  }
+
+  // 計測1回あたりのコストを見積もる（集計を汚さないよう、一時的な領域で記録してから戻す）
+  const int overheadSamples = 64;
+  Log2Histogram savedProfile = loopStageProfiles[STAGE_LOOP_TOTAL];
+  uint32_t overheadStartCycles = ESP.getCycleCount();
+  uint32_t cycles = overheadStartCycles;
+  for (int i = 0; i < overheadSamples; i++)
+  {
+    cycles = recordLoopStageCycles(STAGE_LOOP_TOTAL, cycles);
+  }
+  uint32_t overheadCycles = (ESP.getCycleCount() - overheadStartCycles) / overheadSamples;
+  loopStageProfiles[STAGE_LOOP_TOTAL] = savedProfile;
+  Serial.printf("Instrumentation overhead: ~%lu cycles (%.2f us) per stage\n", (unsigned long)overheadCycles,
+                overheadCycles / cyclesPerMicrosecond);
+  Serial.println("-----------------------------------");
+}
+
+// -----------------------------------------------------------------
+// ログ出力関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief ログを1行、printfと同じ書式でバッファに書き込む
+ * @param format 書式（末尾に改行を含める）
+ * @details
+ * 115200bpsのシリアルは1バイトに約87マイクロ秒かかるため、受信処理の途中で直接出力すると、その分だけ処理が止まります。
+ * ここではバッファに書き込むだけにして、実際の送信はループの空き時間（drainLogBuffer）で行います。
+ * バッファがいっぱいのときは行ごと捨てて数え、次に書き込めたときに捨てた行数をログに残します。
+ */
+void logPrintf(const char *format, ...)
+{
+  char line[LOG_LINE_MAX_LENGTH + 1];
+  va_list arguments;
+  va_start(arguments, format);
+  int formattedLength = vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  if (formattedLength < 0)
+  {
+    return;
+  }
+
+  size_t lineLength = (size_t)formattedLength;
+  if (lineLength > LOG_LINE_MAX_LENGTH)
+  {
+    // 長すぎる行は切り捨てたことがわかるよう、末尾を「~」と改行にする
+    lineLength = LOG_LINE_MAX_LENGTH;
+    line[lineLength - 2] = '~';
+    line[lineLength - 1] = '\n';
+  }
+
+  enqueueLogLine(line, lineLength);
+}
+
+/**
+ * @brief 整数の引数を書き込む（符号付きに広げ、ジグザグ符号化した可変長で書く）
+ * @return 書き込んだ後の位置（入りきらなければ capacity + 1）
+ * @details 小さい値ほど短くなり、0〜63や-64〜-1なら1バイトで済みます。%d と %u のどちらで表示する値も同じ形で書きます。
+ */
+template <typename Integer>
+size_t encodeLogArgument(uint8_t *record, size_t offset, size_t capacity, Integer value)
+{
+  int64_t signedValue = (int64_t)value;
+  uint64_t zigzagValue = ((uint64_t)signedValue << 1) ^ (uint64_t)(signedValue >> 63);
+  do
+  {
+    if (offset >= capacity)
+    {
+      return capacity + 1;
+    }
+    uint8_t lowBits = zigzagValue & 0x7F;
+    zigzagValue >>= 7;
+    record[offset++] = lowBits | (zigzagValue != 0 ? 0x80 : 0x00);
+  } while (zigzagValue != 0);
+  return offset;
+}
+
+/**
+ * @brief 小数の引数を書き込む（floatの4バイト、リトルエンディアン）
+ */
+size_t encodeLogArgument(uint8_t *record, size_t offset, size_t capacity, float value)
+{
+  if (offset + sizeof(float) > capacity)
+  {
+    return capacity + 1;
+  }
+  memcpy(record + offset, &value, sizeof(float)); // ESP32はリトルエンディアンなので、そのまま写せばよい
+  return offset + sizeof(float);
+}
+
+size_t encodeLogArgument(uint8_t *record, size_t offset, size_t capacity, double value)
+{
+  return encodeLogArgument(record, offset, capacity, (float)value);
+}
+
+/**
+ * @brief 文字列の引数を書き込む（長さ1バイト + 中身。入りきらない分は切り捨てる）
+ */
+size_t encodeLogArgument(uint8_t *record, size_t offset, size_t capacity, const char *value)
+{
+  if (offset >= capacity)
+  {
+    return capacity + 1;
+  }
+  size_t length = strlen(value);
+  size_t room = capacity - offset - 1;
+  if (length > room)
+  {
+    length = room;
+  }
+  if (length > 255)
+  {
+    length = 255;
+  }
+  record[offset++] = (uint8_t)length;
+  memcpy(record + offset, value, length);
+  return offset + length;
+}
+
+size_t encodeLogArgument(uint8_t *record, size_t offset, size_t capacity, char *value)
+{
+  return encodeLogArgument(record, offset, capacity, (const char *)value);
+}
+
+/**
+ * @brief 引数を先頭から順に書き込む
+ */
+size_t encodeLogArguments(uint8_t * /* record */, size_t offset, size_t /* capacity */)
+{
+  return offset;
+}
+
+template <typename First, typename... Rest>
+size_t encodeLogArguments(uint8_t *record, size_t offset, size_t capacity, First first, Rest... rest)
+{
+  offset = encodeLogArgument(record, offset, capacity, first);
+  return encodeLogArguments(record, offset, capacity, rest...);
+}
+
+/**
+ * @brief バイナリ形式のログを1件バッファに書き込む
+ * @param level ログのレベル（LOG_LEVEL_ERROR など）
+ * @param token 書式文字列のID（hashLogFormat）
+ * @param arguments 書式に渡す引数
+ * @details
+ * 文章に組み立てず、書式のIDと引数の値だけを送ります。例えば「✅ Sensor data updated: CO2=%d, THI=%.1f %s」は
+ * 約45バイトの文章が12バイト程度になり、シリアルの送信時間もその分短くなります。
+ */
+template <typename... Arguments>
+void writeTokenizedLogRecord(uint8_t level, uint32_t token, Arguments... arguments)
+{
+  uint8_t record[LOG_LINE_MAX_LENGTH];
+  record[0] = LOG_RECORD_MARKER;
+  record[1] = level;
+  for (int i = 0; i < 4; i++)
+  {
+    record[2 + i] = (uint8_t)(token >> (8 * i));
+  }
+
+  // 引数のバイト数は1バイトで表すので、それを超える分は入りきらないものとして扱う
+  size_t capacity = LOG_RECORD_HEADER_SIZE + 255 < sizeof(record) ? LOG_RECORD_HEADER_SIZE + 255 : sizeof(record);
+  size_t recordLength = encodeLogArguments(record, LOG_RECORD_HEADER_SIZE, capacity, arguments...);
+  if (recordLength > capacity)
+  {
+    // 引数が入りきらなかった（長い文字列の後ろに引数が続く場合など）
+    logDroppedLineCount++;
+    logUnreportedDroppedLines++;
+    return;
+  }
+  record[6] = (uint8_t)(recordLength - LOG_RECORD_HEADER_SIZE);
+  enqueueLogLine((const char *)record, recordLength);
+}
+
+/**
+ * @brief 1件分のログをバッファに書き込む
+ * @param line 文章、またはバイナリ形式のログ1件
+ * @param length バイト数
+ * @return 書き込めたらtrue
+ * @details 書き込めなければ捨てた数を数え、次に書き込めたときにその数をログに残します
+ */
+bool enqueueLogLine(const char *line, size_t length)
+{
+  // 前に捨てた行があれば、空きができた今のうちにその数を知らせる
+  if (logUnreportedDroppedLines > 0)
+  {
+    char notice[48];
+    size_t noticeLength = snprintf(notice, sizeof(notice), "⚠️ Log overflow: %lu lines dropped\n",
+                                   (unsigned long)logUnreportedDroppedLines);
+    if (enqueueLogBytes(notice, noticeLength))
+    {
+      logUnreportedDroppedLines = 0;
+    }
+  }
+
+  if (!enqueueLogBytes(line, length))
+  {
+    logDroppedLineCount++;
+    logUnreportedDroppedLines++;
+    return false;
+  }
+  logWrittenLineCount++;
+  return true;
+}
+
+/**
+ * @brief 受信メッセージの内容を、間引いたうえで先頭だけログに出す
+ * @param payload 受信したバイト列
+ * @param length バイト数
+ * @details 全件を出すとログだけでバッファが埋まるので、LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES 件に1件だけ、先頭の LOG_PAYLOAD_DUMP_MAX_BYTES バイトを出します
+ */
+void logPayloadSample(const byte *payload, unsigned int length)
+{
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+  if (LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES == 0 || logPayloadDumpCounter++ % LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES != 0)
+  {
+    return;
+  }
+
+  // 印字可能なASCII文字だけを取り出す（copyPrintablePayloadと同じ扱い）
+  char preview[LOG_PAYLOAD_DUMP_MAX_BYTES + 1];
+  size_t previewLength = 0;
+  unsigned int scannedBytes = 0;
+  for (; scannedBytes < length && previewLength < LOG_PAYLOAD_DUMP_MAX_BYTES; scannedBytes++)
+  {
+    if (payload[scannedBytes] >= 32 && payload[scannedBytes] <= 126)
+    {
+      preview[previewLength++] = (char)payload[scannedBytes];
+    }
+  }
+  preview[previewLength] = '\0';
+
+  if (scannedBytes < length)
+  {
+    LOG_DEBUG("Payload: '%s'... (+%u bytes)\n", preview, length - scannedBytes);
+  }
+  else
+  {
+    LOG_DEBUG("Payload: '%s'\n", preview);
+  }
+#else
+  (void)payload; // デバッグログを取り除いたビルドでは使わない
+  (void)length;
+#endif
+}
+
+/**
+ * @brief バッファに空きがあれば、文字列をまとめて書き込む
+ * @param text 書き込む文字列
+ * @param length バイト数
+ * @return 書き込めたらtrue（空きが足りなければ何も書かずにfalse）
+ * @details 中身を書き終えてから書き込み位置を進めるので、送る側が書きかけの行を送ることはありません
+ */
+bool enqueueLogBytes(const char *text, size_t length)
+{
+  size_t writePosition = logWritePosition; // 書き込む側だけが変更するので、そのまま読める
+  size_t readPosition = __atomic_load_n(&logReadPosition, __ATOMIC_ACQUIRE);
+  size_t usedBytes = (writePosition + LOG_BUFFER_SIZE - readPosition) % LOG_BUFFER_SIZE;
+
+  // 読み書きの位置が重なると「空」と区別できないので、1バイトは常に空けておく
+  if (length > LOG_BUFFER_SIZE - 1 - usedBytes)
+  {
+    return false;
+  }
+
+  // バッファの終わりをまたぐ場合は、2回に分けてコピーする
+  size_t firstPartLength = LOG_BUFFER_SIZE - writePosition;
+  if (firstPartLength > length)
+  {
+    firstPartLength = length;
+  }
+  memcpy(logRingBuffer + writePosition, text, firstPartLength);
+  memcpy(logRingBuffer, text + firstPartLength, length - firstPartLength);
+  __atomic_store_n(&logWritePosition, (writePosition + length) % LOG_BUFFER_SIZE, __ATOMIC_RELEASE);
+
+  if (usedBytes + length > logBufferHighWater)
+  {
+    logBufferHighWater = usedBytes + length;
+  }
+  return true;
+}
+
+/**
+ * @brief まだシリアルへ送っていないログのバイト数を返す
+ */
+size_t getLogBufferedBytes()
+{
+  size_t writePosition = __atomic_load_n(&logWritePosition, __ATOMIC_ACQUIRE);
+  size_t readPosition = __atomic_load_n(&logReadPosition, __ATOMIC_ACQUIRE);
+  return (writePosition + LOG_BUFFER_SIZE - readPosition) % LOG_BUFFER_SIZE;
+}
+
+/**
+ * @brief たまっているログを、シリアルの送信バッファに空いている分だけ送る
+ * @details 空きを待たないので、ループが止まることはありません。送り切れなかった分は次のループで送ります。
+ */
+void drainLogBuffer()
+{
+  size_t readPosition = logReadPosition; // 送る側だけが変更するので、そのまま読める
+  size_t writePosition = __atomic_load_n(&logWritePosition, __ATOMIC_ACQUIRE);
+
+  while (readPosition != writePosition)
+  {
+    int writableBytes = Serial.availableForWrite();
+    if (writableBytes <= 0)
+    {
+      break;
+    }
+
+    // バッファの終わりまで、または書き込み位置までの連続した部分を送る
+    size_t contiguousBytes = (writePosition > readPosition ? writePosition : LOG_BUFFER_SIZE) - readPosition;
+    size_t chunkBytes = contiguousBytes < (size_t)writableBytes ? contiguousBytes : (size_t)writableBytes;
+    traceBegin(TRACE_SERIAL_WRITE, chunkBytes);
+    Serial.write((const uint8_t *)logRingBuffer + readPosition, chunkBytes);
+    traceEnd(TRACE_SERIAL_WRITE);
+
+    readPosition = (readPosition + chunkBytes) % LOG_BUFFER_SIZE;
+    __atomic_store_n(&logReadPosition, readPosition, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * @brief たまっているログをすべて送り終えるまで待つ
+ * @details 起動時や、集計をシリアルに直接出力する前など、待ってもかまわない場面で使います
+ */
+void flushLogBuffer()
+{
+  while (getLogBufferedBytes() > 0)
+  {
+    drainLogBuffer();
+    Serial.flush(); // 送信バッファが空くまで待つ
+  }
+}
+
+/**
+ * @brief ログバッファの使用状況をシリアルに出力する
+ */
+void printLogStatus()
+{
+  Serial.println("--- Log Buffer ---");
+  const char *const levelNames[] = {"none", "error", "warn", "info", "debug"};
+#ifdef LOG_TOKENIZED
+  Serial.printf("Level: %s, format: tokenized (decode with tools/detokenize_log.py)\n", levelNames[LOG_LEVEL]);
+#else
+  Serial.printf("Level: %s, format: text\n", levelNames[LOG_LEVEL]);
+#endif
+  Serial.printf("Buffered: %u / %u bytes (high water %u)\n", (unsigned int)getLogBufferedBytes(),
+                (unsigned int)(LOG_BUFFER_SIZE - 1), (unsigned int)logBufferHighWater);
+  Serial.printf("Lines: %lu written, %lu dropped\n", (unsigned long)logWrittenLineCount,
+                (unsigned long)logDroppedLineCount);
+  if (LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES > 0)
+  {
+    Serial.printf("Payload dump: 1 in %lu messages, first %u bytes\n", LOG_PAYLOAD_DUMP_EVERY_N_MESSAGES,
+                  (unsigned int)LOG_PAYLOAD_DUMP_MAX_BYTES);
+  }
+  else
+  {
+    Serial.println("Payload dump: off");
+  }
+  Serial.println("------------------");
+}
+
+// -----------------------------------------------------------------
+// タスクの健全性監視関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 一定時間ごとに、各タスクのスタックの余裕（最高水位）とCPU時間を記録する
+ * @details
+ * 全タスクの一覧は uxTaskGetSystemState で取得します（FreeRTOSのトレース機能が有効な場合）。
+ * タスクごとのCPU時間は、FreeRTOSの実行時間統計が有効なビルドでだけ求められます。
+ * loop処理のCPU使用率は、ループ処理時間の計測（サイクル数）から常に求めます。
+ * スタックの残りが STACK_HEADROOM_WARNING_BYTES を下回ったタスクは、1回だけ警告をログに残します。
+ */
+void sampleTaskHealthIfIntervalElapsed()
+{
+  if (taskHealthSampleCount > 0 && millis() - lastTaskMonitorTime < TASK_MONITOR_INTERVAL_MILLISECONDS)
+  {
+    return;
+  }
+  lastTaskMonitorTime = millis();
+
+  // loop処理のCPU使用率：前回からの「ループ処理にかかったサイクル数 ÷ 経過時間のサイクル数」
+  unsigned long nowMicros = micros();
+  uint64_t loopCycles = loopStageProfiles[STAGE_LOOP_TOTAL].total;
+  if (taskHealthSampleCount > 0 && nowMicros != lastTaskMonitorMicros)
+  {
+    float elapsedCycles = (float)(nowMicros - lastTaskMonitorMicros) * ESP.getCpuFreqMHz();
+    loopTaskBusyPercent = (loopCycles - lastTaskMonitorLoopCycles) * 100.0f / elapsedCycles;
+  }
+  lastTaskMonitorLoopCycles = loopCycles;
+  lastTaskMonitorMicros = nowMicros;
+
+  // 前回の記録を残しておき、同じタスクのCPU時間の差と警告済みかどうかを引き継ぐ
+  TaskHealthEntry previousEntries[TASK_MONITOR_MAX_TASKS];
+  size_t previousCount = taskHealthCount;
+  memcpy(previousEntries, taskHealthEntries, sizeof(TaskHealthEntry) * previousCount);
+
+  // loopタスクは常に先頭に記録する
+  taskHealthCount = 0;
+  updateTaskHealthEntry(taskHealthCount++, loopTaskHandle, pcTaskGetName(loopTaskHandle),
+                        uxTaskGetStackHighWaterMark(loopTaskHandle), uxTaskPriorityGet(loopTaskHandle), previousEntries,
+                        previousCount);
+
+#if configUSE_TRACE_FACILITY
+  uint32_t totalRunTime = 0;
+  UBaseType_t taskCount = uxTaskGetSystemState(taskStatusSnapshot, TASK_MONITOR_MAX_TASKS, &totalRunTime);
+  uint32_t totalRunTimeDelta = totalRunTime - lastTaskMonitorTotalRunTime;
+  lastTaskMonitorTotalRunTime = totalRunTime;
+  for (UBaseType_t i = 0; i < taskCount; i++)
+  {
+    const TaskStatus_t &status = taskStatusSnapshot[i];
+    if (status.xHandle == loopTaskHandle)
+    {
+      updateTaskCpuTime(taskHealthEntries[0], status.ulRunTimeCounter, totalRunTimeDelta);
+      continue;
+    }
+    TaskHealthEntry &entry = updateTaskHealthEntry(taskHealthCount++, status.xHandle, status.pcTaskName,
+                                                   status.usStackHighWaterMark, status.uxCurrentPriority,
+                                                   previousEntries, previousCount);
+    updateTaskCpuTime(entry, status.ulRunTimeCounter, totalRunTimeDelta);
+  }
+#endif
+
+  taskHealthSampleCount++;
+}
+
+/**
+ * @brief 1タスク分の記録を更新する
+ * @param index 記録する位置
+ * @param handle タスクのハンドル
+ * @param name タスク名
+ * @param headroomBytes スタックの最高水位（バイト）
+ * @param priority 優先度
+ * @param previousEntries 前回の記録
+ * @param previousCount 前回の記録の件数
+ * @return 更新した記録
+ * @details 前回の記録に同じタスクがあれば、CPU時間のカウンタと警告済みかどうかを引き継ぎます
+ */
+TaskHealthEntry &updateTaskHealthEntry(size_t index, TaskHandle_t handle, const char *name, uint32_t headroomBytes,
+                                       uint8_t priority, const TaskHealthEntry *previousEntries, size_t previousCount)
+{
+  TaskHealthEntry &entry = taskHealthEntries[index];
+  entry.hasPreviousRunTime = false;
+  entry.cpuPercent = -1.0f;
+  entry.headroomWarned = false;
+  for (size_t i = 0; i < previousCount; i++)
+  {
+    if (previousEntries[i].handle == handle)
+    {
+      entry.previousRunTime = previousEntries[i].previousRunTime;
+      entry.hasPreviousRunTime = previousEntries[i].hasPreviousRunTime;
+      entry.cpuPercent = previousEntries[i].cpuPercent;
+      entry.headroomWarned = previousEntries[i].headroomWarned;
+      break;
+    }
+  }
+
+  entry.handle = handle;
+  strlcpy(entry.name, name, sizeof(entry.name));
+  entry.stackHeadroomBytes = headroomBytes;
+  entry.priority = priority;
+
+  if (headroomBytes < STACK_HEADROOM_WARNING_BYTES && !entry.headroomWarned)
+  {
+    entry.headroomWarned = true;
+    LOG_WARN("⚠️ Stack headroom low: task '%s' has %lu bytes left\n", entry.name, (unsigned long)headroomBytes);
+  }
+  return entry;
+}
+
+/**
+ * @brief 前回の記録からのCPU使用率を求める
+ * @param entry 更新する記録
+ * @param runTimeCounter そのタスクの累計CPU時間（実行時間統計のカウンタ値）
+ * @param totalRunTimeDelta 前回の記録からの全体の経過時間（同じ単位）
+ * @details 実行時間統計（configGENERATE_RUN_TIME_STATS）が無効なビルドでは何もしません。ESP32は2コアなので、全タスクの合計は最大200%になります。
+ */
+void updateTaskCpuTime(TaskHealthEntry &entry, uint32_t runTimeCounter, uint32_t totalRunTimeDelta)
+{
+#if configGENERATE_RUN_TIME_STATS
+  if (entry.hasPreviousRunTime && totalRunTimeDelta > 0)
+  {
+    entry.cpuPercent = (runTimeCounter - entry.previousRunTime) * 100.0f / totalRunTimeDelta;
+  }
+  entry.previousRunTime = runTimeCounter;
+  entry.hasPreviousRunTime = true;
+#endif
+}
+
+/**
+ * @brief スタックの余裕が最も少ないタスクを探す
+ * @return 見つかったタスクの記録（まだ記録がなければNULL）
+ */
+const TaskHealthEntry *findLowestStackHeadroomTask()
+{
+  const TaskHealthEntry *lowestEntry = NULL;
+  for (size_t i = 0; i < taskHealthCount; i++)
+  {
+    if (lowestEntry == NULL || taskHealthEntries[i].stackHeadroomBytes < lowestEntry->stackHeadroomBytes)
+    {
+      lowestEntry = &taskHealthEntries[i];
+    }
+  }
+  return lowestEntry;
+}
+
+/**
+ * @brief タスクごとのスタックの余裕・優先度・CPU使用率をシリアルに出力する
+ */
+void printTaskHealthReport()
+{
+  // 最新の値で出力する
+  lastTaskMonitorTime = millis() - TASK_MONITOR_INTERVAL_MILLISECONDS;
+  sampleTaskHealthIfIntervalElapsed();
+
+  Serial.println("--- Task Health ---");
+  Serial.println("task             prio  stack free   cpu");
+  for (size_t i = 0; i < taskHealthCount; i++)
+  {
+    const TaskHealthEntry &entry = taskHealthEntries[i];
+    Serial.printf("%-16s %4u %9lu B", entry.name, (unsigned int)entry.priority, (unsigned long)entry.stackHeadroomBytes);
+    if (entry.cpuPercent >= 0.0f)
+      Serial.printf(" %5.1f%%", entry.cpuPercent);
+    else
+      Serial.print("     -");
+    Serial.println(entry.stackHeadroomBytes < STACK_HEADROOM_WARNING_BYTES ? "  LOW" : "");
+  }
+#if !configUSE_TRACE_FACILITY
+  Serial.println("(other tasks need configUSE_TRACE_FACILITY)");
+#elif !configGENERATE_RUN_TIME_STATS
+  Serial.println("(per-task CPU time needs configGENERATE_RUN_TIME_STATS)");
+#endif
+  if (loopTaskBusyPercent >= 0.0f)
+  {
+    Serial.printf("loop() busy: %.1f%% of wall time (from loop cycle counts)\n", loopTaskBusyPercent);
+  }
+  Serial.println("-------------------");
+}
+
+// -----------------------------------------------------------------
+// イベントトレース関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief トレースにイベントを1件記録する
+ * @param eventId 処理の種類
+ * @param phase 'B'（開始）または 'E'（終了）
+ * @param argument バイト数など、処理ごとの補足の値（65535で頭打ち）
+ * @details バッファがいっぱいなら最も古いイベントを上書きするので、常に直近の様子が残ります
+ */
+void recordTraceEvent(TraceEventId eventId, uint8_t phase, uint16_t argument)
+{
+  if (traceFrozen)
+  {
+    return;
+  }
+
+  TraceEvent &event = traceEvents[traceNextIndex];
+  event.timestampMicros = micros();
+  event.eventId = (uint8_t)eventId;
+  event.phase = phase;
+  event.argument = argument;
+
+  traceNextIndex = (traceNextIndex + 1) % TRACE_BUFFER_EVENT_COUNT;
+  if (traceEventCount < TRACE_BUFFER_EVENT_COUNT)
+  {
+    traceEventCount++;
+  }
+  else
+  {
+    traceOverwrittenCount++;
+  }
+}
+
+/**
+ * @brief 処理の開始を記録する
+ */
+void traceBegin(TraceEventId eventId, uint16_t argument)
+{
+  recordTraceEvent(eventId, 'B', argument);
+}
+
+/**
+ * @brief 処理の終了を記録する
+ */
+void traceEnd(TraceEventId eventId, uint16_t argument)
+{
+  recordTraceEvent(eventId, 'E', argument);
+}
+
+TraceSpan::TraceSpan(TraceEventId id, uint16_t argument) : eventId(id)
+{
+  traceBegin(eventId, argument);
+}
+
+TraceSpan::~TraceSpan()
+{
+  traceEnd(eventId);
+}
+
+/**
+ * @brief ループ1回が長くかかっていたら、記録を止めてその直前までを残す
+ * @param loopMicros 今回のループの処理時間（マイクロ秒）
+ * @details 止めたあとに `trace` コマンドでダンプすると、長くかかった原因の処理をタイムラインで確認できます
+ */
+void freezeTraceOnSlowLoop(unsigned long loopMicros)
+{
+  bool ignoreThisLoop = traceIgnoreSlowLoop;
+  traceIgnoreSlowLoop = false;
+  if (TRACE_FREEZE_LOOP_MILLISECONDS == 0 || traceFrozen || ignoreThisLoop ||
+      loopMicros < TRACE_FREEZE_LOOP_MILLISECONDS * 1000UL)
+  {
+    return;
+  }
+  traceFrozen = true;
+  LOG_WARN("🧊 Trace frozen after a %lu ms loop. Send 'trace' to dump it.\n", loopMicros / 1000);
+}
+
+/**
+ * @brief 記録したイベントをバイナリでシリアルに出力し、記録を空にして再開する
+ * @details
+ * 形式（リトルエンディアン）:
+ * "TRC1" | ダンプ時のmicros(u32) | 上書きで失ったイベント数(u32) | イベント数(u16) |
+ * 名前の数(u8) | 名前ごとに 長さ(u8)+文字列 | イベントごとに 時刻(u32)+種類(u8)+'B'/'E'(u8)+補足の値(u16)
+ * 受け取ったバイト列は tools/trace_to_chrome.py でChrome / Perfettoのトレース形式（JSON）に変換できます。
+ */
+void dumpTraceBuffer()
+{
+  // ダンプ中のシリアル出力は記録しない
+  traceFrozen = true;
+
+  Serial.printf("--- Trace dump: %u events (binary follows) ---\n", (unsigned int)traceEventCount);
+  Serial.write((const uint8_t *)TRACE_DUMP_MAGIC, sizeof(TRACE_DUMP_MAGIC));
+
+  uint8_t header[11];
+  size_t offset = 0;
+  writeLittleEndian(header, offset, micros(), 4);
+  writeLittleEndian(header, offset, traceOverwrittenCount, 4);
+  writeLittleEndian(header, offset, traceEventCount, 2);
+  header[offset++] = TRACE_EVENT_ID_COUNT;
+  Serial.write(header, offset);
+  for (int i = 0; i < TRACE_EVENT_ID_COUNT; i++)
+  {
+    uint8_t nameLength = strlen(TRACE_EVENT_NAMES[i]);
+    Serial.write(&nameLength, 1);
+    Serial.write((const uint8_t *)TRACE_EVENT_NAMES[i], nameLength);
+  }
+
+  // 古いイベントから順に出力する
+  size_t oldestIndex = (traceNextIndex + TRACE_BUFFER_EVENT_COUNT - traceEventCount) % TRACE_BUFFER_EVENT_COUNT;
+  for (size_t i = 0; i < traceEventCount; i++)
+  {
+    const TraceEvent &event = traceEvents[(oldestIndex + i) % TRACE_BUFFER_EVENT_COUNT];
+    uint8_t record[8];
+    offset = 0;
+    writeLittleEndian(record, offset, event.timestampMicros, 4);
+    record[offset++] = event.eventId;
+    record[offset++] = event.phase;
+    writeLittleEndian(record, offset, event.argument, 2);
+    Serial.write(record, sizeof(record));
+  }
+  Serial.println();
+  Serial.println("--- Trace dump end ---");
+  Serial.flush();
+
+  traceNextIndex = 0;
+  traceEventCount = 0;
+  traceOverwrittenCount = 0;
+  traceFrozen = false;
+}
+
+// -----------------------------------------------------------------
+// ベンチマーク関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief 主な処理の1回あたりの時間を測り、benchmark_baseline.h の基準値と比べて1行1件のJSONで出力する
+ * @details
+ * 各処理を BENCHMARK_ROUNDS 回測り、割り込みやキャッシュの影響が最も少なかった回（最速の回）を採用します。
+ * 基準値より BENCHMARK_TOLERANCE_PERCENT 以上遅ければ「regressed」とし、最後の集計行の result を fail にします。
+ * 基準値が0（まだ本体で測っていない）の項目は「no_baseline」として数え、ほかに失敗がなければ集計行の result を
+ * uncalibrated にします（pass とは言いません）。基準値を貼り付けるまで、本体での回帰の判定は働きません。
+ * シリアルモニタで「bench」と入力すると呼び出されます。
+ */
+void runBenchmarkSuite()
+{
+  // 測っている間のイベントは調べたい動きではないので、トレースへの記録を止めておく
+  bool traceWasFrozen = traceFrozen;
+  traceFrozen = true;
+
+  // 画面の代わりに描くスプライト（8ビットカラーで約32KB）。確保できなければ描画だけは測らない
+  M5Canvas canvas(&M5.Display);
+  canvas.setColorDepth(8);
+  bool canvasReady = canvas.createSprite(M5.Display.width(), M5.Display.height()) != NULL;
+
+  uint32_t cpuMHz = ESP.getCpuFreqMHz();
+  uint32_t measuredNanoseconds[BENCHMARK_CASE_COUNT];
+  int regressedCount = 0;
+  int improvedCount = 0;
+  int missingBaselineCount = 0;
+
+  Serial.println("--- Benchmark Suite (JSON lines) ---");
+  for (int b = 0; b < BENCHMARK_CASE_COUNT; b++)
+  {
+    BenchmarkCase benchmarkCase = (BenchmarkCase)b;
+    uint32_t baseline = BENCHMARK_BASELINE_NANOSECONDS[b];
+    if (benchmarkCase == BENCH_COMPOSE && !canvasReady)
+    {
+      measuredNanoseconds[b] = baseline; // 貼り付け用の行では、今の基準値をそのまま残す
+      Serial.printf("{\"bench\":\"%s\",\"status\":\"skipped\",\"reason\":\"no memory for canvas\"}\n", BENCHMARK_NAMES[b]);
+      continue;
+    }
+
+    // 1回目は空回し（初回だけのヒープ確保などを計測から外す）
+    runBenchmarkCase(benchmarkCase, 1, canvas);
+    uint32_t bestCycles = UINT32_MAX;
+    for (uint8_t round = 0; round < BENCHMARK_ROUNDS; round++)
+    {
+      uint32_t cycles = runBenchmarkCase(benchmarkCase, BENCHMARK_ITERATIONS[b], canvas);
+      if (cycles < bestCycles)
+        bestCycles = cycles;
+    }
+    measuredNanoseconds[b] = (uint32_t)((uint64_t)bestCycles * 1000ULL / ((uint64_t)cpuMHz * BENCHMARK_ITERATIONS[b]));
+
+    const char *status = "no_baseline";
+    float deltaPercent = 0.0f;
+    if (baseline == 0)
+    {
+      missingBaselineCount++;
+    }
+    else
+    {
+      deltaPercent = ((float)measuredNanoseconds[b] - (float)baseline) * 100.0f / (float)baseline;
+      if (deltaPercent > BENCHMARK_TOLERANCE_PERCENT)
+      {
+        status = "regressed";
+        regressedCount++;
+      }
+      else if (deltaPercent < -BENCHMARK_TOLERANCE_PERCENT)
+      {
+        status = "improved";
+        improvedCount++;
+      }
+      else
+      {
+        status = "ok";
+      }
+    }
+    Serial.printf("{\"bench\":\"%s\",\"ns_per_op\":%lu,\"iterations\":%u,\"rounds\":%u,\"baseline_ns\":%lu,\"delta_pct\":%.1f,\"status\":\"%s\"}\n",
+                  BENCHMARK_NAMES[b], (unsigned long)measuredNanoseconds[b], (unsigned int)BENCHMARK_ITERATIONS[b],
+                  (unsigned int)BENCHMARK_ROUNDS, (unsigned long)baseline, deltaPercent, status);
+  }
+  if (canvasReady)
+    canvas.deleteSprite();
+
+  // 表示用の文字列化が、速さだけでなく値も正しいことを確かめる（一致しなければ集計行を fail にする）
+  uint32_t roundTripCount = 0;
+  bool roundTripPassed = verifyNumericFormattingRoundTrip(roundTripCount);
+  Serial.printf("{\"check\":\"format_round_trip\",\"values\":%lu,\"status\":\"%s\"}\n", (unsigned long)roundTripCount,
+                roundTripPassed ? "ok" : "failed");
+
+  Serial.printf("{\"summary\":true,\"cpu_mhz\":%lu,\"tolerance_pct\":%.1f,\"regressed\":%d,\"improved\":%d,\"no_baseline\":%d,\"result\":\"%s\"}\n",
+                (unsigned long)cpuMHz, BENCHMARK_TOLERANCE_PERCENT, regressedCount, improvedCount, missingBaselineCount,
+                regressedCount > 0 || !roundTripPassed ? "fail" : (missingBaselineCount > 0 ? "uncalibrated" : "pass"));
+
+  // 基準値を更新するときに benchmark_baseline.h へそのまま貼り付けられる行
+  Serial.print("const uint32_t BENCHMARK_BASELINE_NANOSECONDS[] = {");
+  for (int b = 0; b < BENCHMARK_CASE_COUNT; b++)
+  {
+    Serial.printf("%s%lu", b > 0 ? ", " : "", (unsigned long)measuredNanoseconds[b]);
+  }
+  Serial.println("};");
+  Serial.println("------------------------------------");
+
+  traceFrozen = traceWasFrozen;
+}
+
+/**
+ * @brief 1種類の処理を指定回数繰り返し、かかったCPUサイクル数を返す
+ * @param benchmarkCase 測る処理
+ * @param iterations 繰り返す回数
+ * @param canvas 描画を測るときに使うスプライト
+ * @return かかったCPUサイクル数（準備の時間は含めない）
+ * @details
+ * 受信処理（ingest）は handleIncomingMQTTMessage の前半と同じ手順を測ります。
+ * 関数そのものを呼ぶと、センサーの登録表や現在の値が書き換わり画面も描き直されるため、
+ * 並べ替え窓はこの場で用意したものを使い、状態を変える後半（値の反映と描画）は compose で別に測ります。
+ */
+uint32_t runBenchmarkCase(BenchmarkCase benchmarkCase, uint32_t iterations, M5Canvas &canvas)
+{
+  byte *payload = (byte *)BENCHMARK_SAMPLE_PAYLOAD;
+  const unsigned int payloadLength = sizeof(BENCHMARK_SAMPLE_PAYLOAD) - 1;
+  char jsonText[JSON_MESSAGE_MAX_LENGTH + 1];
+  PackedSensorRecord record;
+  IngestRecordText recordText;
+  SequenceWindow window;
+  resetSequenceWindow(window);
+  uint32_t sink = 0;
+
+  uint32_t startCycles = ESP.getCycleCount();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    switch (benchmarkCase)
+    {
+    case BENCH_SANITIZE:
+      sink += copyPrintablePayload(payload, payloadLength, jsonText, sizeof(jsonText));
+      break;
+
+    case BENCH_PARSE:
+      // 解析すると文字列が書き換わるので、毎回元の文字列を写してから解析する
+      memcpy(jsonText, BENCHMARK_SAMPLE_PAYLOAD, sizeof(BENCHMARK_SAMPLE_PAYLOAD));
+      parseJSONSensorRecord(jsonText, record, recordText);
+      sink += record.carbonDioxidePpm;
+      break;
+
+    case BENCH_INGEST:
+    {
+      // 毎回違うタイムスタンプにして、重複として捨てられる近道を通らないようにする
+      unsigned long timestamp = (unsigned long)extractRawJSONUnsigned(payload, payloadLength, "timestamp") + i;
+      char sensorId[SENSOR_ID_MAX_LENGTH + 1];
+      extractRawJSONString(payload, payloadLength, "sensor_id", sensorId, sizeof(sensorId));
+      if (checkSequenceWindow(window, timestamp) == SEQUENCE_DUPLICATE)
+        break;
+      size_t jsonLength = copyPrintablePayload(payload, payloadLength, ingestMessageBuffer, sizeof(ingestMessageBuffer));
+      if (validateJSONDataIntegrity(ingestMessageBuffer, jsonLength) &&
+          parseJSONSensorRecord(ingestMessageBuffer, record, recordText))
+        sink += record.carbonDioxidePpm + sensorId[0];
+      break;
+    }
+
+    case BENCH_FORMAT:
+      // 画面に出すCO2（整数）とTHI（小数1桁）の文字列化
+      sink += formatScaledDecimal<0>(jsonText, sizeof(jsonText), 800 + (int)(i & 0xFF));
+      sink += formatFixedPoint<1>(jsonText, sizeof(jsonText), 70.0f + (i & 0xFF) * 0.1f);
+      break;
+
+    case BENCH_FORMAT_STRING:
+      sink += String(800 + (int)(i & 0xFF)).length() + String(70.0f + (i & 0xFF) * 0.1f, 1).length();
+      break;
+
+    case BENCH_COMPOSE:
+      composeCO2PageOnCanvas(canvas, 800 + (int)(i & 0xFF), "12:34:56");
+      break;
+
+    case BENCH_CLOCK:
+    {
+      // Digi-Clock Unitに送る「HH:MM」の組み立てと同じ処理
+      char timeString[CLOCK_HOUR_MINUTE_TEXT_SIZE];
+      sink += (uint32_t)getCurrentEpochMillis();
+      formatClockHourMinute(timeString, sizeof(timeString), timeClient.getHours(), timeClient.getMinutes());
+      sink += timeString[4];
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+  uint32_t elapsedCycles = ESP.getCycleCount() - startCycles;
+
+  benchmarkSink += sink;
+  return elapsedCycles;
+}
+
+/**
+ * @brief CO2ページ（タイトル・時刻・接続状態・CO2の値）と同じ内容をスプライトに描く
+ * @param canvas 描画先のスプライト
+ * @param carbonDioxideLevel 表示するCO2濃度
+ * @param timeText 表示する時刻の文字列
+ * @details 実際の描画関数は M5.Display に直接描くので、計測用に同じ手順をスプライト向けに並べています
+ */
+void composeCO2PageOnCanvas(M5Canvas &canvas, int carbonDioxideLevel, const char *timeText)
+{
+  canvas.fillScreen(BLACK);
+
+  canvas.setTextSize(1);
+  canvas.setTextColor(CYAN);
+  canvas.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
+  canvas.println("Sensor Monitor");
+
+  canvas.setTextColor(WHITE);
+  canvas.setCursor(TIME_DISPLAY_X, TIME_DISPLAY_Y);
+  canvas.println(timeText);
+
+  canvas.setTextColor(GREEN);
+  canvas.setCursor(CONNECTION_STATUS_X, CONNECTION_STATUS_Y);
+  canvas.println("MQTT:OK");
+
+  canvas.setTextSize(2);
+  canvas.setCursor(LARGE_LABEL_X, LARGE_LABEL_Y);
+  canvas.println("CO2:");
+
+  canvas.setTextSize(8);
+  canvas.setTextDatum(TR_DATUM);
+  char co2Value[NUMERIC_TEXT_BUFFER_SIZE];
+  formatScaledDecimal<0>(co2Value, sizeof(co2Value), carbonDioxideLevel);
+  canvas.drawString(co2Value, canvas.width() - DISPLAY_RIGHT_MARGIN, LARGE_VALUE_Y);
+  canvas.setTextDatum(TL_DATUM);
+}
+
+// -----------------------------------------------------------------
+// シリアルコンソール関連の関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief シリアルモニタから届いた文字を受け取り、1行そろったらコマンドとして実行する
+ * @details 届いている分だけを読むので、入力を待ってメインループが止まることはありません
+ */
+void processSerialConsoleCommands()
+{
+  while (Serial.available() > 0)
+  {
+    char receivedChar = (char)Serial.read();
+
+    if (receivedChar == '\r' || receivedChar == '\n')
+    {
+      // 改行が来たら、そこまでの文字列を1つのコマンドとして実行
+      if (serialCommandLength > 0)
+      {
+        serialCommandBuffer[serialCommandLength] = '\0';
+        executeSerialConsoleCommand(serialCommandBuffer);
+        serialCommandLength = 0;
+        traceIgnoreSlowLoop = true; // 集計の出力やダンプで長くなったループは、調べたい停止ではない
+      }
+    }
+    else if (serialCommandLength < sizeof(serialCommandBuffer) - 1)
+    {
+      serialCommandBuffer[serialCommandLength++] = receivedChar;
+    }
+  }
+}
+
+/**
+ * @brief 1行分のコマンドを実行する
+ * @param command 実行するコマンド文字列
+ */
+void executeSerialConsoleCommand(const char *command)
+{
+  // 集計の出力はそのままシリアルに書くので、先にたまっているログを送り切って順番が混ざらないようにする
+  flushLogBuffer();
+
+  if (strcmp(command, "stats") == 0)
+  {
+    printRunningStatistics();
+  }
+  else if (strcmp(command, "flash") == 0)
+  {
+    printHistoryLogStatus();
+  }
+  else if (strcmp(command, "bench") == 0)
+  {
+    runBenchmarkSuite();
+  }
+  else if (strcmp(command, "bench codec") == 0)
+  {
+    runHistoryCodecBenchmark();
+  }
+  else if (strcmp(command, "forecast") == 0)
+  {
+    printCO2ForecastReport();
+  }
+  else if (strcmp(command, "fresh") == 0)
+  {
+    printSensorFreshnessReport();
+  }
+  else if (strcmp(command, "sensors") == 0)
+  {
+    printSensorRegistryReport();
+  }
+  else if (strcmp(command, "latency") == 0)
+  {
+    printLatencyReport();
+  }
+  else if (strcmp(command, "heap") == 0)
+  {
+    printHeapUsageReport();
+  }
+  else if (strcmp(command, "replay") == 0)
+  {
+    runSteadyStateReplay();
+  }
+  else if (strcmp(command, "heap reset") == 0)
+  {
+    resetHeapUsageTracking();
+    Serial.println("Heap usage counters cleared.");
+  }
+  else if (strcmp(command, "prof") == 0)
+  {
+    printLoopStageProfiles();
+  }
+  else if (strcmp(command, "prof reset") == 0)
+  {
+    resetLoopStageProfiles();
+    Serial.println("Loop profiles cleared.");
+  }
+  else if (strcmp(command, "log") == 0)
+  {
+    printLogStatus();
+  }
+  else if (strcmp(command, "trace") == 0)
+  {
+    dumpTraceBuffer();
+  }
+  else if (strcmp(command, "i2c") == 0)
+  {
+    printI2CBusReport();
+  }
+  else if (strcmp(command, "tasks") == 0)
+  {
+    printTaskHealthReport();
+  }
+  else
+  {
+    Serial.printf("Unknown command: '%s'\n", command);
+    Serial.println("Commands: stats, flash, bench, bench codec, forecast, fresh, sensors, latency, heap, heap reset, replay, prof, prof reset, log, trace, tasks, i2c");
+  }
+}
+
+// -----------------------------------------------------------------
+// ユーティリティ関数
+// -----------------------------------------------------------------
+
+/**
+ * @brief NTPで取得した時刻が有効かどうかを判定する
+ * @return 2023年以降の時刻になっていればtrue（同期済み）
+ */
+bool isSystemTimeSynchronized()
+{
+  return timeClient.getEpochTime() > MINIMUM_VALID_EPOCH_SECONDS;
+}
+
+/**
+ * @brief 現在のUNIX時刻（協定世界時）を秒で取得する
+ * @return UNIX時刻（秒）
+ * @details
+ * timeClientは日本時間のオフセット付きで作っているため、getEpochTime()は協定世界時より9時間進んだ値を返します。
+ * 履歴・フラッシュのログ・問い合わせの応答など、外部とやり取りする時刻はこの関数の値（オフセットなし）を使います。
+ */
+unsigned long getCurrentUnixEpochSeconds()
+{
+  return timeClient.getEpochTime() - JAPAN_TIME_OFFSET_SECONDS;
+}
+
+/**
+ * @brief 接続状態メッセージを画面に表示
+ * @param statusMessage 表示するメッセージ
+ */
+void showConnectionStatusMessage(const char *statusMessage)
+{
+  // 画面をクリア
+  clearDisplayScreenWithColor(BLACK);
+
+  // 直前の段階の結果（Wi-Fi接続成功など）の通知を、画面の下に重ねる
+  drawToastNotifications();
+
+  // テキスト位置を設定
+  M5.Display.setTextColor(WHITE);
+  M5.Display.setCursor(TITLE_POSITION_X, TITLE_POSITION_Y);
+
+  // 指定されたメッセージを表示
+  M5.Display.println(statusMessage);
+}
+
+/**
+ * @brief 画面の下に重ねて表示する通知（トースト）を追加する
+ * @param text 表示する文字列（TOAST_TEXT_MAX_LENGTH を超えた分は切り捨て）
+ * @param color 文字と枠の色
+ * @param durationMillis 表示しておく時間（ミリ秒）
+ * @details
+ * 表示を待たずにすぐ戻ります。通知は画面を描くたびに（起動中の状態表示・ページの描画とも）重ねて描かれ、
+ * 時間が過ぎるとメインループの updateToastNotifications が描き直して消します。
+ * 満杯のときは最も古い通知を消して入れます。
+ */
+void postToastNotification(const char *text, uint16_t color, unsigned long durationMillis)
+{
+  if (toastCount == TOAST_CAPACITY)
+  {
+    memmove(&toastNotifications[0], &toastNotifications[1], sizeof(ToastNotification) * (TOAST_CAPACITY - 1));
+    toastCount--;
+  }
+  ToastNotification &toast = toastNotifications[toastCount++];
+  strlcpy(toast.text, text, sizeof(toast.text));
+  toast.color = color;
+  toast.postedMillis = millis();
+  toast.durationMillis = durationMillis;
+  toastRedrawPending = true;
+}
+
+/**
+ * @brief 表示時間が過ぎた通知を消し、残りを古い順に詰める
+ * @return 1件でも消したらtrue
+ */
+bool removeExpiredToastNotifications()
+{
+  unsigned long currentMillis = millis();
+  uint8_t keptCount = 0;
+  for (uint8_t i = 0; i < toastCount; i++)
+  {
+    // millis()が一周しても正しく比べられるよう、経過時間で判定する
+    if (currentMillis - toastNotifications[i].postedMillis < toastNotifications[i].durationMillis)
+    {
+      if (keptCount != i)
+        toastNotifications[keptCount] = toastNotifications[i];
+      keptCount++;
+    }
+  }
+  bool removedAny = keptCount != toastCount;
+  toastCount = keptCount;
+  return removedAny;
+}
+
+/**
+ * @brief 通知が増えた・表示時間が過ぎたときに、ページの切り替えを待たずに画面全体を描き直す
+ * @details メインループから毎回呼び出します。変化がなければ何もしません
+ */
+void updateToastNotifications()
+{
+  if (removeExpiredToastNotifications() || toastRedrawPending)
+  {
+    refreshEntireDisplay();
+  }
+}
+
+/**
+ * @brief 表示中の通知を、画面の下から新しい順に重ねて描く
+ * @details 画面を描く処理の最後に呼び出します（描いた内容の上に、枠付きで重ねます）
+ */
+void drawToastNotifications()
+{
+  removeExpiredToastNotifications();
+  toastRedrawPending = false;
+
+  M5.Display.setTextSize(1);
+  M5.Display.setTextDatum(TL_DATUM);
+  const int toastWidth = M5.Display.width() - 2 * TOAST_MARGIN_X;
+  for (uint8_t i = 0; i < toastCount; i++)
+  {
+    // 新しい通知ほど下に並べる
+    const ToastNotification &toast = toastNotifications[i];
+    const int toastY = M5.Display.height() - 2 - TOAST_ROW_HEIGHT * (toastCount - i);
+    M5.Display.fillRect(TOAST_MARGIN_X, toastY, toastWidth, TOAST_ROW_HEIGHT - 1, BLACK);
+    M5.Display.drawRect(TOAST_MARGIN_X, toastY, toastWidth, TOAST_ROW_HEIGHT - 1, toast.color);
+    M5.Display.setTextColor(toast.color);
+    M5.Display.setCursor(TOAST_MARGIN_X + 4, toastY + 2);
+    M5.Display.print(toast.text);
+  }
 }
 
 /**
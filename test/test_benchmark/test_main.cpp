@@ -0,0 +1,282 @@
+/**
+ * @file test_main.cpp
+ * @brief ホスト環境で主な処理の1回あたりの時間を測り、benchmark_baseline.h の基準値と比べる
+ * @details
+ * `pio test -e native -f test_benchmark` で実行します。結果は本体の `bench` と同じく1行1件のJSONで出力します。
+ * PCの速さの違いで判定が変わらないよう、各処理は「較正用の処理」と交互に測り、その時間を1000とした値（千分率）で比べます。
+ * 基準値より NATIVE_BENCHMARK_TOLERANCE_PERCENT 以上遅い項目、基準値が0の項目があればテストを失敗にします。
+ * あわせて、表示用の文字列化（format）が snprintf（format_printf）より速いことも、同じ実行の中で比べて確かめます。
+ *
+ * 本体の `bench` にある compose（CO2ページの描画）は、ここでは測りません。描画は M5GFX のフォントの描き方そのものなので、
+ * ホスト環境で別の描き方に置き換えて測っても本体の処理の速さにはならないためです。本体の `bench` で測ります。
+ */
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include "config.example.h" // config.h と同じ既定値。Arduino.h の代わりに stdint.h を先に読み込む
+#include "benchmark_baseline.h"
+#include "clock_format.h"
+#include "fixed_point_format.h"
+#include "history_codec.h"
+#include "sensor_ingest.h"
+
+/**
+ * @brief ホスト環境で測る処理の種類
+ */
+enum NativeBenchmarkCase
+{
+  NATIVE_BENCH_SANITIZE = 0,   // 受信したバイト列から印字可能な文字だけを取り出す
+  NATIVE_BENCH_PREFILTER,      // JSONを解析する前の重複判定（timestamp・sensor_id の取り出しと並べ替え窓）
+  NATIVE_BENCH_PARSE,          // JSONの解析（decodeSensorRecordJSON）
+  NATIVE_BENCH_INGEST,         // 受信処理の前半（本体と同じ decodeSensorPayload：重複判定・文字列化・検証・解析・変換）
+  NATIVE_BENCH_FORMAT,         // 表示する値の文字列化（formatScaledDecimal / formatFixedPoint）
+  NATIVE_BENCH_FORMAT_PRINTF,  // 同じ値の snprintf による文字列化（比べるためだけに測る）
+  NATIVE_BENCH_CODEC,          // 履歴1サンプルの圧縮と復元
+  NATIVE_BENCH_CLOCK,          // 現在時刻のミリ秒の推定と「HH:MM」「HH:MM:SS」の組み立て
+  NATIVE_BENCHMARK_CASE_COUNT  // 種類の数
+};
+
+const char *const NATIVE_BENCHMARK_NAMES[NATIVE_BENCHMARK_CASE_COUNT] = {"sanitize", "prefilter", "parse", "ingest",
+                                                                         "format", "format_printf", "codec", "clock"};
+const uint32_t NATIVE_BENCHMARK_ITERATIONS[NATIVE_BENCHMARK_CASE_COUNT] = {4000, 8000, 1000, 1000, 20000, 4000, 4000, 40000};
+static_assert(sizeof(NATIVE_BENCHMARK_BASELINE_PERMILLE) / sizeof(NATIVE_BENCHMARK_BASELINE_PERMILLE[0]) == NATIVE_BENCHMARK_CASE_COUNT,
+              "NATIVE_BENCHMARK_BASELINE_PERMILLE must have one entry per benchmark case");
+const char BENCHMARK_SAMPLE_PAYLOAD[] =
+    "{\"sensor_id\":\"living\",\"timestamp\":1720000000,\"co2\":812,\"thi\":72.4,"
+    "\"temperature\":25.3,\"humidity\":58.1,\"comfort_level\":\"Comfortable\"}"; // 本体の `bench` と同じメッセージ
+volatile uint32_t benchmarkSink = 0; // 測る処理の結果をここに足し込み、最適化で処理ごと消されないようにする
+
+StaticJsonDocument<JSON_PARSING_MEMORY_SIZE> sensorJsonDocument; // 本体と同じく、静的領域に確保して使い回す
+char ingestMessageBuffer[JSON_MESSAGE_MAX_LENGTH + 1];           // 受信したペイロードを文字列にした領域
+
+/**
+ * @brief 較正用の処理（メッセージ全体のFNV-1aハッシュ）を指定回数繰り返し、かかった時間（ナノ秒）を返す
+ * @details 整数の掛け算とメモリの読み出しだけの、メモリ確保も分岐の予測外れもない処理です
+ */
+uint64_t runCalibrationLoop(uint32_t iterations)
+{
+  uint32_t sink = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    uint32_t hash = 2166136261UL ^ i;
+    for (size_t c = 0; c < sizeof(BENCHMARK_SAMPLE_PAYLOAD) - 1; c++)
+    {
+      hash = (hash ^ (uint8_t)BENCHMARK_SAMPLE_PAYLOAD[c]) * 16777619UL;
+    }
+    sink += hash;
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  benchmarkSink += sink;
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+/**
+ * @brief 1種類の処理を指定回数繰り返し、かかった時間（ナノ秒）を返す
+ */
+uint64_t runNativeBenchmarkCase(NativeBenchmarkCase benchmarkCase, uint32_t iterations)
+{
+  const uint8_t *payload = (const uint8_t *)BENCHMARK_SAMPLE_PAYLOAD;
+  const unsigned int payloadLength = sizeof(BENCHMARK_SAMPLE_PAYLOAD) - 1;
+  char text[JSON_MESSAGE_MAX_LENGTH + 1];
+  SequenceWindow window;
+  resetSequenceWindow(window);
+  uint8_t codecBuffer[64];
+  uint32_t sink = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    switch (benchmarkCase)
+    {
+    case NATIVE_BENCH_SANITIZE:
+      sink += copyPrintablePayload(payload, payloadLength, text, sizeof(text));
+      break;
+
+    case NATIVE_BENCH_PREFILTER:
+    {
+      // 毎回違うタイムスタンプにして、重複として捨てられる近道を通らないようにする
+      unsigned long timestamp = (unsigned long)extractRawJSONUnsigned(payload, payloadLength, "timestamp") + i;
+      char sensorId[SENSOR_ID_MAX_LENGTH + 1];
+      extractRawJSONString(payload, payloadLength, "sensor_id", sensorId, sizeof(sensorId));
+      sink += checkSequenceWindow(window, timestamp) + sensorId[0];
+      break;
+    }
+
+    case NATIVE_BENCH_PARSE:
+    {
+      // 解析すると文字列が書き換わるので、毎回元の文字列を写してから解析する
+      PackedSensorRecord record;
+      IngestRecordText recordText;
+      memcpy(text, BENCHMARK_SAMPLE_PAYLOAD, sizeof(BENCHMARK_SAMPLE_PAYLOAD));
+      decodeSensorRecordJSON(sensorJsonDocument, text, record, recordText);
+      sink += record.carbonDioxidePpm;
+      break;
+    }
+
+    case NATIVE_BENCH_INGEST:
+    {
+      // 同じメッセージが重複として捨てられないよう、窓を毎回空にする（空にするのは数回の書き込みだけ）
+      SensorDataPacket decodedData;
+      resetSequenceWindow(window);
+      if (decodeSensorPayload(payload, payloadLength, window, sensorJsonDocument, ingestMessageBuffer, sizeof(ingestMessageBuffer),
+                              decodedData))
+        sink += decodedData.carbonDioxideLevel + decodedData.sensorId[0];
+      break;
+    }
+
+    case NATIVE_BENCH_FORMAT:
+      sink += formatScaledDecimal<0>(text, sizeof(text), 800 + (int)(i & 0xFF));
+      sink += formatFixedPoint<1>(text, sizeof(text), 70.0f + (i & 0xFF) * 0.1f);
+      break;
+
+    case NATIVE_BENCH_FORMAT_PRINTF:
+      sink += snprintf(text, sizeof(text), "%d", 800 + (int)(i & 0xFF));
+      sink += snprintf(text, sizeof(text), "%.1f", 70.0f + (i & 0xFF) * 0.1f);
+      break;
+
+    case NATIVE_BENCH_CODEC:
+    {
+      // 1件目（値をそのまま書く）と2件目（差分を書く）を圧縮して、同じ順に復元する
+      CompactHistorySample samples[2] = {{(uint16_t)(800 + (i & 0xFF)), 724, 253, 116, 0},
+                                         {(uint16_t)(803 + (i & 0xFF)), 725, 252, 117, 0}};
+      unsigned long epochs[2] = {1720000000UL, 1720000000UL + HISTORY_SAMPLE_PERIOD_SECONDS};
+      BitStreamWriter writer = {codecBuffer, sizeof(codecBuffer) * 8, 0};
+      GorillaCodecState encoderState;
+      beginGorillaCodec(encoderState, epochs[0]);
+      encodeGorillaSample(writer, encoderState, samples[0], epochs[0]);
+      encodeGorillaSample(writer, encoderState, samples[1], epochs[1]);
+
+      BitStreamReader reader = {codecBuffer, writer.bitPosition, 0, false};
+      GorillaCodecState decoderState;
+      beginGorillaCodec(decoderState, epochs[0]);
+      CompactHistorySample decoded = {0, 0, 0, 0, 0};
+      unsigned long decodedEpoch = 0;
+      decodeGorillaSample(reader, decoderState, decoded, decodedEpoch);
+      decodeGorillaSample(reader, decoderState, decoded, decodedEpoch);
+      sink += decoded.carbonDioxidePpm + (uint32_t)writer.bitPosition;
+      break;
+    }
+
+    case NATIVE_BENCH_CLOCK:
+    {
+      // 本体の getCurrentEpochMillis と、Digi-Clock Unit・画面に出す時刻の組み立てと同じ処理
+      unsigned long localEpochSecond = 1720000000UL + JAPAN_TIME_OFFSET_SECONDS + i / 1000;
+      sink += (uint32_t)estimateEpochMillis(localEpochSecond, JAPAN_TIME_OFFSET_SECONDS, i & ~0x3FFUL, i);
+      int secondOfDay = (int)(localEpochSecond % 86400UL);
+      sink += formatClockHourMinute(text, sizeof(text), secondOfDay / 3600, (secondOfDay / 60) % 60) + text[4];
+      sink += formatClockHourMinuteSecond(text, sizeof(text), secondOfDay / 3600, (secondOfDay / 60) % 60, secondOfDay % 60) + text[7];
+      break;
+    }
+
+    default:
+      break;
+    }
+  }
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+  benchmarkSink += sink;
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief すべての処理を較正用の処理と比べて測り、基準値より遅くなった項目や基準値のない項目がないことを確かめる
+ */
+void test_benchmark_against_baseline(void)
+{
+  initializeComfortLevelTable();
+  uint32_t measuredPermille[NATIVE_BENCHMARK_CASE_COUNT];
+  int regressedCount = 0;
+  int missingBaselineCount = 0;
+
+  for (int b = 0; b < NATIVE_BENCHMARK_CASE_COUNT; b++)
+  {
+    NativeBenchmarkCase benchmarkCase = (NativeBenchmarkCase)b;
+    const uint32_t iterations = NATIVE_BENCHMARK_ITERATIONS[b];
+    uint32_t baseline = NATIVE_BENCHMARK_BASELINE_PERMILLE[b];
+
+    // 1回目は空回し（キャッシュを温める）。その後は較正用の処理と交互に測り、各回の比（千分率）の中央値を採用する
+    // （同じ回の中の比なので、その回だけPCが遅かった・速かった影響が打ち消される）
+    runCalibrationLoop(iterations);
+    runNativeBenchmarkCase(benchmarkCase, iterations);
+    uint32_t roundPermille[NATIVE_BENCHMARK_ROUNDS];
+    uint64_t bestCalibrationNanoseconds = UINT64_MAX;
+    uint64_t bestNanoseconds = UINT64_MAX;
+    for (uint8_t round = 0; round < NATIVE_BENCHMARK_ROUNDS; round++)
+    {
+      uint64_t calibration = runCalibrationLoop(iterations);
+      uint64_t elapsed = runNativeBenchmarkCase(benchmarkCase, iterations);
+      roundPermille[round] = (uint32_t)((elapsed * 1000 + calibration / 2) / (calibration > 0 ? calibration : 1));
+      if (calibration < bestCalibrationNanoseconds)
+        bestCalibrationNanoseconds = calibration;
+      if (elapsed < bestNanoseconds)
+        bestNanoseconds = elapsed;
+    }
+    std::sort(roundPermille, roundPermille + NATIVE_BENCHMARK_ROUNDS);
+    // 0.1%に満たない処理も0にはしない（0は「基準値なし」の意味なので）
+    measuredPermille[b] = roundPermille[NATIVE_BENCHMARK_ROUNDS / 2] > 0 ? roundPermille[NATIVE_BENCHMARK_ROUNDS / 2] : 1;
+
+    const char *status = "no_baseline";
+    float deltaPercent = 0.0f;
+    if (baseline == 0)
+    {
+      missingBaselineCount++;
+    }
+    else
+    {
+      deltaPercent = ((float)measuredPermille[b] - (float)baseline) * 100.0f / (float)baseline;
+      if (deltaPercent > NATIVE_BENCHMARK_TOLERANCE_PERCENT)
+      {
+        status = "regressed";
+        regressedCount++;
+      }
+      else if (deltaPercent < -NATIVE_BENCHMARK_TOLERANCE_PERCENT)
+      {
+        status = "improved";
+      }
+      else
+      {
+        status = "ok";
+      }
+    }
+    printf("{\"bench\":\"%s\",\"ns_per_op\":%lu,\"calibration_ns_per_op\":%lu,\"permille_of_calibration\":%lu,\"iterations\":%lu,"
+           "\"rounds\":%u,\"baseline_permille\":%lu,\"delta_pct\":%.1f,\"status\":\"%s\"}\n",
+           NATIVE_BENCHMARK_NAMES[b], (unsigned long)(bestNanoseconds / iterations), (unsigned long)(bestCalibrationNanoseconds / iterations),
+           (unsigned long)measuredPermille[b], (unsigned long)iterations, (unsigned int)NATIVE_BENCHMARK_ROUNDS, (unsigned long)baseline,
+           deltaPercent, status);
+  }
+
+  // 専用の文字列化は snprintf より速いはず（同じ実行の中の比なので、PCの速さによらない）
+  bool formatFasterThanPrintf = measuredPermille[NATIVE_BENCH_FORMAT] < measuredPermille[NATIVE_BENCH_FORMAT_PRINTF];
+  printf("{\"check\":\"format_vs_printf\",\"ratio\":%.2f,\"status\":\"%s\"}\n",
+         (float)measuredPermille[NATIVE_BENCH_FORMAT] / (float)measuredPermille[NATIVE_BENCH_FORMAT_PRINTF],
+         formatFasterThanPrintf ? "ok" : "failed");
+
+  printf("{\"summary\":true,\"tolerance_pct\":%.1f,\"regressed\":%d,\"no_baseline\":%d,\"result\":\"%s\"}\n",
+         NATIVE_BENCHMARK_TOLERANCE_PERCENT, regressedCount, missingBaselineCount,
+         regressedCount > 0 || missingBaselineCount > 0 || !formatFasterThanPrintf ? "fail" : "pass");
+
+  // 基準値を更新するときに benchmark_baseline.h へそのまま貼り付けられる行
+  printf("const uint32_t NATIVE_BENCHMARK_BASELINE_PERMILLE[] = {");
+  for (int b = 0; b < NATIVE_BENCHMARK_CASE_COUNT; b++)
+  {
+    printf("%s%lu", b > 0 ? ", " : "", (unsigned long)measuredPermille[b]);
+  }
+  printf("};\n");
+
+  TEST_ASSERT_EQUAL_MESSAGE(0, missingBaselineCount, "benchmark_baseline.h has no baseline for some cases");
+  TEST_ASSERT_EQUAL_MESSAGE(0, regressedCount, "some cases are slower than the baseline");
+  TEST_ASSERT_TRUE_MESSAGE(formatFasterThanPrintf, "formatFixedPoint is not faster than snprintf");
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_benchmark_against_baseline);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test_main.cpp
+ * @brief 画面に出す値の文字列化（fixed_point_format.h）が printf と同じ文字列になり、読み戻すと元の値に戻るかを確かめる
+ * @details
+ * `pio test -e native -f test_fixed_point_format` で実行します。
+ * 本体の `bench` で確かめている内容（verifyNumericFormattingRoundTrip）と同じ値の範囲を使います。
+ */
+#include <unity.h>
+#include <math.h>
+#include <stdlib.h>
+#include "fixed_point_format.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief 整数（CO2の表示）を、端の値も含めて printf の「%ld」と同じ文字列にし、読み戻すと元の値に戻ることを確かめる
+ */
+void test_integer_round_trip(void)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  char expected[NUMERIC_TEXT_BUFFER_SIZE];
+  const int32_t edgeValues[] = {0, 1, -1, 9, 10, -10, 99, 100, 399, 400, 999, 1000, 5000, 9999, 10000, 65535,
+                                INT32_MAX, INT32_MIN, INT32_MIN + 1};
+  const size_t edgeCount = sizeof(edgeValues) / sizeof(edgeValues[0]);
+  for (int32_t i = -(int32_t)edgeCount; i <= 20000; i++)
+  {
+    int32_t value = i < 0 ? edgeValues[edgeCount + i] : i;
+    size_t length = formatScaledDecimal<0>(text, sizeof(text), value);
+    snprintf(expected, sizeof(expected), "%ld", (long)value);
+    TEST_ASSERT_EQUAL_STRING(expected, text);
+    TEST_ASSERT_EQUAL(strlen(expected), length);
+    TEST_ASSERT_EQUAL(value, strtol(text, NULL, 10));
+  }
+}
+
+/**
+ * @brief 小数1桁（THI・温度の表示）を -50.00〜150.00 の0.01刻みで確かめる
+ * @details
+ * 読み戻した値と元の値の差が0.05（と丸めの誤差）以内で、読み戻した値をもう一度文字列にすると同じ文字列になり、
+ * printf の「%.1f」とも同じ文字列になる（printf が「-0.0」と書く値を除く）ことを確かめます。
+ */
+void test_one_fraction_digit_round_trip(void)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  char reformatted[NUMERIC_TEXT_BUFFER_SIZE];
+  char expected[NUMERIC_TEXT_BUFFER_SIZE];
+  for (int32_t hundredths = -5000; hundredths <= 15000; hundredths++)
+  {
+    float value = hundredths / 100.0f;
+    formatFixedPoint<1>(text, sizeof(text), value);
+    float parsedValue = strtof(text, NULL);
+    formatFixedPoint<1>(reformatted, sizeof(reformatted), parsedValue);
+    snprintf(expected, sizeof(expected), "%.1f", value);
+
+    TEST_ASSERT_TRUE(fabsf(parsedValue - value) <= 0.05f + 1e-4f);
+    TEST_ASSERT_EQUAL_STRING(text, reformatted);
+    if (strcmp(expected, "-0.0") != 0)
+      TEST_ASSERT_EQUAL_STRING(expected, text);
+    else
+      TEST_ASSERT_EQUAL_STRING("0.0", text);
+  }
+}
+
+/**
+ * @brief ちょうど中間の値を printf と同じく偶数の側に丸め、floatの誤差で中間より小さい値は切り捨てることを確かめる
+ */
+void test_rounding_matches_printf(void)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  formatFixedPoint<1>(text, sizeof(text), 72.45f); // 実際には 72.4499…
+  TEST_ASSERT_EQUAL_STRING("72.4", text);
+  formatFixedPoint<1>(text, sizeof(text), 0.25f); // ちょうど中間なので偶数の側
+  TEST_ASSERT_EQUAL_STRING("0.2", text);
+  formatFixedPoint<1>(text, sizeof(text), 0.75f);
+  TEST_ASSERT_EQUAL_STRING("0.8", text);
+  formatFixedPoint<1>(text, sizeof(text), -0.5f);
+  TEST_ASSERT_EQUAL_STRING("-0.5", text);
+}
+
+/**
+ * @brief NaN・無限大・整数に収まらない値は snprintf と同じ文字列になり、書き込み先が小さいときははみ出さないことを確かめる
+ */
+void test_fallback_and_small_buffer(void)
+{
+  char text[NUMERIC_TEXT_BUFFER_SIZE];
+  char expected[64];
+  const float fallbackValues[] = {NAN, INFINITY, -INFINITY, 3.0e9f};
+  for (size_t i = 0; i < sizeof(fallbackValues) / sizeof(fallbackValues[0]); i++)
+  {
+    formatFixedPoint<1>(text, sizeof(text), fallbackValues[i]);
+    snprintf(expected, sizeof(expected), "%.1f", fallbackValues[i]);
+    TEST_ASSERT_EQUAL_STRING(expected, text);
+  }
+
+  char smallText[4] = {'x', 'x', 'x', 'x'};
+  TEST_ASSERT_EQUAL(0, formatScaledDecimal<1>(smallText, sizeof(smallText), 12345));
+  TEST_ASSERT_EQUAL_STRING("", smallText);
+  TEST_ASSERT_EQUAL(3, formatScaledDecimal<1>(smallText, sizeof(smallText), 12));
+  TEST_ASSERT_EQUAL_STRING("1.2", smallText);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_integer_round_trip);
+  RUN_TEST(test_one_fraction_digit_round_trip);
+  RUN_TEST(test_rounding_matches_printf);
+  RUN_TEST(test_fallback_and_small_buffer);
+  return UNITY_END();
+}
@@ -0,0 +1,175 @@
+/**
+ * @file test_main.cpp
+ * @brief 履歴の時系列圧縮（history_codec.h）が、圧縮したサンプルを同じ値・同じ時刻に復元できるかを確かめる
+ * @details `pio test -e native -f test_history_codec` で実行します。
+ */
+#include <unity.h>
+#include <stdint.h>
+#include "config.example.h" // config.h と同じ既定値。Arduino.h の代わりに stdint.h を先に読み込む
+#include "history_codec.h"
+
+const size_t TEST_SAMPLE_COUNT = 64;
+uint8_t codecBuffer[TEST_SAMPLE_COUNT * GORILLA_MAX_BITS_PER_SAMPLE / 8 + 1];
+
+/**
+ * @brief 時刻の値からスロット内の差分秒を含めた圧縮サンプルを作る
+ */
+CompactHistorySample makeSample(uint16_t co2, int16_t thiX10, int16_t temperatureX10, uint8_t humidityX2, unsigned long epoch)
+{
+  CompactHistorySample sample = {co2, thiX10, temperatureX10, humidityX2, (uint8_t)(epoch % HISTORY_SAMPLE_PERIOD_SECONDS)};
+  return sample;
+}
+
+/**
+ * @brief サンプルを順に圧縮してから復元し、すべての値と時刻が一致することを確かめる
+ * @return 圧縮後のビット数
+ */
+size_t assertRoundTrip(const CompactHistorySample *samples, const unsigned long *epochs, size_t count)
+{
+  BitStreamWriter writer = {codecBuffer, sizeof(codecBuffer) * 8, 0};
+  GorillaCodecState encoderState;
+  beginGorillaCodec(encoderState, epochs[0]);
+  for (size_t i = 0; i < count; i++)
+  {
+    encodeGorillaSample(writer, encoderState, samples[i], epochs[i]);
+  }
+  TEST_ASSERT_TRUE(writer.bitPosition <= count * GORILLA_MAX_BITS_PER_SAMPLE);
+
+  BitStreamReader reader = {codecBuffer, writer.bitPosition, 0, false};
+  GorillaCodecState decoderState;
+  beginGorillaCodec(decoderState, epochs[0]);
+  for (size_t i = 0; i < count; i++)
+  {
+    CompactHistorySample decoded;
+    unsigned long decodedEpoch = 0;
+    TEST_ASSERT_TRUE(decodeGorillaSample(reader, decoderState, decoded, decodedEpoch));
+    TEST_ASSERT_EQUAL(epochs[i], decodedEpoch);
+    TEST_ASSERT_EQUAL(samples[i].carbonDioxidePpm, decoded.carbonDioxidePpm);
+    TEST_ASSERT_EQUAL(samples[i].thermalComfortX10, decoded.thermalComfortX10);
+    TEST_ASSERT_EQUAL(samples[i].temperatureX10, decoded.temperatureX10);
+    TEST_ASSERT_EQUAL(samples[i].humidityX2, decoded.humidityX2);
+    TEST_ASSERT_EQUAL(samples[i].secondsIntoSlot, decoded.secondsIntoSlot);
+  }
+  TEST_ASSERT_EQUAL(writer.bitPosition, reader.bitPosition);
+  return writer.bitPosition;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief 一定間隔で、値がゆっくり変わるサンプル（普段の受信）を復元でき、1サンプルが数ビットに収まることを確かめる
+ */
+void test_regular_interval_round_trip(void)
+{
+  CompactHistorySample samples[TEST_SAMPLE_COUNT];
+  unsigned long epochs[TEST_SAMPLE_COUNT];
+  for (size_t i = 0; i < TEST_SAMPLE_COUNT; i++)
+  {
+    epochs[i] = 1720000000UL + i * HISTORY_SAMPLE_PERIOD_SECONDS;
+    samples[i] = makeSample((uint16_t)(800 + i / 4), (int16_t)(724 + i / 8), (int16_t)(253 - i / 16), (uint8_t)(116 + i / 8), epochs[i]);
+  }
+  size_t bits = assertRoundTrip(samples, epochs, TEST_SAMPLE_COUNT);
+  // 先頭は値をそのまま（56ビット）、以降は時刻「0」の1ビットと、ほとんどが0の差分4つなので、圧縮前（64ビット）の3分の1に収まる
+  TEST_ASSERT_TRUE(bits < 56 + (TEST_SAMPLE_COUNT - 1) * 64 / 3);
+}
+
+/**
+ * @brief 送信の遅れや欠け（不規則な間隔）と、負の値（氷点下の温度）を復元できることを確かめる
+ */
+void test_irregular_interval_round_trip(void)
+{
+  const long intervals[] = {30, 31, 29, 30, 90, 30, 1, 600, 30, 3600, 30, 45};
+  const size_t count = sizeof(intervals) / sizeof(intervals[0]) + 1;
+  CompactHistorySample samples[count];
+  unsigned long epochs[count];
+  epochs[0] = 1720000007UL;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i > 0)
+      epochs[i] = epochs[i - 1] + intervals[i - 1];
+    samples[i] = makeSample((uint16_t)(450 + i), (int16_t)(550 - (int)i * 3), (int16_t)(-52 + (int)i), (uint8_t)(60 + i), epochs[i]);
+  }
+  assertRoundTrip(samples, epochs, count);
+}
+
+/**
+ * @brief 値の範囲の端（符号の最長区分を使う大きな差分）を復元できることを確かめる
+ */
+void test_large_delta_round_trip(void)
+{
+  const size_t count = 6;
+  CompactHistorySample samples[count] = {
+      makeSample(0, INT16_MIN, INT16_MAX, 0, 1720000000UL),
+      makeSample(65534, INT16_MAX, INT16_MIN, 255, 1720000030UL),
+      makeSample(400, 0, 0, 100, 1720000060UL),
+      makeSample(65534, -1, 1, 0, 1720086460UL),
+      makeSample(1, 1, -1, 255, 1720086490UL),
+      makeSample(1, 1, -1, 255, 1720086520UL),
+  };
+  unsigned long epochs[count] = {1720000000UL, 1720000030UL, 1720000060UL, 1720086460UL, 1720086490UL, 1720086520UL};
+  assertRoundTrip(samples, epochs, count);
+}
+
+/**
+ * @brief 途中で切れたビット列は、読めたところまでを返し、切れたサンプルは false になることを確かめる
+ */
+void test_truncated_stream_reports_overflow(void)
+{
+  CompactHistorySample samples[3];
+  unsigned long epochs[3];
+  for (size_t i = 0; i < 3; i++)
+  {
+    epochs[i] = 1720000000UL + i * 1000;
+    samples[i] = makeSample((uint16_t)(800 + i * 500), 700, 250, 120, epochs[i]);
+  }
+
+  BitStreamWriter writer = {codecBuffer, sizeof(codecBuffer) * 8, 0};
+  GorillaCodecState encoderState;
+  beginGorillaCodec(encoderState, epochs[0]);
+  size_t bitsAfterSecond = 0;
+  for (size_t i = 0; i < 3; i++)
+  {
+    encodeGorillaSample(writer, encoderState, samples[i], epochs[i]);
+    if (i == 1)
+      bitsAfterSecond = writer.bitPosition;
+  }
+
+  // 3件目の途中までしかないビット列を読む
+  BitStreamReader reader = {codecBuffer, bitsAfterSecond + 3, 0, false};
+  GorillaCodecState decoderState;
+  beginGorillaCodec(decoderState, epochs[0]);
+  CompactHistorySample decoded;
+  unsigned long decodedEpoch = 0;
+  TEST_ASSERT_TRUE(decodeGorillaSample(reader, decoderState, decoded, decodedEpoch));
+  TEST_ASSERT_TRUE(decodeGorillaSample(reader, decoderState, decoded, decodedEpoch));
+  TEST_ASSERT_EQUAL(epochs[1], decodedEpoch);
+  TEST_ASSERT_EQUAL(samples[1].carbonDioxidePpm, decoded.carbonDioxidePpm);
+  TEST_ASSERT_FALSE(decodeGorillaSample(reader, decoderState, decoded, decodedEpoch));
+  TEST_ASSERT_TRUE(reader.overflow);
+}
+
+/**
+ * @brief 書き込み先の容量を超える分は捨て、領域の外に書かないことを確かめる
+ */
+void test_writer_stops_at_capacity(void)
+{
+  uint8_t smallBuffer[3] = {0, 0, 0xAA};
+  BitStreamWriter writer = {smallBuffer, 16, 0};
+  writeBitStream(writer, 0xFFFFFFFFUL, 32);
+  TEST_ASSERT_EQUAL(16, writer.bitPosition);
+  TEST_ASSERT_EQUAL_HEX8(0xFF, smallBuffer[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xFF, smallBuffer[1]);
+  TEST_ASSERT_EQUAL_HEX8(0xAA, smallBuffer[2]);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_regular_interval_round_trip);
+  RUN_TEST(test_irregular_interval_round_trip);
+  RUN_TEST(test_large_delta_round_trip);
+  RUN_TEST(test_truncated_stream_reports_overflow);
+  RUN_TEST(test_writer_stops_at_capacity);
+  return UNITY_END();
+}
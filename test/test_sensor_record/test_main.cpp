@@ -0,0 +1,165 @@
+/**
+ * @file test_main.cpp
+ * @brief 受信したJSONを詰めた形（PackedSensorRecord）にして画面用の形に戻す処理と、快適レベルの言葉の番号化を確かめる
+ * @details `pio test -e native -f test_sensor_record` で実行します。
+ */
+#include <unity.h>
+#include <stdint.h>
+#include "config.example.h" // config.h と同じ既定値。Arduino.h の代わりに stdint.h を先に読み込む
+#include "sensor_ingest.h"
+
+StaticJsonDocument<JSON_PARSING_MEMORY_SIZE> sensorJsonDocument; // 本体と同じく、静的領域に確保して使い回す
+char jsonText[JSON_MESSAGE_MAX_LENGTH + 1];                      // 解析中に書き換わるので、テストごとに写してから渡す
+
+/**
+ * @brief JSON文字列を写してから解析する
+ */
+DeserializationError decodeText(const char *json, PackedSensorRecord &record, IngestRecordText &text)
+{
+  copyBoundedString(jsonText, json, sizeof(jsonText));
+  return decodeSensorRecordJSON(sensorJsonDocument, jsonText, record, text);
+}
+
+void setUp(void)
+{
+  initializeComfortLevelTable();
+}
+
+void tearDown(void) {}
+
+/**
+ * @brief すべての項目がそろったデータを解析し、画面用の形に戻すと元の値になることを確かめる
+ */
+void test_full_record_round_trip(void)
+{
+  PackedSensorRecord record;
+  IngestRecordText text;
+  TEST_ASSERT_FALSE(decodeText("{\"sensor_id\":\"living\",\"timestamp\":1720000000,\"co2\":812,\"thi\":72.4,"
+                               "\"temperature\":25.3,\"humidity\":58.1,\"comfort_level\":\"Comfortable\"}",
+                               record, text));
+  TEST_ASSERT_EQUAL(PACKED_SENSOR_RECORD_VERSION, record.versionAndFlags >> 4);
+  TEST_ASSERT_EQUAL(RECORD_HAS_CO2 | RECORD_HAS_THI | RECORD_HAS_TEMPERATURE | RECORD_HAS_HUMIDITY | RECORD_HAS_COMFORT_LEVEL |
+                        RECORD_HAS_TIMESTAMP | RECORD_HAS_SENSOR_ID,
+                    record.presenceBits);
+  TEST_ASSERT_EQUAL(812, record.carbonDioxidePpm);
+  TEST_ASSERT_EQUAL(724, record.thermalComfortX10);
+  TEST_ASSERT_EQUAL(253, record.temperatureX10);
+  TEST_ASSERT_EQUAL(581, record.humidityX10);
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_PLEASANT, record.comfortLevel);
+  TEST_ASSERT_EQUAL(1720000000UL, record.timestamp);
+
+  SensorDataPacket displayData;
+  TEST_ASSERT_TRUE(unpackSensorRecord(record, text, displayData));
+  TEST_ASSERT_TRUE(displayData.hasValidData);
+  TEST_ASSERT_EQUAL(812, displayData.carbonDioxideLevel);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 72.4f, displayData.thermalComfortIndex);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 25.3f, displayData.ambientTemperature);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 58.1f, displayData.relativeHumidity);
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_PLEASANT, displayData.comfortLevel);
+  TEST_ASSERT_EQUAL_STRING("", displayData.comfortLevelText);
+  TEST_ASSERT_EQUAL(1720000000UL, displayData.dataTimestamp);
+  TEST_ASSERT_EQUAL_STRING("living", displayData.sensorId);
+}
+
+/**
+ * @brief なかった項目は0のままで presenceBits のビットが立たず、範囲外の値は表現できる端に丸めることを確かめる
+ */
+void test_missing_fields_and_clamping(void)
+{
+  PackedSensorRecord record;
+  IngestRecordText text;
+  TEST_ASSERT_FALSE(decodeText("{\"co2\":70000,\"thi\":5000,\"humidity\":-3}", record, text));
+  TEST_ASSERT_EQUAL(RECORD_HAS_CO2 | RECORD_HAS_THI | RECORD_HAS_HUMIDITY, record.presenceBits);
+  TEST_ASSERT_EQUAL(UINT16_MAX, record.carbonDioxidePpm);
+  TEST_ASSERT_EQUAL(INT16_MAX, record.thermalComfortX10);
+  TEST_ASSERT_EQUAL(0, record.humidityX10);
+  TEST_ASSERT_EQUAL(0, record.temperatureX10);
+  TEST_ASSERT_EQUAL(0, record.timestamp);
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_NONE, record.comfortLevel);
+  TEST_ASSERT_EQUAL_STRING("", text.sensorId);
+
+  TEST_ASSERT_FALSE(decodeText("{\"co2\":-5,\"temperature\":-12.35}", record, text));
+  TEST_ASSERT_EQUAL(0, record.carbonDioxidePpm);
+  TEST_ASSERT_EQUAL(-124, record.temperatureX10);
+}
+
+/**
+ * @brief 解析できないJSONはエラーを返し、形式の版が違うレコードは画面用の形に戻さないことを確かめる
+ */
+void test_rejects_bad_input(void)
+{
+  PackedSensorRecord record;
+  IngestRecordText text;
+  TEST_ASSERT_TRUE(decodeText("{\"co2\":", record, text));
+
+  TEST_ASSERT_FALSE(decodeText("{\"co2\":800}", record, text));
+  record.versionAndFlags = (uint8_t)((PACKED_SENSOR_RECORD_VERSION + 1) << 4);
+  SensorDataPacket displayData;
+  TEST_ASSERT_FALSE(unpackSensorRecord(record, text, displayData));
+  TEST_ASSERT_FALSE(displayData.hasValidData);
+
+  TEST_ASSERT_FALSE(validateJSONDataIntegrity("", 0));
+  TEST_ASSERT_FALSE(validateJSONDataIntegrity("[1]", 3));
+  TEST_ASSERT_TRUE(validateJSONDataIntegrity("  {} \n", 6));
+}
+
+/**
+ * @brief sensor_id が長すぎるときは SENSOR_ID_MAX_LENGTH 文字で切り詰めることを確かめる
+ */
+void test_long_sensor_id_is_truncated(void)
+{
+  PackedSensorRecord record;
+  IngestRecordText text;
+  TEST_ASSERT_FALSE(decodeText("{\"sensor_id\":\"0123456789abcdefghij\",\"co2\":800}", record, text));
+  TEST_ASSERT_EQUAL(SENSOR_ID_MAX_LENGTH, strlen(text.sensorId));
+  TEST_ASSERT_EQUAL(0, strncmp("0123456789abcdefghij", text.sensorId, SENSOR_ID_MAX_LENGTH));
+}
+
+/**
+ * @brief 語彙表のすべての言葉（日本語・英語）が対応する番号になり、書き込み先を空にすることを確かめる
+ */
+void test_intern_known_words(void)
+{
+  char fallback[COMFORT_LEVEL_TEXT_MAX_LENGTH + 1] = "stale";
+  for (size_t i = 0; i < COMFORT_LEVEL_VOCABULARY_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(COMFORT_LEVEL_VOCABULARY[i].level, internComfortLevel(COMFORT_LEVEL_VOCABULARY[i].text, fallback, sizeof(fallback)));
+    TEST_ASSERT_EQUAL_STRING("", fallback);
+  }
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_NONE, internComfortLevel("", fallback, sizeof(fallback)));
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_NONE, internComfortLevel(NULL, fallback, sizeof(fallback)));
+}
+
+/**
+ * @brief 語彙表にない言葉はそのまま残し、UTF-8の文字の途中では切らないことを確かめる
+ */
+void test_intern_unknown_words(void)
+{
+  char fallback[COMFORT_LEVEL_TEXT_MAX_LENGTH + 1];
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_OTHER, internComfortLevel("comfortable", fallback, sizeof(fallback))); // 大文字・小文字は区別する
+  TEST_ASSERT_EQUAL_STRING("comfortable", fallback);
+
+  // 3バイトの文字が8個（24バイト）。22バイトに収まるのは7文字（21バイト）まで
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_OTHER, internComfortLevel("とても蒸し暑くて不快", fallback, sizeof(fallback)));
+  TEST_ASSERT_EQUAL_STRING("とても蒸し暑く", fallback);
+
+  PackedSensorRecord record;
+  IngestRecordText text;
+  TEST_ASSERT_FALSE(decodeText("{\"comfort_level\":\"Muggy\"}", record, text));
+  SensorDataPacket displayData;
+  TEST_ASSERT_TRUE(unpackSensorRecord(record, text, displayData));
+  TEST_ASSERT_EQUAL(COMFORT_LEVEL_OTHER, displayData.comfortLevel);
+  TEST_ASSERT_EQUAL_STRING("Muggy", displayData.comfortLevelText);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_full_record_round_trip);
+  RUN_TEST(test_missing_fields_and_clamping);
+  RUN_TEST(test_rejects_bad_input);
+  RUN_TEST(test_long_sensor_id_is_truncated);
+  RUN_TEST(test_intern_known_words);
+  RUN_TEST(test_intern_unknown_words);
+  return UNITY_END();
+}
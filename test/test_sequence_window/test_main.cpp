@@ -0,0 +1,110 @@
+/**
+ * @file test_main.cpp
+ * @brief 並べ替え窓（sequence_window.h）と、JSONを解析する前のタイムスタンプの取り出しを確かめる
+ * @details `pio test -e native -f test_sequence_window` で実行します。
+ */
+#include <unity.h>
+#include <stdint.h>
+#include "config.example.h" // config.h と同じ既定値。Arduino.h の代わりに stdint.h を先に読み込む
+#include "sensor_ingest.h"
+#include "sequence_window.h"
+
+SequenceWindow window;
+
+void setUp(void)
+{
+  resetSequenceWindow(window);
+}
+
+void tearDown(void) {}
+
+/**
+ * @brief 順に届いたデータはすべて受け付け、同じタイムスタンプの再送は重複として捨てることを確かめる
+ */
+void test_in_order_and_duplicate(void)
+{
+  TEST_ASSERT_EQUAL(SEQUENCE_IN_ORDER, checkSequenceWindow(window, 1000));
+  TEST_ASSERT_EQUAL(SEQUENCE_IN_ORDER, checkSequenceWindow(window, 1030));
+  TEST_ASSERT_EQUAL(SEQUENCE_DUPLICATE, checkSequenceWindow(window, 1030));
+  TEST_ASSERT_EQUAL(SEQUENCE_DUPLICATE, checkSequenceWindow(window, 1000));
+  TEST_ASSERT_EQUAL(2, window.duplicateCount);
+  TEST_ASSERT_EQUAL(1030, window.newestTimestamp);
+}
+
+/**
+ * @brief 窓の中で後から届いた古いデータは「入れ替わり」として受け付け、2回目は重複にすることを確かめる
+ */
+void test_reordered_within_window(void)
+{
+  checkSequenceWindow(window, 1000);
+  checkSequenceWindow(window, 1060);
+  TEST_ASSERT_EQUAL(SEQUENCE_REORDERED, checkSequenceWindow(window, 1030));
+  TEST_ASSERT_EQUAL(1, window.reorderedCount);
+  TEST_ASSERT_EQUAL(1060, window.newestTimestamp);
+  TEST_ASSERT_EQUAL(SEQUENCE_DUPLICATE, checkSequenceWindow(window, 1030));
+}
+
+/**
+ * @brief 窓が満杯になったら最も古いものを置き換え、それより古いデータは「古すぎる」として捨てることを確かめる
+ */
+void test_too_old_after_window_fills(void)
+{
+  for (unsigned long i = 0; i < SENSOR_REORDER_WINDOW_SIZE; i++)
+  {
+    TEST_ASSERT_EQUAL(SEQUENCE_IN_ORDER, checkSequenceWindow(window, 2000 + i * 30));
+  }
+  TEST_ASSERT_EQUAL(SENSOR_REORDER_WINDOW_SIZE, window.acceptedCount);
+
+  // 満杯の窓に新しいデータが入ると、最も古い 2000 が押し出される
+  TEST_ASSERT_EQUAL(SEQUENCE_IN_ORDER, checkSequenceWindow(window, 2000 + SENSOR_REORDER_WINDOW_SIZE * 30));
+  TEST_ASSERT_EQUAL(SENSOR_REORDER_WINDOW_SIZE, window.acceptedCount);
+  TEST_ASSERT_EQUAL(SEQUENCE_TOO_OLD, checkSequenceWindow(window, 2000));
+  TEST_ASSERT_EQUAL(SEQUENCE_TOO_OLD, checkSequenceWindow(window, 1));
+  TEST_ASSERT_EQUAL(2, window.tooOldCount);
+
+  // 窓の中の隙間（まだ届いていない時刻）は入れ替わりとして受け付ける
+  TEST_ASSERT_EQUAL(SEQUENCE_REORDERED, checkSequenceWindow(window, 2045));
+}
+
+/**
+ * @brief resetSequenceWindow で覚えた時刻と数がすべて消えることを確かめる
+ */
+void test_reset_forgets_everything(void)
+{
+  checkSequenceWindow(window, 1000);
+  checkSequenceWindow(window, 1000);
+  resetSequenceWindow(window);
+  TEST_ASSERT_EQUAL(0, window.acceptedCount);
+  TEST_ASSERT_EQUAL(0, window.duplicateCount);
+  TEST_ASSERT_EQUAL(SEQUENCE_IN_ORDER, checkSequenceWindow(window, 1000));
+}
+
+/**
+ * @brief JSONを解析する前の取り出し（timestamp・sensor_id）が、空白や項目の順番、文字列中の同じ文字に惑わされないことを確かめる
+ */
+void test_raw_field_extraction(void)
+{
+  const char payload[] = "{\"note\":\"timestamp\",\"sensor_id\" : \"living\", \"timestamp\" :  1720000123 ,\"co2\":800}";
+  const uint8_t *bytes = (const uint8_t *)payload;
+  const unsigned int length = sizeof(payload) - 1;
+  TEST_ASSERT_EQUAL(1720000123ULL, extractRawJSONUnsigned(bytes, length, "timestamp"));
+  TEST_ASSERT_EQUAL(800, extractRawJSONUnsigned(bytes, length, "co2"));
+  TEST_ASSERT_EQUAL(0, extractRawJSONUnsigned(bytes, length, "humidity"));
+
+  char sensorId[SENSOR_ID_MAX_LENGTH + 1];
+  extractRawJSONString(bytes, length, "sensor_id", sensorId, sizeof(sensorId));
+  TEST_ASSERT_EQUAL_STRING("living", sensorId);
+  extractRawJSONString(bytes, length, "missing", sensorId, sizeof(sensorId));
+  TEST_ASSERT_EQUAL_STRING("", sensorId);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_in_order_and_duplicate);
+  RUN_TEST(test_reordered_within_window);
+  RUN_TEST(test_too_old_after_window_fills);
+  RUN_TEST(test_reset_forgets_everything);
+  RUN_TEST(test_raw_field_extraction);
+  return UNITY_END();
+}
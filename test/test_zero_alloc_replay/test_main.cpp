@@ -0,0 +1,130 @@
+/**
+ * @file test_main.cpp
+ * @brief 受信処理の純粋な部分を繰り返しても、準備期間の後はヒープを確保しないことを確かめる
+ * @details
+ * `pio test -e native -f test_zero_alloc_replay` で実行します。本体の `replay` と同じメッセージを、本体と同じ
+ * decodeSensorPayload（重複判定 → 文字列化 → 検証 → JSON解析 → 画面用の形への変換）に通し、表示用に文字列化します。
+ * 本体では `--wrap` で malloc を数えますが、ホスト環境では glibc の malloc を差し替えて数えます
+ * （glibc 以外の環境では数えられないので、テストを飛ばします）。画面の描画は本体の `replay` で確かめます。
+ */
+#include <unity.h>
+#include <stdint.h>
+#include "config.example.h" // config.h と同じ既定値。Arduino.h の代わりに stdint.h を先に読み込む
+#include "fixed_point_format.h"
+#include "sensor_ingest.h"
+
+#if defined(__GLIBC__)
+#define HOST_ALLOCATION_COUNTING 1
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+volatile bool allocationCountingEnabled = false; // true の間だけ確保を数える（Unityの出力などは数えない）
+volatile uint32_t countedAllocations = 0;        // 数えた確保の回数
+
+extern "C" void *malloc(size_t size)
+{
+  if (allocationCountingEnabled)
+    countedAllocations++;
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  if (allocationCountingEnabled)
+    countedAllocations++;
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+  if (allocationCountingEnabled)
+    countedAllocations++;
+  return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void *pointer)
+{
+  __libc_free(pointer);
+}
+#endif
+
+StaticJsonDocument<JSON_PARSING_MEMORY_SIZE> sensorJsonDocument; // 本体と同じく、静的領域に確保して使い回す
+char ingestMessageBuffer[JSON_MESSAGE_MAX_LENGTH + 1];           // 受信したペイロードを文字列にした領域
+
+void setUp(void) {}
+void tearDown(void) {}
+
+/**
+ * @brief REPLAY_MESSAGE_COUNT 件を流し、最初の REPLAY_WARMUP_MESSAGE_COUNT 件の後の確保が0回であることを確かめる
+ */
+void test_steady_state_replay_allocates_nothing(void)
+{
+#ifdef HOST_ALLOCATION_COUNTING
+  initializeComfortLevelTable();
+  char payload[JSON_MESSAGE_MAX_LENGTH];
+  char co2Text[NUMERIC_TEXT_BUFFER_SIZE];
+  char thiText[NUMERIC_TEXT_BUFFER_SIZE];
+  SequenceWindow window;
+  resetSequenceWindow(window);
+  uint32_t decodedCount = 0;
+  countedAllocations = 0;
+
+  for (uint16_t i = 0; i < REPLAY_MESSAGE_COUNT; i++)
+  {
+    // メッセージを作るのは数える範囲の外で行う（本体の `replay` ではコマンドの区分）
+    int payloadLength = snprintf(payload, sizeof(payload),
+                                 "{\"sensor_id\":\"replay\",\"timestamp\":%lu,\"co2\":%d,\"thi\":%.1f,"
+                                 "\"temperature\":%.1f,\"humidity\":%.1f,\"comfort_level\":\"%s\"}",
+                                 1720000000UL + i, 600 + (i % 900), 65.0f + (i % 200) * 0.1f, 20.0f + (i % 100) * 0.1f,
+                                 40.0f + (i % 300) * 0.1f, COMFORT_LEVEL_VOCABULARY[i % COMFORT_LEVEL_VOCABULARY_SIZE].text);
+    TEST_ASSERT_TRUE(payloadLength > 0 && payloadLength < (int)sizeof(payload));
+
+    allocationCountingEnabled = i >= REPLAY_WARMUP_MESSAGE_COUNT;
+    SensorDataPacket decodedData;
+    bool decoded = decodeSensorPayload((const uint8_t *)payload, (unsigned int)payloadLength, window, sensorJsonDocument,
+                                       ingestMessageBuffer, sizeof(ingestMessageBuffer), decodedData);
+    if (decoded)
+    {
+      formatScaledDecimal<0>(co2Text, sizeof(co2Text), decodedData.carbonDioxideLevel);
+      formatFixedPoint<1>(thiText, sizeof(thiText), decodedData.thermalComfortIndex);
+    }
+    allocationCountingEnabled = false;
+
+    if (decoded)
+      decodedCount++;
+  }
+
+  TEST_ASSERT_EQUAL(REPLAY_MESSAGE_COUNT, decodedCount);
+  TEST_ASSERT_EQUAL_MESSAGE(0, countedAllocations, "the ingest pipeline allocated after warm-up");
+#else
+  TEST_IGNORE_MESSAGE("allocation counting needs glibc");
+#endif
+}
+
+/**
+ * @brief 数える仕組みそのものが働いていることを確かめる（数えられていなければ、上のテストは何も確かめていない）
+ */
+void test_allocation_counter_detects_malloc(void)
+{
+#ifdef HOST_ALLOCATION_COUNTING
+  countedAllocations = 0;
+  allocationCountingEnabled = true;
+  void *volatile pointer = malloc(16);
+  allocationCountingEnabled = false;
+  free(pointer);
+  TEST_ASSERT_EQUAL(1, countedAllocations);
+#else
+  TEST_IGNORE_MESSAGE("allocation counting needs glibc");
+#endif
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_allocation_counter_detects_malloc);
+  RUN_TEST(test_steady_state_replay_allocates_nothing);
+  return UNITY_END();
+}
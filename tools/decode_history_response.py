@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""
+M5StickCPlus2 センサーモニターが返す履歴の問い合わせの応答チャンクを解読するツール
+
+問い合わせは sensor_data/history/request に JSON で送り、応答は sensor_data/history/response に
+いくつかのチャンクに分かれて届きます。解読した結果は1チャンク1行のJSONで出力します
+（時刻はUNIX時刻、値は実際の単位に戻したもの）。
+
+使い方の例:
+  # mosquitto_sub の16進数出力をそのまま渡す（トピック名の有無はどちらでもよい）
+  mosquitto_sub -h 192.168.1.100 -t 'sensor_data/history/response' -F '%x' | python3 tools/decode_history_response.py
+  mosquitto_pub -h 192.168.1.100 -t 'sensor_data/history/request' -m '{"id":1,"metric":"co2","from":1720000000,"to":1720086400}'
+
+  # 保存したバイナリファイルを解読する（1ファイル1チャンク）
+  python3 tools/decode_history_response.py chunk.bin
+
+チャンクの形式（リトルエンディアン、形式バージョン2）:
+  オフセット  型    内容
+   0          u8    'H'（0x48）
+   1          u8    形式バージョン（2）
+   2          u16   問い合わせ番号（問い合わせの "id"）
+   4          u16   チャンクの通し番号（0から）
+   6          u8    フラグ（bit0: 最後のチャンク、bit1: エラー。エラーのときは件数0）
+   7          u8    項目（0: co2、1: thi、2: temperature、3: humidity）
+   8          u8    このチャンクの結果の件数
+   9          u32   結果1件あたりの区間幅（秒）
+  13          u32   このチャンクの先頭の区間の開始時刻（UNIX時刻）
+  17          ...   圧縮したビット列（上位ビットから順に詰める）
+
+ビット列には、結果1件ごとに次の5つの値を「長さ可変の符号」で並べます:
+  時刻の delta-of-delta（前回の間隔との差）、平均・最小・最大・サンプル数の前回との差
+長さ可変の符号は、先頭が 0 なら差は0、10 / 110 / 1110 / 1111 なら続けてそれぞれ
+時刻は 5 / 9 / 13 / 32 ビット、値は 3 / 6 / 10 / 17 ビットのジグザグ符号（0,-1,1,-2… → 0,1,2,3…）が続きます。
+チャンクの先頭では、時刻は「先頭の区間の1区間前に、区間幅の間隔で結果があった」状態から、
+値は0から始めます。値は固定小数点の単位（CO2はppm、THIと温度は0.1単位、湿度は0.5%単位）です。
+"""
+
+import json
+import struct
+import sys
+
+RESPONSE_MAGIC = 0x48
+SUPPORTED_VERSION = 2
+HEADER_FORMAT = "<BBHHBBBII"
+FLAG_LAST = 0x01
+FLAG_ERROR = 0x02
+
+# ファームウェアの HISTORY_METRIC_KEYS と同じ順番。値は固定小数点の単位を何で割れば実際の単位になるか
+METRICS = [("co2", 1), ("thi", 10), ("temperature", 10), ("humidity", 2)]
+
+TIMESTAMP_BUCKET_BITS = [5, 9, 13, 32]
+VALUE_BUCKET_BITS = [3, 6, 10, 17]
+FIELD_NAMES = ["mean", "min", "max", "count"]
+
+
+class BitReader:
+    """ファームウェアの readBitStream と同じく、上位ビットから順に読む"""
+
+    def __init__(self, data):
+        self.data = data
+        self.position = 0
+
+    def read(self, bit_count):
+        value = 0
+        for _ in range(bit_count):
+            if self.position >= len(self.data) * 8:
+                raise ValueError("bit stream truncated")
+            bit = (self.data[self.position // 8] >> (7 - self.position % 8)) & 1
+            value = (value << 1) | bit
+            self.position += 1
+        return value
+
+    def read_delta(self, bucket_bits):
+        """ファームウェアの readVariableLengthDelta と同じ長さ可変の符号を読む"""
+        bucket = 0
+        while bucket < 4 and self.read(1) == 1:
+            bucket += 1
+        if bucket == 0:
+            return 0
+        zigzag = self.read(bucket_bits[bucket - 1])
+        return (zigzag >> 1) ^ -(zigzag & 1)
+
+
+def decode_chunk(chunk):
+    """1チャンクを解読して辞書で返す（形式が違う場合は ValueError）"""
+    header_size = struct.calcsize(HEADER_FORMAT)
+    if len(chunk) < header_size:
+        raise ValueError("chunk too short: %d bytes" % len(chunk))
+
+    magic, version, request_id, chunk_index, flags, metric, count, bucket_seconds, first_epoch = \
+        struct.unpack_from(HEADER_FORMAT, chunk, 0)
+    if magic != RESPONSE_MAGIC:
+        raise ValueError("bad magic: 0x%02x" % magic)
+    if version != SUPPORTED_VERSION:
+        raise ValueError("unsupported version: %d" % version)
+
+    result = {
+        "id": request_id,
+        "chunk": chunk_index,
+        "last": bool(flags & FLAG_LAST),
+        "error": bool(flags & FLAG_ERROR),
+    }
+    if result["error"]:
+        return result
+
+    if metric >= len(METRICS):
+        raise ValueError("unknown metric: %d" % metric)
+    metric_name, scale = METRICS[metric]
+    result["metric"] = metric_name
+    result["bucket_seconds"] = bucket_seconds
+
+    reader = BitReader(chunk[header_size:])
+    previous_interval = bucket_seconds
+    previous_epoch = first_epoch - bucket_seconds
+    previous_fields = [0] * len(FIELD_NAMES)
+    points = []
+    for _ in range(count):
+        previous_interval += reader.read_delta(TIMESTAMP_BUCKET_BITS)
+        previous_epoch += previous_interval
+        for i in range(len(FIELD_NAMES)):
+            previous_fields[i] += reader.read_delta(VALUE_BUCKET_BITS)
+        mean, minimum, maximum, sample_count = previous_fields
+        points.append({
+            "t": previous_epoch & 0xFFFFFFFF,
+            "mean": mean / scale,
+            "min": minimum / scale,
+            "max": maximum / scale,
+            "count": sample_count,
+        })
+    result["points"] = points
+    return result
+
+
+def main(arguments):
+    if arguments:
+        # ファイルが指定されていれば、1ファイル1チャンクとして読む
+        for path in arguments:
+            with open(path, "rb") as chunk_file:
+                print(json.dumps(decode_chunk(chunk_file.read())))
+        return 0
+
+    # 標準入力からは、1行1チャンクの16進数（先頭にトピック名があってもよい）を読む
+    exit_code = 0
+    for line in sys.stdin:
+        parts = line.split()
+        if not parts:
+            continue
+        try:
+            result = decode_chunk(bytes.fromhex(parts[-1]))
+        except ValueError as error:
+            sys.stderr.write("skip: %s\n" % error)
+            exit_code = 1
+            continue
+        print(json.dumps(result), flush=True)
+    return exit_code
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
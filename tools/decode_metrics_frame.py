@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""
+M5StickCPlus2 センサーモニターが送信する自己診断メトリクスのフレームを解読するツール
+
+フレームは MQTT_METRICS_TOPIC_PREFIX + MACアドレス のトピックに、一定間隔で送られます。
+解読した結果は1フレーム1行のJSONで出力するので、そのまま時系列データベースに取り込めます。
+
+使い方の例:
+  # mosquitto_sub の16進数出力をそのまま渡す（トピック名付き）
+  mosquitto_sub -h 192.168.1.100 -t 'sensor_monitor/metrics/#' -F '%t %x' | python3 tools/decode_metrics_frame.py
+
+  # 保存したバイナリファイルを解読する
+  python3 tools/decode_metrics_frame.py frame.bin
+
+フレームの形式（リトルエンディアン、形式バージョン1）:
+  オフセット  型    内容
+   0          u8    'M'（0x4D）
+   1          u8    形式バージョン（1）
+   2          u16   フレームの通し番号
+   4          u32   起動からの秒数
+   8          u16   前回のフレームからの秒数
+  10          i8    Wi-Fiの受信強度（dBm）
+  11          u8    フラグ（bit0: 時刻同期済み、bit1: ヒープ確保の計数が有効）
+  12          u32   空きヒープ（バイト）
+  16          u32   最大連続ブロック（バイト）
+  20          u32   起動後の最小空きヒープ（バイト）
+  24          u32   ループ回数（前回のフレーム以降）
+  28          u32   ループ処理時間の平均（マイクロ秒、前回のフレーム以降）
+  32          u32   ループ処理時間の90パーセンタイル（同上、2のべき乗の区間の上限で見積もり）
+  36          u32   ループ処理時間の最大（同上）
+  40          u32   受信したMQTTメッセージ数（累計）
+  44          u32   MQTTの再接続回数（累計）
+  48          u32   重複として捨てたデータ数（累計）
+  52          u32   古すぎるとして捨てたデータ数（累計）
+  56          u32   順序が入れ替わって届いたデータ数（累計）
+  60          u32   JSONの不正・解析失敗で捨てたメッセージ数（累計）
+  64          u32   センサー登録表が満杯で記録できなかったメッセージ数（累計）
+  68          i32   最後のNTP同期での時刻の修正量（秒）
+  72          u8    ステージ数 N
+  73          u16×N ステージごとの平均処理時間（マイクロ秒、前回のフレーム以降。65535で頭打ち）
+"""
+
+import json
+import struct
+import sys
+
+FRAME_MAGIC = 0x4D
+SUPPORTED_VERSION = 1
+
+# ファームウェアの LOOP_STAGE_NAMES と同じ順番
+STAGE_NAMES = ["mqtt_conn", "mqtt_msg", "display", "ntp", "digiclock", "serial",
+               "hist_flush", "freshness", "heap", "metrics", "hist_query", "log_drain", "loop_total"]
+
+FIXED_FORMAT = "<BBHIHbBIIIIIIIIIIIIIIiB"
+FIXED_FIELDS = [
+    "magic", "version", "sequence", "uptime_s", "interval_s", "rssi_dbm", "flags",
+    "heap_free", "heap_largest_block", "heap_min_free",
+    "loop_count", "loop_mean_us", "loop_p90_us", "loop_max_us",
+    "mqtt_messages", "mqtt_reconnects", "drops_duplicate", "drops_too_old", "reordered",
+    "rejected_payloads", "registry_rejected", "ntp_correction_s", "stage_count",
+]
+
+
+def decode_frame(frame):
+    """1フレームを解読して辞書で返す（形式が違う場合は ValueError）"""
+    fixed_size = struct.calcsize(FIXED_FORMAT)
+    if len(frame) < fixed_size:
+        raise ValueError("frame too short: %d bytes" % len(frame))
+
+    values = dict(zip(FIXED_FIELDS, struct.unpack_from(FIXED_FORMAT, frame, 0)))
+    if values["magic"] != FRAME_MAGIC:
+        raise ValueError("bad magic: 0x%02x" % values["magic"])
+    if values["version"] != SUPPORTED_VERSION:
+        raise ValueError("unsupported version: %d" % values["version"])
+
+    stage_count = values.pop("stage_count")
+    if len(frame) < fixed_size + 2 * stage_count:
+        raise ValueError("frame truncated in stage table")
+    stage_means = struct.unpack_from("<%dH" % stage_count, frame, fixed_size)
+    values["stage_mean_us"] = {
+        (STAGE_NAMES[i] if i < len(STAGE_NAMES) else "stage%d" % i): stage_means[i]
+        for i in range(stage_count)
+    }
+
+    flags = values.pop("flags")
+    values["time_synced"] = bool(flags & 0x01)
+    values["heap_hooks"] = bool(flags & 0x02)
+    del values["magic"]
+    return values
+
+
+def decode_hex_line(line):
+    """「トピック 16進数」または「16進数」の1行を解読する"""
+    parts = line.split()
+    if not parts:
+        return None
+    topic = parts[0] if len(parts) > 1 else None
+    result = decode_frame(bytes.fromhex(parts[-1]))
+    if topic is not None:
+        result["topic"] = topic
+        result["device"] = topic.rsplit("/", 1)[-1]
+    return result
+
+
+def main(arguments):
+    if arguments:
+        # ファイルが指定されていれば、1ファイル1フレームとして読む
+        for path in arguments:
+            with open(path, "rb") as frame_file:
+                print(json.dumps(decode_frame(frame_file.read())))
+        return 0
+
+    # 標準入力からは、1行1フレームの16進数を読む
+    exit_code = 0
+    for line in sys.stdin:
+        try:
+            result = decode_hex_line(line)
+        except ValueError as error:
+            sys.stderr.write("skip: %s\n" % error)
+            exit_code = 1
+            continue
+        if result is not None:
+            print(json.dumps(result), flush=True)
+    return exit_code
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""
+M5StickCPlus2 センサーモニターのバイナリ形式のログ（LOG_TOKENIZED）を文章に戻すツール
+
+ファームウェアの LOG_ERROR / LOG_WARN / LOG_INFO / LOG_DEBUG は、書式文字列のID（FNV-1a 32ビット）と
+引数の値だけをシリアルに送ります。このツールは src/main.cpp から同じ書式文字列を集めてIDの対応表を作り、
+シリアルから届いたバイト列を元の文章に戻して表示します。起動メッセージなど普通の文章はそのまま表示します。
+
+使い方の例:
+  # シリアルポートを直接読む（別の端末から echo stats > /dev/ttyUSB0 でコマンドも送れます）
+  stty -F /dev/ttyUSB0 115200 raw -echo
+  python3 tools/detokenize_log.py /dev/ttyUSB0
+
+  # 保存したシリアルの記録を読む
+  python3 tools/detokenize_log.py capture.bin
+
+  # IDの対応表だけを確認する
+  python3 tools/detokenize_log.py --list
+
+ログ1件の形式:
+  0xF5 | レベル(u8) | 書式のID(u32、リトルエンディアン) | 引数のバイト数(u8) | 引数...
+  引数は書式の変換指定の順に並び、整数（%d %u %x %c など）はジグザグ符号化した可変長整数、
+  小数（%f %g など）はfloatの4バイト、文字列（%s）は長さ1バイト＋中身です。
+"""
+
+import codecs
+import os
+import re
+import struct
+import sys
+
+RECORD_MARKER = 0xF5
+HEADER_SIZE = 7
+LEVEL_NAMES = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+DEFAULT_SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "main.cpp")
+LOG_CALL_PATTERN = re.compile(rb'LOG_(?:ERROR|WARN|INFO|DEBUG)\(\s*"((?:[^"\\]|\\.)*)"')
+CONVERSION_PATTERN = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t|L)?([diouxXeEfgGcs%])")
+
+
+def hash_log_format(format_bytes):
+    """ファームウェアの hashLogFormat と同じFNV-1a（32ビット）"""
+    value = 2166136261
+    for byte in format_bytes:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def load_token_database(source_paths):
+    """ソースからログの書式文字列を集め、ID → 書式 の対応表を作る"""
+    database = {}
+    for path in source_paths:
+        with open(path, "rb") as source_file:
+            source = source_file.read()
+        for match in LOG_CALL_PATTERN.finditer(source):
+            format_bytes = codecs.escape_decode(match.group(1))[0]
+            token = hash_log_format(format_bytes)
+            format_text = format_bytes.decode("utf-8", errors="replace")
+            if token in database and database[token] != format_text:
+                sys.stderr.write("warning: token collision 0x%08x: %r / %r\n" % (token, database[token], format_text))
+            database[token] = format_text
+    return database
+
+
+def read_varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        if offset >= len(data):
+            raise ValueError("truncated integer")
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return (value >> 1) ^ -(value & 1), offset
+
+
+def format_record(format_text, arguments):
+    """書式の変換指定に従って引数を読み出し、文章に組み立てる"""
+    pieces = []
+    offset = 0
+    position = 0
+    for match in CONVERSION_PATTERN.finditer(format_text):
+        pieces.append(format_text[position:match.start()])
+        position = match.end()
+        flags, _length, conversion = match.groups()
+        if conversion == "%":
+            pieces.append("%")
+        elif conversion == "s":
+            if offset >= len(arguments):
+                raise ValueError("truncated string")
+            length = arguments[offset]
+            text = arguments[offset + 1:offset + 1 + length].decode("utf-8", errors="replace")
+            offset += 1 + length
+            pieces.append(("%" + flags + "s") % text)
+        elif conversion in "eEfgG":
+            if offset + 4 > len(arguments):
+                raise ValueError("truncated float")
+            value = struct.unpack_from("<f", arguments, offset)[0]
+            offset += 4
+            pieces.append(("%" + flags + conversion) % value)
+        else:
+            value, offset = read_varint(arguments, offset)
+            if conversion in "ouxX" and value < 0:
+                value &= 0xFFFFFFFF  # 負の値を %u や %x で表示する場合は、32ビットの符号なしとして扱う
+            pieces.append(("%" + flags + ("d" if conversion in "iu" else conversion)) % value)
+    pieces.append(format_text[position:])
+    return "".join(pieces)
+
+
+def detokenize_stream(read_chunk, write_text, database):
+    """バイト列を読み、普通の文章はそのまま、バイナリ形式のログは文章に戻して書き出す"""
+    pending = b""
+    while True:
+        chunk = read_chunk()
+        if not chunk:
+            break
+        pending += chunk
+        while pending:
+            marker_index = pending.find(bytes([RECORD_MARKER]))
+            if marker_index < 0:
+                # 文章の途中でUTF-8の文字が分かれないよう、最後の改行までを書き出す
+                newline_index = pending.rfind(b"\n")
+                if newline_index < 0:
+                    break
+                write_text(pending[:newline_index + 1].decode("utf-8", errors="replace"))
+                pending = pending[newline_index + 1:]
+                continue
+            if marker_index > 0:
+                write_text(pending[:marker_index].decode("utf-8", errors="replace"))
+                pending = pending[marker_index:]
+            if len(pending) < HEADER_SIZE:
+                break
+            level = pending[1]
+            token = struct.unpack_from("<I", pending, 2)[0]
+            record_length = HEADER_SIZE + pending[6]
+            if len(pending) < record_length:
+                break
+            arguments = pending[HEADER_SIZE:record_length]
+            pending = pending[record_length:]
+            prefix = "[%s] " % LEVEL_NAMES.get(level, "?")
+            if token not in database:
+                write_text("%s<unknown token 0x%08x, %d argument bytes>\n" % (prefix, token, len(arguments)))
+                continue
+            try:
+                write_text(prefix + format_record(database[token], arguments))
+            except ValueError as error:
+                write_text("%s<bad record for %r: %s>\n" % (prefix, database[token], error))
+    if pending:
+        write_text(pending.decode("utf-8", errors="replace"))
+
+
+def main(arguments):
+    source_paths = [DEFAULT_SOURCE]
+    if "--source" in arguments:
+        index = arguments.index("--source")
+        source_paths = [arguments[index + 1]]
+        del arguments[index:index + 2]
+    database = load_token_database(source_paths)
+
+    if arguments and arguments[0] == "--list":
+        for token, format_text in sorted(database.items()):
+            print("0x%08x %s" % (token, format_text.rstrip("\n")))
+        return 0
+
+    def write_text(text):
+        sys.stdout.write(text)
+        sys.stdout.flush()
+
+    if not arguments:
+        stdin_fd = sys.stdin.fileno()
+        detokenize_stream(lambda: os.read(stdin_fd, 256), write_text, database)
+        return 0
+
+    for path in arguments:
+        # シリアルポートでも読めるよう、バッファを使わずに届いた分だけ読む
+        input_fd = os.open(path, os.O_RDONLY)
+        try:
+            detokenize_stream(lambda: os.read(input_fd, 256), write_text, database)
+        finally:
+            os.close(input_fd)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
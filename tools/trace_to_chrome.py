@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""
+M5StickCPlus2 センサーモニターのイベントトレース（`trace` コマンドの出力）を、
+Chrome（chrome://tracing）や Perfetto（https://ui.perfetto.dev）で開けるJSONに変換するツール
+
+使い方の例:
+  # シリアルポートを直接読み、ダンプを1つ受け取ったら変換して終了する
+  stty -F /dev/ttyUSB0 115200 raw -echo
+  python3 tools/trace_to_chrome.py /dev/ttyUSB0 > trace.json &
+  echo trace > /dev/ttyUSB0
+
+  # 保存したシリアルの記録から変換する（ダンプが複数あれば最後のもの）
+  python3 tools/trace_to_chrome.py capture.bin > trace.json
+
+ダンプの形式（リトルエンディアン）:
+  "TRC1" | ダンプ時のmicros(u32) | 上書きで失ったイベント数(u32) | イベント数(u16) |
+  名前の数(u8) | 名前ごとに 長さ(u8)+文字列 |
+  イベントごとに 時刻micros(u32) + 種類(u8) + 'B'/'E'(u8) + 補足の値(u16)
+"""
+
+import json
+import os
+import struct
+import sys
+
+DUMP_MAGIC = b"TRC1"
+
+
+def parse_dump(data, start):
+    """start の位置から始まるダンプを1つ読む。足りなければ None を返す"""
+    offset = start + len(DUMP_MAGIC)
+    if len(data) < offset + 11:
+        return None
+    dump_micros, overwritten, event_count, name_count = struct.unpack_from("<IIHB", data, offset)
+    offset += 11
+
+    names = []
+    for _ in range(name_count):
+        if len(data) < offset + 1:
+            return None
+        length = data[offset]
+        if len(data) < offset + 1 + length:
+            return None
+        names.append(data[offset + 1:offset + 1 + length].decode("ascii", errors="replace"))
+        offset += 1 + length
+
+    if len(data) < offset + 8 * event_count:
+        return None
+    events = [struct.unpack_from("<IBBH", data, offset + 8 * i) for i in range(event_count)]
+    return {"dump_micros": dump_micros, "overwritten": overwritten, "names": names, "events": events}
+
+
+def find_last_dump(data):
+    """バイト列の中から、最後の完全なダンプを探す"""
+    position = data.rfind(DUMP_MAGIC)
+    while position >= 0:
+        dump = parse_dump(data, position)
+        if dump is not None:
+            return dump
+        position = data.rfind(DUMP_MAGIC, 0, position)
+    return None
+
+
+def to_chrome_trace(dump):
+    """ダンプをChromeのトレース形式（Trace Event Format）に変換する"""
+    trace_events = [
+        {"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "M5StickCPlus2"}},
+        {"name": "thread_name", "ph": "M", "pid": 1, "tid": 1, "args": {"name": "loop"}},
+    ]
+
+    # micros() は約71分で一周するので、直前のイベントとの差を積み上げて時刻を求める
+    elapsed = 0
+    previous_micros = dump["events"][0][0] if dump["events"] else 0
+    open_counts = {}
+    for timestamp_micros, event_id, phase, argument in dump["events"]:
+        elapsed += (timestamp_micros - previous_micros) & 0xFFFFFFFF
+        previous_micros = timestamp_micros
+        name = dump["names"][event_id] if event_id < len(dump["names"]) else "event%d" % event_id
+        phase = chr(phase)
+
+        # 開始が上書きで失われた終了イベントは捨てる（タイムラインが崩れないように）
+        if phase == "E":
+            if open_counts.get(event_id, 0) == 0:
+                continue
+            open_counts[event_id] -= 1
+        else:
+            open_counts[event_id] = open_counts.get(event_id, 0) + 1
+
+        event = {"name": name, "cat": "firmware", "ph": phase, "ts": elapsed, "pid": 1, "tid": 1}
+        if argument:
+            event["args"] = {"value": argument}
+        trace_events.append(event)
+
+    return {
+        "traceEvents": trace_events,
+        "displayTimeUnit": "ms",
+        "otherData": {"overwritten_events": dump["overwritten"], "event_count": len(dump["events"])},
+    }
+
+
+def read_until_dump(path):
+    """シリアルポートやファイルを読み、完全なダンプがそろった時点で返す"""
+    data = b""
+    input_fd = os.open(path, os.O_RDONLY)
+    try:
+        while True:
+            chunk = os.read(input_fd, 4096)
+            if not chunk:
+                break
+            data += chunk
+            position = data.rfind(DUMP_MAGIC)
+            if position >= 0 and parse_dump(data, position) is not None and not os.path.isfile(path):
+                break  # シリアルポートは終わりが来ないので、ダンプがそろったら読むのをやめる
+    finally:
+        os.close(input_fd)
+    return data
+
+
+def main(arguments):
+    if arguments:
+        data = read_until_dump(arguments[0])
+    else:
+        data = sys.stdin.buffer.read()
+
+    dump = find_last_dump(data)
+    if dump is None:
+        sys.stderr.write("no complete trace dump found\n")
+        return 1
+
+    sys.stderr.write("%d events, %d overwritten before the dump\n" % (len(dump["events"]), dump["overwritten"]))
+    json.dump(to_chrome_trace(dump), sys.stdout)
+    sys.stdout.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))